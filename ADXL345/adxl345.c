@@ -10,62 +10,266 @@
 #include <asm/uaccess.h>
 #include <asm/unistd.h>
 #include <linux/cdev.h>
+#include <linux/delay.h>
+#include <linux/workqueue.h>
+#include <linux/kthread.h>
+#include <linux/hrtimer.h>
+#include <linux/math64.h>
 
 #include "adxl345.h"
+#include "obc_probe.h"
+#include "obc_ring.h"
+#include "obc_retry.h"
+#include "obc_trigger.h"
+#include "obc_governor.h"
+#include "obc_desc.h"
+#include "obc_stats.h"
+#include "obc_bus.h"
+#include "obc_trace.h"
+#include "obc_config.h"
+#include "obc_sched.h"
+#include "obc_snap.h"
+#include "obc_journal.h"
 
 static struct sensor_adxl345{
 	struct spi_device *adxl345_spi;
 	struct mutex lock;
-	u16 axis_data[AXIS];
+	s32 axis_data[AXIS];
 	//struct spi_transfer adxl345_transfer;
 	struct cdev c_dev;
 	dev_t adxl345_dev_number;
 	struct class *adxl345_class;
+	struct work_struct config_work;
+	struct obc_probe probe;
+	struct obc_ring ring;
+	struct obc_stats stats;
+	struct task_struct *sampler;
+	wait_queue_head_t sampler_wait;
+	u32 seq;
+	unsigned int period_us;
+	struct obc_err_state err;
+	struct obc_trigger_client trig;
+	struct obc_gov_client gov;
+	struct obc_bus_client bus;
+	struct obc_config_client config;
+	struct obc_sched sched;		/* of the trigger worker or the sampler */
+	struct obc_snap snap;
+	struct obc_journal journal;
+	u8 act_thresh;			/* THRESH_ACT, 62.5 mg per count, 0 for off */
+	bool act_ref_valid;
+	s32 act_ref[AXIS];		/* activity reference, 1/16 counts */
+	s32 last[AXIS];			/* previous capture, for the activity measure */
+	unsigned int activity;		/* smoothed change per sample, 1/16 counts */
+	struct mutex bus_lock;		/* captures vs. reconfiguration */
+	u8 data_format;			/* shadow of DATA_FORMAT */
+	u8 rate;			/* BW_RATE code */
+	unsigned int tick_us;		/* trigger tick the governor cap was set for */
+	s8 offset[AXIS];		/* OFSX, OFSY, OFSZ, 15.6 mg per count */
+	u32 odr_ns;			/* output data period */
+	struct obc_sample block[ADXL345_FIFO_ENTRIES];	/* capture path only */
+	struct spi_transfer fifo_xfer[2 * ADXL345_FIFO_ENTRIES];
+	u8 fifo_cmd ____cacheline_aligned;
+	u8 fifo_raw[ADXL345_FIFO_ENTRIES * 6] ____cacheline_aligned;
 };
 
 static struct sensor_adxl345 *adxl345;
 
-static int adxl345_readings(void)
+static bool trigger = true;
+module_param(trigger, bool, 0444);
+MODULE_PARM_DESC(trigger, "Sample on the common OBC trigger instead of a private timer");
+
+static unsigned int snapshot_kb;
+module_param(snapshot_kb, uint, 0444);
+MODULE_PARM_DESC(snapshot_kb, "Pre-trigger snapshot buffer in KiB, 0 for none");
+
+struct adxl345_reg_write {
+	u8 address;
+	u8 data;
+};
+
+/* Result of a FIFO drain */
+struct adxl345_fifo_drain {
+	unsigned int n;
+	bool overrun;		/* the device dropped entries before this drain */
+};
+
+/* Indexed by the DATA_FORMAT range code, in g */
+static const unsigned int adxl345_range_g[] = {
+	2, 4, 8, 16
+};
+
+/* Indexed by the BW_RATE code, in mHz */
+static const unsigned int adxl345_rate_mhz[] = {
+	100, 200, 390, 780, 1560, 3130, 6250, 12500,
+	25000, 50000, 100000, 200000, 400000, 800000, 1600000, 3200000
+};
+
+enum {
+	ADXL345_RANGE,
+	ADXL345_FULL_RES,
+	ADXL345_RATE,
+	ADXL345_MEASURE,
+	ADXL345_FIFO_MODE,
+};
+
+static const struct obc_field adxl345_fields[] = {
+	[ADXL345_RANGE] = OBC_FIELD_LUT("range", DATA_FORMAT, 0, RANGE_MASK, adxl345_range_g),
+	[ADXL345_FULL_RES] = OBC_FIELD("full_res", DATA_FORMAT, FULL_RES_OFFSET, 0x1),
+	[ADXL345_RATE] = OBC_FIELD_LUT("rate", BW_RATE, 0, RATE_MASK, adxl345_rate_mhz),
+	[ADXL345_MEASURE] = OBC_FIELD("measure", POWER_CTL, MEASURE_OFFSET, 0x1),
+	[ADXL345_FIFO_MODE] = OBC_FIELD("fifo_mode", FIFO_CTL, FIFO_MODE_OFFSET, FIFO_MODE_MASK),
+};
+
+static const struct obc_sensor_desc adxl345_desc = {
+	.name = "adxl345",
+	.dev = OBC_DEV_ADXL345,
+	.id_reg = DEVID,
+	.id = ID_ADXL345,
+	.turn_on_us = ADXL345_TURN_ON_US,
+	.fields = adxl345_fields,
+	.nfields = ARRAY_SIZE(adxl345_fields),
+	.layout = &adxl345_layout,
+};
+
+static int adxl345_xfer_readings(void *raw)
 {
-	unsigned char buf;
-	int err,
-	    i;		/*iterator*/
-	buf = DATA_START;
-	mutex_lock(&adxl345->lock);
-	err = spi_write_then_read(adxl345->adxl345_spi, &buf, 1, (u8 *) adxl345->axis_data, 6);
-	mutex_unlock(&adxl345->lock);
-	if(err){
-		printk(KERN_DEBUG "ADXL345: Cannot read.\n");
-		return err;
-	}
-	for(i = 0; i < AXIS; i++){
-		mutex_lock(&adxl345->lock);
-		adxl345->axis_data[i] = be16_to_cpu(adxl345->axis_data[i]);
-		mutex_unlock(&adxl345->lock);
-	}
-	return 0;
+	unsigned char buf = ADXL_SPI_READ | ADXL_SPI_MB | adxl345_desc.layout->reg;
+	int err = spi_write_then_read(adxl345->adxl345_spi, &buf, 1, raw, adxl345_desc.layout->len);
+	obc_trace(adxl345_desc.dev, adxl345_desc.layout->reg, 0, raw, adxl345_desc.layout->len, err);
+	return err;
+}
+
+/* Repeated failures: set the SPI device up again */
+static int adxl345_recover(void *ctx)
+{
+	return spi_setup(adxl345->adxl345_spi);
 }
 	
 static int adxl345_read_reg(struct spi_device* spi, unsigned char address, void* data)
 {
-	unsigned char buf[2];
-	buf[0] = address;
-	return spi_write_then_read(spi, buf, 1, buf, 1);
+	unsigned char buf;
+	int err;
+	buf = ADXL_SPI_READ | address;
+	err = spi_write_then_read(spi, &buf, 1, data, 1);
+	obc_trace(adxl345_desc.dev, address, 0, data, 1, err);
+	return err;
 }
 
 static int adxl345_write_reg(struct spi_device* spi, unsigned char address, unsigned char data)
 {
 	unsigned char buf[2];
+	int err;
 	buf[0] = address;
-	return spi_write_then_read(spi, buf, 2, NULL, 0);
+	buf[1] = data;
+	err = spi_write_then_read(spi, buf, 2, NULL, 0);
+	obc_trace(adxl345_desc.dev, address, OBC_TRACE_WRITE, &data, 1, err);
+	return err;
+}
+
+static int adxl345_xfer_write(void *ctx)
+{
+	struct adxl345_reg_write *w = ctx;
+	return adxl345_write_reg(adxl345->adxl345_spi, w->address, w->data);
+}
+
+/* Configuration writes wait behind the sample reads on the bus */
+static const struct obc_bus_req adxl345_config_req = {
+	.class = OBC_BUS_HOUSEKEEPING,
+};
+
+static int adxl345_write_retry(unsigned char address, unsigned char data)
+{
+	struct adxl345_reg_write w = { .address = address, .data = data };
+	return obc_retry_bus(&adxl345->err, &adxl345->bus, &adxl345_config_req,
+			adxl345_xfer_write, adxl345_recover, &w);
+}
+
+/*
+ * Drains the FIFO in one SPI message: every entry is a separate 6 byte
+ * burst of the data registers, chip select released in between so the
+ * next entry moves up. The entries land back to back in fifo_raw.
+ */
+static int adxl345_xfer_fifo(void *ctx)
+{
+	struct adxl345_fifo_drain *d = ctx;
+	unsigned int *n = &d->n, i;
+	struct spi_transfer *t;
+	struct spi_message m;
+	u8 status, source;
+	int err;
+	/* Overrun is only cleared by reading the FIFO, so it is sampled first */
+	err = adxl345_read_reg(adxl345->adxl345_spi, INT_SOURCE, &source);
+	if(!err)
+		err = adxl345_read_reg(adxl345->adxl345_spi, FIFO_STATUS, &status);
+	if(err)
+		return err;
+	d->overrun = source & INT_OVERRUN;
+	*n = min_t(unsigned int, status & FIFO_ENTRIES_MASK, ADXL345_FIFO_ENTRIES);
+	if(!*n)
+		return 0;
+	spi_message_init(&m);
+	for(i = 0; i < *n; i++){
+		t = &adxl345->fifo_xfer[2 * i];
+		memset(t, 0, 2 * sizeof(*t));
+		t[0].tx_buf = &adxl345->fifo_cmd;
+		t[0].len = 1;
+		t[1].rx_buf = adxl345->fifo_raw + i * adxl345_desc.layout->len;
+		t[1].len = adxl345_desc.layout->len;
+		/* 5 us with chip select high before the next entry can be read */
+		t[1].cs_change = i + 1 < *n;
+		t[1].delay_usecs = 5;
+		spi_message_add_tail(&t[0], &m);
+		spi_message_add_tail(&t[1], &m);
+	}
+	err = spi_sync(adxl345->adxl345_spi, &m);
+	/* Logged as one read of all the drained entries */
+	obc_trace(adxl345_desc.dev, adxl345_desc.layout->reg, 0, adxl345->fifo_raw,
+			*n * adxl345_desc.layout->len, err);
+	return err;
+}
+
+/*
+ * Reads the latest sample, or in stream mode everything queued in the
+ * FIFO, oldest first, due on the bus within one capture period. A FIFO
+ * drain consumes the entries, so only the single read can be merged.
+ * overrun reports the device's own overrun flag. bus_lock held.
+ */
+static int adxl345_readings(struct obc_sample *s, unsigned int *n, bool *overrun)
+{
+	struct adxl345_fifo_drain d = { 0 };
+	struct obc_bus_req req;
+	int err;
+	*n = 1;
+	*overrun = false;
+	if(adxl345->rate > ADXL345_FIFO_RATE){
+		obc_bus_capture_req(&adxl345->bus, &req, adxl345->period_us, NULL, NULL, 0);
+		err = obc_retry_bus(&adxl345->err, &adxl345->bus, &req, adxl345_xfer_fifo, adxl345_recover, &d);
+		*n = d.n;
+		*overrun = d.overrun;
+	}else{
+		obc_bus_capture_req(&adxl345->bus, &req, adxl345->period_us, &adxl345_layout,
+				adxl345->fifo_raw, adxl345_layout.len);
+		err = obc_retry_bus(&adxl345->err, &adxl345->bus, &req, adxl345_xfer_readings,
+				adxl345_recover, adxl345->fifo_raw);
+	}
+	if(err){
+		printk_ratelimited(KERN_DEBUG "ADXL345: Cannot read.\n");
+		return err;
+	}
+	obc_layout_decode_block(adxl345_desc.layout, adxl345->fifo_raw, s, *n);
+	/* axis_data keeps the last good capture, only updated on success */
+	if(*n){
+		mutex_lock(&adxl345->lock);
+		memcpy(adxl345->axis_data, s[*n - 1].v, sizeof(adxl345->axis_data));
+		mutex_unlock(&adxl345->lock);
+	}
+	return 0;
 }
 
 static int data_format_config(struct spi_device* spi)
 {
-	u8 data_format;
 	int err;
-	data_format = 0x01;
-	err = adxl345_write_reg(spi, DATA_FORMAT, data_format);
+	err = adxl345_write_retry(DATA_FORMAT, adxl345->data_format);
 	if(err){
 		printk(KERN_DEBUG "ADXL345: Cannot configure data format.\n");
 		return err;
@@ -77,8 +281,8 @@ static int power_configure(struct spi_device* spi)
 {
 	u8 power_ctl;
 	int err;
-	power_ctl = 0x08;
-	err = adxl345_write_reg(spi, POWER_CTL, power_ctl);
+	power_ctl = obc_field_prep(&adxl345_fields[ADXL345_MEASURE], 1);
+	err = adxl345_write_retry(POWER_CTL, power_ctl);
 	if(err){
 		printk(KERN_DEBUG "ADXL345: Power Reg can't be configured.\n");
 		return err;
@@ -86,38 +290,764 @@ static int power_configure(struct spi_device* spi)
 	return 0;
 }
 
-static int fifo_control(struct spi_device* spi)
+/* Rates the governor picks from, indexed like the BW_RATE codes */
+static const struct obc_gov_rate adxl345_rates[] = {
+	{ 100, 0x00, 0 },
+	{ 200, 0x01, 0 },
+	{ 390, 0x02, 0 },
+	{ 780, 0x03, 0 },
+	{ 1560, 0x04, 0 },
+	{ 3130, 0x05, 0 },
+	{ 6250, 0x06, 0 },
+	{ 12500, 0x07, 0 },
+	{ 25000, 0x08, 0 },
+	{ 50000, 0x09, 0 },
+	{ 100000, 0x0A, 0 },
+	{ 200000, 0x0B, 0 },
+	{ 400000, 0x0C, 0 },
+	{ 800000, 0x0D, 0 },
+	{ 1600000, 0x0E, 0 },
+	{ 3200000, 0x0F, 0 },
+};
+
+/*
+ * Fastest BW_RATE code the captures keep up with. The private sampler
+ * follows the output rate. On the common trigger a stream mode capture
+ * drains the FIFO once per tick, and a tick must take no more than
+ * ADXL345_FIFO_BATCH samples so the other half of the FIFO absorbs
+ * jitter: 1600 Hz with the default 10 ms tick.
+ */
+static u8 adxl345_max_rate(void)
+{
+	u8 code = ARRAY_SIZE(adxl345_rate_mhz) - 1;
+	u64 limit_mhz;
+	if(!trigger)
+		return code;
+	limit_mhz = div_u64(ADXL345_FIFO_BATCH * 1000000000ULL, max(obc_trigger_period_us(), 1U));
+	while(code > ADXL345_FIFO_RATE && adxl345_rate_mhz[code] > limit_mhz)
+		code--;
+	return code;
+}
+
+/*
+ * Writes BW_RATE and the FIFO mode that goes with it. Above 100 Hz the
+ * FIFO streams and each capture drains about ADXL345_FIFO_BATCH samples.
+ * Codes above adxl345_max_rate() are clamped to it. bus_lock held.
+ */
+static int adxl345_set_rate(u8 code)
+{
+	u8 mode;
+	unsigned int period_us;
+	int err;
+	code = min(code, adxl345_max_rate());
+	mode = code > ADXL345_FIFO_RATE ? FIFO_MODE_STREAM : FIFO_MODE_BYPASS;
+	err = adxl345_write_retry(BW_RATE, obc_field_prep(&adxl345_fields[ADXL345_RATE], code));
+	if(!err)
+		err = adxl345_write_retry(FIFO_CTL, obc_field_prep(&adxl345_fields[ADXL345_FIFO_MODE], mode));
+	if(err)
+		return err;
+	adxl345->rate = code;
+	adxl345->odr_ns = div_u64(1000000000000ULL, adxl345_rate_mhz[code]);
+	period_us = adxl345->odr_ns / NSEC_PER_USEC;
+	if(mode == FIFO_MODE_STREAM)
+		period_us *= ADXL345_FIFO_BATCH;
+	WRITE_ONCE(adxl345->period_us, period_us);
+	WRITE_ONCE(adxl345->trig.period_us, period_us);
+	return 0;
+}
+
+/*
+ * Called between samples from the capture path. A target above the cap
+ * can only be left over from before a tick change; refusing it keeps
+ * the governor's rate the one the device runs at.
+ */
+static int adxl345_gov_apply(struct obc_gov_client *c, const struct obc_gov_rate *r)
 {
-	u8 fifo_ctl;
 	int err;
-	fifo_ctl = 0x00;
-	err = adxl345_write_reg(spi, FIFO_CTL, fifo_ctl);
+	if(r->code > adxl345_max_rate())
+		return -ERANGE;
+	mutex_lock(&adxl345->bus_lock);
+	err = adxl345_set_rate(r->code);
+	mutex_unlock(&adxl345->bus_lock);
+	return err;
+}
+
+/*
+ * Follows trigger_period_us: a slower tick lowers the governor's cap,
+ * and with it the target, before the FIFO can overrun between ticks.
+ * Capture path only.
+ */
+static void adxl345_limit_rate(void)
+{
+	unsigned int tick_us;
+	if(!trigger)
+		return;
+	tick_us = obc_trigger_period_us();
+	if(tick_us == adxl345->tick_us)
+		return;
+	adxl345->tick_us = tick_us;
+	obc_gov_set_max(&adxl345->gov, adxl345_max_rate());
+}
+
+/* Smoothed sample to sample change of all axes, fed to the rate governor */
+static void adxl345_motion(const struct obc_sample *s)
+{
+	unsigned int d = 0;
+	int i;
+	for(i = 0; i < AXIS; i++){
+		d += abs(s->v[i] - adxl345->last[i]);
+		adxl345->last[i] = s->v[i];
+	}
+	if(!s->seq)
+		return;
+	adxl345->activity += ((int)(d << 4) - (int)adxl345->activity) / 4;
+	obc_gov_motion(adxl345->activity >> 4);
+}
+
+/*
+ * The device's activity detection, run on every capture: a change on any
+ * axis of more than THRESH_ACT from a slowly following reference, much
+ * like its ac-coupled mode. The device has no interrupt line here, so the
+ * register copy only matters with INT1 wired to the snapshot GPIO.
+ */
+static bool adxl345_activity(const struct obc_sample *s)
+{
+	u64 thresh_ug = (u64)READ_ONCE(adxl345->act_thresh) * 62500;
+	u32 scale_ug = ADXL345_SCALE_UG(OBC_SAMPLE_RANGE(s->flags));
+	bool hit = false;
+	s32 d;
+	int i;
+	if(!thresh_ug || (s->flags & OBC_SAMPLE_STALE))
+		return false;
+	if(!adxl345->act_ref_valid){
+		for(i = 0; i < AXIS; i++)
+			adxl345->act_ref[i] = s->v[i] << 4;
+		adxl345->act_ref_valid = true;
+		return false;
+	}
+	for(i = 0; i < AXIS; i++){
+		d = (s->v[i] << 4) - adxl345->act_ref[i];
+		if((u64)(abs(d) >> 4) * scale_ug > thresh_ug)
+			hit = true;
+		adxl345->act_ref[i] += d / 16;
+	}
+	return hit;
+}
+
+/*
+ * Takes one sample, or a FIFO block, from the device and publishes it to
+ * every reader. Samples of a block are spaced one output period apart,
+ * the newest stamped with the read time.
+ */
+static int adxl345_capture(u32 set)
+{
+	struct obc_sample *s = adxl345->block;
+	unsigned int n, i;
+	bool done, overrun;
+	u32 odr_ns;
+	u16 flags;
+	u64 t_ns;
+	int err;
+	adxl345_limit_rate();
+	obc_gov_sync(&adxl345->gov);
+	mutex_lock(&adxl345->bus_lock);
+	err = adxl345_readings(s, &n, &overrun);
+	flags = (adxl345->data_format & RANGE_CODE_MASK) << OBC_SAMPLE_RANGE_SHIFT;
+	odr_ns = adxl345->odr_ns;
+	mutex_unlock(&adxl345->bus_lock);
+	t_ns = ktime_get_ns();
 	if(err){
-		printk(KERN_DEBUG "ADXL345: FIFO Control Register can't be configured.\n");
+		n = 1;
+		flags |= OBC_SAMPLE_STALE;
+		obc_err_stale(&adxl345->err);
+		mutex_lock(&adxl345->lock);
+		memcpy(s[0].v, adxl345->axis_data, sizeof(s[0].v));
+		mutex_unlock(&adxl345->lock);
+	}
+	for(i = 0; i < n; i++){
+		s[i].t_ns = t_ns - (u64)(n - 1 - i) * odr_ns;
+		s[i].dev = adxl345_desc.dev;
+		s[i].seq = adxl345->seq++;
+		s[i].set = set;
+		s[i].flags = flags;
+	}
+	/* The FIFO filled up and the device overwrote its oldest entries */
+	if(!err && overrun && n){
+		s[0].flags |= OBC_SAMPLE_GAP;
+		obc_ring_hw_overrun(&adxl345->ring);
+	}
+	for(i = 0; i < n; i++){
+		obc_ring_push(&adxl345->ring, &s[i]);
+		obc_journal_push(&adxl345->journal, &s[i]);
+	}
+	for(i = 0, done = false; i < n; i++)
+		done |= obc_stats_add(&adxl345->stats, &s[i]);
+	if(done)
+		obc_stats_notify(&adxl345->stats);
+	for(i = 0, done = false; i < n; i++){
+		if(adxl345_activity(&s[i]))
+			obc_snap_trigger(&adxl345->snap, OBC_SNAP_ACTIVITY);
+		done |= obc_snap_push(&adxl345->snap, &s[i]);
+	}
+	if(done)
+		obc_snap_notify(&adxl345->snap);
+	if(!err && n)
+		adxl345_motion(&s[n - 1]);
+	return err;
+}
+
+/* Captures run for open files, the windowed statistics and the snapshot buffer */
+static bool adxl345_wanted(void)
+{
+	return atomic_read(&adxl345->ring.readers) || obc_stats_enabled(&adxl345->stats) ||
+			obc_snap_recording(&adxl345->snap);
+}
+
+/* One bus read per period, shared by all open files; idle when nobody wants samples */
+static int adxl345_sampler(void *data)
+{
+	ktime_t next = ktime_get();
+	long late;
+	while(!kthread_should_stop()){
+		if(!adxl345_wanted()){
+			wait_event_interruptible(adxl345->sampler_wait,
+					adxl345_wanted() || kthread_should_stop());
+			next = ktime_get();
+			continue;
+		}
+		adxl345_capture(0);
+		next = ktime_add_us(next, adxl345->period_us);
+		if(ktime_before(next, ktime_get()))
+			next = ktime_get();
+		set_current_state(TASK_INTERRUPTIBLE);
+		late = kthread_should_stop() ? -EINTR : schedule_hrtimeout(&next, HRTIMER_MODE_ABS);
+		__set_current_state(TASK_RUNNING);
+		/* Woken by the timer, the next capture starts now */
+		if(!late)
+			obc_sched_latency(&adxl345->sched, ktime_to_ns(ktime_sub(ktime_get(), next)));
+	}
+	return 0;
+}
+
+static void adxl345_trigger_capture(struct obc_trigger_client *c, u32 set, u64 t_ns)
+{
+	adxl345_capture(set);
+}
+
+static bool adxl345_trigger_wanted(struct obc_trigger_client *c)
+{
+	return adxl345_wanted();
+}
+
+/* Time between captures; the trigger tick can be slower than the output rate */
+static unsigned int adxl345_capture_period_us(void)
+{
+	if(trigger)
+		return max(adxl345->period_us, obc_trigger_period_us());
+	return adxl345->period_us;
+}
+
+/* Captures run either on the common trigger or on the driver's own sampler */
+static int adxl345_start_sampling(void)
+{
+	int err;
+	if(trigger){
+		adxl345->trig.name = adxl345_desc.name;
+		adxl345->trig.capture = adxl345_trigger_capture;
+		adxl345->trig.wanted = adxl345_trigger_wanted;
+		adxl345->trig.period_us = adxl345->period_us;
+		adxl345->trig.sched = &adxl345->sched;
+		return obc_trigger_register(&adxl345->trig);
+	}
+	adxl345->sampler = kthread_run(adxl345_sampler, NULL, "adxl345-sampler");
+	if(IS_ERR(adxl345->sampler)){
+		err = PTR_ERR(adxl345->sampler);
+		adxl345->sampler = NULL;
 		return err;
 	}
+	obc_sched_attach(&adxl345->sched, adxl345->sampler);
 	return 0;
 }
 
-static int adxl345_probe(struct spi_device *spi)
+/* Writes OFSX, OFSY and OFSZ from the shadow. bus_lock held */
+static int adxl345_write_offset(void)
+{
+	int err = 0, i;
+	for(i = 0; i < AXIS && !err; i++)
+		err = adxl345_write_retry(OFFSET_X + i, (u8)adxl345->offset[i]);
+	return err;
+}
+
+static void adxl345_config_save(struct obc_config_client *c, void *data)
 {
+	struct obc_config_adxl345 *cfg = data;
+	mutex_lock(&adxl345->bus_lock);
+	cfg->data_format = adxl345->data_format & RANGE_CODE_MASK;
+	cfg->rate = adxl345->rate;
+	memcpy(cfg->offset, adxl345->offset, sizeof(cfg->offset));
+	mutex_unlock(&adxl345->bus_lock);
+}
+
+static int adxl345_config_load(struct obc_config_client *c, const void *data)
+{
+	const struct obc_config_adxl345 *cfg = data;
+	if(!obc_field_valid(&adxl345_fields[ADXL345_RATE], cfg->rate))
+		return -EINVAL;
+	mutex_lock(&adxl345->bus_lock);
+	adxl345->data_format = (adxl345->data_format & ~RANGE_CODE_MASK) | (cfg->data_format & RANGE_CODE_MASK);
+	adxl345->rate = cfg->rate;
+	memcpy(adxl345->offset, cfg->offset, sizeof(adxl345->offset));
+	mutex_unlock(&adxl345->bus_lock);
+	return 0;
+}
+
+static int adxl345_config_apply(struct obc_config_client *c)
+{
+	int err = obc_probe_wait(&adxl345->probe);
+	if(err)
+		return err;
+	mutex_lock(&adxl345->bus_lock);
+	err = data_format_config(adxl345->adxl345_spi);
+	if(!err)
+		err = adxl345_set_rate(adxl345->rate);
+	if(!err)
+		err = adxl345_write_offset();
+	mutex_unlock(&adxl345->bus_lock);
+	if(!err)
+		obc_gov_reset(&adxl345->gov, adxl345->rate);
+	return err;
+}
+
+static void adxl345_config_work(struct work_struct *work)
+{
+	struct obc_sample *first = adxl345->block;
+	unsigned int n;
+	bool overrun;
 	int err;
-	mutex_lock(&adxl345->lock);
-	adxl345->adxl345_spi = spi;
-	mutex_unlock(&adxl345->lock);
-	err = adxl345_readings();
+	/* A stored configuration replaces the defaults before anything is written */
+	obc_config_fetch(&adxl345->config, &adxl345->adxl345_spi->dev);
+	mutex_lock(&adxl345->bus_lock);
+	err = data_format_config(adxl345->adxl345_spi);
+	if(!err)
+		err = adxl345_set_rate(adxl345->rate);
+	if(!err)
+		err = adxl345_write_offset();
+	if(!err)
+		err = power_configure(adxl345->adxl345_spi);
+	mutex_unlock(&adxl345->bus_lock);
+	if(err){
+		obc_probe_done(&adxl345->probe, err);
+		return;
+	}
+	obc_probe_mark(&adxl345->probe, OBC_PROBE_CONFIG);
+	/* First conversion completes one output period after entering measure mode */
+	usleep_range(adxl345_desc.turn_on_us, adxl345_desc.turn_on_us + 500);
+	mutex_lock(&adxl345->bus_lock);
+	err = adxl345_readings(first, &n, &overrun);
+	mutex_unlock(&adxl345->bus_lock);
+	if(!err && !n)
+		err = -ENODATA;
 	if(err){
 		printk(KERN_DEBUG "ADXL345: Cannot get any readings\n");
+		obc_probe_done(&adxl345->probe, err);
+		return;
+	}
+	obc_probe_mark(&adxl345->probe, OBC_PROBE_FIRST_SAMPLE);
+	printk(KERN_DEBUG "ADXL345: %d %d %d \n", first[n - 1].v[0], first[n - 1].v[1], first[n - 1].v[2]);
+	/* Motion asks for 100 Hz; the FIFO rates are for consumers that vote */
+	adxl345->gov.name = adxl345_desc.name;
+	adxl345->gov.rates = adxl345_rates;
+	/* Capped by adxl345_limit_rate() to what the trigger tick allows */
+	adxl345->gov.nrates = ARRAY_SIZE(adxl345_rates);
+	adxl345->gov.quiet = 0x08;
+	adxl345->gov.motion = ADXL345_FIFO_RATE;
+	adxl345->gov.apply = adxl345_gov_apply;
+	err = obc_gov_register(&adxl345->gov, adxl345->rate);
+	if(!err)
+		err = adxl345_start_sampling();
+	if(err){
+		obc_probe_done(&adxl345->probe, err);
+		return;
+	}
+	obc_probe_done(&adxl345->probe, 0);
+	printk(KERN_DEBUG "ADXL345: Ready after %lld us\n", adxl345->probe.stage_us[OBC_PROBE_READY]);
+}
+
+static ssize_t adxl345_probe_timing(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	return obc_probe_show(&adxl345->probe, buf);
+}
+
+static ssize_t adxl345_error_stats(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	return obc_err_show(&adxl345->err, buf);
+}
+
+static ssize_t adxl345_error_policy_get(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	return obc_err_policy_show(&adxl345->err, buf);
+}
+
+static ssize_t adxl345_error_policy_set(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+{
+	return obc_err_policy_store(&adxl345->err, buf, count);
+}
+
+static ssize_t adxl345_ring_stats(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	return obc_ring_show(&adxl345->ring, buf);
+}
+
+static ssize_t adxl345_ring_policy_get(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	return obc_ring_policy_show(&adxl345->ring, buf);
+}
+
+static ssize_t adxl345_ring_policy_set(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+{
+	return obc_ring_policy_store(&adxl345->ring, buf, count);
+}
+
+static ssize_t adxl345_stats(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	return obc_stats_show(&adxl345->stats, buf);
+}
+
+static ssize_t adxl345_stats_window_get(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	return obc_stats_window_show(&adxl345->stats, buf);
+}
+
+/* Non-zero keeps the sampler running without open files */
+static ssize_t adxl345_stats_window_set(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+{
+	unsigned int ms;
+	if(kstrtouint(buf, 0, &ms))
+		return -EINVAL;
+	obc_stats_set_window(&adxl345->stats, ms);
+	wake_up(&adxl345->sampler_wait);
+	return count;
+}
+
+static ssize_t adxl345_bus_class_get(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	return obc_bus_class_show(&adxl345->bus, buf);
+}
+
+/* Bus priority of the captures: control, stream or housekeeping */
+static ssize_t adxl345_bus_class_set(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+{
+	return obc_bus_class_store(&adxl345->bus, buf, count);
+}
+
+static ssize_t adxl345_sched_get(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	return obc_sched_show(&adxl345->sched, buf);
+}
+
+/* Policy of the capture thread: "other", "fifo <prio>" or "rr <prio>" */
+static ssize_t adxl345_sched_set(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+{
+	return obc_sched_store(&adxl345->sched, buf, count);
+}
+
+static ssize_t adxl345_sched_cpus_get(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	return obc_sched_cpus_show(&adxl345->sched, buf);
+}
+
+/* CPUs the capture thread may run on, as a CPU list */
+static ssize_t adxl345_sched_cpus_set(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+{
+	return obc_sched_cpus_store(&adxl345->sched, buf, count);
+}
+
+/* Timer or trigger to capture start, in power of two us buckets; writing clears it */
+static ssize_t adxl345_latency_get(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	return obc_sched_hist_show(&adxl345->sched, buf);
+}
+
+static ssize_t adxl345_latency_clear(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+{
+	return obc_sched_hist_clear(&adxl345->sched, count);
+}
+
+static ssize_t adxl345_snapshot_state_get(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	return obc_snap_show(&adxl345->snap, buf);
+}
+
+/* "arm", "trigger" or "off" */
+static ssize_t adxl345_snapshot_state_set(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+{
+	ssize_t ret = obc_snap_store(&adxl345->snap, buf, count);
+	wake_up(&adxl345->sampler_wait);
+	return ret;
+}
+
+static ssize_t adxl345_snapshot_window_get(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	u64 odr_ns = READ_ONCE(adxl345->odr_ns);
+	return sprintf(buf, "%llu %llu\n", div_u64(adxl345->snap.pre * odr_ns, NSEC_PER_MSEC),
+			div_u64(adxl345->snap.post * odr_ns, NSEC_PER_MSEC));
+}
+
+/* "pre post" in ms, turned into samples at the current output rate */
+static ssize_t adxl345_snapshot_window_set(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+{
+	unsigned int pre, post;
+	u32 odr_ns = READ_ONCE(adxl345->odr_ns);
+	int err;
+	if(sscanf(buf, "%u %u", &pre, &post) != 2 || !odr_ns)
+		return -EINVAL;
+	err = obc_snap_set_window(&adxl345->snap, div_u64((u64)pre * NSEC_PER_MSEC, odr_ns),
+			div_u64((u64)post * NSEC_PER_MSEC, odr_ns));
+	return err ? err : count;
+}
+
+static ssize_t adxl345_snapshot_thresh_get(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%u\n", DIV_ROUND_CLOSEST(adxl345->act_thresh * 125, 2));
+}
+
+/* Activity threshold that fires the snapshot in mg, rounded to 62.5 mg steps; 0 disables */
+static ssize_t adxl345_snapshot_thresh_set(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+{
+	unsigned int mg, code;
+	int err;
+	if(kstrtouint(buf, 10, &mg))
+		return -EINVAL;
+	code = DIV_ROUND_CLOSEST(mg * 2, 125);
+	if(mg > 16000 || (mg && !code))
+		return -EINVAL;
+	err = obc_probe_wait(&adxl345->probe);
+	if(err)
 		return err;
-		}
-	mutex_lock(&adxl345->lock);
-	printk(KERN_DEBUG "ADXL345: %hd %hd %hd \n", adxl345->axis_data[0], adxl345->axis_data[1], adxl345->axis_data[2]);
-	mutex_unlock(&adxl345->lock);
+	mutex_lock(&adxl345->bus_lock);
+	err = adxl345_write_retry(THRESH_ACT, code);
+	if(!err)
+		err = adxl345_write_retry(ACT_INACT_CTL, code ? ACT_AC_XYZ : 0);
+	if(!err)
+		err = adxl345_write_retry(INT_ENABLE, code ? INT_ACTIVITY : 0);
+	if(!err){
+		adxl345->act_ref_valid = false;
+		WRITE_ONCE(adxl345->act_thresh, code);
+	}
+	mutex_unlock(&adxl345->bus_lock);
+	return err ? err : count;
+}
+
+static ssize_t adxl345_snapshot_bin(struct file *filp, struct kobject *kobj, struct bin_attribute *attr,
+		char *buf, loff_t off, size_t count)
+{
+	return obc_snap_read_bin(&adxl345->snap, buf, off, count);
+}
+
+static ssize_t adxl345_stats_bin(struct file *filp, struct kobject *kobj, struct bin_attribute *attr,
+		char *buf, loff_t off, size_t count)
+{
+	return obc_stats_read_bin(&adxl345->stats, buf, off, count);
+}
+
+/* Writes a DATA_FORMAT field; samples carry the range they were taken with */
+static ssize_t adxl345_store_format(int field, int code, size_t count)
+{
+	u8 format;
+	int err = obc_probe_wait(&adxl345->probe);
+	if(err)
+		return err;
+	if(code < 0)
+		return code;
+	mutex_lock(&adxl345->bus_lock);
+	format = adxl345->data_format;
+	err = obc_field_set(&adxl345_fields[field], &format, code);
+	if(!err)
+		err = adxl345_write_retry(DATA_FORMAT, format);
+	if(!err)
+		adxl345->data_format = format;
+	mutex_unlock(&adxl345->bus_lock);
+	return err ? err : count;
+}
+
+/* Full scale in g: 2, 4, 8 or 16 */
+static ssize_t adxl345_get_range(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%u\n", obc_field_value(&adxl345_fields[ADXL345_RANGE], adxl345->data_format));
+}
+
+static ssize_t adxl345_set_range(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+{
+	unsigned long val;
+	if(kstrtoul(buf, 10, &val))
+		return -EINVAL;
+	return adxl345_store_format(ADXL345_RANGE, obc_field_code(&adxl345_fields[ADXL345_RANGE], val), count);
+}
+
+/* 1: 3.9 mg per count at every range, 0: 10 bits over the range */
+static ssize_t adxl345_get_full_res(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%u\n", obc_field_value(&adxl345_fields[ADXL345_FULL_RES], adxl345->data_format));
+}
+
+static ssize_t adxl345_set_full_res(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+{
+	bool val;
+	if(kstrtobool(buf, &val))
+		return -EINVAL;
+	return adxl345_store_format(ADXL345_FULL_RES, val, count);
+}
+
+static ssize_t adxl345_get_scale(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%u\n", ADXL345_SCALE_UG(adxl345->data_format & RANGE_CODE_MASK));
+}
+
+static ssize_t adxl345_get_rate(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%u\n", obc_field_value(&adxl345_fields[ADXL345_RATE], adxl345->rate));
+}
+
+/*
+ * Output rate in mHz, rounded up to a BW_RATE step; the governor takes
+ * over on its next decision. On the common trigger, rates whose FIFO
+ * would take more than half its depth per tick are refused with -ERANGE
+ * (see adxl345_max_rate); load with trigger=0 for the fastest rates.
+ */
+static ssize_t adxl345_set_rate_attr(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+{
+	unsigned long val;
+	int code, err;
+	if(kstrtoul(buf, 10, &val))
+		return -EINVAL;
+	code = obc_field_code(&adxl345_fields[ADXL345_RATE], val);
+	if(code < 0)
+		return code;
+	if(code > adxl345_max_rate())
+		return -ERANGE;
+	err = obc_probe_wait(&adxl345->probe);
+	if(err)
+		return err;
+	mutex_lock(&adxl345->bus_lock);
+	err = adxl345_set_rate(code);
+	mutex_unlock(&adxl345->bus_lock);
+	if(err)
+		return err;
+	obc_gov_reset(&adxl345->gov, code);
+	return count;
+}
+
+/* Offset registers, "x y z" in counts of 15.6 mg */
+static ssize_t adxl345_get_offset(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%d %d %d\n", adxl345->offset[0], adxl345->offset[1], adxl345->offset[2]);
+}
+
+static ssize_t adxl345_set_offset(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+{
+	int ofs[AXIS], err, i;
+	if(sscanf(buf, "%d %d %d", &ofs[0], &ofs[1], &ofs[2]) != AXIS)
+		return -EINVAL;
+	for(i = 0; i < AXIS; i++)
+		if(ofs[i] < S8_MIN || ofs[i] > S8_MAX)
+			return -EINVAL;
+	err = obc_probe_wait(&adxl345->probe);
+	if(err)
+		return err;
+	mutex_lock(&adxl345->bus_lock);
+	for(i = 0; i < AXIS && !err; i++){
+		err = adxl345_write_retry(OFFSET_X + i, (u8)ofs[i]);
+		if(!err)
+			adxl345->offset[i] = ofs[i];
+	}
+	mutex_unlock(&adxl345->bus_lock);
+	return err ? err : count;
+}
+
+static DEVICE_ATTR(range, 0664, adxl345_get_range, adxl345_set_range);
+static DEVICE_ATTR(full_res, 0664, adxl345_get_full_res, adxl345_set_full_res);
+static DEVICE_ATTR(scale_ug, 0444, adxl345_get_scale, NULL);
+static DEVICE_ATTR(rate_mhz, 0664, adxl345_get_rate, adxl345_set_rate_attr);
+static DEVICE_ATTR(offset, 0664, adxl345_get_offset, adxl345_set_offset);
+static DEVICE_ATTR(probe_timing, 0444, adxl345_probe_timing, NULL);
+static DEVICE_ATTR(error_stats, 0444, adxl345_error_stats, NULL);
+static DEVICE_ATTR(error_policy, 0664, adxl345_error_policy_get, adxl345_error_policy_set);
+static DEVICE_ATTR(ring_stats, 0444, adxl345_ring_stats, NULL);
+static DEVICE_ATTR(ring_policy, 0664, adxl345_ring_policy_get, adxl345_ring_policy_set);
+static DEVICE_ATTR(stats, 0444, adxl345_stats, NULL);
+static DEVICE_ATTR(stats_window_ms, 0664, adxl345_stats_window_get, adxl345_stats_window_set);
+static DEVICE_ATTR(bus_class, 0664, adxl345_bus_class_get, adxl345_bus_class_set);
+static DEVICE_ATTR(sched_policy, 0664, adxl345_sched_get, adxl345_sched_set);
+static DEVICE_ATTR(sched_cpus, 0664, adxl345_sched_cpus_get, adxl345_sched_cpus_set);
+static DEVICE_ATTR(wakeup_latency, 0664, adxl345_latency_get, adxl345_latency_clear);
+static DEVICE_ATTR(snapshot_state, 0664, adxl345_snapshot_state_get, adxl345_snapshot_state_set);
+static DEVICE_ATTR(snapshot_window_ms, 0664, adxl345_snapshot_window_get, adxl345_snapshot_window_set);
+static DEVICE_ATTR(snapshot_thresh_mg, 0664, adxl345_snapshot_thresh_get, adxl345_snapshot_thresh_set);
+static BIN_ATTR(stats_bin, 0444, adxl345_stats_bin, NULL,
+		OBC_STATS_HISTORY * sizeof(struct obc_stats_window));
+/* Size depends on the frozen window */
+static BIN_ATTR(snapshot, 0444, adxl345_snapshot_bin, NULL, 0);
+
+static struct device_attribute *adxl345_attr_list[] = {
+	&dev_attr_range,
+	&dev_attr_full_res,
+	&dev_attr_scale_ug,
+	&dev_attr_rate_mhz,
+	&dev_attr_offset,
+	&dev_attr_probe_timing,
+	&dev_attr_error_stats,
+	&dev_attr_error_policy,
+	&dev_attr_ring_stats,
+	&dev_attr_ring_policy,
+	&dev_attr_stats,
+	&dev_attr_stats_window_ms,
+	&dev_attr_bus_class,
+	&dev_attr_sched_policy,
+	&dev_attr_sched_cpus,
+	&dev_attr_wakeup_latency,
+	&dev_attr_snapshot_state,
+	&dev_attr_snapshot_window_ms,
+	&dev_attr_snapshot_thresh_mg,
+};
+
+static void adxl345_create_attr(struct device *dev)
+{
+	int i;
+	for(i = 0; i < ARRAY_SIZE(adxl345_attr_list); i++)
+		if(device_create_file(dev, adxl345_attr_list[i]) < 0)
+			printk(KERN_DEBUG "ADXL345: Error creating attribute file\n");
+	if(device_create_bin_file(dev, &bin_attr_stats_bin) < 0)
+		printk(KERN_DEBUG "ADXL345: Error creating attribute file\n");
+	if(device_create_bin_file(dev, &bin_attr_snapshot) < 0)
+		printk(KERN_DEBUG "ADXL345: Error creating attribute file\n");
+}
+
+static void adxl345_remove_attr(struct device *dev)
+{
+	int i;
+	for(i = 0; i < ARRAY_SIZE(adxl345_attr_list); i++)
+		device_remove_file(dev, adxl345_attr_list[i]);
+	device_remove_bin_file(dev, &bin_attr_stats_bin);
+	device_remove_bin_file(dev, &bin_attr_snapshot);
+}
+
+static int adxl345_probe(struct spi_device *spi)
+{
+	obc_probe_start(&adxl345->probe);
 	mutex_lock(&adxl345->lock);
-	data_format_config(adxl345->adxl345_spi);
-	power_configure(adxl345->adxl345_spi);
-	fifo_control(adxl345->adxl345_spi);
+	adxl345->adxl345_spi = spi;
 	mutex_unlock(&adxl345->lock);
+	obc_stats_init(&adxl345->stats, &spi->dev, adxl345_desc.dev, AXIS);
+	obc_sched_init(&adxl345->sched);
+	/* Without the memory the device runs as before, no snapshots */
+	if(obc_snap_alloc(&adxl345->snap, &spi->dev, adxl345_desc.dev, snapshot_kb))
+		printk(KERN_DEBUG "ADXL345: Cannot allocate the snapshot buffer\n");
+	obc_snap_register(&adxl345->snap);
+	obc_journal_attach(&adxl345->journal, adxl345_desc.dev);
+	obc_trace_layout(adxl345_desc.dev, adxl345_desc.layout);
+	/* Without a bus queue the transfers still run, unscheduled */
+	if(obc_bus_attach(&adxl345->bus, &spi->master->dev))
+		printk(KERN_DEBUG "ADXL345: Cannot attach to the bus scheduler\n");
 	/*adxl345->adxl345_spi->max_speeed_hz = 5000000;
 	err = spi_setup(adxl345->adxl345_spi);
 	if(!err){
@@ -125,12 +1055,32 @@ static int adxl345_probe(struct spi_device *spi)
 		return err;
 	}*/
 	//spi_cmd(SPI1, ENABLE);
+	adxl345_create_attr(&spi->dev);
+	obc_config_register(&adxl345->config);
+	/* Bus configuration runs in the background, readers wait for it */
+	INIT_WORK(&adxl345->config_work, adxl345_config_work);
+	queue_work(system_unbound_wq, &adxl345->config_work);
 	printk(KERN_DEBUG "ADXL345: Probe completed\n");
 	return 0;
 }
 
 static int adxl345_remove(struct spi_device *spi)
 {
+	cancel_work_sync(&adxl345->config_work);
+	obc_config_unregister(&adxl345->config);
+	obc_trigger_unregister(&adxl345->trig);
+	if(adxl345->sampler){
+		obc_sched_detach(&adxl345->sched);
+		kthread_stop(adxl345->sampler);
+		adxl345->sampler = NULL;
+	}
+	obc_gov_unregister(&adxl345->gov);
+	adxl345_remove_attr(&spi->dev);
+	obc_snap_unregister(&adxl345->snap);
+	obc_snap_free(&adxl345->snap);
+	obc_journal_detach(&adxl345->journal);
+	obc_bus_detach(&adxl345->bus);
+	obc_trace_layout(adxl345_desc.dev, NULL);
 	return 0;
 	}
 
@@ -148,6 +1098,7 @@ static struct spi_driver adxl345_driver = {
 		.name = SENSOR_ID,
 		.owner = THIS_MODULE,
 		.of_match_table = adxl345_of_match,
+		.probe_type = PROBE_PREFER_ASYNCHRONOUS,
 	},
 	.probe = adxl345_probe,
 	.remove = adxl345_remove,
@@ -155,31 +1106,118 @@ static struct spi_driver adxl345_driver = {
 
 static int adxl345_open(struct inode *inode, struct file *file)
 {
+	struct obc_ring_reader *reader;
 	printk(KERN_DEBUG "ADXL345: Open called\n");
+	reader = obc_ring_reader_alloc(&adxl345->ring);
+	if(!reader)
+		return -ENOMEM;
+	file->private_data = reader;
+	wake_up(&adxl345->sampler_wait);
 	return 0;
 }
 
 static int adxl345_release(struct inode *inode, struct file *file)
 {
+	struct obc_ring_reader *reader = file->private_data;
 	printk(KERN_DEBUG "ADXL345: Release called\n");
+	if(reader->rate_vote >= 0)
+		obc_gov_vote(&adxl345->gov, &reader->rate_vote, 0);
+	obc_ring_reader_free(reader);
 	return 0;
 }
 
+/* Returns the samples this file has not seen yet as delta/varint chunks, also to splice() and sendfile() */
+static ssize_t adxl345_read_iter(struct kiocb *iocb, struct iov_iter *to)
+{
+	int err = obc_probe_wait(&adxl345->probe);
+	if(err)
+		return err;
+	return obc_ring_read_delta(iocb->ki_filp->private_data, iocb->ki_filp, to);
+}
+
+static loff_t adxl345_llseek(struct file *file, loff_t offset, int whence)
+{
+	return obc_ring_llseek(file->private_data, offset, whence);
+}
+
+static int adxl345_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	return obc_ring_mmap(&adxl345->ring, vma);
+}
+
+static unsigned int adxl345_poll(struct file *file, poll_table *wait)
+{
+	return obc_ring_poll(file->private_data, file, wait);
+}
+
 static long adxl345_ioctl(struct file *fi, unsigned int cmd, unsigned long arg)
 {
 	mutex_lock(&adxl345->lock);
 	struct spi_device* spi = adxl345->adxl345_spi;
 	mutex_unlock(&adxl345->lock);
+	int err = obc_probe_wait(&adxl345->probe);
+	if(err)
+		return err;
 	switch(cmd){
 		case ADXL345_READ:
-			adxl345_readings();
-			mutex_lock(&adxl345->lock);
-			if(copy_to_user((unsigned short *)arg, adxl345->axis_data, 6)){
-				mutex_unlock(&adxl345->lock);
+		{
+			/* Latest shared capture, no bus traffic of its own */
+			struct obc_sample sample;
+			u16 axis[AXIS];
+			int i;
+			err = obc_ring_wait_latest(&adxl345->ring, &sample,
+					usecs_to_jiffies(2 * adxl345_capture_period_us()));
+			if(err)
+				return err;
+			if(sample.flags & OBC_SAMPLE_STALE)
+				return -ENODATA;
+			for(i = 0; i < AXIS; i++)
+				axis[i] = sample.v[i];
+			if(copy_to_user((unsigned short *)arg, axis, sizeof(axis)))
 				return -EFAULT;
-			}
-			mutex_unlock(&adxl345->lock);
 			return 0;
+		}
+		case ADXL345_READ_SAMPLE:
+		{
+			/* Latest capture with timestamp and flags, stale ones included */
+			struct obc_sample sample;
+			err = obc_ring_wait_latest(&adxl345->ring, &sample,
+					usecs_to_jiffies(2 * adxl345_capture_period_us()));
+			if(err)
+				return err;
+			if(copy_to_user((void __user *)arg, &sample, sizeof(sample)))
+				return -EFAULT;
+			return 0;
+		}
+		case ADXL345_SET_RATE:
+		{
+			struct obc_ring_reader *reader = fi->private_data;
+			u32 mhz;
+			if(copy_from_user(&mhz, (void __user *)arg, sizeof(mhz)))
+				return -EFAULT;
+			mhz = obc_gov_vote(&adxl345->gov, &reader->rate_vote, mhz);
+			if(copy_to_user((void __user *)arg, &mhz, sizeof(mhz)))
+				return -EFAULT;
+			return 0;
+		}
+		case ADXL345_SET_RING_POLICY:
+		{
+			u32 policy;
+			if(copy_from_user(&policy, (void __user *)arg, sizeof(policy)))
+				return -EFAULT;
+			return obc_ring_set_policy(fi->private_data, policy);
+		}
+		case ADXL345_SNAPSHOT_TRIGGER:
+			obc_snap_trigger(&adxl345->snap, OBC_SNAP_USER);
+			return 0;
+		case ADXL345_GET_RING_STAT:
+		{
+			struct obc_ring_stat st;
+			obc_ring_stat(fi->private_data, &st);
+			if(copy_to_user((void __user *)arg, &st, sizeof(st)))
+				return -EFAULT;
+			return 0;
+		}
 		default:
 			return -ENOTTY;
 	}
@@ -189,49 +1227,95 @@ static const struct file_operations adxl345_fops = {
 	.owner = THIS_MODULE,
 	.open = adxl345_open,
 	.release = adxl345_release,
+	.read_iter = adxl345_read_iter,
+	.splice_read = generic_file_splice_read,
+	.poll = adxl345_poll,
+	.llseek = adxl345_llseek,
+	.mmap = adxl345_mmap,
 	.unlocked_ioctl = adxl345_ioctl,
 };
 
 static int __init adxl345_init(void)
 {
-	int error;
-
+	int err;
 	adxl345 = kzalloc(sizeof(struct sensor_adxl345), GFP_KERNEL);
 	if(!adxl345){
 		printk(KERN_DEBUG "ADXL345: Cannot create adxl345 structure\n");
 		return -ENOMEM;
 	}
-	
-	if(alloc_chrdev_region(&adxl345->adxl345_dev_number, 0, 1, "adxl345")){
+	mutex_init(&adxl345->lock);
+	mutex_init(&adxl345->bus_lock);
+	obc_probe_init(&adxl345->probe);
+	init_waitqueue_head(&adxl345->sampler_wait);
+	obc_err_init(&adxl345->err);
+	adxl345->period_us = ADXL345_PERIOD_US;
+	/* Attitude input: ahead of the other sensors' streams on a shared bus */
+	adxl345->bus.capture_class = OBC_BUS_CONTROL;
+	adxl345->config.name = adxl345_desc.name;
+	adxl345->config.dev = OBC_DEV_ADXL345;
+	adxl345->config.version = OBC_CONFIG_ADXL345_VERSION;
+	adxl345->config.size = sizeof(struct obc_config_adxl345);
+	adxl345->config.save = adxl345_config_save;
+	adxl345->config.load = adxl345_config_load;
+	adxl345->config.apply = adxl345_config_apply;
+	/* Power-on BW_RATE 100 Hz, configured for +-4 g at 10 bits as before */
+	adxl345->rate = ADXL345_FIFO_RATE;
+	adxl345->odr_ns = ADXL345_PERIOD_US * NSEC_PER_USEC;
+	adxl345->data_format = obc_field_prep(&adxl345_fields[ADXL345_RANGE], 1);
+	adxl345->fifo_cmd = ADXL_SPI_READ | ADXL_SPI_MB | DATA_START;
+	err = obc_ring_init(&adxl345->ring, OBC_RING_ORDER, OBC_DEV_ADXL345);
+	if(err){
+		printk(KERN_DEBUG "ADXL345: Cannot allocate sample ring\n");
+		goto free;
+	}
+	err = alloc_chrdev_region(&adxl345->adxl345_dev_number, 0, 1, "adxl345");
+	if(err){
 		printk(KERN_DEBUG "ADXL345: Cannot register char device\n");
-		return -1;
+		goto ring;
 	}
-	
 	adxl345->adxl345_class = class_create(THIS_MODULE, "adxl345-spi");
+	if(IS_ERR(adxl345->adxl345_class)){
+		err = PTR_ERR(adxl345->adxl345_class);
+		goto region;
+	}
+	/* Openable from here on, everything it uses is set up */
 	cdev_init(&adxl345->c_dev, &adxl345_fops);
-	error = cdev_add(&adxl345->c_dev, adxl345->adxl345_dev_number, 1);
-	if(error<0){
+	err = cdev_add(&adxl345->c_dev, adxl345->adxl345_dev_number, 1);
+	if(err){
 		printk(KERN_DEBUG "ADXL345: Cannot add device\n");
-		unregister_chrdev_region(adxl345->adxl345_dev_number, 1);
-		return -1;
+		goto class;
+	}
+	device_create(adxl345->adxl345_class, NULL, adxl345->adxl345_dev_number, NULL, "adxl345");
+	err = spi_register_driver(&adxl345_driver);
+	if(err){
+		printk(KERN_DEBUG "ADXL345: Registering on SPI core failed\n");
+		goto cdev;
 	}
-	mutex_init(&adxl345->lock);
-	spi_register_driver(&adxl345_driver);
-	device_create(adxl345->adxl345_class, NULL, adxl345->adxl345_dev_number,NULL, "adxl345");
 	printk(KERN_DEBUG "ADXL345: Major number: %d Minor number: %d\n", MAJOR(adxl345->adxl345_dev_number), MINOR(adxl345->adxl345_dev_number));
 	return 0;
+cdev:
+	device_destroy(adxl345->adxl345_class, adxl345->adxl345_dev_number);
+	cdev_del(&adxl345->c_dev);
+class:
+	class_destroy(adxl345->adxl345_class);
+region:
+	unregister_chrdev_region(adxl345->adxl345_dev_number, 1);
+ring:
+	obc_ring_free(&adxl345->ring);
+free:
+	kfree(adxl345);
+	return err;
 }
 
 static void __exit adxl345_exit(void)
 {
 	spi_unregister_driver(&adxl345_driver);
-
 	device_destroy(adxl345->adxl345_class, adxl345->adxl345_dev_number);
-	class_destroy(adxl345->adxl345_class);
-
 	cdev_del(&adxl345->c_dev);
+	class_destroy(adxl345->adxl345_class);
 	unregister_chrdev_region(adxl345->adxl345_dev_number, 1);
-
+	obc_ring_free(&adxl345->ring);
+	kfree(adxl345);
 }
 
 module_init(adxl345_init);
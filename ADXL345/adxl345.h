@@ -1,14 +1,57 @@
 
 
+#define DEVID 0x00
+#define OFFSET_X 0x1E
 #define OFFSET_Y 0x1F
 #define OFFSET_Z 0x20
 #define THRESH_ACT 0x24
 #define THRESH_INACT 0x25
+#define ACT_INACT_CTL 0x27
+	/* Activity ac-coupled, on all three axes */
+	#define ACT_AC_XYZ 0xF0
+#define INT_ENABLE 0x2E
+	#define INT_ACTIVITY 0x10
+#define INT_SOURCE 0x30
+	/* Set while new data has replaced unread FIFO entries, cleared by the drain */
+	#define INT_OVERRUN 0x01
 #define DATA_START 0x32 // 6 registers, 2 per axis
 #define ID_ADXL345 0xE5
 #define FIFO_CTL 0x38
+	#define FIFO_MODE_OFFSET 6
+	#define FIFO_MODE_MASK 0x3
+		#define FIFO_MODE_BYPASS 0x0
+		#define FIFO_MODE_STREAM 0x2
+#define FIFO_STATUS 0x39
+	#define FIFO_ENTRIES_MASK 0x3F
 #define DATA_FORMAT 0x31
+	#define RANGE_MASK 0x3
+	#define FULL_RES_OFFSET 3
+	/* Range and FULL_RES bits, carried in OBC_SAMPLE_RANGE() of each sample */
+	#define RANGE_CODE_MASK 0xB
 #define POWER_CTL 0x2D
+	#define MEASURE_OFFSET 3
+#define BW_RATE 0x2C
+	#define RATE_MASK 0xF
+
+/* 1.1 ms turn-on plus one period at the default 100 Hz output rate */
+#define ADXL345_TURN_ON_US 11100
+/* Sampler period matching the default 100 Hz output rate */
+#define ADXL345_PERIOD_US 10000
+
+/* SPI command byte: read, and address increment for bursts */
+#define ADXL_SPI_READ 0x80
+#define ADXL_SPI_MB 0x40
+
+/* 32 FIFO entries plus the data registers */
+#define ADXL345_FIFO_ENTRIES 33
+#define ADXL345_FIFO_DEPTH 32
+/* Above this BW_RATE code (100 Hz) samples are drained from the FIFO in stream mode */
+#define ADXL345_FIFO_RATE 0x0A
+/* Samples per capture in stream mode, half the FIFO */
+#define ADXL345_FIFO_BATCH 16
+
+/* Micro-g per count for a range code: 3.9 mg with FULL_RES, doubling per range step without */
+#define ADXL345_SCALE_UG(range) (((range) & (1 << 3)) ? 3900 : 3900 << ((range) & 0x3))
 
 #define ADXL_X_AXIS 0
 #define ADXL_Y_AXIS 1
@@ -17,5 +60,36 @@
 
 #define SENSOR_ID "adxl345"
 
-#define ADXL345_MAGIC '0xF2'
+#include "obc_sample.h"
+
+#define ADXL345_MAGIC 0xF2
 #define ADXL345_READ _IOR(ADXL345_MAGIC, 1, unsigned short)
+#define ADXL345_GET_RING_STAT _IOR(ADXL345_MAGIC, 2, struct obc_ring_stat)
+#define ADXL345_READ_SAMPLE _IOR(ADXL345_MAGIC, 3, struct obc_sample)
+/*
+ * Asks for at least this output rate in mHz while the file is open, 0
+ * withdraws; returns the granted rate. On the common trigger the grant is
+ * capped at the fastest rate the tick drains without FIFO overruns.
+ */
+#define ADXL345_SET_RATE _IOWR(ADXL345_MAGIC, 4, __u32)
+/* OBC_RING_* overrun policy of this file */
+#define ADXL345_SET_RING_POLICY _IOW(ADXL345_MAGIC, 5, __u32)
+/* Fires the snapshot trigger (obc_snap.h) */
+#define ADXL345_SNAPSHOT_TRIGGER _IO(ADXL345_MAGIC, 6)
+
+#ifdef __KERNEL__
+
+#include "obc_desc.h"
+
+/* DATAX0 to DATAZ1, little endian two's complement; also used by the KUnit suite */
+static const struct obc_layout adxl345_layout = {
+	.reg = DATA_START,
+	.len = 6,
+	.channels = AXIS,
+	.width = 16,
+	.endian = OBC_LE,
+	.is_signed = 1,
+	.offset = { 0, 2, 4 },
+};
+
+#endif
@@ -0,0 +1,142 @@
+/*
+ * HMC5883L driver core shared by the sysfs and char device frontends. The
+ * core owns the device, the sampler thread and the sample ring; the
+ * frontends only read from the ring and call the setters below, so both
+ * can be used at once without extra bus traffic.
+ */
+#ifndef HMC5883L_H
+#define HMC5883L_H
+
+#include <linux/i2c.h>
+#include <linux/mutex.h>
+#include <linux/cdev.h>
+#include <linux/workqueue.h>
+
+#include "obc_probe.h"
+#include "obc_retry.h"
+#include "obc_magcal.h"
+#include "obc_ring.h"
+#include "obc_trigger.h"
+#include "obc_governor.h"
+#include "obc_stats.h"
+#include "obc_bus.h"
+#include "obc_config.h"
+#include "obc_sched.h"
+#include "obc_snap.h"
+#include "obc_journal.h"
+#include "obc_desc.h"
+
+#define SENSOR_NAME "hmc5883l-i2c"
+
+#define HMC5883L_CONFIG_REG_A    0x00
+    #define TOBE_CLEAR      1<<7
+    #define SAMPLE_AVER     0x3
+        #define SAMPLE_AVER_OFFSET   5
+    #define DATA_OUT_RATE   0x7
+        #define DATA_OUT_RATE_OFFSET 2
+    #define MESURE_SETTING   3<<0
+
+enum {
+    NORMAL_MESURA = 0,
+    POSITIVE_MESURA,
+    NEGATIVE_MESURA,
+    MAX_MESURA
+};
+
+#define HMC5883L_CONFIG_REG_B 0x01
+    #define GAIN_SETTING 0x7
+        #define GAIN_SETTING_OFFSET 5
+
+#define HMC5883L_GAINS 8
+
+#define HMC5883L_MODE_REG    0x02
+    #define MODE_SETTING 3<<0
+
+enum {
+    CONTINOUS_MODE = 0,
+    SINGLE_MODE,
+    IDLE_MODE,
+    MAX_MODE
+};
+
+#define HMC5883L_DATA_OUT_REG    0x03
+
+/* Kept in register order X, Z, Y; consumers map the axes */
+static const struct obc_layout hmc5883l_layout = {
+    .reg = HMC5883L_DATA_OUT_REG,
+    .len = 6,
+    .channels = 3,
+    .width = 16,
+    .endian = OBC_BE,
+    .is_signed = 1,
+    .offset = { 0, 2, 4 },
+};
+
+#define HMC5883L_STATUS_REG    0x09
+    #define STATUS_RDY 1<<0
+
+/* The sampler keeps running this long after the last cache-only read */
+#define HMC5883L_DEMAND_MS 1000
+
+struct sensor_hmc5883l{
+	struct mutex lock;
+	struct i2c_client *client;
+	u8 sample;
+	u8 out_rate;
+	u8 mesura;
+	u8 mode;
+	u8 gain;
+	s32 axis[3];
+	struct cdev c_dev;
+	struct work_struct config_work;
+	struct obc_probe probe;
+	struct obc_err_state err;
+	struct obc_ring ring;
+	struct obc_stats stats;		/* over calibrated samples */
+	struct task_struct *sampler;	/* free running, when not on the common trigger */
+	wait_queue_head_t sampler_wait;
+	struct obc_trigger_client trig;
+	struct obc_gov_client gov;
+	struct obc_bus_client bus;
+	struct obc_config_client config;
+	struct obc_sched sched;		/* of the trigger worker or the sampler */
+	struct obc_snap snap;		/* raw captures, as in the ring */
+	struct obc_journal journal;	/* same */
+	unsigned long demand_until;	/* jiffies, sampler runs without readers until then */
+	u32 seq;
+	struct mutex bus_lock;		/* captures vs. configuration writes and self-test */
+	spinlock_t cal_lock;
+	struct obc_magcal cal[HMC5883L_GAINS];	/* as uploaded */
+	struct obc_magcal eff[HMC5883L_GAINS];	/* uploaded, self-test scale folded in */
+	u8 cal_valid;			/* bit per gain */
+	bool scale_valid;
+	s32 scale[3];
+};
+
+extern struct sensor_hmc5883l *hmc5883l;
+extern const unsigned int data_out_period_us[];
+
+/* Core */
+int hmc5883l_set_mode(struct i2c_client *client, u8 mode);
+u8 hmc5883l_get_mode(struct i2c_client *client);
+s32 hmc5883l_set_sample_average(struct i2c_client *client, u8 sample);
+u8 hmc5883l_get_sample_average(struct i2c_client *client);
+int hmc5883l_set_gain(struct i2c_client *client, u8 gain);
+u8 hmc5883l_get_gain(struct i2c_client *client);
+s32 hmc5883l_set_mesura(struct i2c_client *client, u8 mesura);
+u8 hmc5883l_get_mesura(struct i2c_client *client);
+s32 hmc5883l_set_data_out_rate(struct i2c_client *client, u8 rate);
+u8 hmc5883l_get_data_out_rate(struct i2c_client *client);
+void hmc5883l_calibrate(void *ctx, struct obc_sample *s, unsigned int n);
+int hmc5883l_set_cal(const struct obc_magcal_set *set);
+int hmc5883l_get_cal(struct obc_magcal_set *set);
+int hmc5883l_self_calibrate(struct i2c_client *client, struct obc_magcal_selftest *st);
+int hmc5883l_latest(struct obc_sample *s);
+
+/* Frontends */
+int hmc5883l_cdev_init(void);
+void hmc5883l_cdev_exit(void);
+void hmc5883l_create_attr(struct device *dev);
+void hmc5883l_remove_attr(struct device *dev);
+
+#endif
@@ -0,0 +1,330 @@
+/* HMC5883L char device frontend: /dev/hmc5883l-i2c */
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/cdev.h>
+#include <linux/device.h>
+#include <linux/fs.h>
+#include <asm/uaccess.h>
+
+#include "hmc5883l.h"
+#include "hmc5883l_ioctl.h"
+
+static dev_t hmc5883l_dev_number;
+static struct class *hmc5883l_class;
+
+static long hmc5883l_ioctl(struct file *fi,
+			unsigned int cmd, unsigned long arg)
+			{
+		printk(KERN_DEBUG "IOCTL called : %u\n", arg);
+		mutex_lock(&hmc5883l->lock);
+		struct i2c_client *client = hmc5883l->client;
+		mutex_unlock(&hmc5883l->lock);
+		int err = obc_probe_wait(&hmc5883l->probe);
+		if(err)
+			return err;
+
+			switch(cmd){
+				case HMC5883L_READ:
+					{
+					/* Latest shared capture from the core, no bus traffic of its own */
+					struct obc_sample sample;
+					u16 axis[3];
+					int i;
+					err = hmc5883l_latest(&sample);
+					if(err)
+						return err;
+					if(sample.flags & OBC_SAMPLE_STALE)
+						return -ENODATA;
+					for(i = 0; i < 3; i++)
+						axis[i] = sample.v[i];
+					if(copy_to_user((unsigned short *)arg, axis, sizeof(axis)))
+						return -EFAULT;
+					return 0;}
+
+				case HMC5883L_READ_SAMPLE:
+					{
+					/* Latest capture with timestamp and flags, stale ones included */
+					struct obc_sample sample;
+					err = hmc5883l_latest(&sample);
+					if(err)
+						return err;
+					if(copy_to_user((void __user *)arg, &sample, sizeof(sample)))
+						return -EFAULT;
+					return 0;}
+
+				case HMC5883L_SET_CAL:
+					{
+					struct obc_magcal_set set;
+					if(copy_from_user(&set, (void __user *)arg, sizeof(set)))
+						return -EFAULT;
+					return hmc5883l_set_cal(&set);}
+
+				case HMC5883L_GET_CAL:
+					{
+					struct obc_magcal_set set;
+					if(copy_from_user(&set, (void __user *)arg, sizeof(set)))
+						return -EFAULT;
+					err = hmc5883l_get_cal(&set);
+					if(err)
+						return err;
+					if(copy_to_user((void __user *)arg, &set, sizeof(set)))
+						return -EFAULT;
+					return 0;}
+
+				case HMC5883L_SELF_CALIBRATE:
+					{
+					struct obc_magcal_selftest st;
+					memset(&st, 0, sizeof(st));
+					err = hmc5883l_self_calibrate(client, &st);
+					/* Readings are returned even when they fail the limits */
+					if((!err || err == -ERANGE) &&
+							copy_to_user((void __user *)arg, &st, sizeof(st)))
+						return -EFAULT;
+					return err;}
+
+				case HMC5883L_SET_RATE:
+					{
+					struct obc_ring_reader *reader = fi->private_data;
+					u32 mhz;
+					if(copy_from_user(&mhz, (void __user *)arg, sizeof(mhz)))
+						return -EFAULT;
+					mhz = obc_gov_vote(&hmc5883l->gov, &reader->rate_vote, mhz);
+					if(copy_to_user((void __user *)arg, &mhz, sizeof(mhz)))
+						return -EFAULT;
+					return 0;}
+
+				case HMC5883L_SET_RING_POLICY:
+					{
+					u32 policy;
+					if(copy_from_user(&policy, (void __user *)arg, sizeof(policy)))
+						return -EFAULT;
+					return obc_ring_set_policy(fi->private_data, policy);}
+
+				case HMC5883L_SNAPSHOT_TRIGGER:
+					obc_snap_trigger(&hmc5883l->snap, OBC_SNAP_USER);
+					return 0;
+
+				case HMC5883L_GET_RING_STAT:
+					{
+					struct obc_ring_stat st;
+					obc_ring_stat(fi->private_data, &st);
+					if(copy_to_user((void __user *)arg, &st, sizeof(st)))
+						return -EFAULT;
+					return 0;}
+
+				case HMC5883L_GET_MODE:
+					{	
+						u8 mode = hmc5883l_get_mode(client);
+						if(copy_to_user((unsigned short *)arg, &mode, 1)){
+							       return -EFAULT;
+							       }
+						return 0;
+						}		
+
+
+
+				case HMC5883L_GET_SAMPLE:
+				{
+					u8 sample = hmc5883l_get_sample_average(client);
+					if(copy_to_user((unsigned short *)arg, &sample, 1)){
+							return -EFAULT;
+							}
+						return 0;
+						}
+
+				case HMC5883L_GET_GAIN:
+				{
+					u8 gain = hmc5883l_get_gain(client);
+					if(copy_to_user((unsigned short *)arg, &gain, 1)){
+							return -EFAULT;
+							}
+						return 0;
+						}
+
+				case HMC5883L_GET_MESURA:
+				{
+					u8 mesura = hmc5883l_get_mesura(client);
+					if(copy_to_user((unsigned short *)arg, &mesura, 1)){
+						return -EFAULT;
+						}
+					return 0;
+					}
+
+				case HMC5883L_GET_OUT_RATE:
+				{
+					u8 rate = hmc5883l_get_data_out_rate(client);
+					if(copy_to_user((unsigned short *)arg, &rate, 1)){
+							return -EFAULT;
+							}
+					return 0;
+					}
+			
+				case HMC5883L_SET_MODE:
+				{
+					u8 mode;
+					if(copy_from_user(&mode, (unsigned short *)arg, 1)){
+							return -EFAULT;
+						}
+					err = hmc5883l_set_mode(client, mode);
+					if(err < 0){
+							return err;
+							}
+							return 0;
+							}
+
+				
+				case HMC5883L_SET_SAMPLE:
+				{
+					u8 sample;
+					if(copy_from_user(&sample, (unsigned short *)arg, 1)){
+							return -EFAULT;
+							}
+					err = hmc5883l_set_sample_average(client, sample);
+					if(err < 0){
+						return err;
+						}
+						return 0;
+						}
+
+				case HMC5883L_SET_GAIN:
+   				{
+					u8 gain;
+					if(copy_from_user(&gain, (unsigned short *)arg, 1)){
+							return -EFAULT;
+							}
+					err = hmc5883l_set_gain(client, gain);
+					if(err < 0){
+						return err;
+						}
+						return 0;
+						}
+
+	
+				case HMC5883L_SET_MESURA:
+				{
+					u8 mesura;
+					if(copy_from_user(&mesura, (unsigned short *)arg, 1)){
+							return -EFAULT;
+							}
+					err = hmc5883l_set_mesura(client, mesura);
+					if(err < 0){
+						return err;
+						}
+						return 0;
+						}
+
+
+				case HMC5883L_SET_OUT_RATE:
+				{
+					u8 rate;
+					if(copy_from_user(&rate, (unsigned short *)arg, 1)){
+							return -EFAULT;
+							}
+					err = hmc5883l_set_data_out_rate(client, rate);
+					if(err < 0){
+						return err;
+						}
+						return 0;
+						}
+
+
+				default:
+				return -ENOTTY;
+			}
+			}
+
+static int hmc5883l_open(struct inode *inode, struct file *file)
+{
+	struct obc_ring_reader *reader;
+	printk(KERN_DEBUG "HMC5883L: hmc5883l_open called\n");
+	reader = obc_ring_reader_alloc(&hmc5883l->ring);
+	if(!reader)
+		return -ENOMEM;
+	file->private_data = reader;
+	wake_up(&hmc5883l->sampler_wait);
+	return 0;
+}
+
+static int hmc5883l_release(struct inode *inode, struct file *file)
+{
+	struct obc_ring_reader *reader = file->private_data;
+	if(reader->rate_vote >= 0)
+		obc_gov_vote(&hmc5883l->gov, &reader->rate_vote, 0);
+	obc_ring_reader_free(reader);
+	return 0;
+}
+
+/* Returns the samples this file has not seen yet as delta/varint chunks, also to splice() and sendfile() */
+static ssize_t hmc5883l_read_iter(struct kiocb *iocb, struct iov_iter *to)
+{
+	int err = obc_probe_wait(&hmc5883l->probe);
+	if(err)
+		return err;
+	return obc_ring_read_delta(iocb->ki_filp->private_data, iocb->ki_filp, to);
+}
+
+static loff_t hmc5883l_llseek(struct file *file, loff_t offset, int whence)
+{
+	return obc_ring_llseek(file->private_data, offset, whence);
+}
+
+static int hmc5883l_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	return obc_ring_mmap(&hmc5883l->ring, vma);
+}
+
+static unsigned int hmc5883l_poll(struct file *file, poll_table *wait)
+{
+	return obc_ring_poll(file->private_data, file, wait);
+}
+
+static const struct file_operations hmc5883l_fops = {
+	.owner = THIS_MODULE,
+	.unlocked_ioctl = hmc5883l_ioctl,
+	.open = hmc5883l_open,
+	.read_iter = hmc5883l_read_iter,
+	.splice_read = generic_file_splice_read,
+	.poll = hmc5883l_poll,
+	.llseek = hmc5883l_llseek,
+	.mmap = hmc5883l_mmap,
+	.write = NULL,
+	.release = hmc5883l_release
+};
+
+int hmc5883l_cdev_init(void)
+{
+	int err;
+	err = alloc_chrdev_region(&hmc5883l_dev_number, 0, 1, "hmc5883l");
+	if(err){
+		printk(KERN_DEBUG "HMC5883L: Can't register device\n");
+		return err;
+	}
+	hmc5883l_class = class_create(THIS_MODULE, SENSOR_NAME);
+	if(IS_ERR(hmc5883l_class)){
+		err = PTR_ERR(hmc5883l_class);
+		goto region;
+	}
+	cdev_init(&(hmc5883l->c_dev), &hmc5883l_fops);
+	err = cdev_add(&(hmc5883l->c_dev),hmc5883l_dev_number, 1);
+	if(err){
+		printk(KERN_DEBUG "HMC5883L: Can't add device");
+		goto class;
+	}
+	device_create(hmc5883l_class, NULL, hmc5883l_dev_number, NULL, SENSOR_NAME);
+	printk("HMC5883L: Major number: %d Minor number: %d\n", MAJOR(hmc5883l_dev_number),MINOR(hmc5883l_dev_number));
+	return 0;
+class:
+	class_destroy(hmc5883l_class);
+region:
+	unregister_chrdev_region(hmc5883l_dev_number, 1);
+	return err;
+}
+
+void hmc5883l_cdev_exit(void)
+{
+	device_destroy(hmc5883l_class, hmc5883l_dev_number);
+	cdev_del(&(hmc5883l->c_dev));
+	class_destroy(hmc5883l_class);
+	unregister_chrdev_region(hmc5883l_dev_number, 1);
+}
@@ -0,0 +1,911 @@
+/* HMC5883L Driver core: device, sampler and sample ring */
+
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/i2c.h>
+#include <linux/mutex.h>
+#include <linux/delay.h>
+#include <linux/workqueue.h>
+#include <linux/kthread.h>
+#include <linux/hrtimer.h>
+#include <linux/math64.h>
+
+#include "hmc5883l.h"
+#include "obc_desc.h"
+#include "obc_trace.h"
+
+static bool trigger = true;
+module_param(trigger, bool, 0444);
+MODULE_PARM_DESC(trigger, "Sample on the common OBC trigger instead of a private timer");
+
+static unsigned int snapshot_kb;
+module_param(snapshot_kb, uint, 0444);
+MODULE_PARM_DESC(snapshot_kb, "Pre-trigger snapshot buffer in KiB, 0 for none");
+
+/* Output period in microseconds for each data_out_rate setting */
+const unsigned int data_out_period_us[] = {
+    1333334, 666667, 333334, 133334, 66667, 33334, 13334, 0
+};
+
+/* Output rate in mHz for each data_out_rate setting, 7 is reserved */
+static const unsigned int data_out_rate_mhz[] = {
+    750, 1500, 3000, 7500, 15000, 30000, 75000
+};
+
+/* Counts per gauss for each gain setting */
+static const unsigned int gain_lsb_per_gauss[] = {
+    1370, 1090, 820, 660, 440, 390, 330, 230
+};
+
+enum {
+    HMC5883L_AVER,
+    HMC5883L_RATE,
+    HMC5883L_MESURA,
+    HMC5883L_GAIN,
+    HMC5883L_MODE,
+};
+
+static const struct obc_field hmc5883l_fields[] = {
+    [HMC5883L_AVER] = OBC_FIELD("sample_average", HMC5883L_CONFIG_REG_A, SAMPLE_AVER_OFFSET, SAMPLE_AVER),
+    [HMC5883L_RATE] = OBC_FIELD_LUT("data_out_rate", HMC5883L_CONFIG_REG_A, DATA_OUT_RATE_OFFSET, DATA_OUT_RATE, data_out_rate_mhz),
+    [HMC5883L_MESURA] = OBC_FIELD("mesura", HMC5883L_CONFIG_REG_A, 0, MESURE_SETTING),
+    [HMC5883L_GAIN] = OBC_FIELD_LUT("gain", HMC5883L_CONFIG_REG_B, GAIN_SETTING_OFFSET, GAIN_SETTING, gain_lsb_per_gauss),
+    [HMC5883L_MODE] = OBC_FIELD("mode", HMC5883L_MODE_REG, 0, MODE_SETTING),
+};
+
+static const struct obc_sensor_desc hmc5883l_desc = {
+    .name = "hmc5883l",
+    .dev = OBC_DEV_HMC5883L,
+    .fields = hmc5883l_fields,
+    .nfields = ARRAY_SIZE(hmc5883l_fields),
+    .layout = &hmc5883l_layout,
+};
+
+/*
+ * Self-test: the bias strap adds 1.16 Ga on X and Y and 1.08 Ga on Z,
+ * measured at gain 5. The data registers are ordered X, Z, Y.
+ */
+#define SELFTEST_GAIN 5
+#define SELFTEST_MIN 243
+#define SELFTEST_MAX 575
+static const unsigned int selftest_field_mga[] = {
+    1160, 1080, 1160
+};
+
+struct sensor_hmc5883l *hmc5883l;
+
+struct hmc5883l_xfer {
+    struct i2c_client *client;
+    u8 reg;
+    u8 len;
+    u8 *data;
+};
+
+static int hmc5883l_xfer_write(void *ctx)
+{
+    struct hmc5883l_xfer *x = ctx;
+    int err;
+    if (x->len == 1)
+        err = i2c_smbus_write_byte_data(x->client, x->reg, x->data[0]);
+    else
+        err = i2c_smbus_write_i2c_block_data(x->client, x->reg, x->len, x->data);
+    obc_trace(hmc5883l_desc.dev, x->reg, OBC_TRACE_WRITE, x->data, x->len, err);
+    return err;
+}
+
+/* A short block read is a failure too, never decode partial data */
+static int hmc5883l_xfer_read(void *ctx)
+{
+    struct hmc5883l_xfer *x = ctx;
+    int n = i2c_smbus_read_i2c_block_data(x->client, x->reg, x->len, x->data);
+    if (n >= 0)
+        n = n == x->len ? 0 : -EIO;
+    obc_trace(hmc5883l_desc.dev, x->reg, 0, x->data, x->len, n);
+    return n;
+}
+
+/* Clocks a stuck slave free when the adapter supports bus recovery */
+static int hmc5883l_recover(void *ctx)
+{
+    struct hmc5883l_xfer *x = ctx;
+    return i2c_recover_bus(x->client->adapter);
+}
+
+/* Configuration and self-test transfers wait behind the sample reads on the bus */
+static const struct obc_bus_req hmc5883l_config_req = {
+    .class = OBC_BUS_HOUSEKEEPING,
+};
+
+static s32 hmc5883l_write_byte(struct i2c_client *client,
+        u8 reg, u8 val)
+{
+    struct hmc5883l_xfer x = { client, reg, 1, &val };
+    return obc_retry_bus(&hmc5883l->err, &hmc5883l->bus, &hmc5883l_config_req,
+            hmc5883l_xfer_write, hmc5883l_recover, &x);
+}
+
+static s32 hmc5883l_read_byte(struct i2c_client *client,
+        u8 reg)
+{
+    s32 val = i2c_smbus_read_byte_data(client, reg);
+    u8 byte = val;
+    obc_trace(hmc5883l_desc.dev, reg, 0, &byte, 1, val < 0 ? val : 0);
+    return val;
+}
+
+/* A capture is due on the bus within one output period and can be merged */
+static int hmc5883l_read_raw(s32 *v, bool capture)
+{
+	const struct obc_layout *l = hmc5883l_desc.layout;
+	u8 raw[6];
+	struct hmc5883l_xfer x = { hmc5883l->client, l->reg, l->len, raw };
+	struct obc_bus_req req = hmc5883l_config_req;
+	int err;
+	if(capture)
+		obc_bus_capture_req(&hmc5883l->bus, &req, data_out_period_us[hmc5883l->out_rate],
+				l, raw, l->len);
+	err = obc_retry_bus(&hmc5883l->err, &hmc5883l->bus, &req, hmc5883l_xfer_read, hmc5883l_recover, &x);
+	if(!err)
+		obc_layout_decode(l, raw, v);
+	return err;
+}
+
+static s32 hmc5883l_read_block(void)
+{
+	s32 v[3];
+	int err;
+	err = hmc5883l_read_raw(v, true);
+	if(err){
+		printk_ratelimited(KERN_DEBUG "HMC5883L: Cannot read.\n");
+		return err;
+	}
+	/* axis keeps the last good capture, only updated on success */
+	mutex_lock(&hmc5883l->lock);
+	memcpy(hmc5883l->axis, v, sizeof(v));
+	mutex_unlock(&hmc5883l->lock);
+	return 0;
+}
+
+/* CONFIG_REG_A, CONFIG_REG_B and MODE_REG from the field codes */
+static void hmc5883l_build_regs(u8 *regs, u8 sample, u8 out_rate, u8 mesura, u8 gain, u8 mode)
+{
+    const struct obc_field *f = hmc5883l_fields;
+    regs[0] = obc_field_prep(&f[HMC5883L_AVER], sample)
+        | obc_field_prep(&f[HMC5883L_RATE], out_rate)
+        | obc_field_prep(&f[HMC5883L_MESURA], mesura);
+    regs[1] = obc_field_prep(&f[HMC5883L_GAIN], gain);
+    regs[2] = obc_field_prep(&f[HMC5883L_MODE], mode);
+}
+
+static void hmc5883l_regs(u8 *regs)
+{
+    mutex_lock(&hmc5883l->lock);
+    hmc5883l_build_regs(regs, hmc5883l->sample, hmc5883l->out_rate,
+            hmc5883l->mesura, hmc5883l->gain, hmc5883l->mode);
+    mutex_unlock(&hmc5883l->lock);
+}
+
+static s32 hmc5883l_write_regA(struct i2c_client *client)
+{
+    u8 regs[3];
+    hmc5883l_regs(regs);
+    return hmc5883l_write_byte(client, HMC5883L_CONFIG_REG_A, regs[0]);
+}
+
+/* Writes CONFIG_REG_A, CONFIG_REG_B and MODE_REG in one transfer */
+static s32 hmc5883l_write_config(struct i2c_client *client)
+{
+    struct hmc5883l_xfer x;
+    u8 regs[3];
+    hmc5883l_regs(regs);
+    x.client = client;
+    x.reg = HMC5883L_CONFIG_REG_A;
+    x.len = sizeof(regs);
+    x.data = regs;
+    return obc_retry_bus(&hmc5883l->err, &hmc5883l->bus, &hmc5883l_config_req,
+            hmc5883l_xfer_write, hmc5883l_recover, &x);
+}
+
+/* Polls the RDY bit for up to two output periods */
+static int hmc5883l_wait_data_ready(struct i2c_client *client)
+{
+    s32 status;
+    unsigned int waited = 0, timeout;
+    timeout = 2 * data_out_period_us[hmc5883l->out_rate];
+    for (;;) {
+        status = hmc5883l_read_byte(client, HMC5883L_STATUS_REG);
+        if (status < 0)
+            return status;
+        if (status & STATUS_RDY)
+            return 0;
+        if (waited >= timeout)
+            return -ETIMEDOUT;
+        usleep_range(1000, 1500);
+        waited += 1000;
+    }
+}
+
+int hmc5883l_set_mode(struct i2c_client *client,
+        u8 mode)
+{
+    u8 regs[3];
+    s32 result;
+    if (!obc_field_valid(&hmc5883l_fields[HMC5883L_MODE], mode) || mode >= MAX_MODE) {
+       printk(KERN_DEBUG "HMC5883L: Invalid mode\n");
+        return -EINVAL;
+    }
+    mutex_lock(&hmc5883l->bus_lock);
+    mutex_lock(&hmc5883l->lock);
+    hmc5883l->mode = mode;
+    mutex_unlock(&hmc5883l->lock);
+
+    hmc5883l_regs(regs);
+    result = hmc5883l_write_byte(client, HMC5883L_MODE_REG, regs[2]);
+    mutex_unlock(&hmc5883l->bus_lock);
+    return (result > 0? -EBUSY : result);
+}
+
+u8 hmc5883l_get_mode(struct i2c_client *client)
+{
+    return hmc5883l->mode;
+}
+
+s32 hmc5883l_set_sample_average(struct i2c_client *client, u8 sample)
+{
+    if (!obc_field_valid(&hmc5883l_fields[HMC5883L_AVER], sample))
+        return -EINVAL;
+    s32 err;
+    mutex_lock(&hmc5883l->bus_lock);
+    mutex_lock(&hmc5883l->lock);
+    hmc5883l->sample = sample;
+    mutex_unlock(&hmc5883l->lock);
+    err = hmc5883l_write_regA(client);
+    mutex_unlock(&hmc5883l->bus_lock);
+    return err;
+}
+
+u8 hmc5883l_get_sample_average(struct i2c_client *client)
+{
+    return hmc5883l->sample;
+}
+
+int hmc5883l_set_gain(struct i2c_client *client,
+        u8 gain)
+{
+    u8 regs[3];
+    s32 result;
+    if (!obc_field_valid(&hmc5883l_fields[HMC5883L_GAIN], gain)) {
+        printk(KERN_DEBUG "HMC5883L: Invalid gain\n");
+        return -EINVAL;
+    }
+    /* Captures tag their samples with the gain under bus_lock too */
+    mutex_lock(&hmc5883l->bus_lock);
+    mutex_lock(&hmc5883l->lock);
+    hmc5883l->gain = gain;
+    mutex_unlock(&hmc5883l->lock);
+
+    hmc5883l_regs(regs);
+    result = hmc5883l_write_byte(client, HMC5883L_CONFIG_REG_B, regs[1]);
+    mutex_unlock(&hmc5883l->bus_lock);
+    return (result > 0? -EBUSY : result);
+}
+
+u8 hmc5883l_get_gain(struct i2c_client *client)
+{
+    return hmc5883l->gain;
+}
+
+s32 hmc5883l_set_mesura(struct i2c_client *client, u8 mesura)
+{
+    if (!obc_field_valid(&hmc5883l_fields[HMC5883L_MESURA], mesura) || mesura >= MAX_MESURA)
+        return -EINVAL;
+
+    s32 err;
+    mutex_lock(&hmc5883l->bus_lock);
+    mutex_lock(&hmc5883l->lock);
+    hmc5883l->mesura = mesura;
+    mutex_unlock(&hmc5883l->lock);
+    err = hmc5883l_write_regA(client);
+    mutex_unlock(&hmc5883l->bus_lock);
+    return err;
+}
+
+u8 hmc5883l_get_mesura(struct i2c_client *client)
+{
+    return hmc5883l->mesura;
+}
+
+s32 hmc5883l_set_data_out_rate(struct i2c_client *client,
+        u8 rate)
+{
+    if (!obc_field_valid(&hmc5883l_fields[HMC5883L_RATE], rate)) {
+        printk(KERN_DEBUG "HMC5883L: Invalid data out rate \n");
+        return -EINVAL;
+    }
+    s32 err;
+    mutex_lock(&hmc5883l->bus_lock);
+    mutex_lock(&hmc5883l->lock);
+    hmc5883l->out_rate = rate;
+    WRITE_ONCE(hmc5883l->trig.period_us, data_out_period_us[rate]);
+    mutex_unlock(&hmc5883l->lock);
+    err = hmc5883l_write_regA(client);
+    mutex_unlock(&hmc5883l->bus_lock);
+    /* Rate codes and governor indices are the same */
+    obc_gov_reset(&hmc5883l->gov, rate);
+    return err;
+}
+
+u8 hmc5883l_get_data_out_rate(struct i2c_client *client)
+{
+    return hmc5883l->out_rate;
+}
+
+/*
+ * Rebuilds the tables applied on the sample path and gives the bus trace
+ * the ones in use, so a replay corrects like the driver. cal_lock held.
+ */
+static void hmc5883l_update_cal(void)
+{
+    static const s32 unity[3] = { OBC_MAGCAL_ONE, OBC_MAGCAL_ONE, OBC_MAGCAL_ONE };
+    struct obc_magcal identity;
+    bool valid;
+    int g;
+    BUILD_BUG_ON(HMC5883L_GAINS > OBC_TRACE_CALIB_SLOTS ||
+            sizeof(struct obc_magcal) > OBC_TRACE_CALIB_MAX);
+    obc_magcal_identity(&identity);
+    for (g = 0; g < HMC5883L_GAINS; g++) {
+        obc_magcal_fold_scale(&hmc5883l->eff[g],
+                (hmc5883l->cal_valid & (1 << g)) ? &hmc5883l->cal[g] : &identity,
+                hmc5883l->scale_valid ? hmc5883l->scale : unity);
+        valid = hmc5883l->scale_valid || (hmc5883l->cal_valid & (1 << g));
+        obc_trace_calib(hmc5883l_desc.dev, g, &hmc5883l->eff[g], valid ? sizeof(hmc5883l->eff[g]) : 0);
+    }
+}
+
+/*
+ * Ring filter: corrects a block in runs of samples captured at the same
+ * gain. Uncalibrated gains are passed through untouched.
+ */
+void hmc5883l_calibrate(void *ctx, struct obc_sample *s, unsigned int n)
+{
+    unsigned long flags;
+    unsigned int i, j, gain;
+    spin_lock_irqsave(&hmc5883l->cal_lock, flags);
+    for (i = 0; i < n; i = j) {
+        gain = OBC_SAMPLE_RANGE(s[i].flags);
+        for (j = i + 1; j < n && OBC_SAMPLE_RANGE(s[j].flags) == gain; j++)
+            ;
+        if (gain < HMC5883L_GAINS &&
+                (hmc5883l->scale_valid || (hmc5883l->cal_valid & (1 << gain))))
+            obc_magcal_apply(&hmc5883l->eff[gain], s + i, j - i);
+    }
+    spin_unlock_irqrestore(&hmc5883l->cal_lock, flags);
+}
+
+int hmc5883l_set_cal(const struct obc_magcal_set *set)
+{
+    unsigned long flags;
+    if (set->gain >= HMC5883L_GAINS)
+        return -EINVAL;
+    spin_lock_irqsave(&hmc5883l->cal_lock, flags);
+    hmc5883l->cal[set->gain] = set->cal;
+    if (set->valid)
+        hmc5883l->cal_valid |= 1 << set->gain;
+    else
+        hmc5883l->cal_valid &= ~(1 << set->gain);
+    hmc5883l_update_cal();
+    spin_unlock_irqrestore(&hmc5883l->cal_lock, flags);
+    return 0;
+}
+
+/* Returns the effective parameters for set->gain, self-test scale included */
+int hmc5883l_get_cal(struct obc_magcal_set *set)
+{
+    unsigned long flags;
+    if (set->gain >= HMC5883L_GAINS)
+        return -EINVAL;
+    spin_lock_irqsave(&hmc5883l->cal_lock, flags);
+    set->cal = hmc5883l->eff[set->gain];
+    set->valid = hmc5883l->scale_valid || (hmc5883l->cal_valid & (1 << set->gain));
+    spin_unlock_irqrestore(&hmc5883l->cal_lock, flags);
+    return 0;
+}
+
+/* One single-shot measurement with the given bias at the self-test gain */
+static int hmc5883l_self_test_read(struct i2c_client *client, u8 mesura, s32 *out)
+{
+    struct hmc5883l_xfer x;
+    u8 regs[3];
+    int err, k;
+    hmc5883l_build_regs(regs, 3, 4, mesura, SELFTEST_GAIN, SINGLE_MODE);
+    x.client = client;
+    x.reg = HMC5883L_CONFIG_REG_A;
+    x.len = sizeof(regs);
+    x.data = regs;
+    err = obc_retry_bus(&hmc5883l->err, &hmc5883l->bus, &hmc5883l_config_req,
+            hmc5883l_xfer_write, hmc5883l_recover, &x);
+    /* The first conversion after a gain change still uses the old gain */
+    for (k = 0; !err && k < 2; k++) {
+        if (k)
+            err = hmc5883l_write_byte(client, HMC5883L_MODE_REG, SINGLE_MODE);
+        if (!err) {
+            usleep_range(6000, 7000);
+            err = hmc5883l_wait_data_ready(client);
+        }
+        if (!err)
+            err = hmc5883l_read_raw(out, false);
+    }
+    return err;
+}
+
+/*
+ * Self-calibration with the internal bias strap: readings with the
+ * positive and negative bias field differ by twice the known field, which
+ * gives each axis' sensitivity independent of the ambient field. The
+ * resulting per-axis scale is folded into the tables of every gain. The
+ * sampler is held off while the device is reconfigured.
+ */
+int hmc5883l_self_calibrate(struct i2c_client *client, struct obc_magcal_selftest *st)
+{
+    unsigned long flags;
+    int err, restore, i;
+    bool in_limits = true;
+    mutex_lock(&hmc5883l->bus_lock);
+    err = hmc5883l_self_test_read(client, POSITIVE_MESURA, st->positive);
+    if (!err)
+        err = hmc5883l_self_test_read(client, NEGATIVE_MESURA, st->negative);
+    restore = hmc5883l_write_config(client);
+    mutex_unlock(&hmc5883l->bus_lock);
+    if (err)
+        return err;
+    if (restore < 0)
+        return restore;
+    for (i = 0; i < 3; i++) {
+        st->expected[i] = selftest_field_mga[i] * gain_lsb_per_gauss[SELFTEST_GAIN] / 1000;
+        if (st->positive[i] < SELFTEST_MIN || st->positive[i] > SELFTEST_MAX ||
+                -st->negative[i] < SELFTEST_MIN || -st->negative[i] > SELFTEST_MAX)
+            in_limits = false;
+        else
+            st->scale[i] = div_s64((s64)2 * st->expected[i] << OBC_MAGCAL_MATRIX_SHIFT,
+                    st->positive[i] - st->negative[i]);
+    }
+    if (!in_limits) {
+        printk(KERN_DEBUG "HMC5883L: Self-test readings out of limits\n");
+        return -ERANGE;
+    }
+    spin_lock_irqsave(&hmc5883l->cal_lock, flags);
+    memcpy(hmc5883l->scale, st->scale, sizeof(hmc5883l->scale));
+    hmc5883l->scale_valid = true;
+    hmc5883l_update_cal();
+    spin_unlock_irqrestore(&hmc5883l->cal_lock, flags);
+    return 0;
+}
+
+/*
+ * Rates the governor picks from, indexed like the rate codes. Fewer
+ * samples are averaged at the fast rates to keep the conversion short.
+ */
+static const struct obc_gov_rate hmc5883l_rates[] = {
+	{ 750, 0, 3 },
+	{ 1500, 1, 3 },
+	{ 3000, 2, 3 },
+	{ 7500, 3, 3 },
+	{ 15000, 4, 3 },
+	{ 30000, 5, 2 },
+	{ 75000, 6, 1 },
+};
+
+/* Called between samples from the capture path; the self-test is held off */
+static int hmc5883l_gov_apply(struct obc_gov_client *c, const struct obc_gov_rate *r)
+{
+	u8 out_rate, sample;
+	int err;
+	mutex_lock(&hmc5883l->bus_lock);
+	mutex_lock(&hmc5883l->lock);
+	out_rate = hmc5883l->out_rate;
+	sample = hmc5883l->sample;
+	hmc5883l->out_rate = r->code;
+	hmc5883l->sample = r->avg;
+	mutex_unlock(&hmc5883l->lock);
+	err = hmc5883l_write_regA(hmc5883l->client);
+	mutex_lock(&hmc5883l->lock);
+	if(err){
+		hmc5883l->out_rate = out_rate;
+		hmc5883l->sample = sample;
+	}
+	WRITE_ONCE(hmc5883l->trig.period_us, data_out_period_us[hmc5883l->out_rate]);
+	mutex_unlock(&hmc5883l->lock);
+	mutex_unlock(&hmc5883l->bus_lock);
+	return err;
+}
+
+/*
+ * Open files stream from the ring, the windowed statistics and the
+ * snapshot buffer need every capture, sysfs and ioctl reads only keep it
+ * fresh
+ */
+static bool hmc5883l_wanted(void)
+{
+	return atomic_read(&hmc5883l->ring.readers) || obc_stats_enabled(&hmc5883l->stats) ||
+		obc_snap_recording(&hmc5883l->snap) ||
+		time_before(jiffies, READ_ONCE(hmc5883l->demand_until));
+}
+
+/* Takes one sample from the device and publishes it to every reader */
+static int hmc5883l_capture(u32 set)
+{
+	struct obc_sample sample;
+	int err, i;
+	u8 gain;
+	obc_gov_sync(&hmc5883l->gov);
+	/* The setters change the gain under bus_lock, so it is the one the data was read at */
+	mutex_lock(&hmc5883l->bus_lock);
+	err = hmc5883l_read_block();
+	gain = hmc5883l->gain;
+	mutex_unlock(&hmc5883l->bus_lock);
+	memset(&sample, 0, sizeof(sample));
+	sample.t_ns = ktime_get_ns();
+	sample.dev = hmc5883l_desc.dev;
+	sample.seq = hmc5883l->seq++;
+	sample.set = set;
+	/* The ring keeps raw counts, calibration is applied on the way out */
+	sample.flags = gain << OBC_SAMPLE_RANGE_SHIFT;
+	if(err){
+		sample.flags |= OBC_SAMPLE_STALE;
+		obc_err_stale(&hmc5883l->err);
+	}
+	mutex_lock(&hmc5883l->lock);
+	for(i = 0; i < 3; i++)
+		sample.v[i] = hmc5883l->axis[i];
+	mutex_unlock(&hmc5883l->lock);
+	obc_ring_push(&hmc5883l->ring, &sample);
+	obc_journal_push(&hmc5883l->journal, &sample);
+	if(obc_snap_push(&hmc5883l->snap, &sample))
+		obc_snap_notify(&hmc5883l->snap);
+	if(obc_stats_enabled(&hmc5883l->stats)){
+		hmc5883l_calibrate(NULL, &sample, 1);
+		if(obc_stats_add(&hmc5883l->stats, &sample))
+			obc_stats_notify(&hmc5883l->stats);
+	}
+	return err;
+}
+
+/* One bus read per output period, shared by every frontend; idle when nobody reads */
+static int hmc5883l_sampler(void *data)
+{
+	ktime_t next = ktime_get();
+	long late;
+	while(!kthread_should_stop()){
+		if(!hmc5883l_wanted()){
+			wait_event_interruptible(hmc5883l->sampler_wait,
+					hmc5883l_wanted() || kthread_should_stop());
+			next = ktime_get();
+			continue;
+		}
+		hmc5883l_capture(0);
+		next = ktime_add_us(next, data_out_period_us[hmc5883l->out_rate]);
+		if(ktime_before(next, ktime_get()))
+			next = ktime_get();
+		set_current_state(TASK_INTERRUPTIBLE);
+		late = kthread_should_stop() ? -EINTR : schedule_hrtimeout(&next, HRTIMER_MODE_ABS);
+		__set_current_state(TASK_RUNNING);
+		/* Woken by the timer, the next capture starts now */
+		if(!late)
+			obc_sched_latency(&hmc5883l->sched, ktime_to_ns(ktime_sub(ktime_get(), next)));
+	}
+	return 0;
+}
+
+static void hmc5883l_trigger_capture(struct obc_trigger_client *c, u32 set, u64 t_ns)
+{
+	hmc5883l_capture(set);
+}
+
+static bool hmc5883l_trigger_wanted(struct obc_trigger_client *c)
+{
+	return hmc5883l_wanted();
+}
+
+/* Time between captures; the trigger tick can be slower than the output rate */
+static unsigned int hmc5883l_capture_period_us(void)
+{
+	unsigned int period_us = data_out_period_us[hmc5883l->out_rate];
+	if(trigger)
+		return max(period_us, obc_trigger_period_us());
+	return period_us;
+}
+
+/* Captures run either on the common trigger or on the driver's own sampler */
+static int hmc5883l_start_sampling(void)
+{
+	int err;
+	if(trigger){
+		hmc5883l->trig.name = hmc5883l_desc.name;
+		hmc5883l->trig.capture = hmc5883l_trigger_capture;
+		hmc5883l->trig.wanted = hmc5883l_trigger_wanted;
+		hmc5883l->trig.period_us = data_out_period_us[hmc5883l->out_rate];
+		hmc5883l->trig.sched = &hmc5883l->sched;
+		return obc_trigger_register(&hmc5883l->trig);
+	}
+	hmc5883l->sampler = kthread_run(hmc5883l_sampler, NULL, "hmc5883l-sampler");
+	if(IS_ERR(hmc5883l->sampler)){
+		err = PTR_ERR(hmc5883l->sampler);
+		hmc5883l->sampler = NULL;
+		return err;
+	}
+	obc_sched_attach(&hmc5883l->sched, hmc5883l->sampler);
+	return 0;
+}
+
+/*
+ * Latest calibrated capture for the cache-only readers. A capture older
+ * than one output period is not returned; the sampler is woken and the
+ * next one waited for instead.
+ */
+int hmc5883l_latest(struct obc_sample *s)
+{
+	unsigned int period_us = hmc5883l_capture_period_us();
+	long left;
+	u64 head;
+	int err;
+	WRITE_ONCE(hmc5883l->demand_until, jiffies + msecs_to_jiffies(HMC5883L_DEMAND_MS));
+	wake_up(&hmc5883l->sampler_wait);
+	head = READ_ONCE(hmc5883l->ring.head);
+	err = obc_ring_latest(&hmc5883l->ring, s);
+	if(err || ktime_get_ns() - s->t_ns > (u64)period_us * NSEC_PER_USEC){
+		left = wait_event_interruptible_timeout(hmc5883l->ring.wait,
+				READ_ONCE(hmc5883l->ring.head) != head, usecs_to_jiffies(2 * period_us));
+		if(left < 0)
+			return left;
+		if(!left)
+			return -ETIMEDOUT;
+		err = obc_ring_latest(&hmc5883l->ring, s);
+		if(err)
+			return err;
+	}
+	hmc5883l_calibrate(NULL, s, 1);
+	return 0;
+}
+
+static int hmc5883l_remove(struct i2c_client *client)
+{
+    cancel_work_sync(&hmc5883l->config_work);
+    obc_config_unregister(&hmc5883l->config);
+    obc_trigger_unregister(&hmc5883l->trig);
+    if (hmc5883l->sampler) {
+        obc_sched_detach(&hmc5883l->sched);
+        kthread_stop(hmc5883l->sampler);
+        hmc5883l->sampler = NULL;
+    }
+    obc_gov_unregister(&hmc5883l->gov);
+    hmc5883l_remove_attr(&client->dev);
+    obc_snap_unregister(&hmc5883l->snap);
+    obc_snap_free(&hmc5883l->snap);
+    obc_journal_detach(&hmc5883l->journal);
+    obc_bus_detach(&hmc5883l->bus);
+    obc_trace_layout(hmc5883l_desc.dev, NULL);
+    return 0;
+}
+
+static void hmc5883l_config_save(struct obc_config_client *c, void *data)
+{
+    struct obc_config_hmc5883l *cfg = data;
+    unsigned long flags;
+    mutex_lock(&hmc5883l->lock);
+    cfg->sample = hmc5883l->sample;
+    cfg->out_rate = hmc5883l->out_rate;
+    cfg->mesura = hmc5883l->mesura;
+    cfg->gain = hmc5883l->gain;
+    cfg->mode = hmc5883l->mode;
+    mutex_unlock(&hmc5883l->lock);
+    spin_lock_irqsave(&hmc5883l->cal_lock, flags);
+    cfg->cal_valid = hmc5883l->cal_valid;
+    cfg->scale_valid = hmc5883l->scale_valid;
+    memcpy(cfg->scale, hmc5883l->scale, sizeof(cfg->scale));
+    memcpy(cfg->cal, hmc5883l->cal, sizeof(cfg->cal));
+    spin_unlock_irqrestore(&hmc5883l->cal_lock, flags);
+}
+
+/* Register settings and the uploaded and self-test calibration */
+static int hmc5883l_config_load(struct obc_config_client *c, const void *data)
+{
+    const struct obc_config_hmc5883l *cfg = data;
+    const struct obc_field *f = hmc5883l_fields;
+    unsigned long flags;
+    BUILD_BUG_ON(OBC_CONFIG_HMC5883L_GAINS != HMC5883L_GAINS);
+    if (!obc_field_valid(&f[HMC5883L_AVER], cfg->sample) ||
+            !obc_field_valid(&f[HMC5883L_RATE], cfg->out_rate) ||
+            !obc_field_valid(&f[HMC5883L_MESURA], cfg->mesura) || cfg->mesura >= MAX_MESURA ||
+            !obc_field_valid(&f[HMC5883L_GAIN], cfg->gain) ||
+            !obc_field_valid(&f[HMC5883L_MODE], cfg->mode) || cfg->mode >= MAX_MODE)
+        return -EINVAL;
+    mutex_lock(&hmc5883l->lock);
+    hmc5883l->sample = cfg->sample;
+    hmc5883l->out_rate = cfg->out_rate;
+    hmc5883l->mesura = cfg->mesura;
+    hmc5883l->gain = cfg->gain;
+    hmc5883l->mode = cfg->mode;
+    WRITE_ONCE(hmc5883l->trig.period_us, data_out_period_us[cfg->out_rate]);
+    mutex_unlock(&hmc5883l->lock);
+    spin_lock_irqsave(&hmc5883l->cal_lock, flags);
+    hmc5883l->cal_valid = cfg->cal_valid;
+    hmc5883l->scale_valid = cfg->scale_valid;
+    memcpy(hmc5883l->scale, cfg->scale, sizeof(hmc5883l->scale));
+    memcpy(hmc5883l->cal, cfg->cal, sizeof(hmc5883l->cal));
+    hmc5883l_update_cal();
+    spin_unlock_irqrestore(&hmc5883l->cal_lock, flags);
+    return 0;
+}
+
+static int hmc5883l_config_apply(struct obc_config_client *c)
+{
+    int err = obc_probe_wait(&hmc5883l->probe);
+    if (err)
+        return err;
+    mutex_lock(&hmc5883l->bus_lock);
+    err = hmc5883l_write_config(hmc5883l->client);
+    mutex_unlock(&hmc5883l->bus_lock);
+    if (!err)
+        obc_gov_reset(&hmc5883l->gov, hmc5883l->out_rate);
+    return err;
+}
+
+static void hmc5883l_config_work(struct work_struct *work)
+{
+    int err;
+    struct i2c_client *client = hmc5883l->client;
+    /* A stored configuration replaces the probe defaults before anything is written */
+    obc_config_fetch(&hmc5883l->config, &client->dev);
+    err = hmc5883l_write_config(client);
+    if (err < 0) {
+        printk(KERN_DEBUG "HMC5883L: Cannot configure device\n");
+        obc_probe_done(&hmc5883l->probe, err);
+        return;
+    }
+    obc_probe_mark(&hmc5883l->probe, OBC_PROBE_CONFIG);
+    err = hmc5883l_wait_data_ready(client);
+    if (!err)
+        err = hmc5883l_read_block();
+    if (err < 0) {
+        printk(KERN_DEBUG "HMC5883L: No first sample\n");
+        obc_probe_done(&hmc5883l->probe, err);
+        return;
+    }
+    obc_probe_mark(&hmc5883l->probe, OBC_PROBE_FIRST_SAMPLE);
+    hmc5883l->gov.name = hmc5883l_desc.name;
+    hmc5883l->gov.rates = hmc5883l_rates;
+    hmc5883l->gov.nrates = ARRAY_SIZE(hmc5883l_rates);
+    hmc5883l->gov.quiet = 3;
+    hmc5883l->gov.motion = ARRAY_SIZE(hmc5883l_rates) - 1;
+    hmc5883l->gov.apply = hmc5883l_gov_apply;
+    err = obc_gov_register(&hmc5883l->gov, hmc5883l->out_rate);
+    if (!err)
+        err = hmc5883l_start_sampling();
+    if (err) {
+        obc_probe_done(&hmc5883l->probe, err);
+        return;
+    }
+    obc_probe_done(&hmc5883l->probe, 0);
+    printk(KERN_DEBUG "HMC5883L: Ready after %lld us\n", hmc5883l->probe.stage_us[OBC_PROBE_READY]);
+}
+
+static int hmc5883l_probe(struct i2c_client *client,
+        const struct i2c_device_id *id)
+{
+    obc_probe_start(&hmc5883l->probe);
+    i2c_set_clientdata(client, hmc5883l);
+    hmc5883l->mesura = NORMAL_MESURA;
+    hmc5883l->gain = 0x01;
+    hmc5883l->mode = CONTINOUS_MODE;
+    hmc5883l->out_rate = 0x04;
+    hmc5883l->sample = 0x03;
+    hmc5883l->client = client;
+    obc_stats_init(&hmc5883l->stats, &client->dev, hmc5883l_desc.dev, 3);
+    obc_sched_init(&hmc5883l->sched);
+    /* Without the memory the device runs as before, no snapshots */
+    if (obc_snap_alloc(&hmc5883l->snap, &client->dev, hmc5883l_desc.dev, snapshot_kb))
+        printk(KERN_DEBUG "HMC5883L: Cannot allocate the snapshot buffer\n");
+    obc_snap_register(&hmc5883l->snap);
+    obc_journal_attach(&hmc5883l->journal, hmc5883l_desc.dev);
+    obc_trace_layout(hmc5883l_desc.dev, hmc5883l_desc.layout);
+    /* Without a bus queue the transfers still run, unscheduled */
+    if (obc_bus_attach(&hmc5883l->bus, &client->adapter->dev))
+        printk(KERN_DEBUG "HMC5883L: Cannot attach to the bus scheduler\n");
+    hmc5883l_create_attr(&client->dev);
+    obc_config_register(&hmc5883l->config);
+    /* Bus configuration runs in the background, readers wait for it */
+    INIT_WORK(&hmc5883l->config_work, hmc5883l_config_work);
+    queue_work(system_unbound_wq, &hmc5883l->config_work);
+    return 0;
+}
+
+static const struct i2c_device_id hmc5883l_id[] = {
+    {"hmc5883l-i2c", 0},
+    { }
+};
+
+MODULE_DEVICE_TABLE(i2c, hmc5883l_id);
+
+static const struct of_device_id hmc5883l_of_match[] = {
+{    .compatible = "honeywell,hmc5883l",
+     .data = 0,
+	},
+     {}
+};
+
+MODULE_DEVICE_TABLE(of, hmc5883l_of_match);
+
+static struct i2c_driver hmc5883l_driver = {
+    .driver = {
+        .name = SENSOR_NAME,
+	.owner = THIS_MODULE,
+	.of_match_table = hmc5883l_of_match,
+	.probe_type = PROBE_PREFER_ASYNCHRONOUS,
+    },
+    .probe = hmc5883l_probe,
+    .remove = hmc5883l_remove,
+    .id_table = hmc5883l_id,
+};
+
+static int __init hmc5883l_init(void)
+{
+	int err;
+	hmc5883l = kzalloc(sizeof(struct sensor_hmc5883l), GFP_KERNEL);
+	if(!hmc5883l){
+		printk(KERN_DEBUG "HMC5883L: Cannot create hmc5883l structure\n");
+		return -ENOMEM;
+	}
+	mutex_init(&hmc5883l->lock);
+	mutex_init(&hmc5883l->bus_lock);
+	spin_lock_init(&hmc5883l->cal_lock);
+	hmc5883l_update_cal();
+	obc_probe_init(&hmc5883l->probe);
+	obc_err_init(&hmc5883l->err);
+	/* Attitude input: ahead of the other sensors' streams on a shared bus */
+	hmc5883l->bus.capture_class = OBC_BUS_CONTROL;
+	hmc5883l->config.name = hmc5883l_desc.name;
+	hmc5883l->config.dev = OBC_DEV_HMC5883L;
+	hmc5883l->config.version = OBC_CONFIG_HMC5883L_VERSION;
+	hmc5883l->config.size = sizeof(struct obc_config_hmc5883l);
+	hmc5883l->config.save = hmc5883l_config_save;
+	hmc5883l->config.load = hmc5883l_config_load;
+	hmc5883l->config.apply = hmc5883l_config_apply;
+	init_waitqueue_head(&hmc5883l->sampler_wait);
+	err = obc_ring_init(&hmc5883l->ring, OBC_RING_ORDER, OBC_DEV_HMC5883L);
+	if(err){
+		printk(KERN_DEBUG "HMC5883L: Cannot allocate sample ring\n");
+		goto free;
+	}
+	hmc5883l->ring.filter = hmc5883l_calibrate;
+	err = hmc5883l_cdev_init();
+	if(err)
+		goto ring;
+	err = i2c_add_driver(&hmc5883l_driver);
+	if(err){
+		printk(KERN_DEBUG "HMC5883L: Registering on I2C core failed\n");
+		goto cdev;
+	}
+	return 0;
+cdev:
+	hmc5883l_cdev_exit();
+ring:
+	obc_ring_free(&hmc5883l->ring);
+free:
+	kfree(hmc5883l);
+	return err;
+}
+
+static void __exit hmc5883l_exit(void)
+{
+	i2c_del_driver(&hmc5883l_driver);
+	hmc5883l_cdev_exit();
+	obc_ring_free(&hmc5883l->ring);
+	kfree(hmc5883l);
+	printk(KERN_DEBUG "HMC5883L: Module removed \n");
+}
+
+module_init(hmc5883l_init);
+module_exit(hmc5883l_exit);
+MODULE_LICENSE("GPL");
@@ -0,0 +1,28 @@
+/*IOCTL parameters*/
+
+#include "obc_sample.h"
+#include "obc_magcal.h"
+
+#define HMC5883L_MAGIC 0xF2
+#define HMC5883L_READ _IOR(HMC5883L_MAGIC, 1, unsigned short)
+#define HMC5883L_GET_MODE _IOR(HMC5883L_MAGIC, 2, unsigned short)
+#define HMC5883L_GET_SAMPLE _IOR(HMC5883L_MAGIC, 3, unsigned short)
+#define HMC5883L_GET_GAIN _IOR(HMC5883L_MAGIC, 4, unsigned short)
+#define HMC5883L_GET_MESURA _IOR(HMC5883L_MAGIC, 5, unsigned short)
+#define HMC5883L_GET_OUT_RATE _IOR(HMC5883L_MAGIC, 6, unsigned short)
+#define HMC5883L_SET_MODE _IOW(HMC5883L_MAGIC, 7, unsigned short)
+#define HMC5883L_SET_SAMPLE _IOW(HMC5883L_MAGIC, 8, unsigned short)
+#define HMC5883L_SET_GAIN _IOW(HMC5883L_MAGIC, 9, unsigned short)
+#define HMC5883L_SET_MESURA _IOW(HMC5883L_MAGIC, 10, unsigned short)
+#define HMC5883L_SET_OUT_RATE _IOW(HMC5883L_MAGIC, 11, unsigned short)
+#define HMC5883L_GET_RING_STAT _IOR(HMC5883L_MAGIC, 12, struct obc_ring_stat)
+#define HMC5883L_READ_SAMPLE _IOR(HMC5883L_MAGIC, 13, struct obc_sample)
+#define HMC5883L_SET_CAL _IOW(HMC5883L_MAGIC, 14, struct obc_magcal_set)
+#define HMC5883L_GET_CAL _IOWR(HMC5883L_MAGIC, 15, struct obc_magcal_set)
+#define HMC5883L_SELF_CALIBRATE _IOR(HMC5883L_MAGIC, 16, struct obc_magcal_selftest)
+/* Asks for at least this output rate in mHz while the file is open, 0 withdraws; returns the granted rate */
+#define HMC5883L_SET_RATE _IOWR(HMC5883L_MAGIC, 17, __u32)
+/* OBC_RING_* overrun policy of this file */
+#define HMC5883L_SET_RING_POLICY _IOW(HMC5883L_MAGIC, 18, __u32)
+/* Fires the snapshot trigger (obc_snap.h) */
+#define HMC5883L_SNAPSHOT_TRIGGER _IO(HMC5883L_MAGIC, 19)
@@ -0,0 +1,392 @@
+/* HMC5883L sysfs frontend: attributes on the I2C client device */
+
+#include <linux/kernel.h>
+#include <linux/device.h>
+#include <linux/i2c.h>
+
+#include "hmc5883l.h"
+
+//Attribute methods start here
+/* Axis attributes come from the core's sample cache, never from the bus */
+static ssize_t hmc5883l_axis_show(struct device *dev, char *buf, int axis)
+{
+	struct sensor_hmc5883l *sensor_hmc5883l = dev_get_drvdata(dev);
+	struct obc_sample sample;
+	int err = obc_probe_wait(&sensor_hmc5883l->probe);
+	if(err)
+		return err;
+	err = hmc5883l_latest(&sample);
+	if(err)
+		return err;
+	if(sample.flags & OBC_SAMPLE_STALE)
+		return -ENODATA;
+	return sprintf(buf,"%d\n", sample.v[axis]);
+}
+
+static ssize_t hmc5883l_int_x(struct device *dev, struct device_attribute *attr, char *buf){
+	return hmc5883l_axis_show(dev, buf, 0);
+}
+
+static ssize_t hmc5883l_int_y(struct device *dev, struct device_attribute *attr, char *buf){
+	return hmc5883l_axis_show(dev, buf, 1);
+}
+
+
+static ssize_t hmc5883l_int_z(struct device *dev, struct device_attribute *attr, char *buf){
+	return hmc5883l_axis_show(dev, buf, 2);
+}
+
+static ssize_t hmc5883l_mode_set(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+{	
+	struct sensor_hmc5883l *sensor_hmc5883l = dev_get_drvdata(dev);
+	int err = obc_probe_wait(&sensor_hmc5883l->probe);
+	if(err)
+		return err;
+	u8 mode = simple_strtoul(buf, NULL, 10);
+	printk(KERN_NOTICE "Before changing mode\n"); 
+	err = hmc5883l_set_mode(sensor_hmc5883l->client, mode);
+	printk(KERN_NOTICE "After changing mode %d\n", err); 
+	if(err < 0)
+		return err;
+	return count;
+}
+
+static ssize_t hmc5883l_mode_get(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	struct sensor_hmc5883l *sensor_hmc5883l = dev_get_drvdata(dev);
+	u8 mode = 0;
+	mode = hmc5883l_get_mode(sensor_hmc5883l->client);
+	return sprintf(buf, "%u\n", mode);
+}
+
+static ssize_t hmc5883l_data_out_rate_set(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+{
+	struct sensor_hmc5883l *sensor_hmc5883l = dev_get_drvdata(dev);
+	int err = obc_probe_wait(&sensor_hmc5883l->probe);
+	if(err)
+		return err;
+	u8 data_rate = simple_strtoul(buf, NULL, 10); 
+	err = hmc5883l_set_data_out_rate (sensor_hmc5883l->client, data_rate);
+	if(err < 0)
+		return err;
+	return count;
+}
+
+static ssize_t hmc5883l_data_out_rate_get(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	struct sensor_hmc5883l *sensor_hmc5883l = dev_get_drvdata(dev);
+	u8 data_out_rate = 0;
+	data_out_rate = hmc5883l_get_data_out_rate(sensor_hmc5883l->client);
+	return sprintf( buf, "%u\n", data_out_rate);
+}
+
+static ssize_t hmc5883l_sample_average_set(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+{
+	struct sensor_hmc5883l *sensor_hmc5883l = dev_get_drvdata(dev);
+	int err = obc_probe_wait(&sensor_hmc5883l->probe);
+	if(err)
+		return err;
+	u8 sample_average = simple_strtoul(buf, NULL, 10); 
+	err = hmc5883l_set_sample_average( sensor_hmc5883l->client, sample_average);
+	if(err < 0)
+		return err;
+	return count;
+}
+
+static ssize_t hmc5883l_sample_average_get(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	struct sensor_hmc5883l *sensor_hmc5883l = dev_get_drvdata(dev);
+	u8 sample_average = 0;
+	sample_average = hmc5883l_get_sample_average( sensor_hmc5883l->client);
+	return sprintf( buf, "%u\n", sample_average);
+}
+
+static ssize_t hmc5883l_mesura_set( struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+{
+	struct sensor_hmc5883l *sensor_hmc5883l = dev_get_drvdata(dev);
+	int err = obc_probe_wait(&sensor_hmc5883l->probe);
+	if(err)
+		return err;
+	u8 mesura = simple_strtoul(buf, NULL, 10); 
+	err = hmc5883l_set_mesura(sensor_hmc5883l->client, mesura);
+	if(err < 0)
+		return err;
+	return count;
+}
+
+static ssize_t hmc5883l_mesura_get(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	struct sensor_hmc5883l *sensor_hmc5883l = dev_get_drvdata(dev);
+	u8 mesura = 0;
+	mesura = hmc5883l_get_mesura( sensor_hmc5883l->client);
+	return sprintf( buf, "%u\n", mesura);
+}
+
+
+static ssize_t hmc5883l_gain_set(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+{
+	struct sensor_hmc5883l *sensor_hmc5883l = dev_get_drvdata(dev);
+	int err = obc_probe_wait(&sensor_hmc5883l->probe);
+	if(err)
+		return err;
+	u8 gain = simple_strtoul(buf, NULL, 10); 
+	err = hmc5883l_set_gain( sensor_hmc5883l->client, gain);
+	if(err < 0)
+		return err;
+	return count;
+}
+
+static ssize_t hmc5883l_gain_get(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	struct sensor_hmc5883l *sensor_hmc5883l = dev_get_drvdata(dev);
+	u8 gain = 0;
+	gain = hmc5883l_get_gain(sensor_hmc5883l->client);
+	return sprintf( buf, "%u\n", gain);
+}
+
+static ssize_t hmc5883l_probe_timing(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	struct sensor_hmc5883l *sensor_hmc5883l = dev_get_drvdata(dev);
+	return obc_probe_show(&sensor_hmc5883l->probe, buf);
+}
+
+static ssize_t hmc5883l_error_stats(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	struct sensor_hmc5883l *sensor_hmc5883l = dev_get_drvdata(dev);
+	return obc_err_show(&sensor_hmc5883l->err, buf);
+}
+
+static ssize_t hmc5883l_error_policy_get(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	struct sensor_hmc5883l *sensor_hmc5883l = dev_get_drvdata(dev);
+	return obc_err_policy_show(&sensor_hmc5883l->err, buf);
+}
+
+static ssize_t hmc5883l_error_policy_set(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+{
+	struct sensor_hmc5883l *sensor_hmc5883l = dev_get_drvdata(dev);
+	return obc_err_policy_store(&sensor_hmc5883l->err, buf, count);
+}
+
+static ssize_t hmc5883l_ring_stats(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	struct sensor_hmc5883l *sensor_hmc5883l = dev_get_drvdata(dev);
+	return obc_ring_show(&sensor_hmc5883l->ring, buf);
+}
+
+static ssize_t hmc5883l_ring_policy_get(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	struct sensor_hmc5883l *sensor_hmc5883l = dev_get_drvdata(dev);
+	return obc_ring_policy_show(&sensor_hmc5883l->ring, buf);
+}
+
+static ssize_t hmc5883l_ring_policy_set(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+{
+	struct sensor_hmc5883l *sensor_hmc5883l = dev_get_drvdata(dev);
+	return obc_ring_policy_store(&sensor_hmc5883l->ring, buf, count);
+}
+
+static ssize_t hmc5883l_stats(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	struct sensor_hmc5883l *sensor_hmc5883l = dev_get_drvdata(dev);
+	return obc_stats_show(&sensor_hmc5883l->stats, buf);
+}
+
+static ssize_t hmc5883l_stats_window_get(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	struct sensor_hmc5883l *sensor_hmc5883l = dev_get_drvdata(dev);
+	return obc_stats_window_show(&sensor_hmc5883l->stats, buf);
+}
+
+/* Non-zero keeps the sampler running without open files */
+static ssize_t hmc5883l_stats_window_set(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+{
+	struct sensor_hmc5883l *sensor_hmc5883l = dev_get_drvdata(dev);
+	unsigned int ms;
+	if(kstrtouint(buf, 0, &ms))
+		return -EINVAL;
+	obc_stats_set_window(&sensor_hmc5883l->stats, ms);
+	wake_up(&sensor_hmc5883l->sampler_wait);
+	return count;
+}
+
+static ssize_t hmc5883l_bus_class_get(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	struct sensor_hmc5883l *sensor_hmc5883l = dev_get_drvdata(dev);
+	return obc_bus_class_show(&sensor_hmc5883l->bus, buf);
+}
+
+/* Bus priority of the captures: control, stream or housekeeping */
+static ssize_t hmc5883l_bus_class_set(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+{
+	struct sensor_hmc5883l *sensor_hmc5883l = dev_get_drvdata(dev);
+	return obc_bus_class_store(&sensor_hmc5883l->bus, buf, count);
+}
+
+static ssize_t hmc5883l_sched_get(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	struct sensor_hmc5883l *sensor_hmc5883l = dev_get_drvdata(dev);
+	return obc_sched_show(&sensor_hmc5883l->sched, buf);
+}
+
+/* Policy of the capture thread: "other", "fifo <prio>" or "rr <prio>" */
+static ssize_t hmc5883l_sched_set(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+{
+	struct sensor_hmc5883l *sensor_hmc5883l = dev_get_drvdata(dev);
+	return obc_sched_store(&sensor_hmc5883l->sched, buf, count);
+}
+
+static ssize_t hmc5883l_sched_cpus_get(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	struct sensor_hmc5883l *sensor_hmc5883l = dev_get_drvdata(dev);
+	return obc_sched_cpus_show(&sensor_hmc5883l->sched, buf);
+}
+
+/* CPUs the capture thread may run on, as a CPU list */
+static ssize_t hmc5883l_sched_cpus_set(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+{
+	struct sensor_hmc5883l *sensor_hmc5883l = dev_get_drvdata(dev);
+	return obc_sched_cpus_store(&sensor_hmc5883l->sched, buf, count);
+}
+
+/* Timer or trigger to capture start, in power of two us buckets; writing clears it */
+static ssize_t hmc5883l_latency_get(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	struct sensor_hmc5883l *sensor_hmc5883l = dev_get_drvdata(dev);
+	return obc_sched_hist_show(&sensor_hmc5883l->sched, buf);
+}
+
+static ssize_t hmc5883l_latency_clear(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+{
+	struct sensor_hmc5883l *sensor_hmc5883l = dev_get_drvdata(dev);
+	return obc_sched_hist_clear(&sensor_hmc5883l->sched, count);
+}
+
+static ssize_t hmc5883l_snapshot_state_get(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	struct sensor_hmc5883l *sensor_hmc5883l = dev_get_drvdata(dev);
+	return obc_snap_show(&sensor_hmc5883l->snap, buf);
+}
+
+/* "arm", "trigger" or "off" */
+static ssize_t hmc5883l_snapshot_state_set(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+{
+	struct sensor_hmc5883l *sensor_hmc5883l = dev_get_drvdata(dev);
+	ssize_t ret = obc_snap_store(&sensor_hmc5883l->snap, buf, count);
+	wake_up(&sensor_hmc5883l->sampler_wait);
+	return ret;
+}
+
+static ssize_t hmc5883l_snapshot_window_get(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	struct sensor_hmc5883l *sensor_hmc5883l = dev_get_drvdata(dev);
+	u64 period_us = data_out_period_us[sensor_hmc5883l->out_rate];
+	return sprintf(buf, "%llu %llu\n", div_u64(sensor_hmc5883l->snap.pre * period_us, USEC_PER_MSEC),
+			div_u64(sensor_hmc5883l->snap.post * period_us, USEC_PER_MSEC));
+}
+
+/* "pre post" in ms, turned into samples at the current output rate */
+static ssize_t hmc5883l_snapshot_window_set(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+{
+	struct sensor_hmc5883l *sensor_hmc5883l = dev_get_drvdata(dev);
+	unsigned int pre, post, period_us = data_out_period_us[sensor_hmc5883l->out_rate];
+	int err;
+	if(sscanf(buf, "%u %u", &pre, &post) != 2 || !period_us)
+		return -EINVAL;
+	err = obc_snap_set_window(&sensor_hmc5883l->snap, div_u64((u64)pre * USEC_PER_MSEC, period_us),
+			div_u64((u64)post * USEC_PER_MSEC, period_us));
+	return err ? err : count;
+}
+
+static ssize_t hmc5883l_snapshot_bin(struct file *filp, struct kobject *kobj, struct bin_attribute *attr,
+		char *buf, loff_t off, size_t count)
+{
+	struct sensor_hmc5883l *sensor_hmc5883l = dev_get_drvdata(container_of(kobj, struct device, kobj));
+	return obc_snap_read_bin(&sensor_hmc5883l->snap, buf, off, count);
+}
+
+static ssize_t hmc5883l_stats_bin(struct file *filp, struct kobject *kobj, struct bin_attribute *attr,
+		char *buf, loff_t off, size_t count)
+{
+	struct sensor_hmc5883l *sensor_hmc5883l = dev_get_drvdata(container_of(kobj, struct device, kobj));
+	return obc_stats_read_bin(&sensor_hmc5883l->stats, buf, off, count);
+}
+
+//Attribute methods end here
+
+//Attributes declared here
+static DEVICE_ATTR(hmc5883l_int_x, 0664, hmc5883l_int_x, NULL);
+static DEVICE_ATTR(hmc5883l_int_y, 0664, hmc5883l_int_y, NULL);
+static DEVICE_ATTR(hmc5883l_int_z, 0664, hmc5883l_int_z, NULL);
+static DEVICE_ATTR(hmc5883l_gain, 0664, hmc5883l_gain_get, hmc5883l_gain_set);
+static DEVICE_ATTR(hmc5883l_mesura, 0664, hmc5883l_mesura_get, hmc5883l_mesura_set);
+static DEVICE_ATTR(hmc5883l_data_out_rate, 0664, hmc5883l_data_out_rate_get, hmc5883l_data_out_rate_set);
+static DEVICE_ATTR(hmc5883l_sample_average, 0664, hmc5883l_sample_average_get, hmc5883l_sample_average_set);
+static DEVICE_ATTR(hmc5883l_mode, 0664, hmc5883l_mode_get, hmc5883l_mode_set); 
+static DEVICE_ATTR(probe_timing, 0444, hmc5883l_probe_timing, NULL);
+static DEVICE_ATTR(error_stats, 0444, hmc5883l_error_stats, NULL);
+static DEVICE_ATTR(error_policy, 0664, hmc5883l_error_policy_get, hmc5883l_error_policy_set);
+static DEVICE_ATTR(ring_stats, 0444, hmc5883l_ring_stats, NULL);
+static DEVICE_ATTR(ring_policy, 0664, hmc5883l_ring_policy_get, hmc5883l_ring_policy_set);
+static DEVICE_ATTR(stats, 0444, hmc5883l_stats, NULL);
+static DEVICE_ATTR(stats_window_ms, 0664, hmc5883l_stats_window_get, hmc5883l_stats_window_set);
+static DEVICE_ATTR(bus_class, 0664, hmc5883l_bus_class_get, hmc5883l_bus_class_set);
+static DEVICE_ATTR(sched_policy, 0664, hmc5883l_sched_get, hmc5883l_sched_set);
+static DEVICE_ATTR(sched_cpus, 0664, hmc5883l_sched_cpus_get, hmc5883l_sched_cpus_set);
+static DEVICE_ATTR(wakeup_latency, 0664, hmc5883l_latency_get, hmc5883l_latency_clear);
+static DEVICE_ATTR(snapshot_state, 0664, hmc5883l_snapshot_state_get, hmc5883l_snapshot_state_set);
+static DEVICE_ATTR(snapshot_window_ms, 0664, hmc5883l_snapshot_window_get, hmc5883l_snapshot_window_set);
+static BIN_ATTR(stats_bin, 0444, hmc5883l_stats_bin, NULL,
+		OBC_STATS_HISTORY * sizeof(struct obc_stats_window));
+/* Size depends on the frozen window */
+static BIN_ATTR(snapshot, 0444, hmc5883l_snapshot_bin, NULL, 0);
+
+static struct device_attribute *hmc5883l_attr_list[] = {
+	&dev_attr_hmc5883l_int_x,
+	&dev_attr_hmc5883l_int_y,
+	&dev_attr_hmc5883l_int_z,
+	&dev_attr_hmc5883l_mode,
+	&dev_attr_hmc5883l_data_out_rate,
+	&dev_attr_hmc5883l_sample_average,
+	&dev_attr_hmc5883l_mesura,
+	&dev_attr_hmc5883l_gain,
+	&dev_attr_probe_timing,
+	&dev_attr_error_stats,
+	&dev_attr_error_policy,
+	&dev_attr_ring_stats,
+	&dev_attr_ring_policy,
+	&dev_attr_stats,
+	&dev_attr_stats_window_ms,
+	&dev_attr_bus_class,
+	&dev_attr_sched_policy,
+	&dev_attr_sched_cpus,
+	&dev_attr_wakeup_latency,
+	&dev_attr_snapshot_state,
+	&dev_attr_snapshot_window_ms,
+};
+
+void hmc5883l_create_attr(struct device *dev){
+	int index;
+	int num = (int)(sizeof(hmc5883l_attr_list)/sizeof(hmc5883l_attr_list[0]));
+	for(index = 0; index < num; index++){
+		if(device_create_file(dev, hmc5883l_attr_list[index]) < 0){
+			printk(KERN_DEBUG "HMC5883L: Error creating attribute file\n");
+		}
+	}
+	if(device_create_bin_file(dev, &bin_attr_stats_bin) < 0){
+		printk(KERN_DEBUG "HMC5883L: Error creating attribute file\n");
+	}
+	if(device_create_bin_file(dev, &bin_attr_snapshot) < 0){
+		printk(KERN_DEBUG "HMC5883L: Error creating attribute file\n");
+	}
+}
+
+void hmc5883l_remove_attr(struct device *dev){
+	int index;
+	int num = (int)(sizeof(hmc5883l_attr_list)/sizeof(hmc5883l_attr_list[0]));
+	for(index = 0; index < num; index++){
+		device_remove_file(dev, hmc5883l_attr_list[index]);
+	}
+	device_remove_bin_file(dev, &bin_attr_stats_bin);
+	device_remove_bin_file(dev, &bin_attr_snapshot);
+}
@@ -0,0 +1,38 @@
+/*userspace example: prints HMC5883L readings through libobcsensors*/
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<errno.h>
+#include"obcsensors.h"
+
+int main(int argc, char **argv)
+{
+	struct obcs_mag reading[16];
+	struct obcs_dev *dev;
+	int count = argc > 1 ? atoi(argv[1]) : 1;
+	int n, i;
+	dev = obcs_open(OBCS_HMC5883L, OBCS_PATH_AUTO);
+	if(!dev){
+		printf("Cannot open HMC5883L: %s\n", strerror(errno));
+		exit(-1);
+	}
+	printf("Using %s access\n", obcs_path_name(obcs_path(dev)));
+	while(count > 0){
+		if(obcs_wait(dev, 2000) <= 0){
+			printf("No data.\n");
+			exit(-1);
+		}
+		while(count > 0 && (n = obcs_read_mag(dev, reading, 16)) > 0){
+			for( i = 0; i < n && count > 0; i++, count--){
+				printf("x : %d y : %d z : %d%s\n", reading[i].x, reading[i].y, reading[i].z,
+						reading[i].flags & OBC_SAMPLE_STALE ? " (stale)" : "");
+			}
+		}
+		if(n < 0){
+			printf("Read failed: %s\n", strerror(-n));
+			exit(-1);
+		}
+	}
+	obcs_close(dev);
+	return 0;
+}
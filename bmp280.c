@@ -9,59 +9,893 @@
 #include <linux/spi/spi.h>
 #include <asm/uaccess.h>
 #include <linux/delay.h>
+#include <linux/workqueue.h>
 
 #include "bmp280.h"
+#include "obc_probe.h"
+#include "obc_retry.h"
+#include "obc_trigger.h"
+#include "obc_stats.h"
+#include "obc_bus.h"
+#include "obc_trace.h"
+#include "obc_config.h"
+#include "obc_sched.h"
+#include "obc_journal.h"
+#include "obc_sample.h"
+#include "obc_desc.h"
+
+static bool trigger = true;
+module_param(trigger, bool, 0444);
+MODULE_PARM_DESC(trigger, "Measure on the common OBC trigger and serve raw from the last capture");
+
+struct sensor_bmp280{
+	struct spi_device *spi;
+	struct mutex bus_lock;	/* conversions vs. configuration writes, taken before lock */
+	struct mutex lock;
+	u8 ctrl_meas;		/* shadow of CTRL_MEAS, mode bits select forced or normal, under both locks */
+	u8 config;		/* shadow of CONFIG, under both locks */
+	struct work_struct config_work;
+	struct obc_probe probe;
+	struct obc_err_state err;
+	struct obc_trigger_client trig;
+	struct obc_sample last;		/* latest trigger capture, under lock */
+	unsigned long demand_until;	/* jiffies, trigger captures run until then */
+	u64 read_ns;			/* previous raw read, paces forced mode captures */
+	struct obc_stats stats;		/* over the trigger captures */
+	struct obc_bus_client bus;
+	struct obc_config_client config_client;
+	struct obc_sched sched;		/* of the trigger worker */
+	struct obc_journal journal;	/* trigger captures */
+	struct bmp280_calib calib;	/* read after the reset */
+};
+
+/* Indexed by the osrs_t/osrs_p register code */
+static const unsigned int oversampling[] = {
+	0, 1, 2, 4, 8, 16
+};
+
+/* Indexed by the filter register code */
+static const unsigned int filter_coefficient[] = {
+	0, 2, 4, 8, 16
+};
+
+/* Indexed by the t_sb register code */
+static const unsigned int standby_us[] = {
+	500, 62500, 125000, 250000, 500000, 1000000, 2000000, 4000000
+};
+
+enum {
+	BMP280_OSRS_T,
+	BMP280_OSRS_P,
+	BMP280_MODE,
+	BMP280_T_SB,
+	BMP280_FILTER,
+};
+
+static const struct obc_field bmp280_fields[] = {
+	[BMP280_OSRS_T] = OBC_FIELD_LUT("osrs_t", CTRL_MEAS, OSRS_T_OFFSET, OSRS_MASK, oversampling),
+	[BMP280_OSRS_P] = OBC_FIELD_LUT("osrs_p", CTRL_MEAS, OSRS_P_OFFSET, OSRS_MASK, oversampling),
+	[BMP280_MODE] = OBC_FIELD("mode", CTRL_MEAS, 0, MODE_MASK),
+	[BMP280_T_SB] = OBC_FIELD_LUT("t_sb", CONFIG, T_SB_OFFSET, T_SB_MASK, standby_us),
+	[BMP280_FILTER] = OBC_FIELD_LUT("filter", CONFIG, FILTER_OFFSET, FILTER_MASK, filter_coefficient),
+};
+
+static const struct obc_sensor_desc bmp280_desc = {
+	.name = "bmp280",
+	.dev = OBC_DEV_BMP280,
+	.id_reg = ID,
+	.id = ID_BMP280,
+	.reset_us = BMP280_RESET_US,
+	.fields = bmp280_fields,
+	.nfields = ARRAY_SIZE(bmp280_fields),
+	.layout = &bmp280_layout,
+};
 
 static int bmp280_write(struct spi_device *spi, u8 address, u8 data)
 {	
 	u8 tx_buf[2];
+	int err;
 	tx_buf[0] = WR_ADDRESS & address;
 	tx_buf[1] = data;
-	return spi_write_then_read(spi, tx_buf, 2, NULL, 0);
+	err = spi_write_then_read(spi, tx_buf, 2, NULL, 0);
+	obc_trace(bmp280_desc.dev, address, OBC_TRACE_WRITE, &data, 1, err);
+	return err;
 	}
 	
 static int bmp280_read(struct spi_device *spi, u8 address, u8 *data, int count)
 {
 	u8 tx_buf;
+	int err;
 	tx_buf = RD_ADDRESS | address;
-	return spi_write_then_read(spi, &tx_buf, 1, data, count);
+	err = spi_write_then_read(spi, &tx_buf, 1, data, count);
+	obc_trace(bmp280_desc.dev, address, 0, data, count, err);
+	return err;
 	}
 
+struct bmp280_xfer {
+	struct spi_device *spi;
+	u8 address;
+	u8 *data;
+	int count;		/* 0 for a single register write of data[0] */
+};
+
+static int bmp280_xfer(void *ctx)
+{
+	struct bmp280_xfer *x = ctx;
+	if(!x->count)
+		return bmp280_write(x->spi, x->address, x->data[0]);
+	return bmp280_read(x->spi, x->address, x->data, x->count);
+}
+
+/* Repeated failures: set the SPI device up again */
+static int bmp280_recover(void *ctx)
+{
+	struct bmp280_xfer *x = ctx;
+	return spi_setup(x->spi);
+}
+
+/* Configuration writes wait behind the sample reads on the bus */
+static const struct obc_bus_req bmp280_config_req = {
+	.class = OBC_BUS_HOUSEKEEPING,
+};
+
+/* req schedules the transfer on the shared bus */
+static int bmp280_write_retry(struct sensor_bmp280 *bmp280, const struct obc_bus_req *req,
+		u8 address, u8 data)
+{
+	struct bmp280_xfer x = { bmp280->spi, address, &data, 0 };
+	return obc_retry_bus(&bmp280->err, &bmp280->bus, req, bmp280_xfer, bmp280_recover, &x);
+}
+
+static int bmp280_read_retry(struct sensor_bmp280 *bmp280, const struct obc_bus_req *req,
+		u8 address, u8 *data, int count)
+{
+	struct bmp280_xfer x = { bmp280->spi, address, data, count };
+	return obc_retry_bus(&bmp280->err, &bmp280->bus, req, bmp280_xfer, bmp280_recover, &x);
+}
+
 static ssize_t bmp280_id(struct spi_device *spi)
 {
-	return spi_w8r8(spi, RD_ADDRESS | ID);
+	return spi_w8r8(spi, RD_ADDRESS | bmp280_desc.id_reg);
 }
 	
 static ssize_t bmp280_get_id(struct device *dev, 
-		struct device_attribute *attr, const char *buf, size_t count)
+		struct device_attribute *attr, char *buf)
 {
-	struct spi_device *spi = dev_get_drvdata(dev);
+	struct sensor_bmp280 *bmp280 = dev_get_drvdata(dev);
 	u8 id = 0;
-	id = bmp280_id(spi);
+	int err = obc_probe_wait(&bmp280->probe);
+	if(err)
+		return err;
+	id = bmp280_id(bmp280->spi);
 	return sprintf(buf, "%u\n", id);
 }
 
-static DEVICE_ATTR(id, 0664, bmp280_get_id, NULL);
+/*
+ * Burst read of the 20-bit pressure and temperature ADC outputs, due on
+ * the bus within period_us; identical queued reads are merged, see
+ * bmp280_measure().
+ */
+static int bmp280_read_raw(struct sensor_bmp280 *bmp280, unsigned int period_us, s32 *press, s32 *temp)
+{
+	const struct obc_layout *l = bmp280_desc.layout;
+	struct obc_bus_req req;
+	u8 data[6];
+	s32 v[3];
+	int err;
+	obc_bus_capture_req(&bmp280->bus, &req, period_us, bmp280, data, l->len);
+	err = bmp280_read_retry(bmp280, &req, l->reg, data, l->len);
+	if(err){
+		printk_ratelimited(KERN_DEBUG "BMP280: Cannot read.\n");
+		return err;
+	}
+	obc_layout_decode(l, data, v);
+	*press = v[0];
+	*temp = v[1];
+	return 0;
+}
+
+/* Datasheet maximum conversion time for the oversampling in ctrl_meas */
+static unsigned int bmp280_measure_time_us(u8 ctrl_meas)
+{
+	unsigned int os_t = obc_field_value(&bmp280_fields[BMP280_OSRS_T], ctrl_meas);
+	unsigned int os_p = obc_field_value(&bmp280_fields[BMP280_OSRS_P], ctrl_meas);
+	unsigned int t = BMP280_T_MEAS_BASE_US + os_t * BMP280_T_MEAS_PER_OS_US;
+	if(os_p)
+		t += os_p * BMP280_T_MEAS_PER_OS_US + BMP280_T_MEAS_P_US;
+	return t;
+}
+
+/* Conversion period: measurement time, plus standby in normal mode */
+static unsigned int bmp280_period_us(struct sensor_bmp280 *bmp280)
+{
+	unsigned int t = bmp280_measure_time_us(bmp280->ctrl_meas);
+	if(obc_field_get(&bmp280_fields[BMP280_MODE], bmp280->ctrl_meas) != MODE_FORCED)
+		t += obc_field_value(&bmp280_fields[BMP280_T_SB], bmp280->config);
+	return t;
+}
+
+/*
+ * Writes CTRL_MEAS and CONFIG. CONFIG writes may be ignored in normal
+ * mode, so the device is put to sleep first. In forced mode the device
+ * is left asleep until the next measurement.
+ */
+static int bmp280_write_config(struct sensor_bmp280 *bmp280, u8 ctrl_meas, u8 config)
+{
+	int err;
+	err = bmp280_write_retry(bmp280, &bmp280_config_req, CTRL_MEAS,
+			(ctrl_meas & ~MODE_MASK) | MODE_SLEEP);
+	if(!err)
+		err = bmp280_write_retry(bmp280, &bmp280_config_req, CONFIG, config);
+	if(!err && (ctrl_meas & MODE_MASK) != MODE_FORCED)
+		err = bmp280_write_retry(bmp280, &bmp280_config_req, CTRL_MEAS, ctrl_meas);
+	return err;
+}
+
+/* Writes the shadow registers */
+static int bmp280_apply(struct sensor_bmp280 *bmp280)
+{
+	return bmp280_write_config(bmp280, bmp280->ctrl_meas, bmp280->config);
+}
+
+/*
+ * In forced mode each measurement triggers one conversion and sleeps for
+ * exactly the datasheet conversion time of the configured oversampling.
+ * In normal mode the device converts on its own every t_sb + t_meas and
+ * the latest result is read. Only bus_lock is held across the
+ * conversion, so readers of the last capture do not wait for it.
+ *
+ * Normal mode reads take no bus_lock: a configuration write in between
+ * only costs the device a conversion, the data registers keep the last
+ * result. A sysfs read and a trigger capture due together thus queue on
+ * the bus at the same time and share one transfer.
+ */
+static int bmp280_measure(struct sensor_bmp280 *bmp280, s32 *press, s32 *temp)
+{
+	struct obc_bus_req req;
+	unsigned int t, period_us, polls = 0;
+	u8 status, mode;
+	int err;
+	mutex_lock(&bmp280->lock);
+	mode = bmp280->ctrl_meas & MODE_MASK;
+	period_us = bmp280_period_us(bmp280);
+	mutex_unlock(&bmp280->lock);
+	if(mode != MODE_FORCED)
+		return bmp280_read_raw(bmp280, period_us, press, temp);
+	mutex_lock(&bmp280->bus_lock);
+	/* The shadows hold still under bus_lock; the mode may have changed since */
+	if((bmp280->ctrl_meas & MODE_MASK) == MODE_FORCED){
+		/* Starting the conversion is part of the capture */
+		t = bmp280_measure_time_us(bmp280->ctrl_meas);
+		obc_bus_capture_req(&bmp280->bus, &req, t, NULL, NULL, 0);
+		err = bmp280_write_retry(bmp280, &req, CTRL_MEAS, bmp280->ctrl_meas);
+		if(err)
+			goto out;
+		usleep_range(t, t + 50);
+		/* The datasheet time is a maximum, this normally does not loop */
+		for(;;){
+			obc_bus_capture_req(&bmp280->bus, &req, 0, NULL, NULL, 0);
+			err = bmp280_read_retry(bmp280, &req, STATUS, &status, 1);
+			if(err || !(status & STATUS_MEASURING))
+				break;
+			/* Still converting: the data registers hold the previous result */
+			if(++polls >= 10){
+				err = -ETIMEDOUT;
+				break;
+			}
+			usleep_range(100, 150);
+		}
+		if(err)
+			goto out;
+	}
+	err = bmp280_read_raw(bmp280, bmp280_period_us(bmp280), press, temp);
+out:
+	mutex_unlock(&bmp280->bus_lock);
+	return err;
+}
+
+/* Runs on the BMP280's trigger worker, in parallel with the other sensors */
+static void bmp280_trigger_capture(struct obc_trigger_client *c, u32 set, u64 t_ns)
+{
+	struct sensor_bmp280 *bmp280 = container_of(c, struct sensor_bmp280, trig);
+	struct obc_sample sample;
+	s32 press, temp;
+	int err;
+	err = bmp280_measure(bmp280, &press, &temp);
+	mutex_lock(&bmp280->lock);
+	bmp280->last.t_ns = ktime_get_ns();
+	bmp280->last.dev = bmp280_desc.dev;
+	bmp280->last.seq++;
+	bmp280->last.set = set;
+	bmp280->last.flags = 0;
+	if(err){
+		bmp280->last.flags |= OBC_SAMPLE_STALE;
+		obc_err_stale(&bmp280->err);
+	}else{
+		bmp280->last.v[0] = press;
+		bmp280->last.v[1] = temp;
+	}
+	sample = bmp280->last;
+	mutex_unlock(&bmp280->lock);
+	obc_journal_push(&bmp280->journal, &sample);
+	if(obc_stats_add(&bmp280->stats, &sample))
+		obc_stats_notify(&bmp280->stats);
+}
+
+/* Recent raw reads and the windowed statistics keep the captures running */
+static bool bmp280_trigger_wanted(struct obc_trigger_client *c)
+{
+	struct sensor_bmp280 *bmp280 = container_of(c, struct sensor_bmp280, trig);
+	return time_before(jiffies, READ_ONCE(bmp280->demand_until)) ||
+		obc_stats_enabled(&bmp280->stats);
+}
+
+/*
+ * On the trigger, the last capture is returned if it is younger than two
+ * capture periods; the first read after an idle spell measures directly
+ * and keeps the trigger captures running for BMP280_DEMAND_MS. In forced
+ * mode every capture is a conversion, so the captures follow the interval
+ * between reads rather than the conversion time.
+ */
+static int bmp280_latest(struct sensor_bmp280 *bmp280, s32 *press, s32 *temp)
+{
+	unsigned int period_us;
+	u64 now_ns, max_age_ns;
+	int err = -EAGAIN;
+	if(!bmp280->trig.worker)
+		return bmp280_measure(bmp280, press, temp);
+	WRITE_ONCE(bmp280->demand_until, jiffies + msecs_to_jiffies(BMP280_DEMAND_MS));
+	now_ns = ktime_get_ns();
+	mutex_lock(&bmp280->lock);
+	if((bmp280->ctrl_meas & MODE_MASK) == MODE_FORCED){
+		period_us = min_t(u64, div_u64(now_ns - bmp280->read_ns, NSEC_PER_USEC),
+				BMP280_DEMAND_MS * USEC_PER_MSEC);
+		WRITE_ONCE(bmp280->trig.period_us, max(period_us, bmp280_period_us(bmp280)));
+	}
+	bmp280->read_ns = now_ns;
+	max_age_ns = 2ULL * max(bmp280->trig.period_us, obc_trigger_period_us()) * NSEC_PER_USEC;
+	if(bmp280->last.seq && !(bmp280->last.flags & OBC_SAMPLE_STALE) &&
+			now_ns - bmp280->last.t_ns < max_age_ns){
+		*press = bmp280->last.v[0];
+		*temp = bmp280->last.v[1];
+		err = 0;
+	}
+	mutex_unlock(&bmp280->lock);
+	if(err)
+		err = bmp280_measure(bmp280, press, temp);
+	return err;
+}
+
+static ssize_t bmp280_get_raw(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct sensor_bmp280 *bmp280 = dev_get_drvdata(dev);
+	s32 press, temp;
+	int err = obc_probe_wait(&bmp280->probe);
+	if(!err)
+		err = bmp280_latest(bmp280, &press, &temp);
+	if(err)
+		return err;
+	return sprintf(buf, "%d %d\n", press, temp);
+}
+
+/* Pressure in Pa and temperature in 0.01 degC, from the same reading as raw */
+static ssize_t bmp280_get_compensated(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct sensor_bmp280 *bmp280 = dev_get_drvdata(dev);
+	s32 press, temp, t_fine;
+	int err = obc_probe_wait(&bmp280->probe);
+	if(!err)
+		err = bmp280_latest(bmp280, &press, &temp);
+	if(err)
+		return err;
+	temp = bmp280_compensate_t(&bmp280->calib, temp, &t_fine);
+	return sprintf(buf, "%u %d\n", (bmp280_compensate_p(&bmp280->calib, press, t_fine) + 128) >> 8, temp);
+}
+
+static u8 *bmp280_shadow(struct sensor_bmp280 *bmp280, const struct obc_field *f)
+{
+	return f->reg == CONFIG ? &bmp280->config : &bmp280->ctrl_meas;
+}
+
+static unsigned int bmp280_field(struct sensor_bmp280 *bmp280, int field)
+{
+	const struct obc_field *f = &bmp280_fields[field];
+	return obc_field_value(f, *bmp280_shadow(bmp280, f));
+}
+
+/*
+ * Checks a CTRL_MEAS and CONFIG pair from sysfs or a stored configuration
+ * before the device or the shadows take it. Mode 2 is forced mode too and
+ * becomes MODE_FORCED; sleep is refused, it would stop the measurements.
+ * Temperature cannot be skipped, the pressure compensation needs it.
+ */
+static int bmp280_check_config(u8 *ctrl_meas, u8 config)
+{
+	const struct obc_field *f = bmp280_fields;
+	unsigned int os_t = obc_field_get(&f[BMP280_OSRS_T], *ctrl_meas);
+	switch(obc_field_get(&f[BMP280_MODE], *ctrl_meas)){
+	case MODE_SLEEP:
+		return -EINVAL;
+	case MODE_NORMAL:
+		break;
+	default:
+		obc_field_set(&f[BMP280_MODE], ctrl_meas, MODE_FORCED);
+	}
+	if(!os_t || !obc_field_valid(&f[BMP280_OSRS_T], os_t) ||
+			!obc_field_valid(&f[BMP280_OSRS_P], obc_field_get(&f[BMP280_OSRS_P], *ctrl_meas)) ||
+			!obc_field_valid(&f[BMP280_FILTER], obc_field_get(&f[BMP280_FILTER], config)))
+		return -EINVAL;
+	return 0;
+}
+
+/*
+ * Writes a field to the device; the shadow registers and the trigger
+ * period follow only once the device has taken it. On a failed write the
+ * device is put back to the shadow values.
+ */
+static ssize_t bmp280_store_field(struct device *dev, int field, int code, size_t count)
+{
+	struct sensor_bmp280 *bmp280 = dev_get_drvdata(dev);
+	const struct obc_field *f = &bmp280_fields[field];
+	u8 ctrl_meas, config;
+	int err = obc_probe_wait(&bmp280->probe);
+	if(err)
+		return err;
+	if(code < 0)
+		return code;
+	mutex_lock(&bmp280->bus_lock);
+	ctrl_meas = bmp280->ctrl_meas;
+	config = bmp280->config;
+	err = obc_field_set(f, f->reg == CONFIG ? &config : &ctrl_meas, code);
+	if(!err)
+		err = bmp280_check_config(&ctrl_meas, config);
+	if(err)
+		goto out;
+	err = bmp280_write_config(bmp280, ctrl_meas, config);
+	if(err){
+		if(bmp280_apply(bmp280))
+			printk(KERN_DEBUG "BMP280: Cannot restore configuration\n");
+		goto out;
+	}
+	mutex_lock(&bmp280->lock);
+	bmp280->ctrl_meas = ctrl_meas;
+	bmp280->config = config;
+	WRITE_ONCE(bmp280->trig.period_us, bmp280_period_us(bmp280));
+	mutex_unlock(&bmp280->lock);
+out:
+	mutex_unlock(&bmp280->bus_lock);
+	return err ? err : count;
+}
+
+static ssize_t bmp280_get_os_p(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	struct sensor_bmp280 *bmp280 = dev_get_drvdata(dev);
+	return sprintf(buf, "%u\n", bmp280_field(bmp280, BMP280_OSRS_P));
+}
+
+static ssize_t bmp280_set_os_p(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+{
+	struct sensor_bmp280 *bmp280 = dev_get_drvdata(dev);
+	unsigned long val;
+	if(kstrtoul(buf, 10, &val))
+		return -EINVAL;
+	return bmp280_store_field(dev, BMP280_OSRS_P,
+			obc_field_code(&bmp280_fields[BMP280_OSRS_P], val), count);
+}
+
+static ssize_t bmp280_get_os_t(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	struct sensor_bmp280 *bmp280 = dev_get_drvdata(dev);
+	return sprintf(buf, "%u\n", bmp280_field(bmp280, BMP280_OSRS_T));
+}
+
+static ssize_t bmp280_set_os_t(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+{
+	struct sensor_bmp280 *bmp280 = dev_get_drvdata(dev);
+	unsigned long val;
+	if(kstrtoul(buf, 10, &val))
+		return -EINVAL;
+	return bmp280_store_field(dev, BMP280_OSRS_T,
+			obc_field_code(&bmp280_fields[BMP280_OSRS_T], val), count);
+}
+
+static ssize_t bmp280_get_filter(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	struct sensor_bmp280 *bmp280 = dev_get_drvdata(dev);
+	return sprintf(buf, "%u\n", bmp280_field(bmp280, BMP280_FILTER));
+}
+
+static ssize_t bmp280_set_filter(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+{
+	struct sensor_bmp280 *bmp280 = dev_get_drvdata(dev);
+	unsigned long val;
+	if(kstrtoul(buf, 10, &val))
+		return -EINVAL;
+	return bmp280_store_field(dev, BMP280_FILTER,
+			obc_field_code(&bmp280_fields[BMP280_FILTER], val), count);
+}
+
+static ssize_t bmp280_get_mode(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	struct sensor_bmp280 *bmp280 = dev_get_drvdata(dev);
+	return sprintf(buf, "%s\n", bmp280_field(bmp280, BMP280_MODE) == MODE_FORCED ? "forced" : "normal");
+}
+
+static ssize_t bmp280_set_mode(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+{
+	struct sensor_bmp280 *bmp280 = dev_get_drvdata(dev);
+	int mode;
+	if(sysfs_streq(buf, "forced"))
+		mode = MODE_FORCED;
+	else if(sysfs_streq(buf, "normal"))
+		mode = MODE_NORMAL;
+	else
+		return -EINVAL;
+	return bmp280_store_field(dev, BMP280_MODE, mode, count);
+}
+
+/* Normal mode conversion period: measurement time plus standby */
+static ssize_t bmp280_get_period(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	struct sensor_bmp280 *bmp280 = dev_get_drvdata(dev);
+	return sprintf(buf, "%u\n", (bmp280_measure_time_us(bmp280->ctrl_meas) +
+			bmp280_field(bmp280, BMP280_T_SB)) / 1000);
+}
+
+/* Rate-limited normal mode: picks the shortest standby giving at least the requested period */
+static ssize_t bmp280_set_period(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+{
+	struct sensor_bmp280 *bmp280 = dev_get_drvdata(dev);
+	unsigned long period_us, t_meas;
+	int code;
+	if(kstrtoul(buf, 10, &period_us))
+		return -EINVAL;
+	period_us *= 1000;
+	t_meas = bmp280_measure_time_us(bmp280->ctrl_meas);
+	code = obc_field_code(&bmp280_fields[BMP280_T_SB], period_us > t_meas ? period_us - t_meas : 0);
+	if(code < 0)
+		code = ARRAY_SIZE(standby_us) - 1;
+	return bmp280_store_field(dev, BMP280_T_SB, code, count);
+}
+
+static ssize_t bmp280_get_measure_time(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	struct sensor_bmp280 *bmp280 = dev_get_drvdata(dev);
+	return sprintf(buf, "%u\n", bmp280_measure_time_us(bmp280->ctrl_meas));
+}
+
+static ssize_t bmp280_probe_timing(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct sensor_bmp280 *bmp280 = dev_get_drvdata(dev);
+	return obc_probe_show(&bmp280->probe, buf);
+}
+
+static ssize_t bmp280_error_stats(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	struct sensor_bmp280 *bmp280 = dev_get_drvdata(dev);
+	return obc_err_show(&bmp280->err, buf);
+}
+
+static ssize_t bmp280_error_policy_get(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	struct sensor_bmp280 *bmp280 = dev_get_drvdata(dev);
+	return obc_err_policy_show(&bmp280->err, buf);
+}
+
+static ssize_t bmp280_error_policy_set(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+{
+	struct sensor_bmp280 *bmp280 = dev_get_drvdata(dev);
+	return obc_err_policy_store(&bmp280->err, buf, count);
+}
+
+static ssize_t bmp280_stats(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	struct sensor_bmp280 *bmp280 = dev_get_drvdata(dev);
+	return obc_stats_show(&bmp280->stats, buf);
+}
+
+static ssize_t bmp280_stats_window_get(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	struct sensor_bmp280 *bmp280 = dev_get_drvdata(dev);
+	return obc_stats_window_show(&bmp280->stats, buf);
+}
+
+/* Windows fill from the trigger captures, so they need trigger=1 */
+static ssize_t bmp280_stats_window_set(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+{
+	struct sensor_bmp280 *bmp280 = dev_get_drvdata(dev);
+	unsigned int ms;
+	if(kstrtouint(buf, 0, &ms))
+		return -EINVAL;
+	if(ms && !trigger)
+		return -EOPNOTSUPP;
+	obc_stats_set_window(&bmp280->stats, ms);
+	return count;
+}
+
+static ssize_t bmp280_bus_class_get(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	struct sensor_bmp280 *bmp280 = dev_get_drvdata(dev);
+	return obc_bus_class_show(&bmp280->bus, buf);
+}
+
+/* Bus priority of the measurements: control, stream or housekeeping */
+static ssize_t bmp280_bus_class_set(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+{
+	struct sensor_bmp280 *bmp280 = dev_get_drvdata(dev);
+	return obc_bus_class_store(&bmp280->bus, buf, count);
+}
+
+static ssize_t bmp280_sched_get(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	struct sensor_bmp280 *bmp280 = dev_get_drvdata(dev);
+	return obc_sched_show(&bmp280->sched, buf);
+}
+
+/* Policy of the trigger worker: "other", "fifo <prio>" or "rr <prio>" */
+static ssize_t bmp280_sched_set(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+{
+	struct sensor_bmp280 *bmp280 = dev_get_drvdata(dev);
+	return obc_sched_store(&bmp280->sched, buf, count);
+}
+
+static ssize_t bmp280_sched_cpus_get(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	struct sensor_bmp280 *bmp280 = dev_get_drvdata(dev);
+	return obc_sched_cpus_show(&bmp280->sched, buf);
+}
+
+/* CPUs the trigger worker may run on, as a CPU list */
+static ssize_t bmp280_sched_cpus_set(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+{
+	struct sensor_bmp280 *bmp280 = dev_get_drvdata(dev);
+	return obc_sched_cpus_store(&bmp280->sched, buf, count);
+}
+
+/* Trigger to measurement start, in power of two us buckets; writing clears it */
+static ssize_t bmp280_latency_get(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	struct sensor_bmp280 *bmp280 = dev_get_drvdata(dev);
+	return obc_sched_hist_show(&bmp280->sched, buf);
+}
+
+static ssize_t bmp280_latency_clear(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+{
+	struct sensor_bmp280 *bmp280 = dev_get_drvdata(dev);
+	return obc_sched_hist_clear(&bmp280->sched, count);
+}
+
+static ssize_t bmp280_stats_bin(struct file *filp, struct kobject *kobj, struct bin_attribute *attr,
+		char *buf, loff_t off, size_t count)
+{
+	struct sensor_bmp280 *bmp280 = dev_get_drvdata(container_of(kobj, struct device, kobj));
+	return obc_stats_read_bin(&bmp280->stats, buf, off, count);
+}
+
+static DEVICE_ATTR(id, 0444, bmp280_get_id, NULL);
+static DEVICE_ATTR(raw, 0444, bmp280_get_raw, NULL);
+static DEVICE_ATTR(compensated, 0444, bmp280_get_compensated, NULL);
+static DEVICE_ATTR(oversampling_pressure, 0664, bmp280_get_os_p, bmp280_set_os_p);
+static DEVICE_ATTR(oversampling_temperature, 0664, bmp280_get_os_t, bmp280_set_os_t);
+static DEVICE_ATTR(filter, 0664, bmp280_get_filter, bmp280_set_filter);
+static DEVICE_ATTR(mode, 0664, bmp280_get_mode, bmp280_set_mode);
+static DEVICE_ATTR(period_ms, 0664, bmp280_get_period, bmp280_set_period);
+static DEVICE_ATTR(measure_time_us, 0444, bmp280_get_measure_time, NULL);
+static DEVICE_ATTR(probe_timing, 0444, bmp280_probe_timing, NULL);
+static DEVICE_ATTR(error_stats, 0444, bmp280_error_stats, NULL);
+static DEVICE_ATTR(error_policy, 0664, bmp280_error_policy_get, bmp280_error_policy_set);
+static DEVICE_ATTR(stats, 0444, bmp280_stats, NULL);
+static DEVICE_ATTR(stats_window_ms, 0664, bmp280_stats_window_get, bmp280_stats_window_set);
+static DEVICE_ATTR(bus_class, 0664, bmp280_bus_class_get, bmp280_bus_class_set);
+static DEVICE_ATTR(sched_policy, 0664, bmp280_sched_get, bmp280_sched_set);
+static DEVICE_ATTR(sched_cpus, 0664, bmp280_sched_cpus_get, bmp280_sched_cpus_set);
+static DEVICE_ATTR(wakeup_latency, 0664, bmp280_latency_get, bmp280_latency_clear);
+static BIN_ATTR(stats_bin, 0444, bmp280_stats_bin, NULL,
+		OBC_STATS_HISTORY * sizeof(struct obc_stats_window));
+
+static struct device_attribute *bmp280_attr_list[] = {
+	&dev_attr_id,
+	&dev_attr_raw,
+	&dev_attr_compensated,
+	&dev_attr_oversampling_pressure,
+	&dev_attr_oversampling_temperature,
+	&dev_attr_filter,
+	&dev_attr_mode,
+	&dev_attr_period_ms,
+	&dev_attr_measure_time_us,
+	&dev_attr_probe_timing,
+	&dev_attr_error_stats,
+	&dev_attr_error_policy,
+	&dev_attr_stats,
+	&dev_attr_stats_window_ms,
+	&dev_attr_bus_class,
+	&dev_attr_sched_policy,
+	&dev_attr_sched_cpus,
+	&dev_attr_wakeup_latency,
+};
+
+static void bmp280_create_attr(struct device *dev)
+{
+	int i;
+	for(i = 0; i < ARRAY_SIZE(bmp280_attr_list); i++)
+		if(device_create_file(dev, bmp280_attr_list[i]) < 0)
+			printk(KERN_DEBUG "BMP280: Error creating attribute file\n");
+	if(device_create_bin_file(dev, &bin_attr_stats_bin) < 0)
+		printk(KERN_DEBUG "BMP280: Error creating attribute file\n");
+}
+
+static void bmp280_remove_attr(struct device *dev)
+{
+	int i;
+	for(i = 0; i < ARRAY_SIZE(bmp280_attr_list); i++)
+		device_remove_file(dev, bmp280_attr_list[i]);
+	device_remove_bin_file(dev, &bin_attr_stats_bin);
+}
+
+/* Waits for the NVM copy that follows a soft reset to finish */
+static int bmp280_wait_reset(struct spi_device *spi)
+{
+	int status, waited = 0;
+	usleep_range(bmp280_desc.reset_us / 4, bmp280_desc.reset_us / 4 + 100);
+	for(;;){
+		status = spi_w8r8(spi, RD_ADDRESS | STATUS);
+		if(status >= 0 && !(status & STATUS_IM_UPDATE) && bmp280_id(spi) == bmp280_desc.id)
+			return 0;
+		if(waited >= bmp280_desc.reset_us)
+			return status < 0 ? status : -ETIMEDOUT;
+		usleep_range(200, 300);
+		waited += 200;
+	}
+}
+
+static void bmp280_config_save(struct obc_config_client *c, void *data)
+{
+	struct sensor_bmp280 *bmp280 = container_of(c, struct sensor_bmp280, config_client);
+	struct obc_config_bmp280 *cfg = data;
+	mutex_lock(&bmp280->lock);
+	cfg->ctrl_meas = bmp280->ctrl_meas;
+	cfg->config = bmp280->config;
+	mutex_unlock(&bmp280->lock);
+}
+
+static int bmp280_config_load(struct obc_config_client *c, const void *data)
+{
+	struct sensor_bmp280 *bmp280 = container_of(c, struct sensor_bmp280, config_client);
+	const struct obc_config_bmp280 *cfg = data;
+	u8 ctrl_meas = cfg->ctrl_meas;
+	int err = bmp280_check_config(&ctrl_meas, cfg->config);
+	if(err)
+		return err;
+	mutex_lock(&bmp280->bus_lock);
+	mutex_lock(&bmp280->lock);
+	bmp280->ctrl_meas = ctrl_meas;
+	bmp280->config = cfg->config;
+	WRITE_ONCE(bmp280->trig.period_us, bmp280_period_us(bmp280));
+	mutex_unlock(&bmp280->lock);
+	mutex_unlock(&bmp280->bus_lock);
+	return 0;
+}
+
+static int bmp280_config_apply(struct obc_config_client *c)
+{
+	struct sensor_bmp280 *bmp280 = container_of(c, struct sensor_bmp280, config_client);
+	int err = obc_probe_wait(&bmp280->probe);
+	if(err)
+		return err;
+	mutex_lock(&bmp280->bus_lock);
+	err = bmp280_apply(bmp280);
+	mutex_unlock(&bmp280->bus_lock);
+	return err;
+}
+
+static void bmp280_config_work(struct work_struct *work)
+{
+	struct sensor_bmp280 *bmp280 = container_of(work, struct sensor_bmp280, config_work);
+	struct spi_device *spi = bmp280->spi;
+	u8 calib[BMP280_CALIB_LEN];
+	int err;
+	err = bmp280_wait_reset(spi);
+	if(err){
+		printk(KERN_DEBUG "BMP280: Reset did not complete\n");
+		obc_probe_done(&bmp280->probe, err);
+		return;
+	}
+	obc_probe_mark(&bmp280->probe, OBC_PROBE_RESET);
+	/* A stored configuration replaces NORMAL_CTRL and NORMAL_CONFIG */
+	obc_config_fetch(&bmp280->config_client, &spi->dev);
+	mutex_lock(&bmp280->bus_lock);
+	err = bmp280_read_retry(bmp280, &bmp280_config_req, BMP280_CALIB_START, calib, BMP280_CALIB_LEN);
+	if(!err){
+		bmp280_calib_parse(&bmp280->calib, calib);
+		obc_trace_calib(bmp280_desc.dev, BMP280_CALIB_START, calib, BMP280_CALIB_LEN);
+		err = bmp280_apply(bmp280);
+	}
+	mutex_unlock(&bmp280->bus_lock);
+	if(err){
+		printk(KERN_DEBUG "BMP280: Cannot configure device\n");
+		obc_probe_done(&bmp280->probe, err);
+		return;
+	}
+	obc_probe_mark(&bmp280->probe, OBC_PROBE_CONFIG);
+	if(trigger){
+		/* Every n-th tick, n following the conversion period or, in forced mode, the reads */
+		bmp280->trig.name = bmp280_desc.name;
+		bmp280->trig.capture = bmp280_trigger_capture;
+		bmp280->trig.wanted = bmp280_trigger_wanted;
+		bmp280->trig.period_us = bmp280_period_us(bmp280);
+		bmp280->trig.sched = &bmp280->sched;
+		err = obc_trigger_register(&bmp280->trig);
+		if(err)
+			printk(KERN_DEBUG "BMP280: Not on the common trigger, measuring on demand\n");
+	}
+	obc_probe_done(&bmp280->probe, 0);
+	printk(KERN_DEBUG "BMP280: Ready after %lld us\n", bmp280->probe.stage_us[OBC_PROBE_READY]);
+}
 
 static int bmp280_probe(struct spi_device *spi)
 {
+	struct sensor_bmp280 *bmp280;
+	int err;
 	printk(KERN_DEBUG "BMP280: Probe called\n");
-	u8 id;
-	u8 temp[2];
-	u8 pressure[2];
+	bmp280 = devm_kzalloc(&spi->dev, sizeof(*bmp280), GFP_KERNEL);
+	if(!bmp280)
+		return -ENOMEM;
+	obc_probe_init(&bmp280->probe);
+	obc_probe_start(&bmp280->probe);
+	obc_err_init(&bmp280->err);
+	bmp280->spi = spi;
+	mutex_init(&bmp280->bus_lock);
+	mutex_init(&bmp280->lock);
+	obc_stats_init(&bmp280->stats, &spi->dev, bmp280_desc.dev, 2);
+	obc_sched_init(&bmp280->sched);
+	bmp280->bus.capture_class = OBC_BUS_STREAM;
+	bmp280->ctrl_meas = NORMAL_CTRL;
+	bmp280->config = NORMAL_CONFIG;
+	bmp280->config_client.name = bmp280_desc.name;
+	bmp280->config_client.dev = OBC_DEV_BMP280;
+	bmp280->config_client.version = OBC_CONFIG_BMP280_VERSION;
+	bmp280->config_client.size = sizeof(struct obc_config_bmp280);
+	bmp280->config_client.save = bmp280_config_save;
+	bmp280->config_client.load = bmp280_config_load;
+	bmp280->config_client.apply = bmp280_config_apply;
+	spi_set_drvdata(spi, bmp280);
 	spi->max_speed_hz = 5000000;
 	spi->bits_per_word = 8;
 	spi->mode = SPI_MODE_0;
-	spi_setup(spi);
-	bmp280_write(spi, RESET, TO_RESET);
-	bmp280_write(spi, CONFIG, NORMAL_CONFIG);
-	bmp280_write(spi, CTRL_MEAS, NORMAL_CTRL);
-	device_create_file( spi->device, &dev_attr_id);
+	err = spi_setup(spi);
+	if(!err)
+		err = bmp280_write(spi, RESET, TO_RESET);
+	if(err){
+		printk(KERN_DEBUG "BMP280: Cannot reset device\n");
+		return err;
+	}
+	/* Without a bus queue the transfers still run, unscheduled */
+	if(obc_bus_attach(&bmp280->bus, &spi->master->dev))
+		printk(KERN_DEBUG "BMP280: Cannot attach to the bus scheduler\n");
+	obc_trace_layout(bmp280_desc.dev, bmp280_desc.layout);
+	/* One partition per device type, a second BMP280 goes unjournaled */
+	obc_journal_attach(&bmp280->journal, bmp280_desc.dev);
+	bmp280_create_attr(&spi->dev);
+	obc_config_register(&bmp280->config_client);
+	/* Reset completion and configuration run in the background */
+	INIT_WORK(&bmp280->config_work, bmp280_config_work);
+	queue_work(system_unbound_wq, &bmp280->config_work);
 	return 0;
 	}
 	
 static int bmp280_remove(struct spi_device *spi)
 {
+	struct sensor_bmp280 *bmp280 = spi_get_drvdata(spi);
+	cancel_work_sync(&bmp280->config_work);
+	obc_config_unregister(&bmp280->config_client);
+	obc_trigger_unregister(&bmp280->trig);
+	bmp280_remove_attr(&spi->dev);
+	obc_journal_detach(&bmp280->journal);
+	obc_bus_detach(&bmp280->bus);
+	obc_trace_layout(bmp280_desc.dev, NULL);
 	return 0;
 	}
 
@@ -79,6 +913,7 @@ static struct spi_driver bmp280_driver = {
 		.name = SENSOR_ID,
 		.owner = THIS_MODULE,
 		.of_match_table = bmp280_of_match,
+		.probe_type = PROBE_PREFER_ASYNCHRONOUS,
 	},
 	.probe = bmp280_probe,
 	.remove = bmp280_remove,
@@ -0,0 +1,55 @@
+#define ID 0xD0
+#define RESET 0xE0
+#define STATUS 0xF3
+	#define STATUS_MEASURING 1<<3
+	#define STATUS_IM_UPDATE 1<<0
+#define CTRL_MEAS 0xF4
+	#define OSRS_T_OFFSET 5
+	#define OSRS_P_OFFSET 2
+	#define OSRS_MASK 0x7
+	#define MODE_MASK 0x3
+		#define MODE_SLEEP 0x0
+		#define MODE_FORCED 0x1
+		#define MODE_NORMAL 0x3
+#define CONFIG 0xF5
+	#define T_SB_OFFSET 5
+	#define T_SB_MASK 0x7
+	#define FILTER_OFFSET 2
+	#define FILTER_MASK 0x7
+#define PRESS_MSB 0xF7
+#define TEMP_MSB 0xFA
+
+#define ID_BMP280 0x58
+#define TO_RESET 0xB6
+#define NORMAL_CONFIG 0x10 // t_sb 0.5 ms, IIR filter 16
+#define NORMAL_CTRL 0x57 // osrs_t x2, osrs_p x16, normal mode
+
+#define RD_ADDRESS 0x80
+#define WR_ADDRESS 0x7F
+
+/* Datasheet start-up time after power-on or soft reset */
+#define BMP280_RESET_US 2000
+
+/* Maximum measurement time: 1.25 ms + 2.3 ms per oversampled T/P conversion + 0.575 ms with P */
+#define BMP280_T_MEAS_BASE_US 1250
+#define BMP280_T_MEAS_PER_OS_US 2300
+#define BMP280_T_MEAS_P_US 575
+
+/* Trigger captures keep running this long after the last raw read */
+#define BMP280_DEMAND_MS 1000
+
+#define SENSOR_ID "bmp280"
+
+#include <linux/types.h>
+#include "obc_desc.h"
+#include "obc_baro.h"
+
+/* 20-bit pressure then temperature, MSB first */
+static const struct obc_layout bmp280_layout = {
+	.reg = PRESS_MSB,
+	.len = 6,
+	.channels = 2,
+	.width = 20,
+	.endian = OBC_BE,
+	.offset = { 0, 3 },
+};
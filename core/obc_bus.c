@@ -0,0 +1,257 @@
+/* Per-bus transaction scheduler: class and deadline ordered grants, merged reads */
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/device.h>
+#include <linux/slab.h>
+#include <linux/list.h>
+#include <linux/mutex.h>
+#include <linux/spinlock.h>
+#include <linux/completion.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+
+#include "obc_bus.h"
+#include "obc_core.h"
+
+/* Deadline of a transaction that does not give one, from its queueing time */
+static const unsigned int obc_bus_budget_us[OBC_BUS_CLASSES] = {
+	[OBC_BUS_CONTROL] = 2000,
+	[OBC_BUS_STREAM] = 10000,
+	[OBC_BUS_HOUSEKEEPING] = 100000,
+};
+
+struct obc_bus_stat {
+	u64 count;		/* transactions run */
+	u64 merged;		/* reads served by an identical queued one */
+	u64 late;		/* granted after their deadline */
+	u64 wait_sum_ns;	/* queueing delay */
+	u64 wait_max_ns;
+};
+
+struct obc_bus {
+	struct list_head node;
+	struct device *ctrl;
+	unsigned int users;
+	spinlock_t lock;
+	bool busy;
+	struct list_head queue;	/* waiting transactions */
+	struct obc_bus_stat stat[OBC_BUS_CLASSES];
+};
+
+struct obc_bus_txn {
+	struct list_head node;
+	struct list_head merged;	/* callers waiting for this one's data */
+	const struct obc_bus_req *req;
+	u8 class;
+	u64 queued_ns;
+	u64 deadline_ns;
+	int result;
+	struct completion done;	/* granted, or for a merged read finished */
+};
+
+static DEFINE_MUTEX(obc_bus_list_lock);
+static LIST_HEAD(obc_bus_list);
+
+int obc_bus_attach(struct obc_bus_client *c, struct device *ctrl)
+{
+	struct obc_bus *bus;
+	mutex_lock(&obc_bus_list_lock);
+	list_for_each_entry(bus, &obc_bus_list, node)
+		if(bus->ctrl == ctrl)
+			goto found;
+	bus = kzalloc(sizeof(*bus), GFP_KERNEL);
+	if(!bus){
+		mutex_unlock(&obc_bus_list_lock);
+		return -ENOMEM;
+	}
+	bus->ctrl = get_device(ctrl);
+	spin_lock_init(&bus->lock);
+	INIT_LIST_HEAD(&bus->queue);
+	list_add_tail(&bus->node, &obc_bus_list);
+found:
+	bus->users++;
+	c->bus = bus;
+	mutex_unlock(&obc_bus_list_lock);
+	return 0;
+}
+EXPORT_SYMBOL_GPL(obc_bus_attach);
+
+/* Safe on a client that never attached */
+void obc_bus_detach(struct obc_bus_client *c)
+{
+	struct obc_bus *bus = c->bus;
+	if(!bus)
+		return;
+	mutex_lock(&obc_bus_list_lock);
+	c->bus = NULL;
+	if(!--bus->users){
+		list_del(&bus->node);
+		put_device(bus->ctrl);
+		kfree(bus);
+	}
+	mutex_unlock(&obc_bus_list_lock);
+}
+EXPORT_SYMBOL_GPL(obc_bus_detach);
+
+/* Overdue housekeeping competes with streaming */
+static unsigned int obc_bus_rank(const struct obc_bus_txn *t, u64 now)
+{
+	if(t->class == OBC_BUS_HOUSEKEEPING && now > t->deadline_ns)
+		return OBC_BUS_STREAM;
+	return t->class;
+}
+
+static bool obc_bus_before(const struct obc_bus_txn *a, const struct obc_bus_txn *b, u64 now)
+{
+	unsigned int ra = obc_bus_rank(a, now), rb = obc_bus_rank(b, now);
+	if(ra != rb)
+		return ra < rb;
+	return a->deadline_ns < b->deadline_ns;
+}
+
+/* Accounts the grant of t. Called with the bus lock held */
+static void obc_bus_account(struct obc_bus *bus, struct obc_bus_txn *t, u64 now)
+{
+	struct obc_bus_stat *s = &bus->stat[t->class];
+	u64 wait = now - t->queued_ns;
+	s->count++;
+	s->wait_sum_ns += wait;
+	s->wait_max_ns = max(s->wait_max_ns, wait);
+	if(now > t->deadline_ns)
+		s->late++;
+}
+
+/* Hands the bus to the most urgent waiter, or frees it */
+static void obc_bus_release(struct obc_bus *bus)
+{
+	struct obc_bus_txn *t, *next = NULL;
+	unsigned long flags;
+	u64 now = ktime_get_ns();
+	spin_lock_irqsave(&bus->lock, flags);
+	list_for_each_entry(t, &bus->queue, node)
+		if(!next || obc_bus_before(t, next, now))
+			next = t;
+	if(next){
+		list_del_init(&next->node);
+		obc_bus_account(bus, next, now);
+		complete(&next->done);
+	}else{
+		bus->busy = false;
+	}
+	spin_unlock_irqrestore(&bus->lock, flags);
+}
+
+int __obc_bus_run(struct obc_bus_client *c, const struct obc_bus_req *req,
+		int (*xfer)(void *ctx), void *ctx)
+{
+	struct obc_bus *bus = c->bus;
+	struct obc_bus_txn txn, *t, *tmp;
+	unsigned long flags;
+	LIST_HEAD(merged);
+
+	INIT_LIST_HEAD(&txn.merged);
+	init_completion(&txn.done);
+	txn.req = req;
+	txn.class = min_t(unsigned int, req->class, OBC_BUS_HOUSEKEEPING);
+	txn.queued_ns = ktime_get_ns();
+	txn.deadline_ns = req->deadline_ns ? req->deadline_ns :
+		txn.queued_ns + (u64)obc_bus_budget_us[txn.class] * NSEC_PER_USEC;
+	txn.result = 0;
+
+	spin_lock_irqsave(&bus->lock, flags);
+	if(req->key){
+		list_for_each_entry(t, &bus->queue, node){
+			if(t->req->key != req->key || t->req->len != req->len)
+				continue;
+			/* The queued read takes on the more urgent class and deadline */
+			t->class = min(t->class, txn.class);
+			t->deadline_ns = min(t->deadline_ns, txn.deadline_ns);
+			list_add_tail(&txn.node, &t->merged);
+			bus->stat[txn.class].merged++;
+			spin_unlock_irqrestore(&bus->lock, flags);
+			wait_for_completion(&txn.done);
+			return txn.result;
+		}
+	}
+	if(!bus->busy){
+		bus->busy = true;
+		obc_bus_account(bus, &txn, txn.queued_ns);
+	}else{
+		list_add_tail(&txn.node, &bus->queue);
+		spin_unlock_irqrestore(&bus->lock, flags);
+		wait_for_completion(&txn.done);
+		spin_lock_irqsave(&bus->lock, flags);
+	}
+	/* Granted: no read can join this one any more */
+	list_splice_init(&txn.merged, &merged);
+	spin_unlock_irqrestore(&bus->lock, flags);
+
+	txn.result = xfer(ctx);
+	obc_bus_release(bus);
+
+	list_for_each_entry_safe(t, tmp, &merged, node){
+		if(txn.result >= 0 && t->req->data)
+			memcpy(t->req->data, req->data, req->len);
+		t->result = txn.result;
+		complete(&t->done);
+	}
+	return txn.result;
+}
+EXPORT_SYMBOL_GPL(__obc_bus_run);
+
+/* Per bus and class: transactions, merged reads, late grants, mean and max queueing delay */
+static ssize_t obc_bus_get_stats(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	struct obc_bus_stat s;
+	struct obc_bus *bus;
+	unsigned long flags;
+	unsigned int i;
+	ssize_t len = 0;
+	mutex_lock(&obc_bus_list_lock);
+	list_for_each_entry(bus, &obc_bus_list, node){
+		len += scnprintf(buf + len, PAGE_SIZE - len, "%s users %u\n",
+				dev_name(bus->ctrl), bus->users);
+		for(i = 0; i < OBC_BUS_CLASSES; i++){
+			spin_lock_irqsave(&bus->lock, flags);
+			s = bus->stat[i];
+			spin_unlock_irqrestore(&bus->lock, flags);
+			len += scnprintf(buf + len, PAGE_SIZE - len,
+					"  %s count %llu merged %llu late %llu wait_avg_us %llu wait_max_us %llu\n",
+					obc_bus_class_names[i], s.count, s.merged, s.late,
+					s.count ? div64_u64(s.wait_sum_ns, s.count * NSEC_PER_USEC) : 0,
+					div_u64(s.wait_max_ns, NSEC_PER_USEC));
+		}
+	}
+	mutex_unlock(&obc_bus_list_lock);
+	return len;
+}
+
+/* Any write clears the statistics */
+static ssize_t obc_bus_clear_stats(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+{
+	struct obc_bus *bus;
+	unsigned long flags;
+	mutex_lock(&obc_bus_list_lock);
+	list_for_each_entry(bus, &obc_bus_list, node){
+		spin_lock_irqsave(&bus->lock, flags);
+		memset(bus->stat, 0, sizeof(bus->stat));
+		spin_unlock_irqrestore(&bus->lock, flags);
+	}
+	mutex_unlock(&obc_bus_list_lock);
+	return count;
+}
+
+static DEVICE_ATTR(bus_stats, 0664, obc_bus_get_stats, obc_bus_clear_stats);
+
+int obc_bus_init(struct device *dev)
+{
+	if(device_create_file(dev, &dev_attr_bus_stats) < 0)
+		printk(KERN_DEBUG "OBC: Error creating attribute file\n");
+	return 0;
+}
+
+void obc_bus_exit(struct device *dev)
+{
+	device_remove_file(dev, &dev_attr_bus_stats);
+}
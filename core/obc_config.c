@@ -0,0 +1,187 @@
+/* Configuration blob: export, bulk apply, and the firmware copy taken at probe */
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/device.h>
+#include <linux/mutex.h>
+#include <linux/list.h>
+#include <linux/crc32.h>
+#include <linux/firmware.h>
+#include <linux/string.h>
+
+#include "obc_config.h"
+#include "obc_core.h"
+
+static DEFINE_MUTEX(obc_config_lock);
+static LIST_HEAD(obc_config_clients);
+
+static u32 obc_config_crc(const u8 *p, size_t len)
+{
+	return crc32_le(~0, p, len) ^ ~0;
+}
+
+/* Checks the header, checksum and section bounds of a blob */
+static int obc_config_check(const u8 *blob, size_t len)
+{
+	const struct obc_config_header *h = (const void *)blob;
+	const struct obc_config_section *s;
+	size_t off = sizeof(*h);
+	unsigned int i;
+	if(len < sizeof(*h) || h->magic != OBC_CONFIG_MAGIC || h->version != OBC_CONFIG_VERSION ||
+			h->size < sizeof(*h) || h->size > len)
+		return -EINVAL;
+	if(obc_config_crc(blob + sizeof(*h), h->size - sizeof(*h)) != h->crc)
+		return -EBADMSG;
+	for(i = 0; i < h->sections; i++){
+		s = (const void *)(blob + off);
+		if(off + sizeof(*s) > h->size || s->len % 4 || off + sizeof(*s) + s->len > h->size)
+			return -EINVAL;
+		off += sizeof(*s) + s->len;
+	}
+	return 0;
+}
+
+/* The client's section of a checked blob, NULL if there is none it can take */
+static const void *obc_config_find(const u8 *blob, const struct obc_config_client *c)
+{
+	const struct obc_config_header *h = (const void *)blob;
+	const struct obc_config_section *s;
+	size_t off = sizeof(*h);
+	unsigned int i;
+	for(i = 0; i < h->sections; i++){
+		s = (const void *)(blob + off);
+		if(s->dev == c->dev && s->version == c->version && s->len == c->size)
+			return s + 1;
+		off += sizeof(*s) + s->len;
+	}
+	return NULL;
+}
+
+/*
+ * Takes the client's section of the firmware blob, if one is installed.
+ * Called from the driver's configuration pass before it writes the
+ * device; returns -ENOENT without a usable section.
+ */
+int obc_config_fetch(struct obc_config_client *c, struct device *dev)
+{
+	const struct firmware *fw;
+	const void *data;
+	int err;
+	err = request_firmware_direct(&fw, OBC_CONFIG_FIRMWARE, dev);
+	if(err)
+		return -ENOENT;
+	err = obc_config_check(fw->data, fw->size);
+	if(err){
+		printk(KERN_DEBUG "OBC: %s is not a valid configuration blob\n", OBC_CONFIG_FIRMWARE);
+	}else{
+		data = obc_config_find(fw->data, c);
+		err = data ? c->load(c, data) : -ENOENT;
+		if(!err)
+			printk(KERN_DEBUG "OBC: %s configured from %s\n", c->name, OBC_CONFIG_FIRMWARE);
+	}
+	release_firmware(fw);
+	return err;
+}
+EXPORT_SYMBOL_GPL(obc_config_fetch);
+
+void obc_config_register(struct obc_config_client *c)
+{
+	mutex_lock(&obc_config_lock);
+	list_add_tail(&c->node, &obc_config_clients);
+	mutex_unlock(&obc_config_lock);
+}
+EXPORT_SYMBOL_GPL(obc_config_register);
+
+/* Waits for an export or bulk apply using the client */
+void obc_config_unregister(struct obc_config_client *c)
+{
+	mutex_lock(&obc_config_lock);
+	list_del(&c->node);
+	mutex_unlock(&obc_config_lock);
+}
+EXPORT_SYMBOL_GPL(obc_config_unregister);
+
+/* The running configuration of every registered sensor, as one blob */
+static ssize_t obc_config_read(struct file *filp, struct kobject *kobj, struct bin_attribute *attr,
+		char *buf, loff_t off, size_t count)
+{
+	struct obc_config_header *h = (void *)buf;
+	struct obc_config_section *s;
+	struct obc_config_client *c;
+	size_t len = sizeof(*h);
+	u16 sections = 0;
+	if(off)
+		return 0;
+	if(count < sizeof(*h))
+		return -EFBIG;
+	mutex_lock(&obc_config_lock);
+	list_for_each_entry(c, &obc_config_clients, node){
+		if(len + sizeof(*s) + c->size > count){
+			mutex_unlock(&obc_config_lock);
+			return -EFBIG;
+		}
+		s = (void *)(buf + len);
+		memset(s, 0, sizeof(*s) + c->size);
+		s->dev = c->dev;
+		s->version = c->version;
+		s->len = c->size;
+		c->save(c, s + 1);
+		len += sizeof(*s) + c->size;
+		sections++;
+	}
+	mutex_unlock(&obc_config_lock);
+	h->magic = OBC_CONFIG_MAGIC;
+	h->version = OBC_CONFIG_VERSION;
+	h->sections = sections;
+	h->size = len;
+	h->crc = obc_config_crc(buf + sizeof(*h), len - sizeof(*h));
+	return len;
+}
+
+/*
+ * Applies a whole blob given in one write. Every sensor with a section
+ * is loaded and reconfigured; the first error is returned, the other
+ * sensors are still applied.
+ */
+static ssize_t obc_config_write(struct file *filp, struct kobject *kobj, struct bin_attribute *attr,
+		char *buf, loff_t off, size_t count)
+{
+	struct obc_config_client *c;
+	const void *data;
+	int err, ret = 0;
+	if(off)
+		return -EINVAL;
+	err = obc_config_check(buf, count);
+	if(err)
+		return err;
+	mutex_lock(&obc_config_lock);
+	list_for_each_entry(c, &obc_config_clients, node){
+		data = obc_config_find(buf, c);
+		if(!data)
+			continue;
+		err = c->load(c, data);
+		if(!err)
+			err = c->apply(c);
+		if(err){
+			printk(KERN_DEBUG "OBC: Cannot apply the configuration of %s\n", c->name);
+			if(!ret)
+				ret = err;
+		}
+	}
+	mutex_unlock(&obc_config_lock);
+	return ret ? ret : count;
+}
+
+static BIN_ATTR(config, 0664, obc_config_read, obc_config_write, OBC_CONFIG_MAX_SIZE);
+
+int obc_config_init(struct device *dev)
+{
+	if(device_create_bin_file(dev, &bin_attr_config) < 0)
+		printk(KERN_DEBUG "OBC: Error creating attribute file\n");
+	return 0;
+}
+
+void obc_config_exit(struct device *dev)
+{
+	device_remove_bin_file(dev, &bin_attr_config);
+}
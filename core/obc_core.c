@@ -0,0 +1,78 @@
+/*
+ * OBC core: services shared by the sensor drivers. The drivers link
+ * against the symbols exported here, so this module is loaded first. Its
+ * attributes live under /sys/devices/obc.
+ */
+
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/device.h>
+#include <linux/err.h>
+
+#include "obc_core.h"
+
+static struct device *obc_core_dev;
+
+static int __init obc_core_init(void)
+{
+	int err;
+	obc_core_dev = root_device_register("obc");
+	if(IS_ERR(obc_core_dev)){
+		printk(KERN_DEBUG "OBC: Cannot register core device\n");
+		return PTR_ERR(obc_core_dev);
+	}
+	err = obc_trigger_init(obc_core_dev);
+	if(err)
+		goto dev;
+	err = obc_gov_init(obc_core_dev);
+	if(err)
+		goto trigger;
+	err = obc_bus_init(obc_core_dev);
+	if(err)
+		goto gov;
+	err = obc_trace_init(obc_core_dev);
+	if(err)
+		goto bus;
+	err = obc_config_init(obc_core_dev);
+	if(err)
+		goto trace;
+	err = obc_snap_init(obc_core_dev);
+	if(err)
+		goto config;
+	err = obc_journal_init(obc_core_dev);
+	if(err)
+		goto snap;
+	return 0;
+snap:
+	obc_snap_exit(obc_core_dev);
+config:
+	obc_config_exit(obc_core_dev);
+trace:
+	obc_trace_exit(obc_core_dev);
+bus:
+	obc_bus_exit(obc_core_dev);
+gov:
+	obc_gov_exit(obc_core_dev);
+trigger:
+	obc_trigger_exit(obc_core_dev);
+dev:
+	root_device_unregister(obc_core_dev);
+	return err;
+}
+
+static void __exit obc_core_exit(void)
+{
+	obc_journal_exit(obc_core_dev);
+	obc_snap_exit(obc_core_dev);
+	obc_config_exit(obc_core_dev);
+	obc_trace_exit(obc_core_dev);
+	obc_bus_exit(obc_core_dev);
+	obc_gov_exit(obc_core_dev);
+	obc_trigger_exit(obc_core_dev);
+	root_device_unregister(obc_core_dev);
+}
+
+module_init(obc_core_init);
+module_exit(obc_core_exit);
+MODULE_LICENSE("GPL v2");
@@ -0,0 +1,22 @@
+/* Parts of the obc_core module, set up in order by obc_core.c */
+#ifndef OBC_CORE_H
+#define OBC_CORE_H
+
+#include <linux/device.h>
+
+int obc_trigger_init(struct device *dev);
+void obc_trigger_exit(struct device *dev);
+int obc_gov_init(struct device *dev);
+void obc_gov_exit(struct device *dev);
+int obc_bus_init(struct device *dev);
+void obc_bus_exit(struct device *dev);
+int obc_trace_init(struct device *dev);
+void obc_trace_exit(struct device *dev);
+int obc_config_init(struct device *dev);
+void obc_config_exit(struct device *dev);
+int obc_snap_init(struct device *dev);
+void obc_snap_exit(struct device *dev);
+int obc_journal_init(struct device *dev);
+void obc_journal_exit(struct device *dev);
+
+#endif
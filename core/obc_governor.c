@@ -0,0 +1,297 @@
+/* Output data rate governor: consumer votes and accelerometer motion pick each sensor's rate */
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/device.h>
+#include <linux/spinlock.h>
+#include <linux/jiffies.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+
+#include "obc_governor.h"
+#include "obc_core.h"
+
+#define OBC_GOV_LOG 32
+
+static bool governor = true;
+module_param(governor, bool, 0644);
+MODULE_PARM_DESC(governor, "Let the governor change sensor output data rates");
+
+struct obc_gov_event {
+	u64 t_ns;
+	const char *name;
+	unsigned int from_mhz;
+	unsigned int to_mhz;
+	const char *reason;
+	int err;
+};
+
+static struct obc_gov{
+	spinlock_t lock;
+	struct list_head clients;
+	bool moving;
+	unsigned long quiet_since;	/* jiffies, activity last above inact */
+	/* Activity is the smoothed sample to sample change of the accelerometer, in counts */
+	unsigned int act;		/* moving from this activity up */
+	unsigned int inact;		/* quiet below this ... */
+	unsigned int quiet_ms;		/* ... for this long */
+	struct obc_gov_event log[OBC_GOV_LOG];
+	unsigned int log_head;
+} gov;
+
+/* gov.lock held */
+static void obc_gov_log(struct obc_gov_client *c, unsigned int from, unsigned int to, int err)
+{
+	struct obc_gov_event *e = &gov.log[gov.log_head++ % OBC_GOV_LOG];
+	e->t_ns = ktime_get_ns();
+	e->name = c->name;
+	e->from_mhz = c->rates[from].mhz;
+	e->to_mhz = c->rates[to].mhz;
+	e->reason = c->reason;
+	e->err = err;
+}
+
+/* Sets the target from motion and the highest voted rate, gov.lock held */
+static void obc_gov_decide(struct obc_gov_client *c)
+{
+	unsigned int idx, i;
+	const char *reason;
+	if(!governor)
+		return;
+	idx = min(gov.moving ? c->motion : c->quiet, c->max);
+	reason = gov.moving ? "motion" : "quiet";
+	for(i = c->max; i > idx; i--)
+		if(c->votes[i]){
+			idx = i;
+			reason = "consumer";
+			break;
+		}
+	if(idx == c->target)
+		return;
+	c->reason = reason;
+	WRITE_ONCE(c->target, idx);
+}
+
+int obc_gov_register(struct obc_gov_client *c, unsigned int cur)
+{
+	unsigned long flags;
+	if(!c->nrates || c->nrates > OBC_GOV_MAX_RATES || cur >= c->nrates ||
+			c->quiet >= c->nrates || c->motion >= c->nrates)
+		return -EINVAL;
+	memset(c->votes, 0, sizeof(c->votes));
+	c->cur = cur;
+	c->target = cur;
+	c->max = c->nrates - 1;
+	c->reason = "probe";
+	c->changes = 0;
+	spin_lock_irqsave(&gov.lock, flags);
+	list_add_tail(&c->node, &gov.clients);
+	obc_gov_decide(c);
+	spin_unlock_irqrestore(&gov.lock, flags);
+	return 0;
+}
+EXPORT_SYMBOL_GPL(obc_gov_register);
+
+/* Safe on a zeroed client that never registered */
+void obc_gov_unregister(struct obc_gov_client *c)
+{
+	unsigned long flags;
+	if(!c->node.next)
+		return;
+	spin_lock_irqsave(&gov.lock, flags);
+	list_del_init(&c->node);
+	spin_unlock_irqrestore(&gov.lock, flags);
+}
+EXPORT_SYMBOL_GPL(obc_gov_unregister);
+
+int obc_gov_vote(struct obc_gov_client *c, int *vote, unsigned int mhz)
+{
+	unsigned long flags;
+	unsigned int granted = 0;
+	int idx = -1;
+	if(mhz){
+		for(idx = 0; idx < (int)c->nrates - 1 && c->rates[idx].mhz < mhz; idx++)
+			;
+	}
+	spin_lock_irqsave(&gov.lock, flags);
+	if(*vote >= 0)
+		c->votes[*vote]--;
+	if(idx >= 0)
+		c->votes[idx]++;
+	*vote = idx;
+	obc_gov_decide(c);
+	if(idx >= 0)
+		granted = c->rates[min_t(unsigned int, idx, c->max)].mhz;
+	spin_unlock_irqrestore(&gov.lock, flags);
+	return granted;
+}
+EXPORT_SYMBOL_GPL(obc_gov_vote);
+
+void obc_gov_reset(struct obc_gov_client *c, unsigned int idx)
+{
+	unsigned long flags;
+	if(idx >= c->nrates)
+		return;
+	spin_lock_irqsave(&gov.lock, flags);
+	c->reason = "manual";
+	obc_gov_log(c, c->cur, idx, 0);
+	c->cur = idx;
+	WRITE_ONCE(c->target, idx);
+	spin_unlock_irqrestore(&gov.lock, flags);
+}
+EXPORT_SYMBOL_GPL(obc_gov_reset);
+
+void obc_gov_set_max(struct obc_gov_client *c, unsigned int max)
+{
+	unsigned long flags;
+	spin_lock_irqsave(&gov.lock, flags);
+	c->max = min(max, c->nrates - 1);
+	/* Also with the governor off, the driver cannot keep a rate above the cap */
+	if(c->target > c->max){
+		c->reason = "limit";
+		WRITE_ONCE(c->target, c->max);
+	}
+	obc_gov_decide(c);
+	spin_unlock_irqrestore(&gov.lock, flags);
+}
+EXPORT_SYMBOL_GPL(obc_gov_set_max);
+
+/* Runs on the capture path of the sensor, before its next bus read */
+void obc_gov_apply(struct obc_gov_client *c)
+{
+	unsigned int from = c->cur, to = READ_ONCE(c->target);
+	unsigned long flags;
+	int err;
+	err = c->apply(c, &c->rates[to]);
+	spin_lock_irqsave(&gov.lock, flags);
+	obc_gov_log(c, from, to, err);
+	if(err){
+		/* Stay at the old rate until the next decision */
+		if(c->target == to)
+			WRITE_ONCE(c->target, from);
+	}else{
+		c->cur = to;
+		c->changes++;
+	}
+	spin_unlock_irqrestore(&gov.lock, flags);
+	printk(KERN_DEBUG "OBC: %s rate %u -> %u mHz (%s)%s\n", c->name,
+			c->rates[from].mhz, c->rates[to].mhz, c->reason, err ? " failed" : "");
+}
+EXPORT_SYMBOL_GPL(obc_gov_apply);
+
+/* Hysteresis: moving above act, quiet after quiet_ms below inact */
+void obc_gov_motion(unsigned int activity)
+{
+	struct obc_gov_client *c;
+	unsigned long flags;
+	bool moving = READ_ONCE(gov.moving);
+	if(!governor)
+		return;
+	if(!moving){
+		if(activity < READ_ONCE(gov.act))
+			return;
+		moving = true;
+	}else{
+		if(activity >= READ_ONCE(gov.inact)){
+			WRITE_ONCE(gov.quiet_since, jiffies);
+			return;
+		}
+		if(time_before(jiffies, READ_ONCE(gov.quiet_since) + msecs_to_jiffies(READ_ONCE(gov.quiet_ms))))
+			return;
+		moving = false;
+	}
+	spin_lock_irqsave(&gov.lock, flags);
+	gov.moving = moving;
+	gov.quiet_since = jiffies;
+	list_for_each_entry(c, &gov.clients, node)
+		obc_gov_decide(c);
+	spin_unlock_irqrestore(&gov.lock, flags);
+}
+EXPORT_SYMBOL_GPL(obc_gov_motion);
+
+/* Decisions oldest first: time in us, sensor, from and to in mHz, reason, error */
+static ssize_t obc_gov_get_log(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	struct obc_gov_event *e;
+	unsigned long flags;
+	unsigned int i;
+	ssize_t len = 0;
+	spin_lock_irqsave(&gov.lock, flags);
+	i = gov.log_head > OBC_GOV_LOG ? gov.log_head - OBC_GOV_LOG : 0;
+	for(; i < gov.log_head; i++){
+		e = &gov.log[i % OBC_GOV_LOG];
+		len += scnprintf(buf + len, PAGE_SIZE - len, "%llu %s %u %u %s %d\n",
+				div_u64(e->t_ns, NSEC_PER_USEC), e->name,
+				e->from_mhz, e->to_mhz, e->reason, e->err);
+	}
+	spin_unlock_irqrestore(&gov.lock, flags);
+	return len;
+}
+
+static ssize_t obc_gov_get_state(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	struct obc_gov_client *c;
+	unsigned long flags;
+	unsigned int i;
+	ssize_t len;
+	spin_lock_irqsave(&gov.lock, flags);
+	len = sprintf(buf, "%s\n", gov.moving ? "moving" : "quiet");
+	list_for_each_entry(c, &gov.clients, node){
+		len += scnprintf(buf + len, PAGE_SIZE - len, "%s cur %u target %u max %u reason %s changes %llu votes",
+				c->name, c->rates[c->cur].mhz, c->rates[c->target].mhz, c->rates[c->max].mhz,
+				c->reason, c->changes);
+		for(i = 0; i < c->nrates; i++)
+			len += scnprintf(buf + len, PAGE_SIZE - len, " %u", c->votes[i]);
+		len += scnprintf(buf + len, PAGE_SIZE - len, "\n");
+	}
+	spin_unlock_irqrestore(&gov.lock, flags);
+	return len;
+}
+
+static ssize_t obc_gov_get_motion(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%u %u %u\n", gov.act, gov.inact, gov.quiet_ms);
+}
+
+/* "act inact quiet_ms" */
+static ssize_t obc_gov_set_motion(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+{
+	unsigned int act, inact, quiet_ms;
+	if(sscanf(buf, "%u %u %u", &act, &inact, &quiet_ms) != 3 || inact > act)
+		return -EINVAL;
+	WRITE_ONCE(gov.act, act);
+	WRITE_ONCE(gov.inact, inact);
+	WRITE_ONCE(gov.quiet_ms, quiet_ms);
+	return count;
+}
+
+static DEVICE_ATTR(governor_log, 0444, obc_gov_get_log, NULL);
+static DEVICE_ATTR(governor_state, 0444, obc_gov_get_state, NULL);
+static DEVICE_ATTR(governor_motion, 0664, obc_gov_get_motion, obc_gov_set_motion);
+
+static struct device_attribute *obc_gov_attr_list[] = {
+	&dev_attr_governor_log,
+	&dev_attr_governor_state,
+	&dev_attr_governor_motion,
+};
+
+int obc_gov_init(struct device *dev)
+{
+	int i;
+	spin_lock_init(&gov.lock);
+	INIT_LIST_HEAD(&gov.clients);
+	gov.act = 12;
+	gov.inact = 4;
+	gov.quiet_ms = 2000;
+	for(i = 0; i < ARRAY_SIZE(obc_gov_attr_list); i++)
+		if(device_create_file(dev, obc_gov_attr_list[i]) < 0)
+			printk(KERN_DEBUG "OBC: Error creating attribute file\n");
+	return 0;
+}
+
+void obc_gov_exit(struct device *dev)
+{
+	int i;
+	for(i = 0; i < ARRAY_SIZE(obc_gov_attr_list); i++)
+		device_remove_file(dev, obc_gov_attr_list[i]);
+}
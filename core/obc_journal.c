@@ -0,0 +1,238 @@
+/* Sample journal in reserved memory: recovery of the previous boot and partitions for this one */
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/device.h>
+#include <linux/io.h>
+#include <linux/of.h>
+#include <linux/of_address.h>
+#include <linux/vmalloc.h>
+#include <linux/crc32.h>
+#include <linux/bitops.h>
+#include <linux/log2.h>
+#include <linux/string.h>
+#include <linux/cache.h>
+
+#include "obc_journal.h"
+#include "obc_core.h"
+
+static unsigned long journal_addr;
+module_param(journal_addr, ulong, 0444);
+MODULE_PARM_DESC(journal_addr, "Physical address of the journal region, instead of the obc,journal reserved-memory node");
+
+static unsigned long journal_size;
+module_param(journal_size, ulong, 0444);
+MODULE_PARM_DESC(journal_size, "Size of the journal region in bytes");
+
+static unsigned int journal_decimation = 1;
+module_param(journal_decimation, uint, 0444);
+MODULE_PARM_DESC(journal_decimation, "Journal one capture out of this many");
+
+#define OBC_JOURNAL_PARTS (OBC_DEV_MAX - 1)
+/* Partitions start after the region header, cache line aligned */
+#define OBC_JOURNAL_HEADER_SIZE 64
+
+static struct obc_journal_header *obc_journal_region;
+static unsigned long obc_journal_attached;	/* bit per partition */
+static void *obc_journal_prev;			/* recovered partitions */
+static size_t obc_journal_prev_len;
+
+static u32 obc_journal_crc(const void *p, size_t len)
+{
+	return crc32_le(~0, p, len) ^ ~0;
+}
+
+static struct obc_journal_part *obc_journal_part(unsigned int i)
+{
+	return (void *)obc_journal_region + OBC_JOURNAL_HEADER_SIZE + i * obc_journal_region->part_size;
+}
+
+/* Samples a partition left by the previous boot holds, 0 if it cannot be trusted */
+static u32 obc_journal_part_count(const struct obc_journal_header *h, const struct obc_journal_part *p)
+{
+	if(p->magic != OBC_JOURNAL_PART_MAGIC || p->version != OBC_JOURNAL_VERSION ||
+			p->crc != obc_journal_crc(p, offsetof(struct obc_journal_part, crc)))
+		return 0;
+	if(p->record_size != sizeof(struct obc_sample) || p->boot != h->boot || !is_power_of_2(p->slots) ||
+			sizeof(*p) + (u64)p->slots * p->record_size > h->part_size)
+		return 0;
+	return min(READ_ONCE(p->head), p->slots);
+}
+
+/*
+ * Copies out what the previous boot left, before the region is reused.
+ * Returns false if the region holds no journal.
+ */
+static bool obc_journal_recover(size_t size)
+{
+	const struct obc_journal_header *h = obc_journal_region;
+	const struct obc_journal_part *p;
+	const struct obc_sample *slots;
+	struct obc_journal_part *out;
+	size_t len = 0;
+	unsigned int i;
+	u32 n, k;
+	if(h->magic != OBC_JOURNAL_MAGIC || h->version != OBC_JOURNAL_VERSION ||
+			h->crc != obc_journal_crc(h, offsetof(struct obc_journal_header, crc)) ||
+			h->size != size || h->parts != OBC_JOURNAL_PARTS)
+		return false;
+	for(i = 0; i < OBC_JOURNAL_PARTS; i++){
+		n = obc_journal_part_count(h, obc_journal_part(i));
+		if(n)
+			len += sizeof(*p) + n * sizeof(struct obc_sample);
+	}
+	if(!len)
+		return true;
+	obc_journal_prev = vmalloc(len);
+	if(!obc_journal_prev){
+		printk(KERN_DEBUG "OBC: Cannot keep the journal of the previous boot\n");
+		return true;
+	}
+	for(i = 0, len = 0; i < OBC_JOURNAL_PARTS; i++){
+		p = obc_journal_part(i);
+		n = obc_journal_part_count(h, p);
+		if(!n)
+			continue;
+		out = obc_journal_prev + len;
+		*out = *p;
+		out->head = READ_ONCE(p->head);
+		slots = (const void *)(p + 1);
+		/* Oldest first */
+		for(k = 0; k < n; k++)
+			((struct obc_sample *)(out + 1))[k] = slots[(out->head - n + k) & (p->slots - 1)];
+		len += sizeof(*out) + n * sizeof(struct obc_sample);
+	}
+	obc_journal_prev_len = len;
+	printk(KERN_DEBUG "OBC: Recovered %zu bytes of journal from boot %u\n", len, h->boot);
+	return true;
+}
+
+/* Lays out the region for this boot, every partition empty */
+static void obc_journal_format(size_t size, u32 boot)
+{
+	struct obc_journal_header *h = obc_journal_region;
+	struct obc_journal_part *p;
+	unsigned int i;
+	u32 part_size = ((size - OBC_JOURNAL_HEADER_SIZE) / OBC_JOURNAL_PARTS) & ~(u32)(L1_CACHE_BYTES - 1);
+	memset(h, 0, OBC_JOURNAL_HEADER_SIZE);
+	h->magic = OBC_JOURNAL_MAGIC;
+	h->version = OBC_JOURNAL_VERSION;
+	h->parts = OBC_JOURNAL_PARTS;
+	h->size = size;
+	h->part_size = part_size;
+	h->boot = boot;
+	h->crc = obc_journal_crc(h, offsetof(struct obc_journal_header, crc));
+	for(i = 0; i < OBC_JOURNAL_PARTS; i++){
+		p = obc_journal_part(i);
+		memset(p, 0, sizeof(*p));
+		p->magic = OBC_JOURNAL_PART_MAGIC;
+		p->dev = i + 1;
+		p->version = OBC_JOURNAL_VERSION;
+		p->record_size = sizeof(struct obc_sample);
+		p->slots = rounddown_pow_of_two((part_size - sizeof(*p)) / sizeof(struct obc_sample));
+		p->decimation = max(journal_decimation, 1U);
+		p->boot = boot;
+		p->crc = obc_journal_crc(p, offsetof(struct obc_journal_part, crc));
+	}
+	wmb();
+}
+
+/*
+ * Hands the driver its device's partition, continuing after what an
+ * earlier load in this boot wrote. -ENODEV without a region; the driver
+ * then runs unjournaled.
+ */
+int obc_journal_attach(struct obc_journal *j, u16 dev)
+{
+	struct obc_journal_part *p;
+	memset(j, 0, sizeof(*j));
+	if(!obc_journal_region)
+		return -ENODEV;
+	if(dev == OBC_DEV_NONE || dev >= OBC_DEV_MAX)
+		return -EINVAL;
+	if(test_and_set_bit(dev - 1, &obc_journal_attached))
+		return -EBUSY;
+	p = obc_journal_part(dev - 1);
+	j->part = p;
+	j->mask = p->slots - 1;
+	j->head = p->head;
+	j->decimation = p->decimation;
+	j->slots = (void *)(p + 1);
+	return 0;
+}
+EXPORT_SYMBOL_GPL(obc_journal_attach);
+
+void obc_journal_detach(struct obc_journal *j)
+{
+	if(j->part)
+		clear_bit(j->part->dev - 1, &obc_journal_attached);
+	j->part = NULL;
+	j->slots = NULL;
+}
+EXPORT_SYMBOL_GPL(obc_journal_detach);
+
+/* The previous boot's partitions, as described in obc_journal.h */
+static ssize_t obc_journal_read(struct file *filp, struct kobject *kobj, struct bin_attribute *attr,
+		char *buf, loff_t off, size_t count)
+{
+	if(off >= obc_journal_prev_len)
+		return 0;
+	count = min_t(size_t, count, obc_journal_prev_len - off);
+	memcpy(buf, obc_journal_prev + off, count);
+	return count;
+}
+
+static BIN_ATTR(journal, 0444, obc_journal_read, NULL, 0);
+
+/* The region: module parameters first, then the reserved-memory node */
+static int obc_journal_find(struct resource *res)
+{
+	struct device_node *np;
+	int err;
+	if(journal_addr && journal_size){
+		res->start = journal_addr;
+		res->end = journal_addr + journal_size - 1;
+		return 0;
+	}
+	np = of_find_compatible_node(NULL, NULL, "obc,journal");
+	if(!np)
+		return -ENODEV;
+	err = of_address_to_resource(np, 0, res);
+	of_node_put(np);
+	return err;
+}
+
+int obc_journal_init(struct device *dev)
+{
+	struct resource res;
+	size_t size;
+	if(obc_journal_find(&res))
+		return 0;
+	size = resource_size(&res);
+	if(size < OBC_JOURNAL_HEADER_SIZE + OBC_JOURNAL_PARTS * (L1_CACHE_BYTES + 2 * sizeof(struct obc_sample))){
+		printk(KERN_DEBUG "OBC: Journal region too small\n");
+		return 0;
+	}
+	/* Write-combined, so a reset loses no more than what sits in the write buffer */
+	obc_journal_region = memremap(res.start, size, MEMREMAP_WC);
+	if(!obc_journal_region){
+		printk(KERN_DEBUG "OBC: Cannot map the journal region\n");
+		return 0;
+	}
+	obc_journal_format(size, obc_journal_recover(size) ? obc_journal_region->boot + 1 : 1);
+	if(obc_journal_prev_len){
+		bin_attr_journal.size = obc_journal_prev_len;
+		if(device_create_bin_file(dev, &bin_attr_journal) < 0)
+			printk(KERN_DEBUG "OBC: Error creating attribute file\n");
+	}
+	return 0;
+}
+
+void obc_journal_exit(struct device *dev)
+{
+	if(obc_journal_prev_len)
+		device_remove_bin_file(dev, &bin_attr_journal);
+	vfree(obc_journal_prev);
+	if(obc_journal_region)
+		memunmap(obc_journal_region);
+}
@@ -0,0 +1,101 @@
+/* Snapshot triggers shared by all sensors: the snapshot GPIO and a write to snapshot_trigger */
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/device.h>
+#include <linux/spinlock.h>
+#include <linux/list.h>
+#include <linux/gpio.h>
+#include <linux/interrupt.h>
+
+#include "obc_snap.h"
+#include "obc_segment.h"
+#include "obc_core.h"
+
+static int snap_gpio = -1;
+module_param(snap_gpio, int, 0444);
+MODULE_PARM_DESC(snap_gpio, "GPIO whose rising edge fires every snapshot trigger, -1 for none");
+
+static DEFINE_SPINLOCK(obc_snap_lock);
+static LIST_HEAD(obc_snap_list);
+static int obc_snap_irq = -1;
+
+static void obc_snap_fire(unsigned int reason)
+{
+	struct obc_snap *s;
+	unsigned long flags;
+	spin_lock_irqsave(&obc_snap_lock, flags);
+	list_for_each_entry(s, &obc_snap_list, node)
+		obc_snap_trigger(s, reason);
+	spin_unlock_irqrestore(&obc_snap_lock, flags);
+}
+
+static irqreturn_t obc_snap_gpio_irq(int irq, void *data)
+{
+	obc_snap_fire(OBC_SNAP_GPIO);
+	return IRQ_HANDLED;
+}
+
+void obc_snap_register(struct obc_snap *s)
+{
+	unsigned long flags;
+	spin_lock_irqsave(&obc_snap_lock, flags);
+	list_add_tail(&s->node, &obc_snap_list);
+	spin_unlock_irqrestore(&obc_snap_lock, flags);
+}
+EXPORT_SYMBOL_GPL(obc_snap_register);
+
+void obc_snap_unregister(struct obc_snap *s)
+{
+	unsigned long flags;
+	spin_lock_irqsave(&obc_snap_lock, flags);
+	list_del_init(&s->node);
+	spin_unlock_irqrestore(&obc_snap_lock, flags);
+}
+EXPORT_SYMBOL_GPL(obc_snap_unregister);
+
+/* Any write fires the trigger of every armed sensor at once */
+static ssize_t obc_snap_set_trigger(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+{
+	obc_snap_fire(OBC_SNAP_USER);
+	return count;
+}
+
+static DEVICE_ATTR(snapshot_trigger, 0220, NULL, obc_snap_set_trigger);
+
+int obc_snap_init(struct device *dev)
+{
+	int err;
+	/* Tools tell a snapshot blob from a recorder segment by the magic alone */
+	BUILD_BUG_ON(OBC_SNAP_MAGIC == OBC_SEGMENT_MAGIC);
+	if(snap_gpio >= 0){
+		err = gpio_request_one(snap_gpio, GPIOF_IN, "obc-snap");
+		if(err){
+			printk(KERN_DEBUG "OBC: Cannot request snapshot GPIO %d\n", snap_gpio);
+			return err;
+		}
+		err = gpio_to_irq(snap_gpio);
+		if(err >= 0){
+			obc_snap_irq = err;
+			err = request_irq(obc_snap_irq, obc_snap_gpio_irq, IRQF_TRIGGER_RISING, "obc-snap", &obc_snap_list);
+		}
+		if(err){
+			printk(KERN_DEBUG "OBC: Cannot use snapshot GPIO %d as interrupt\n", snap_gpio);
+			gpio_free(snap_gpio);
+			obc_snap_irq = -1;
+			return err;
+		}
+	}
+	if(device_create_file(dev, &dev_attr_snapshot_trigger) < 0)
+		printk(KERN_DEBUG "OBC: Error creating attribute file\n");
+	return 0;
+}
+
+void obc_snap_exit(struct device *dev)
+{
+	device_remove_file(dev, &dev_attr_snapshot_trigger);
+	if(obc_snap_irq >= 0){
+		free_irq(obc_snap_irq, &obc_snap_list);
+		gpio_free(snap_gpio);
+	}
+}
@@ -0,0 +1,266 @@
+/* Raw bus transaction trace: a byte ring of variable length records read through sysfs */
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/device.h>
+#include <linux/spinlock.h>
+#include <linux/mutex.h>
+#include <linux/vmalloc.h>
+#include <linux/ktime.h>
+#include <linux/string.h>
+
+#include "obc_trace.h"
+#include "obc_sample.h"
+#include "obc_core.h"
+
+static unsigned int trace_kb = 256;
+module_param(trace_kb, uint, 0444);
+MODULE_PARM_DESC(trace_kb, "Bus trace buffer size in KiB, allocated when tracing is first enabled");
+
+bool obc_trace_on;
+EXPORT_SYMBOL_GPL(obc_trace_on);
+
+static struct obc_trace{
+	spinlock_t lock;
+	struct mutex enable_lock;
+	u8 *buf;
+	size_t size;		/* bytes, a multiple of OBC_TRACE_ALIGN */
+	/* Byte offsets; used bytes run from tail to head, wrapping */
+	size_t head;
+	size_t tail;
+	size_t used;
+	u32 seq;
+	u64 logged;
+	u64 dropped;
+	const struct obc_layout *layout[OBC_DEV_MAX];
+	struct {
+		u8 reg;
+		u8 len;		/* 0 for a free slot */
+		u8 data[OBC_TRACE_CALIB_MAX];
+	} calib[OBC_DEV_MAX][OBC_TRACE_CALIB_SLOTS];	/* under lock */
+} trace;
+
+/* Copies len bytes into the ring at head, wrapping. trace.lock held */
+static void obc_trace_put(const void *src, size_t len)
+{
+	size_t first = min(len, trace.size - trace.head);
+	memcpy(trace.buf + trace.head, src, first);
+	memcpy(trace.buf, (const u8 *)src + first, len - first);
+	trace.head = (trace.head + len) % trace.size;
+}
+
+static void obc_trace_get(void *dst, size_t len)
+{
+	size_t first = min(len, trace.size - trace.tail);
+	memcpy(dst, trace.buf + trace.tail, first);
+	memcpy((u8 *)dst + first, trace.buf, len - first);
+	trace.tail = (trace.tail + len) % trace.size;
+}
+
+void __obc_trace(u16 dev, u8 reg, u8 flags, const void *data, size_t len, int status)
+{
+	static const u8 pad[OBC_TRACE_ALIGN];
+	struct obc_trace_rec rec;
+	unsigned long flags_irq;
+	size_t size;
+	if(status < 0)
+		len = 0;
+	len = min_t(size_t, len, OBC_TRACE_MAX_DATA);
+	size = OBC_TRACE_REC_SIZE(len);
+	memset(&rec, 0, sizeof(rec));
+	rec.t_ns = ktime_get_ns();
+	rec.status = min(status, 0);
+	rec.dev = dev;
+	rec.len = len;
+	rec.reg = reg;
+	rec.flags = flags;
+	spin_lock_irqsave(&trace.lock, flags_irq);
+	rec.seq = trace.seq++;
+	if(!trace.buf || trace.size - trace.used < size){
+		trace.dropped++;
+	}else{
+		obc_trace_put(&rec, sizeof(rec));
+		obc_trace_put(data, len);
+		obc_trace_put(pad, size - sizeof(rec) - len);
+		trace.used += size;
+		trace.logged++;
+	}
+	spin_unlock_irqrestore(&trace.lock, flags_irq);
+}
+EXPORT_SYMBOL_GPL(__obc_trace);
+
+/* Drivers give their sample layout at probe and NULL at remove, which also drops their calibration */
+void obc_trace_layout(u16 dev, const struct obc_layout *l)
+{
+	unsigned long flags;
+	if(dev >= OBC_DEV_MAX)
+		return;
+	mutex_lock(&trace.enable_lock);
+	if(!l){
+		spin_lock_irqsave(&trace.lock, flags);
+		memset(trace.calib[dev], 0, sizeof(trace.calib[dev]));
+		spin_unlock_irqrestore(&trace.lock, flags);
+	}
+	trace.layout[dev] = l;
+	if(l && obc_trace_on)
+		__obc_trace(dev, l->reg, OBC_TRACE_LAYOUT, l, sizeof(*l), 0);
+	mutex_unlock(&trace.enable_lock);
+}
+EXPORT_SYMBOL_GPL(obc_trace_layout);
+
+/*
+ * Drivers give each calibration block they apply whenever it changes,
+ * len 0 once it is dropped. The blocks are kept and logged again every
+ * time tracing is enabled. Does not sleep.
+ */
+void obc_trace_calib(u16 dev, u8 reg, const void *data, size_t len)
+{
+	unsigned long flags;
+	int i, slot = -1;
+	if(dev >= OBC_DEV_MAX || WARN_ON_ONCE(len > OBC_TRACE_CALIB_MAX))
+		return;
+	spin_lock_irqsave(&trace.lock, flags);
+	for(i = 0; i < OBC_TRACE_CALIB_SLOTS; i++){
+		if(trace.calib[dev][i].len && trace.calib[dev][i].reg == reg){
+			slot = i;
+			break;
+		}
+		if(!trace.calib[dev][i].len && slot < 0)
+			slot = i;
+	}
+	if(slot >= 0){
+		trace.calib[dev][slot].reg = reg;
+		trace.calib[dev][slot].len = len;
+		memcpy(trace.calib[dev][slot].data, data, len);
+	}
+	spin_unlock_irqrestore(&trace.lock, flags);
+	obc_trace(dev, reg, OBC_TRACE_CALIB, data, len, 0);
+}
+EXPORT_SYMBOL_GPL(obc_trace_calib);
+
+/* Logs the blocks of every device, the way obc_trace_calib() did */
+static void obc_trace_log_calib(void)
+{
+	u8 data[OBC_TRACE_CALIB_MAX];
+	unsigned long flags;
+	u8 reg, len;
+	int i, j;
+	for(i = 0; i < OBC_DEV_MAX; i++)
+		for(j = 0; j < OBC_TRACE_CALIB_SLOTS; j++){
+			spin_lock_irqsave(&trace.lock, flags);
+			reg = trace.calib[i][j].reg;
+			len = trace.calib[i][j].len;
+			memcpy(data, trace.calib[i][j].data, len);
+			spin_unlock_irqrestore(&trace.lock, flags);
+			if(len)
+				__obc_trace(i, reg, OBC_TRACE_CALIB, data, len, 0);
+		}
+}
+
+/*
+ * Whole records from the oldest on, as many as fit in count. The file
+ * offset is ignored, every read continues where the last one stopped.
+ */
+static ssize_t obc_trace_read(struct file *filp, struct kobject *kobj, struct bin_attribute *attr,
+		char *buf, loff_t off, size_t count)
+{
+	struct obc_trace_rec rec;
+	unsigned long flags;
+	size_t len = 0, size;
+	if(off)
+		return 0;
+	spin_lock_irqsave(&trace.lock, flags);
+	while(trace.used){
+		size_t tail = trace.tail;
+		obc_trace_get(&rec, sizeof(rec));
+		trace.tail = tail;
+		size = OBC_TRACE_REC_SIZE(rec.len);
+		if(len + size > count)
+			break;
+		obc_trace_get(buf + len, size);
+		trace.used -= size;
+		len += size;
+	}
+	spin_unlock_irqrestore(&trace.lock, flags);
+	return len;
+}
+
+static ssize_t obc_trace_get_enable(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%d\n", READ_ONCE(obc_trace_on));
+}
+
+/* 1 clears the buffer, logs the sensor layouts and calibration and starts tracing; 0 stops it */
+static ssize_t obc_trace_set_enable(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+{
+	unsigned long flags;
+	bool on;
+	u8 *mem = NULL;
+	int i;
+	if(strtobool(buf, &on))
+		return -EINVAL;
+	mutex_lock(&trace.enable_lock);
+	if(on && !trace.buf){
+		mem = vmalloc(max(trace_kb, 4U) * 1024);
+		if(!mem){
+			mutex_unlock(&trace.enable_lock);
+			return -ENOMEM;
+		}
+	}
+	spin_lock_irqsave(&trace.lock, flags);
+	if(mem){
+		trace.buf = mem;
+		trace.size = max(trace_kb, 4U) * 1024;
+	}
+	if(on){
+		trace.head = trace.tail = trace.used = 0;
+		trace.seq = 0;
+		trace.logged = trace.dropped = 0;
+	}
+	spin_unlock_irqrestore(&trace.lock, flags);
+	if(on){
+		for(i = 0; i < OBC_DEV_MAX; i++)
+			if(trace.layout[i])
+				__obc_trace(i, trace.layout[i]->reg, OBC_TRACE_LAYOUT,
+						trace.layout[i], sizeof(*trace.layout[i]), 0);
+		obc_trace_log_calib();
+	}
+	WRITE_ONCE(obc_trace_on, on);
+	mutex_unlock(&trace.enable_lock);
+	return count;
+}
+
+static ssize_t obc_trace_get_stats(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	unsigned long flags;
+	ssize_t len;
+	spin_lock_irqsave(&trace.lock, flags);
+	len = sprintf(buf, "logged %llu\ndropped %llu\nbuffered %zu\nsize %zu\n",
+			trace.logged, trace.dropped, trace.used, trace.size);
+	spin_unlock_irqrestore(&trace.lock, flags);
+	return len;
+}
+
+static DEVICE_ATTR(trace_enable, 0664, obc_trace_get_enable, obc_trace_set_enable);
+static DEVICE_ATTR(trace_stats, 0444, obc_trace_get_stats, NULL);
+static BIN_ATTR(trace, 0444, obc_trace_read, NULL, 0);
+
+int obc_trace_init(struct device *dev)
+{
+	spin_lock_init(&trace.lock);
+	mutex_init(&trace.enable_lock);
+	if(device_create_file(dev, &dev_attr_trace_enable) < 0 ||
+			device_create_file(dev, &dev_attr_trace_stats) < 0 ||
+			device_create_bin_file(dev, &bin_attr_trace) < 0)
+		printk(KERN_DEBUG "OBC: Error creating attribute file\n");
+	return 0;
+}
+
+void obc_trace_exit(struct device *dev)
+{
+	device_remove_bin_file(dev, &bin_attr_trace);
+	device_remove_file(dev, &dev_attr_trace_stats);
+	device_remove_file(dev, &dev_attr_trace_enable);
+	WRITE_ONCE(obc_trace_on, false);
+	vfree(trace.buf);
+}
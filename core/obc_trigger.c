@@ -0,0 +1,292 @@
+/* Common acquisition trigger: one time base, one capture worker per sensor */
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/device.h>
+#include <linux/spinlock.h>
+#include <linux/mutex.h>
+#include <linux/hrtimer.h>
+#include <linux/gpio.h>
+#include <linux/interrupt.h>
+#include <linux/kthread.h>
+#include <linux/bitops.h>
+#include <linux/math64.h>
+#include <linux/cpumask.h>
+
+#include "obc_trigger.h"
+#include "obc_core.h"
+
+#define OBC_TRIGGER_MIN_PERIOD_US 500
+
+static unsigned int period_us = 10000;
+module_param(period_us, uint, 0444);
+MODULE_PARM_DESC(period_us, "Trigger tick in microseconds, nominal tick with sync_gpio");
+
+static int sync_gpio = -1;
+module_param(sync_gpio, int, 0444);
+MODULE_PARM_DESC(sync_gpio, "GPIO whose rising edge starts a capture set, -1 for the hrtimer");
+
+static struct obc_trigger{
+	spinlock_t lock;
+	struct list_head clients;
+	struct hrtimer timer;
+	unsigned int period_us;
+	u32 set;
+	u64 ticks;
+	int irq;		/* sync GPIO interrupt, negative when the hrtimer runs */
+	struct cpumask irq_cpus;	/* its affinity, kept as the hint */
+} trig;
+
+/*
+ * Orders registrations, so the hrtimer start for the first client and
+ * the cancel for the last one happen in list order. The tick takes
+ * trig.lock, so hrtimer_cancel() cannot run under it.
+ */
+static DEFINE_MUTEX(obc_trigger_reg_lock);
+
+/*
+ * Hands the tick to every client that is due. A client still busy with
+ * the previous tick misses this one rather than queueing behind it, so
+ * a slow bus never delays the next capture set.
+ */
+static void obc_trigger_fire(u64 t_ns, u64 due_ns)
+{
+	struct obc_trigger_client *c;
+	unsigned long flags;
+	unsigned int div;
+	u32 set;
+	spin_lock_irqsave(&trig.lock, flags);
+	set = ++trig.set;
+	trig.ticks++;
+	list_for_each_entry(c, &trig.clients, node){
+		div = DIV_ROUND_CLOSEST(READ_ONCE(c->period_us), trig.period_us);
+		if(div > 1 && set % div)
+			continue;
+		if(c->wanted && !c->wanted(c))
+			continue;
+		if(test_and_set_bit(0, &c->busy)){
+			c->missed++;
+			continue;
+		}
+		c->set = set;
+		c->t_ns = t_ns;
+		c->due_ns = due_ns;
+		kthread_queue_work(c->worker, &c->work);
+	}
+	spin_unlock_irqrestore(&trig.lock, flags);
+}
+
+static void obc_trigger_work(struct kthread_work *work)
+{
+	struct obc_trigger_client *c = container_of(work, struct obc_trigger_client, work);
+	unsigned long flags;
+	u64 start, end;
+	start = ktime_get_ns();
+	if(c->sched)
+		obc_sched_latency(c->sched, start - c->due_ns);
+	c->capture(c, c->set, c->t_ns);
+	end = ktime_get_ns();
+	spin_lock_irqsave(&trig.lock, flags);
+	c->fired++;
+	c->start_sum_ns += start - c->t_ns;
+	c->start_max_ns = max(c->start_max_ns, start - c->t_ns);
+	c->run_max_ns = max(c->run_max_ns, end - start);
+	spin_unlock_irqrestore(&trig.lock, flags);
+	smp_mb__before_atomic();
+	clear_bit(0, &c->busy);
+}
+
+static enum hrtimer_restart obc_trigger_tick(struct hrtimer *timer)
+{
+	obc_trigger_fire(ktime_get_ns(), ktime_to_ns(hrtimer_get_expires(timer)));
+	hrtimer_forward_now(timer, us_to_ktime(READ_ONCE(trig.period_us)));
+	return HRTIMER_RESTART;
+}
+
+static irqreturn_t obc_trigger_irq(int irq, void *data)
+{
+	u64 now = ktime_get_ns();
+	obc_trigger_fire(now, now);
+	return IRQ_HANDLED;
+}
+
+int obc_trigger_register(struct obc_trigger_client *c)
+{
+	unsigned long flags;
+	bool first;
+	c->worker = kthread_create_worker(0, "obc-%s", c->name);
+	if(IS_ERR(c->worker)){
+		int err = PTR_ERR(c->worker);
+		c->worker = NULL;
+		return err;
+	}
+	if(c->sched)
+		obc_sched_attach(c->sched, c->worker->task);
+	kthread_init_work(&c->work, obc_trigger_work);
+	c->busy = 0;
+	c->fired = c->missed = 0;
+	c->start_sum_ns = c->start_max_ns = c->run_max_ns = 0;
+	mutex_lock(&obc_trigger_reg_lock);
+	spin_lock_irqsave(&trig.lock, flags);
+	first = list_empty(&trig.clients);
+	list_add_tail(&c->node, &trig.clients);
+	spin_unlock_irqrestore(&trig.lock, flags);
+	/* The hrtimer only runs while somebody is registered */
+	if(first && trig.irq < 0)
+		hrtimer_start(&trig.timer, us_to_ktime(trig.period_us), HRTIMER_MODE_REL);
+	mutex_unlock(&obc_trigger_reg_lock);
+	printk(KERN_DEBUG "OBC: %s on the common trigger\n", c->name);
+	return 0;
+}
+EXPORT_SYMBOL_GPL(obc_trigger_register);
+
+void obc_trigger_unregister(struct obc_trigger_client *c)
+{
+	unsigned long flags;
+	bool last;
+	if(!c->worker)
+		return;
+	mutex_lock(&obc_trigger_reg_lock);
+	spin_lock_irqsave(&trig.lock, flags);
+	list_del(&c->node);
+	last = list_empty(&trig.clients);
+	spin_unlock_irqrestore(&trig.lock, flags);
+	if(last && trig.irq < 0)
+		hrtimer_cancel(&trig.timer);
+	mutex_unlock(&obc_trigger_reg_lock);
+	if(c->sched)
+		obc_sched_detach(c->sched);
+	/* Nothing is queued after the list_del, this runs the last capture out */
+	kthread_destroy_worker(c->worker);
+	c->worker = NULL;
+}
+EXPORT_SYMBOL_GPL(obc_trigger_unregister);
+
+unsigned int obc_trigger_period_us(void)
+{
+	return READ_ONCE(trig.period_us);
+}
+EXPORT_SYMBOL_GPL(obc_trigger_period_us);
+
+static ssize_t obc_trigger_get_period(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%u\n", READ_ONCE(trig.period_us));
+}
+
+/* Takes effect from the next tick; with sync_gpio it only rescales the client dividers */
+static ssize_t obc_trigger_set_period(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+{
+	unsigned int val;
+	if(kstrtouint(buf, 10, &val) || val < OBC_TRIGGER_MIN_PERIOD_US)
+		return -EINVAL;
+	WRITE_ONCE(trig.period_us, val);
+	return count;
+}
+
+static ssize_t obc_trigger_get_source(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	if(trig.irq >= 0)
+		return sprintf(buf, "gpio %d\n", sync_gpio);
+	return sprintf(buf, "hrtimer\n");
+}
+
+/* Per client: captures, missed ticks, tick to start latency avg/max and longest capture, in us */
+static ssize_t obc_trigger_get_stats(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	struct obc_trigger_client *c;
+	unsigned long flags;
+	ssize_t len;
+	spin_lock_irqsave(&trig.lock, flags);
+	len = sprintf(buf, "ticks %llu set %u\n", trig.ticks, trig.set);
+	list_for_each_entry(c, &trig.clients, node)
+		len += scnprintf(buf + len, PAGE_SIZE - len, "%s fired %llu missed %llu start_avg %llu start_max %llu run_max %llu\n",
+				c->name, c->fired, c->missed,
+				c->fired ? div64_u64(c->start_sum_ns, c->fired) / NSEC_PER_USEC : 0,
+				div_u64(c->start_max_ns, NSEC_PER_USEC),
+				div_u64(c->run_max_ns, NSEC_PER_USEC));
+	spin_unlock_irqrestore(&trig.lock, flags);
+	return len;
+}
+
+static ssize_t obc_trigger_get_irq_cpus(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	if(trig.irq < 0)
+		return -ENODEV;
+	return sprintf(buf, "%*pbl\n", cpumask_pr_args(&trig.irq_cpus));
+}
+
+/* CPUs taking the sync GPIO interrupt, and so running the tick; a CPU list */
+static ssize_t obc_trigger_set_irq_cpus(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+{
+	struct cpumask cpus;
+	int err;
+	if(trig.irq < 0)
+		return -ENODEV;
+	err = cpulist_parse(buf, &cpus);
+	if(err)
+		return err;
+	if(!cpumask_intersects(&cpus, cpu_online_mask))
+		return -EINVAL;
+	cpumask_copy(&trig.irq_cpus, &cpus);
+	err = irq_set_affinity_hint(trig.irq, &trig.irq_cpus);
+	return err ? err : count;
+}
+
+static DEVICE_ATTR(trigger_period_us, 0664, obc_trigger_get_period, obc_trigger_set_period);
+static DEVICE_ATTR(trigger_source, 0444, obc_trigger_get_source, NULL);
+static DEVICE_ATTR(trigger_stats, 0444, obc_trigger_get_stats, NULL);
+static DEVICE_ATTR(trigger_irq_cpus, 0664, obc_trigger_get_irq_cpus, obc_trigger_set_irq_cpus);
+
+static struct device_attribute *obc_trigger_attr_list[] = {
+	&dev_attr_trigger_period_us,
+	&dev_attr_trigger_source,
+	&dev_attr_trigger_stats,
+	&dev_attr_trigger_irq_cpus,
+};
+
+int obc_trigger_init(struct device *dev)
+{
+	int err, i;
+	spin_lock_init(&trig.lock);
+	INIT_LIST_HEAD(&trig.clients);
+	hrtimer_init(&trig.timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	trig.timer.function = obc_trigger_tick;
+	trig.period_us = max(period_us, (unsigned int)OBC_TRIGGER_MIN_PERIOD_US);
+	trig.irq = -1;
+	cpumask_copy(&trig.irq_cpus, cpu_possible_mask);
+	if(sync_gpio >= 0){
+		err = gpio_request_one(sync_gpio, GPIOF_IN, "obc-sync");
+		if(err){
+			printk(KERN_DEBUG "OBC: Cannot request sync GPIO %d\n", sync_gpio);
+			return err;
+		}
+		err = gpio_to_irq(sync_gpio);
+		if(err >= 0){
+			trig.irq = err;
+			err = request_irq(trig.irq, obc_trigger_irq, IRQF_TRIGGER_RISING, "obc-sync", &trig);
+		}
+		if(err){
+			printk(KERN_DEBUG "OBC: Cannot use sync GPIO %d as interrupt\n", sync_gpio);
+			gpio_free(sync_gpio);
+			trig.irq = -1;
+			return err;
+		}
+	}
+	for(i = 0; i < ARRAY_SIZE(obc_trigger_attr_list); i++)
+		if(device_create_file(dev, obc_trigger_attr_list[i]) < 0)
+			printk(KERN_DEBUG "OBC: Error creating attribute file\n");
+	return 0;
+}
+
+void obc_trigger_exit(struct device *dev)
+{
+	int i;
+	for(i = 0; i < ARRAY_SIZE(obc_trigger_attr_list); i++)
+		device_remove_file(dev, obc_trigger_attr_list[i]);
+	if(trig.irq >= 0){
+		irq_set_affinity_hint(trig.irq, NULL);
+		free_irq(trig.irq, &trig);
+		gpio_free(sync_gpio);
+	}
+	hrtimer_cancel(&trig.timer);
+}
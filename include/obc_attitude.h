@@ -0,0 +1,60 @@
+/*
+ * Attitude estimate published by obc_attitude through POSIX shared memory
+ * (OBC_ATTITUDE_SHM). Consumers map it read-only and copy the estimate
+ * with obc_attitude_read(); seq can be waited on with FUTEX_WAIT.
+ */
+#ifndef OBC_ATTITUDE_H
+#define OBC_ATTITUDE_H
+
+#include <linux/types.h>
+
+#define OBC_ATTITUDE_SHM "/obc_attitude"
+#define OBC_ATTITUDE_MAGIC 0x5441424f /* "OBAT" */
+#define OBC_ATTITUDE_VERSION 1
+#define OBC_ATTITUDE_ONE (1 << 30)	/* quaternion and vector scale */
+#define OBC_ATTITUDE_LAT_BUCKETS 24	/* log2 microsecond latency histogram */
+
+/* The magnetometer sample used was older than the skew limit, yaw held */
+#define OBC_ATTITUDE_MAG_STALE (1 << 0)
+/* The accelerometer sample was stale, the estimate was not updated */
+#define OBC_ATTITUDE_ACCEL_STALE (1 << 1)
+
+struct obc_attitude {
+	__u64 t_sample_ns;	/* accelerometer capture time, CLOCK_MONOTONIC */
+	__u64 t_publish_ns;	/* time the estimate was written */
+	__s32 q[4];		/* body to NED rotation w, x, y, z; OBC_ATTITUDE_ONE is 1.0 */
+	__s32 euler_mdeg[3];	/* roll, pitch, yaw in millidegrees */
+	__u32 accel_seq;
+	__u32 mag_seq;
+	__u32 flags;
+};
+
+struct obc_attitude_shm {
+	__u32 magic;
+	__u16 version;
+	__u16 reserved;
+	__u32 seq;		/* odd while the estimate is being written */
+	__u32 pad;
+	struct obc_attitude cur;
+	/* Sample capture to publish latency, written with the estimate */
+	__u64 updates;
+	__u64 lat_sum_ns;
+	__u64 lat_max_ns;
+	__u32 lat_hist[OBC_ATTITUDE_LAT_BUCKETS];	/* bucket i: below 2^(i+1) us */
+};
+
+/* Copies a consistent estimate, returns its sequence number */
+static inline __u32 obc_attitude_read(const struct obc_attitude_shm *shm, struct obc_attitude *out)
+{
+	__u32 s0, s1;
+
+	do {
+		s0 = __atomic_load_n(&shm->seq, __ATOMIC_ACQUIRE);
+		*out = shm->cur;
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		s1 = __atomic_load_n(&shm->seq, __ATOMIC_RELAXED);
+	} while ((s0 & 1) || s0 != s1);
+	return s0;
+}
+
+#endif
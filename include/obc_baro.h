@@ -0,0 +1,88 @@
+/*
+ * BMP280 trimming parameters and the datasheet's integer compensation,
+ * shared by the driver and userspace tools (the trace replay).
+ *
+ * The parameters are the CALIB_LEN bytes read from BMP280_CALIB_START
+ * once after reset; the compensation turns the raw 20-bit ADC outputs
+ * into 0.01 degC and 1/256 Pa.
+ */
+#ifndef OBC_BARO_H
+#define OBC_BARO_H
+
+#include <linux/types.h>
+
+#ifdef __KERNEL__
+#include <linux/math64.h>
+#define obc_baro_div_s64(x, y) div64_s64(x, y)
+#else
+#define obc_baro_div_s64(x, y) ((x) / (y))
+#endif
+
+#define BMP280_CALIB_START 0x88
+#define BMP280_CALIB_LEN 24
+
+/* Trimming parameters dig_T1 to dig_P9 */
+struct bmp280_calib {
+	__u16 t1;
+	__s16 t2, t3;
+	__u16 p1;
+	__s16 p2, p3, p4, p5, p6, p7, p8, p9;
+};
+
+/* BMP280_CALIB_LEN bytes from BMP280_CALIB_START, little endian words */
+static inline void bmp280_calib_parse(struct bmp280_calib *c, const __u8 *raw)
+{
+	__s16 w[BMP280_CALIB_LEN / 2];
+	int i;
+	for (i = 0; i < BMP280_CALIB_LEN / 2; i++)
+		w[i] = (__s16)(raw[2 * i] | (raw[2 * i + 1] << 8));
+	c->t1 = (__u16)w[0];
+	c->t2 = w[1];
+	c->t3 = w[2];
+	c->p1 = (__u16)w[3];
+	c->p2 = w[4];
+	c->p3 = w[5];
+	c->p4 = w[6];
+	c->p5 = w[7];
+	c->p6 = w[8];
+	c->p7 = w[9];
+	c->p8 = w[10];
+	c->p9 = w[11];
+}
+
+/*
+ * Datasheet integer compensation. Temperature in 0.01 degC; t_fine
+ * carries the temperature into the pressure formula.
+ */
+static inline __s32 bmp280_compensate_t(const struct bmp280_calib *c, __s32 adc_t, __s32 *t_fine)
+{
+	__s32 var1, var2;
+	var1 = (((adc_t >> 3) - ((__s32)c->t1 << 1)) * c->t2) >> 11;
+	var2 = (((((adc_t >> 4) - (__s32)c->t1) * ((adc_t >> 4) - (__s32)c->t1)) >> 12) * c->t3) >> 14;
+	*t_fine = var1 + var2;
+	return (*t_fine * 5 + 128) >> 8;
+}
+
+/*
+ * Pressure in 1/256 Pa; 0 with an invalid dig_P1. The datasheet's 64-bit
+ * variant, its 32-bit one is off by a few Pa.
+ */
+static inline __u32 bmp280_compensate_p(const struct bmp280_calib *c, __s32 adc_p, __s32 t_fine)
+{
+	__s64 var1, var2, p;
+	var1 = (__s64)t_fine - 128000;
+	var2 = var1 * var1 * c->p6;
+	var2 = var2 + ((var1 * c->p5) << 17);
+	var2 = var2 + ((__s64)c->p4 << 35);
+	var1 = ((var1 * var1 * c->p3) >> 8) + ((var1 * c->p2) << 12);
+	var1 = (((1LL << 47) + var1) * c->p1) >> 33;
+	if (!var1)
+		return 0;
+	p = 1048576 - adc_p;
+	p = obc_baro_div_s64(((p << 31) - var2) * 3125, var1);
+	var1 = (c->p9 * (p >> 13) * (p >> 13)) >> 25;
+	var2 = (c->p8 * p) >> 19;
+	return (__u32)(((p + var1 + var2) >> 8) + ((__s64)c->p7 << 4));
+}
+
+#endif
@@ -0,0 +1,97 @@
+/*
+ * Per-bus transaction scheduler, provided by the obc_core module.
+ *
+ * Every sensor driver attaches to the bus of its controller; drivers on
+ * the same I2C adapter or SPI master share one queue. A transaction runs
+ * on the caller's thread once the scheduler grants it the bus. Waiting
+ * transactions are granted by class, control loop before streaming
+ * before housekeeping, and earliest deadline first within a class; a
+ * housekeeping transaction past its deadline moves up to the streaming
+ * class so it cannot starve. Nothing is preempted, so a control loop
+ * transaction waits at most for the one in flight and the other control
+ * loop ones.
+ *
+ * A read with a key joins an identical read that is still queued
+ * instead of running again, and gets a copy of its data.
+ */
+#ifndef OBC_BUS_H
+#define OBC_BUS_H
+
+#include <linux/kernel.h>
+#include <linux/device.h>
+#include <linux/string.h>
+#include <linux/ktime.h>
+
+enum {
+	OBC_BUS_CONTROL = 0,
+	OBC_BUS_STREAM,
+	OBC_BUS_HOUSEKEEPING,
+	OBC_BUS_CLASSES
+};
+
+static const char * const obc_bus_class_names[OBC_BUS_CLASSES] = {
+	[OBC_BUS_CONTROL] = "control",
+	[OBC_BUS_STREAM] = "stream",
+	[OBC_BUS_HOUSEKEEPING] = "housekeeping",
+};
+
+struct obc_bus;
+
+struct obc_bus_client {
+	struct obc_bus *bus;	/* NULL: transactions run unscheduled */
+	u8 capture_class;	/* class of the driver's sample reads */
+};
+
+struct obc_bus_req {
+	u8 class;
+	u64 deadline_ns;	/* CLOCK_MONOTONIC, 0 for the class default */
+	const void *key;	/* non-NULL: queued reads with the same key are merged */
+	void *data;		/* filled by the transfer, copied to merged callers */
+	size_t len;
+};
+
+int obc_bus_attach(struct obc_bus_client *c, struct device *ctrl);
+void obc_bus_detach(struct obc_bus_client *c);
+int __obc_bus_run(struct obc_bus_client *c, const struct obc_bus_req *req,
+		int (*xfer)(void *ctx), void *ctx);
+
+/* Runs xfer(ctx) when the bus is granted, returns its result */
+static inline int obc_bus_run(struct obc_bus_client *c, const struct obc_bus_req *req,
+		int (*xfer)(void *ctx), void *ctx)
+{
+	if(!c || !c->bus || !req)
+		return xfer(ctx);
+	return __obc_bus_run(c, req, xfer, ctx);
+}
+
+/*
+ * A sample read of the client's capture class, due within one capture
+ * period (period_us 0 for the class default)
+ */
+static inline void obc_bus_capture_req(struct obc_bus_client *c, struct obc_bus_req *req,
+		unsigned int period_us, const void *key, void *data, size_t len)
+{
+	req->class = READ_ONCE(c->capture_class);
+	req->deadline_ns = period_us ? ktime_get_ns() + (u64)period_us * NSEC_PER_USEC : 0;
+	req->key = key;
+	req->data = data;
+	req->len = len;
+}
+
+static inline ssize_t obc_bus_class_show(struct obc_bus_client *c, char *buf)
+{
+	return sprintf(buf, "%s\n", obc_bus_class_names[c->capture_class]);
+}
+
+static inline ssize_t obc_bus_class_store(struct obc_bus_client *c, const char *buf, size_t count)
+{
+	unsigned int i;
+	for(i = 0; i < OBC_BUS_CLASSES && !sysfs_streq(buf, obc_bus_class_names[i]); i++)
+		;
+	if(i == OBC_BUS_CLASSES)
+		return -EINVAL;
+	WRITE_ONCE(c->capture_class, i);
+	return count;
+}
+
+#endif
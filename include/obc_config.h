@@ -0,0 +1,106 @@
+/*
+ * Persisted sensor configuration and calibration, one versioned blob for
+ * all drivers.
+ *
+ * The blob is a header followed by one section per sensor, each holding
+ * that driver's settings as a fixed struct. Reading /sys/devices/obc/config
+ * exports the running configuration of every probed sensor; writing a
+ * blob there applies it in one pass. A driver probing with the blob
+ * installed as firmware (OBC_CONFIG_FIRMWARE) takes its section instead
+ * of the defaults, so the device comes up configured by its own probe
+ * sequence without further bus traffic.
+ *
+ * Sections with an unknown device or version are skipped, so a blob can
+ * carry settings for drivers that are not loaded.
+ */
+#ifndef OBC_CONFIG_H
+#define OBC_CONFIG_H
+
+#include <linux/types.h>
+
+#include "obc_magcal.h"
+
+#define OBC_CONFIG_MAGIC 0x4643424f /* "OBCF" */
+#define OBC_CONFIG_VERSION 1
+#define OBC_CONFIG_FIRMWARE "obc_config.bin"
+/* A blob is read and written in one piece */
+#define OBC_CONFIG_MAX_SIZE 4096
+
+struct obc_config_header {
+	__u32 magic;
+	__u16 version;
+	__u16 sections;
+	__u32 size;		/* header and sections */
+	__u32 crc;		/* CRC-32 of the sections, as zlib's crc32() */
+};
+
+/* Followed by len bytes of payload, len a multiple of 4 */
+struct obc_config_section {
+	__u16 dev;		/* OBC_DEV_* */
+	__u16 version;		/* of the payload struct */
+	__u16 len;
+	__u16 reserved;
+};
+
+#define OBC_CONFIG_ADXL345_VERSION 1
+
+struct obc_config_adxl345 {
+	__u8 data_format;	/* range and FULL_RES bits of DATA_FORMAT */
+	__u8 rate;		/* BW_RATE code */
+	__s8 offset[3];		/* OFSX, OFSY, OFSZ */
+	__u8 reserved[3];
+};
+
+#define OBC_CONFIG_HMC5883L_VERSION 1
+#define OBC_CONFIG_HMC5883L_GAINS 8
+
+struct obc_config_hmc5883l {
+	__u8 sample;		/* register codes */
+	__u8 out_rate;
+	__u8 mesura;
+	__u8 gain;
+	__u8 mode;
+	__u8 cal_valid;		/* bit per gain with an uploaded calibration */
+	__u8 scale_valid;	/* scale holds a self-test result */
+	__u8 reserved;
+	__s32 scale[3];
+	struct obc_magcal cal[OBC_CONFIG_HMC5883L_GAINS];
+};
+
+#define OBC_CONFIG_BMP280_VERSION 1
+
+struct obc_config_bmp280 {
+	__u8 ctrl_meas;
+	__u8 config;
+	__u16 reserved;
+};
+
+#ifdef __KERNEL__
+
+#include <linux/kernel.h>
+#include <linux/list.h>
+#include <linux/device.h>
+
+/*
+ * A driver's part of the blob. load() checks a section and takes it into
+ * the driver's shadow registers only; apply() writes the shadows to a
+ * running device.
+ */
+struct obc_config_client {
+	struct list_head node;
+	const char *name;
+	u16 dev;
+	u16 version;
+	u16 size;		/* of the payload struct */
+	void (*save)(struct obc_config_client *c, void *data);
+	int (*load)(struct obc_config_client *c, const void *data);
+	int (*apply)(struct obc_config_client *c);
+};
+
+void obc_config_register(struct obc_config_client *c);
+void obc_config_unregister(struct obc_config_client *c);
+int obc_config_fetch(struct obc_config_client *c, struct device *dev);
+
+#endif
+
+#endif
@@ -0,0 +1,245 @@
+/*
+ * Delta/varint compressed sample stream, shared by the drivers' read path
+ * and the userspace tools.
+ *
+ * A stream is a sequence of chunks. Each chunk starts with a tag byte
+ * holding the number of samples in its low seven bits. If OBC_DELTA_KEY is
+ * set the first sample is stored as absolute values and the chunk can be
+ * decoded on its own; every other sample is stored as the difference to the
+ * previous one. Timestamps are microseconds, written as unsigned LEB128
+ * varints; the three channels are zig-zag mapped before varint coding so
+ * that small negative steps stay one byte.
+ *
+ * A keyframe sample goes on with the sample's OBC_DELTA_KEY_FLAGS, its
+ * seq and its set; a delta sample with the zig-zag step of set, its seq
+ * being one past the previous sample's. A sample whose OBC_DELTA_KEY_FLAGS
+ * differ from the last keyframe's is always encoded as a keyframe, so a
+ * range, gain or calibration change is never lost to a delta.
+ *
+ * A tag byte of zero is a gap marker: it is followed by a varint count of
+ * samples the producer lost, and the next chunk is always a keyframe.
+ */
+#ifndef OBC_DELTA_H
+#define OBC_DELTA_H
+
+#include <linux/types.h>
+#include "obc_sample.h"
+
+#ifdef __KERNEL__
+#include <linux/math64.h>
+#define obc_delta_div_u64(x, y) div_u64(x, y)
+#else
+#include <stddef.h>
+#define obc_delta_div_u64(x, y) ((x) / (y))
+#endif
+
+#define OBC_DELTA_GAP 0x00
+#define OBC_DELTA_KEY 0x80
+#define OBC_DELTA_COUNT_MASK 0x7f
+#define OBC_DELTA_MAX_CHUNK_SAMPLES 127
+/* Sample flags a keyframe carries; gaps and stale captures are gap markers */
+#define OBC_DELTA_KEY_FLAGS (OBC_SAMPLE_CALIBRATED | OBC_SAMPLE_RANGE_MASK)
+/* 10 bytes for a 64-bit timestamp varint, 5 per channel, 3 for flags, 5 each for seq and set */
+#define OBC_DELTA_MAX_SAMPLE_BYTES 38
+#define OBC_DELTA_MAX_CHUNK_BYTES (1 + OBC_DELTA_MAX_CHUNK_SAMPLES * OBC_DELTA_MAX_SAMPLE_BYTES)
+#define OBC_DELTA_MAX_GAP_BYTES 11
+/* Worst case per sample of obc_delta_encode_block(): a gap marker, a chunk tag and the sample */
+#define OBC_DELTA_MAX_BLOCK_SAMPLE_BYTES (OBC_DELTA_MAX_GAP_BYTES + 1 + OBC_DELTA_MAX_SAMPLE_BYTES)
+#define OBC_DELTA_DEFAULT_KEY_INTERVAL 64
+
+/* Optional header written in front of a stream stored in a file */
+#define OBC_DELTA_STREAM_MAGIC 0x5a43424f /* "OBCZ" */
+#define OBC_DELTA_STREAM_VERSION 2	/* 1 had no flags, seq or set */
+
+struct obc_delta_stream_header {
+	__u32 magic;
+	__u8 version;
+	__u8 dev;
+	__u16 key_interval;
+};
+
+struct obc_delta_enc {
+	__u64 last_t_us;
+	__s32 last[3];
+	__u32 key_interval;
+	__u32 since_key;	/* samples since the last keyframe, 0 forces one */
+	__u16 flags;		/* OBC_DELTA_KEY_FLAGS of the last keyframe */
+	__u32 last_set;
+	__u32 next_seq;		/* follows the last sample encoded, if seq_valid */
+	int seq_valid;		/* cleared when samples were skipped unseen */
+};
+
+static inline void obc_delta_enc_init(struct obc_delta_enc *e, __u32 key_interval)
+{
+	e->last_t_us = 0;
+	e->last[0] = e->last[1] = e->last[2] = 0;
+	e->key_interval = key_interval ? key_interval : OBC_DELTA_DEFAULT_KEY_INTERVAL;
+	e->since_key = 0;
+	e->flags = 0;
+	e->last_set = 0;
+	e->next_seq = 0;
+	e->seq_valid = 0;
+}
+
+static inline __u32 obc_delta_zigzag(__s32 v)
+{
+	return ((__u32)v << 1) ^ (__u32)(v >> 31);
+}
+
+static inline __s32 obc_delta_unzigzag(__u32 v)
+{
+	return (__s32)(v >> 1) ^ -(__s32)(v & 1);
+}
+
+static inline __u8 *obc_delta_put_varint(__u8 *p, __u64 v)
+{
+	while (v >= 0x80) {
+		*p++ = (__u8)v | 0x80;
+		v >>= 7;
+	}
+	*p++ = (__u8)v;
+	return p;
+}
+
+/* Writes a gap marker for lost samples and forces the next keyframe */
+static inline size_t obc_delta_encode_gap(struct obc_delta_enc *e, __u64 lost, __u8 *out)
+{
+	__u8 *p = out;
+	*p++ = OBC_DELTA_GAP;
+	p = obc_delta_put_varint(p, lost);
+	e->since_key = 0;
+	return p - out;
+}
+
+/*
+ * Encodes up to *n samples as whole chunks into out. On return *n holds the
+ * number of samples consumed; the return value is the number of bytes
+ * written. A chunk is only started if a worst-case chunk still fits.
+ */
+static inline size_t obc_delta_encode(struct obc_delta_enc *e,
+		const struct obc_sample *s, unsigned int *n, __u8 *out, size_t len)
+{
+	unsigned int done = 0, avail = *n;
+	__u8 *p = out;
+
+	while (done < avail) {
+		unsigned int count = avail - done, i;
+		__u16 flags = s->flags & OBC_DELTA_KEY_FLAGS;
+		__u8 *tag = p;
+
+		if (count > OBC_DELTA_MAX_CHUNK_SAMPLES)
+			count = OBC_DELTA_MAX_CHUNK_SAMPLES;
+		if ((size_t)(out + len - p) < 1 + count * OBC_DELTA_MAX_SAMPLE_BYTES) {
+			if ((size_t)(out + len - p) < 1 + OBC_DELTA_MAX_SAMPLE_BYTES)
+				break;
+			count = (out + len - p - 1) / OBC_DELTA_MAX_SAMPLE_BYTES;
+		}
+		/* A keyframe always starts a new chunk, and so does a change of flags */
+		if (flags != e->flags)
+			e->since_key = 0;
+		if (count > e->key_interval - e->since_key)
+			count = e->key_interval - e->since_key;
+		for (i = 1; i < count && (s[i].flags & OBC_DELTA_KEY_FLAGS) == flags; i++)
+			;
+		count = i;
+
+		*tag = count;
+		p++;
+		for (i = 0; i < count; i++, s++) {
+			__u64 t_us = obc_delta_div_u64(s->t_ns, 1000);
+			if (e->since_key == 0) {
+				*tag |= OBC_DELTA_KEY;
+				p = obc_delta_put_varint(p, t_us);
+				p = obc_delta_put_varint(p, obc_delta_zigzag(s->v[0]));
+				p = obc_delta_put_varint(p, obc_delta_zigzag(s->v[1]));
+				p = obc_delta_put_varint(p, obc_delta_zigzag(s->v[2]));
+				p = obc_delta_put_varint(p, flags);
+				p = obc_delta_put_varint(p, s->seq);
+				p = obc_delta_put_varint(p, s->set);
+				e->flags = flags;
+			} else {
+				p = obc_delta_put_varint(p, t_us - e->last_t_us);
+				p = obc_delta_put_varint(p, obc_delta_zigzag(s->v[0] - e->last[0]));
+				p = obc_delta_put_varint(p, obc_delta_zigzag(s->v[1] - e->last[1]));
+				p = obc_delta_put_varint(p, obc_delta_zigzag(s->v[2] - e->last[2]));
+				p = obc_delta_put_varint(p, obc_delta_zigzag(s->set - e->last_set));
+			}
+			e->last_t_us = t_us;
+			e->last[0] = s->v[0];
+			e->last[1] = s->v[1];
+			e->last[2] = s->v[2];
+			e->last_set = s->set;
+			if (++e->since_key >= e->key_interval)
+				e->since_key = 0;
+		}
+		done += count;
+	}
+	*n = done;
+	return p - out;
+}
+
+/*
+ * Encodes a block the way the drivers' read path streams it: runs of
+ * fresh or stale samples, split before each one flagged as following a
+ * gap, where a gap marker counts the samples missing from the sequence
+ * (0 when that is not known). Stale captures carry no new data, they
+ * appear as gaps in the stream. out must hold
+ * n * OBC_DELTA_MAX_BLOCK_SAMPLE_BYTES; returns the bytes written.
+ */
+static inline size_t obc_delta_encode_block(struct obc_delta_enc *e,
+		const struct obc_sample *s, unsigned int n, __u8 *out)
+{
+	unsigned int i, j, m;
+	__u16 stale;
+	__u8 *p = out;
+
+	for (i = 0; i < n; i = j) {
+		if (s[i].flags & OBC_SAMPLE_GAP)
+			p += obc_delta_encode_gap(e, e->seq_valid ? s[i].seq - e->next_seq : 0, p);
+		stale = s[i].flags & OBC_SAMPLE_STALE;
+		for (j = i + 1; j < n && !(s[j].flags & OBC_SAMPLE_GAP) &&
+				(s[j].flags & OBC_SAMPLE_STALE) == stale; j++)
+			;
+		if (stale) {
+			p += obc_delta_encode_gap(e, j - i, p);
+		} else {
+			/* Room for one chunk per sample, so the whole run is taken */
+			m = j - i;
+			p += obc_delta_encode(e, s + i, &m, p, (size_t)m * (1 + OBC_DELTA_MAX_SAMPLE_BYTES));
+		}
+		e->next_seq = s[j - 1].seq + 1;
+		e->seq_valid = 1;
+	}
+	return p - out;
+}
+
+#ifndef __KERNEL__
+
+struct obc_delta_dec {
+	__u64 last_t_us;
+	__s32 last[3];
+	__u64 lost;		/* total reported by gap markers */
+	__u32 seq;
+	__u32 set;
+	__u16 dev;
+	__u16 key_flags;	/* OBC_DELTA_KEY_FLAGS of the last keyframe */
+	__u16 flags;		/* applied to the next decoded sample */
+	int synced;		/* a keyframe has been seen */
+};
+
+void obc_delta_dec_init(struct obc_delta_dec *d, __u16 dev);
+
+/*
+ * Decodes whole chunks from in into at most max samples. *used is set to
+ * the number of input bytes consumed. Returns the number of samples
+ * produced or -1 if the input is corrupt. Delta chunks seen before the
+ * first keyframe are skipped. The sample following a gap marker carries
+ * OBC_SAMPLE_GAP and the sequence numbers skip the lost samples; each
+ * keyframe sets them, the flags and set as the producer had them.
+ */
+int obc_delta_decode(struct obc_delta_dec *d, const __u8 *in, size_t len,
+		size_t *used, struct obc_sample *out, unsigned int max);
+
+#endif
+
+#endif
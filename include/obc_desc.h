@@ -0,0 +1,162 @@
+/*
+ * Descriptor tables for the OBC sensors.
+ *
+ * A sensor is described by static const tables: its configuration fields
+ * (register, position, lookup table of physical values) and the layout
+ * of one sample in its data registers (channel count and order, width,
+ * endianness, signedness). The helpers below do the register plumbing
+ * and the raw to sample conversion from those tables. Everything is
+ * static inline and the tables are const, so each driver's decode loop
+ * is compiled for its own layout with the switches folded away.
+ */
+#ifndef OBC_DESC_H
+#define OBC_DESC_H
+
+#include <linux/types.h>
+
+#ifdef __KERNEL__
+#include <linux/kernel.h>
+#else
+/* The layout and decode helpers also serve the trace replay in userspace */
+#include <stdbool.h>
+#include <errno.h>
+typedef __u8 u8;
+typedef __u16 u16;
+typedef __u32 u32;
+typedef __s32 s32;
+#ifndef ARRAY_SIZE
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
+#endif
+#endif
+
+#include "obc_sample.h"
+
+/* A bit field in one configuration register */
+struct obc_field {
+	const char *name;
+	u8 reg;
+	u8 shift;
+	u8 mask;		/* unshifted */
+	u8 nlut;
+	const unsigned int *lut;	/* physical value per code, NULL for raw codes */
+};
+
+#define OBC_FIELD(_name, _reg, _shift, _mask) \
+	{ .name = _name, .reg = _reg, .shift = _shift, .mask = _mask }
+#define OBC_FIELD_LUT(_name, _reg, _shift, _mask, _lut) \
+	{ .name = _name, .reg = _reg, .shift = _shift, .mask = _mask, \
+	  .nlut = ARRAY_SIZE(_lut), .lut = _lut }
+
+enum {
+	OBC_LE = 0,
+	OBC_BE,
+};
+
+/*
+ * One sample in the data registers: channel i is at byte offset[i] of a
+ * burst of len bytes starting at reg. Channels wider than a byte boundary
+ * (the BMP280's 20 bits) are left aligned in their bytes, MSB first.
+ */
+struct obc_layout {
+	u8 reg;
+	u8 len;
+	u8 channels;
+	u8 width;		/* bits per channel */
+	u8 endian;
+	u8 is_signed;
+	u8 offset[3];
+};
+
+/* Timing and identity of a sensor */
+struct obc_sensor_desc {
+	const char *name;
+	u16 dev;		/* OBC_DEV_* */
+	u8 id_reg;
+	u8 id;
+	unsigned int reset_us;	/* soft reset to registers usable */
+	unsigned int turn_on_us;	/* measurement enabled to first sample */
+	const struct obc_field *fields;
+	unsigned int nfields;
+	const struct obc_layout *layout;
+};
+
+static inline unsigned int obc_field_get(const struct obc_field *f, u8 reg)
+{
+	return (reg >> f->shift) & f->mask;
+}
+
+static inline u8 obc_field_prep(const struct obc_field *f, unsigned int code)
+{
+	return (code & f->mask) << f->shift;
+}
+
+static inline bool obc_field_valid(const struct obc_field *f, unsigned int code)
+{
+	return code <= f->mask && (!f->lut || code < f->nlut);
+}
+
+/* Replaces the field in a shadow register, -EINVAL if the code does not fit */
+static inline int obc_field_set(const struct obc_field *f, u8 *reg, unsigned int code)
+{
+	if(!obc_field_valid(f, code))
+		return -EINVAL;
+	*reg = (*reg & ~(f->mask << f->shift)) | obc_field_prep(f, code);
+	return 0;
+}
+
+/* Physical value of the field's current code, the code itself without a table */
+static inline unsigned int obc_field_value(const struct obc_field *f, u8 reg)
+{
+	unsigned int code = obc_field_get(f, reg);
+	if(!f->lut)
+		return code;
+	return code < f->nlut ? f->lut[code] : 0;
+}
+
+/* Code of the smallest table entry not below val, the table must be ascending */
+static inline int obc_field_code(const struct obc_field *f, unsigned long val)
+{
+	unsigned int i;
+	if(!f->lut)
+		return val <= f->mask ? (int)val : -EINVAL;
+	for(i = 0; i < f->nlut; i++)
+		if(f->lut[i] >= val)
+			return i;
+	return -EINVAL;
+}
+
+static inline s32 obc_layout_channel(const struct obc_layout *l, const u8 *p)
+{
+	u32 v;
+	unsigned int bytes = (l->width + 7) / 8;
+	if(bytes == 2)
+		v = l->endian == OBC_BE ? (p[0] << 8) | p[1] : (p[1] << 8) | p[0];
+	else if(bytes == 3)
+		v = l->endian == OBC_BE ? (p[0] << 16) | (p[1] << 8) | p[2] :
+			(p[2] << 16) | (p[1] << 8) | p[0];
+	else
+		v = p[0];
+	v >>= bytes * 8 - l->width;
+	if(l->is_signed)
+		return (s32)(v << (32 - l->width)) >> (32 - l->width);
+	return v;
+}
+
+/* Raw burst to channel values */
+static inline void obc_layout_decode(const struct obc_layout *l, const u8 *raw, s32 *v)
+{
+	unsigned int i;
+	for(i = 0; i < l->channels; i++)
+		v[i] = obc_layout_channel(l, raw + l->offset[i]);
+}
+
+/* n bursts stored back to back, e.g. a FIFO drain, into n samples */
+static inline void obc_layout_decode_block(const struct obc_layout *l, const u8 *raw,
+		struct obc_sample *s, unsigned int n)
+{
+	unsigned int i;
+	for(i = 0; i < n; i++)
+		obc_layout_decode(l, raw + i * l->len, s[i].v);
+}
+
+#endif
@@ -0,0 +1,63 @@
+/*
+ * Output data rate governor, provided by the obc_core module.
+ *
+ * Each sensor describes the rates it supports; the governor picks one
+ * from the highest rate an open file asked for and from the motion seen
+ * by the ADXL345: the sensor's motion rate while moving, its quiet rate
+ * otherwise, never below what a consumer asked for. A decision only sets
+ * the target. The driver calls obc_gov_sync() from its capture path right
+ * before a bus read, so the change is written between two samples and
+ * never in the middle of one.
+ */
+#ifndef OBC_GOVERNOR_H
+#define OBC_GOVERNOR_H
+
+#include <linux/kernel.h>
+#include <linux/list.h>
+
+#define OBC_GOV_MAX_RATES 16
+
+struct obc_gov_rate {
+	unsigned int mhz;	/* output data rate in millihertz */
+	u8 code;		/* rate register code */
+	u8 avg;			/* averaging register code, if the sensor has one */
+};
+
+struct obc_gov_client {
+	const char *name;
+	const struct obc_gov_rate *rates;	/* ascending */
+	unsigned int nrates;
+	unsigned int quiet;	/* rate index while motion is quiet */
+	unsigned int motion;	/* rate index while moving */
+	/* Programs a rate; called from obc_gov_sync(), between samples */
+	int (*apply)(struct obc_gov_client *c, const struct obc_gov_rate *r);
+
+	/* Owned by the governor */
+	struct list_head node;
+	unsigned int votes[OBC_GOV_MAX_RATES];	/* open files asking for each rate */
+	unsigned int cur;
+	unsigned int target;
+	unsigned int max;	/* highest index allowed, see obc_gov_set_max() */
+	const char *reason;
+	u64 changes;
+};
+
+int obc_gov_register(struct obc_gov_client *c, unsigned int cur);
+void obc_gov_unregister(struct obc_gov_client *c);
+/* Moves the vote held in *vote (-1 for none) to the lowest rate >= mhz, 0 withdraws it */
+int obc_gov_vote(struct obc_gov_client *c, int *vote, unsigned int mhz);
+/* The rate was set by hand; the governor takes over again on its next decision */
+void obc_gov_reset(struct obc_gov_client *c, unsigned int idx);
+/* Caps the rates the governor and the votes may pick, lowering the target if needed */
+void obc_gov_set_max(struct obc_gov_client *c, unsigned int max);
+/* Activity measure from the accelerometer, once per sample */
+void obc_gov_motion(unsigned int activity);
+void obc_gov_apply(struct obc_gov_client *c);
+
+static inline void obc_gov_sync(struct obc_gov_client *c)
+{
+	if(unlikely(READ_ONCE(c->target) != c->cur))
+		obc_gov_apply(c);
+}
+
+#endif
@@ -0,0 +1,92 @@
+/*
+ * Sample journal in reserved memory that survives a warm reboot.
+ *
+ * A region kept out of the kernel's memory, like the one ramoops uses, is
+ * split into one partition per OBC_DEV_* device. Each driver copies its
+ * captures there as it takes them, every n-th one with journal_decimation,
+ * into a circular buffer of struct obc_sample. Nothing is flushed to
+ * flash; after a watchdog reset the region still holds the history up to
+ * the fault. At the next load of obc_core the previous boot's partitions
+ * are checked, copied out and offered read-only as
+ * /sys/devices/obc/journal before the region is reused.
+ *
+ * The region is the reserved-memory node compatible with "obc,journal",
+ * or journal_addr/journal_size given to obc_core. The recovered file is a
+ * sequence of partitions, each a struct obc_journal_part followed by
+ * min(head, slots) samples, oldest first.
+ */
+#ifndef OBC_JOURNAL_H
+#define OBC_JOURNAL_H
+
+#include <linux/types.h>
+
+#define OBC_JOURNAL_MAGIC 0x4a43424f /* "OBCJ" */
+#define OBC_JOURNAL_PART_MAGIC 0x5043424f /* "OBCP" */
+#define OBC_JOURNAL_VERSION 1
+
+/* At the start of the region */
+struct obc_journal_header {
+	__u32 magic;
+	__u16 version;
+	__u16 parts;
+	__u32 size;		/* of the region */
+	__u32 part_size;	/* of each partition, header included */
+	__u32 boot;		/* boots that have used the region */
+	__u32 crc;		/* CRC-32 of the fields above */
+};
+
+/* At the start of each partition; the sample slots follow */
+struct obc_journal_part {
+	__u32 magic;
+	__u16 dev;		/* OBC_DEV_* */
+	__u16 version;
+	__u32 record_size;	/* sizeof(struct obc_sample) */
+	__u32 slots;		/* a power of two */
+	__u32 decimation;	/* one sample kept out of this many */
+	__u32 boot;		/* of the region header when written */
+	__u32 crc;		/* CRC-32 of the fields above */
+	__u32 head;		/* samples written, slot head % slots is next */
+};
+
+#ifdef __KERNEL__
+
+#include <linux/kernel.h>
+#include <linux/compiler.h>
+#include <asm/barrier.h>
+
+#include "obc_sample.h"
+
+/* A driver's handle on its partition; slots is NULL without a region */
+struct obc_journal {
+	struct obc_journal_part *part;
+	struct obc_sample *slots;
+	u32 mask;
+	u32 head;
+	unsigned int skip;
+	unsigned int decimation;
+};
+
+int obc_journal_attach(struct obc_journal *j, u16 dev);
+void obc_journal_detach(struct obc_journal *j);
+
+/*
+ * Copies one capture into the partition. Called from the driver's
+ * capture path only, so there is one writer per partition. The slot is
+ * written before head moves past it; a reset in between leaves head on
+ * the last complete sample.
+ */
+static inline void obc_journal_push(struct obc_journal *j, const struct obc_sample *s)
+{
+	if(!j->slots)
+		return;
+	if(++j->skip < j->decimation)
+		return;
+	j->skip = 0;
+	j->slots[j->head & j->mask] = *s;
+	wmb();
+	WRITE_ONCE(j->part->head, ++j->head);
+}
+
+#endif
+
+#endif
@@ -0,0 +1,91 @@
+/*
+ * Magnetometer hard/soft-iron calibration in fixed point, shared by the
+ * HMC5883L driver and userspace tools.
+ *
+ * A corrected sample is M * (v - o): o is the hard-iron offset in raw
+ * counts scaled by 2^OBC_MAGCAL_OFFSET_SHIFT, M the soft-iron matrix with
+ * OBC_MAGCAL_ONE as 1.0. Results are raw counts again, rounded.
+ */
+#ifndef OBC_MAGCAL_H
+#define OBC_MAGCAL_H
+
+#include <linux/types.h>
+#include "obc_sample.h"
+
+#define OBC_MAGCAL_OFFSET_SHIFT 4
+#define OBC_MAGCAL_MATRIX_SHIFT 14
+#define OBC_MAGCAL_ONE (1 << OBC_MAGCAL_MATRIX_SHIFT)
+#define OBC_MAGCAL_SHIFT (OBC_MAGCAL_OFFSET_SHIFT + OBC_MAGCAL_MATRIX_SHIFT)
+
+struct obc_magcal {
+	__s32 offset[3];
+	__s32 matrix[3][3];
+};
+
+/* Argument of the calibration upload and query ioctls */
+struct obc_magcal_set {
+	__u8 gain;		/* gain register code the parameters apply to */
+	__u8 valid;		/* 0 clears the calibration for this gain */
+	__u16 reserved;
+	struct obc_magcal cal;
+};
+
+/* Result of the bias-field self-calibration, all in raw counts */
+struct obc_magcal_selftest {
+	__s32 positive[3];	/* reading with the positive bias field */
+	__s32 negative[3];	/* reading with the negative bias field */
+	__s32 expected[3];	/* bias field the datasheet specifies */
+	__s32 scale[3];		/* per-axis sensitivity correction, OBC_MAGCAL_ONE is 1.0 */
+};
+
+static inline void obc_magcal_identity(struct obc_magcal *c)
+{
+	int i, j;
+	for (i = 0; i < 3; i++) {
+		c->offset[i] = 0;
+		for (j = 0; j < 3; j++)
+			c->matrix[i][j] = i == j ? OBC_MAGCAL_ONE : 0;
+	}
+}
+
+/* out = cal with each matrix column multiplied by scale, i.e. M * diag(scale) */
+static inline void obc_magcal_fold_scale(struct obc_magcal *out,
+		const struct obc_magcal *cal, const __s32 scale[3])
+{
+	int i, j;
+	for (i = 0; i < 3; i++) {
+		out->offset[i] = cal->offset[i];
+		for (j = 0; j < 3; j++)
+			out->matrix[i][j] = (__s32)(((__s64)cal->matrix[i][j] * scale[j] +
+					(OBC_MAGCAL_ONE / 2)) >> OBC_MAGCAL_MATRIX_SHIFT);
+	}
+}
+
+/*
+ * Multiply-accumulate over a block of samples captured with the same
+ * parameters. The coefficients are loaded once per block and the inner
+ * loops have constant bounds, so the compiler can unroll them fully.
+ */
+static inline void obc_magcal_apply(const struct obc_magcal *c,
+		struct obc_sample *s, unsigned int n)
+{
+	__s64 m[3][3], o[3], d[3];
+	unsigned int k;
+	int i, j;
+
+	for (i = 0; i < 3; i++) {
+		o[i] = c->offset[i];
+		for (j = 0; j < 3; j++)
+			m[i][j] = c->matrix[i][j];
+	}
+	for (k = 0; k < n; k++) {
+		for (j = 0; j < 3; j++)
+			d[j] = ((__s64)s[k].v[j] << OBC_MAGCAL_OFFSET_SHIFT) - o[j];
+		for (i = 0; i < 3; i++)
+			s[k].v[i] = (__s32)((m[i][0] * d[0] + m[i][1] * d[1] + m[i][2] * d[2] +
+					(1LL << (OBC_MAGCAL_SHIFT - 1))) >> OBC_MAGCAL_SHIFT);
+		s[k].flags |= OBC_SAMPLE_CALIBRATED;
+	}
+}
+
+#endif
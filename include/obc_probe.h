@@ -0,0 +1,86 @@
+/* Probe stage timing and readiness shared by the OBC sensor drivers */
+#ifndef OBC_PROBE_H
+#define OBC_PROBE_H
+
+#include <linux/kernel.h>
+#include <linux/ktime.h>
+#include <linux/jiffies.h>
+#include <linux/completion.h>
+
+#define OBC_PROBE_READY_TIMEOUT_MS 2000
+
+enum {
+	OBC_PROBE_RESET = 0,
+	OBC_PROBE_CONFIG,
+	OBC_PROBE_FIRST_SAMPLE,
+	OBC_PROBE_READY,
+	OBC_PROBE_STAGES
+};
+
+/*
+ * Configuration is deferred to a work item so that probe returns right away.
+ * Readers wait on 'ready' and then see the result of the deferred
+ * configuration in 'err'. Stage times are microseconds since probe entry,
+ * -1 if the stage was not reached.
+ */
+struct obc_probe {
+	ktime_t start;
+	s64 stage_us[OBC_PROBE_STAGES];
+	struct completion ready;
+	int err;
+};
+
+/* Called once when the driver state is allocated */
+static inline void obc_probe_init(struct obc_probe *p)
+{
+	init_completion(&p->ready);
+	p->err = -ENODEV;
+}
+
+/* Called on probe entry, before the configuration work is queued */
+static inline void obc_probe_start(struct obc_probe *p)
+{
+	int i;
+	p->start = ktime_get();
+	for(i = 0; i < OBC_PROBE_STAGES; i++)
+		p->stage_us[i] = -1;
+	p->err = 0;
+	reinit_completion(&p->ready);
+}
+
+static inline void obc_probe_mark(struct obc_probe *p, int stage)
+{
+	p->stage_us[stage] = ktime_us_delta(ktime_get(), p->start);
+}
+
+static inline void obc_probe_done(struct obc_probe *p, int err)
+{
+	p->err = err;
+	obc_probe_mark(p, OBC_PROBE_READY);
+	complete_all(&p->ready);
+}
+
+static inline int obc_probe_wait(struct obc_probe *p)
+{
+	long left;
+	left = wait_for_completion_interruptible_timeout(&p->ready,
+			msecs_to_jiffies(OBC_PROBE_READY_TIMEOUT_MS));
+	if(left < 0)
+		return left;
+	if(left == 0)
+		return -ETIMEDOUT;
+	return p->err;
+}
+
+static inline ssize_t obc_probe_show(struct obc_probe *p, char *buf)
+{
+	return sprintf(buf, "start %lld\nreset %lld\nconfig %lld\nfirst_sample %lld\nready %lld\nerr %d\n",
+			ktime_to_us(p->start),
+			p->stage_us[OBC_PROBE_RESET],
+			p->stage_us[OBC_PROBE_CONFIG],
+			p->stage_us[OBC_PROBE_FIRST_SAMPLE],
+			p->stage_us[OBC_PROBE_READY],
+			p->err);
+}
+
+#endif
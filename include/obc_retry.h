@@ -0,0 +1,177 @@
+/*
+ * Per-device bus error policy: bounded retries inside a time budget, bus
+ * recovery after repeated failures and a circuit breaker that fails fast
+ * with exponential backoff while a sensor keeps failing.
+ */
+#ifndef OBC_RETRY_H
+#define OBC_RETRY_H
+
+#include <linux/kernel.h>
+#include <linux/ktime.h>
+#include <linux/jiffies.h>
+#include <linux/spinlock.h>
+
+#include "obc_bus.h"
+
+struct obc_err_policy {
+	unsigned int max_retries;	/* extra attempts after the first one */
+	unsigned int deadline_us;	/* no retry is started after this budget */
+	unsigned int recover_after;	/* consecutive failures between bus recoveries */
+	unsigned int breaker_after;	/* consecutive failures that open the breaker */
+	unsigned int backoff_min_ms;
+	unsigned int backoff_max_ms;
+};
+
+#define OBC_ERR_POLICY_DEFAULT { \
+	.max_retries = 2, \
+	.deadline_us = 5000, \
+	.recover_after = 3, \
+	.breaker_after = 6, \
+	.backoff_min_ms = 100, \
+	.backoff_max_ms = 5000, \
+}
+
+struct obc_err_state {
+	spinlock_t lock;
+	struct obc_err_policy policy;
+	unsigned int consecutive;
+	unsigned int backoff_ms;
+	unsigned long open_until;	/* jiffies, breaker open before this */
+	u64 ok;
+	u64 errors;
+	u64 retries;
+	u64 timeouts;
+	u64 recoveries;
+	u64 trips;
+	u64 rejected;
+	u64 stale;
+};
+
+static inline void obc_err_init(struct obc_err_state *st)
+{
+	struct obc_err_policy def = OBC_ERR_POLICY_DEFAULT;
+	memset(st, 0, sizeof(*st));
+	spin_lock_init(&st->lock);
+	st->policy = def;
+}
+
+/*
+ * Runs xfer(ctx) under the policy, each attempt as one transaction
+ * scheduled on the client's bus (obc_bus.h) when bc and req are given.
+ * recover(ctx) is called every recover_after consecutive failures, e.g.
+ * to recover the I2C bus or set the SPI device up again. While the
+ * breaker is open the transfer is not attempted and -EAGAIN is returned.
+ * Returns the last xfer result.
+ */
+static inline int obc_retry_bus(struct obc_err_state *st, struct obc_bus_client *bc,
+		const struct obc_bus_req *req, int (*xfer)(void *ctx),
+		int (*recover)(void *ctx), void *ctx)
+{
+	struct obc_err_policy p;
+	ktime_t deadline;
+	unsigned int attempt = 0;
+	bool do_recover;
+	int err;
+
+	spin_lock(&st->lock);
+	if(st->open_until && time_before(jiffies, st->open_until)){
+		st->rejected++;
+		spin_unlock(&st->lock);
+		return -EAGAIN;
+	}
+	p = st->policy;
+	spin_unlock(&st->lock);
+
+	deadline = ktime_add_us(ktime_get(), p.deadline_us);
+	for(;;){
+		err = obc_bus_run(bc, req, xfer, ctx);
+		spin_lock(&st->lock);
+		if(err >= 0){
+			st->ok++;
+			st->consecutive = 0;
+			st->backoff_ms = 0;
+			st->open_until = 0;
+			spin_unlock(&st->lock);
+			return err;
+		}
+		st->errors++;
+		st->consecutive++;
+		do_recover = recover && p.recover_after && st->consecutive % p.recover_after == 0;
+		if(do_recover)
+			st->recoveries++;
+		if(p.breaker_after && st->consecutive >= p.breaker_after){
+			/* Half-open after the backoff: one failed attempt reopens it for longer */
+			st->backoff_ms = st->backoff_ms ? min(2 * st->backoff_ms, p.backoff_max_ms) : p.backoff_min_ms;
+			st->open_until = jiffies + msecs_to_jiffies(st->backoff_ms);
+			st->trips++;
+			spin_unlock(&st->lock);
+			if(do_recover)
+				recover(ctx);
+			return err;
+		}
+		if(attempt++ >= p.max_retries){
+			spin_unlock(&st->lock);
+			if(do_recover)
+				recover(ctx);
+			return err;
+		}
+		if(ktime_after(ktime_get(), deadline)){
+			st->timeouts++;
+			spin_unlock(&st->lock);
+			return err;
+		}
+		st->retries++;
+		spin_unlock(&st->lock);
+		if(do_recover)
+			recover(ctx);
+	}
+}
+
+static inline int obc_retry(struct obc_err_state *st, int (*xfer)(void *ctx),
+		int (*recover)(void *ctx), void *ctx)
+{
+	return obc_retry_bus(st, NULL, NULL, xfer, recover, ctx);
+}
+
+static inline void obc_err_stale(struct obc_err_state *st)
+{
+	spin_lock(&st->lock);
+	st->stale++;
+	spin_unlock(&st->lock);
+}
+
+static inline ssize_t obc_err_show(struct obc_err_state *st, char *buf)
+{
+	ssize_t len;
+	spin_lock(&st->lock);
+	len = sprintf(buf, "ok %llu\nerrors %llu\nretries %llu\ntimeouts %llu\nrecoveries %llu\n"
+			"trips %llu\nrejected %llu\nstale %llu\nconsecutive %u\nbackoff_ms %u\n",
+			st->ok, st->errors, st->retries, st->timeouts, st->recoveries,
+			st->trips, st->rejected, st->stale, st->consecutive,
+			st->open_until && time_before(jiffies, st->open_until) ? st->backoff_ms : 0);
+	spin_unlock(&st->lock);
+	return len;
+}
+
+static inline ssize_t obc_err_policy_show(struct obc_err_state *st, char *buf)
+{
+	struct obc_err_policy *p = &st->policy;
+	return sprintf(buf, "%u %u %u %u %u %u\n", p->max_retries, p->deadline_us,
+			p->recover_after, p->breaker_after, p->backoff_min_ms, p->backoff_max_ms);
+}
+
+/* Input: max_retries deadline_us recover_after breaker_after backoff_min_ms backoff_max_ms */
+static inline ssize_t obc_err_policy_store(struct obc_err_state *st, const char *buf, size_t count)
+{
+	struct obc_err_policy p;
+	if(sscanf(buf, "%u %u %u %u %u %u", &p.max_retries, &p.deadline_us, &p.recover_after,
+			&p.breaker_after, &p.backoff_min_ms, &p.backoff_max_ms) != 6 ||
+			p.backoff_min_ms > p.backoff_max_ms)
+		return -EINVAL;
+	spin_lock(&st->lock);
+	st->policy = p;
+	spin_unlock(&st->lock);
+	return count;
+}
+
+#endif
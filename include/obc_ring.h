@@ -0,0 +1,517 @@
+/*
+ * Single producer sample ring with an independent cursor per open file.
+ *
+ * The sampler thread pushes every capture once; each reader copies from
+ * its own cursor. What happens when a reader falls a full ring behind is
+ * its policy (OBC_RING_* in obc_sample.h), inherited from the device's
+ * default at open. With drop-oldest, the default, the reader does not
+ * hold the producer back: its cursor jumps to the oldest sample still
+ * held, the loss is counted and a gap marker is put in its stream. With
+ * drop-newest the producer discards new samples until the reader catches
+ * up; with block it first waits up to block_us for it. Discarded samples
+ * are counted on the ring and the next stored sample carries
+ * OBC_SAMPLE_GAP, which read() turns into a gap marker with the number of
+ * samples missing from the sequence.
+ *
+ * The ring can also be mapped read-only (struct obc_ring_shm). Mapped
+ * readers keep their cursor in userspace and lseek() the file to it
+ * before polling, so poll() keeps meaning "samples past my cursor".
+ * With drop-newest or block they also seek after consuming, since the
+ * file's cursor is what holds the producer back.
+ *
+ * The stream is produced through read_iter, so the char devices also
+ * take splice() and sendfile(): a logger moves it into a pipe, file or
+ * socket without it passing through a user buffer.
+ */
+#ifndef OBC_RING_H
+#define OBC_RING_H
+
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/mm.h>
+#include <linux/spinlock.h>
+#include <linux/wait.h>
+#include <linux/poll.h>
+#include <linux/fs.h>
+#include <linux/uio.h>
+#include <linux/uaccess.h>
+#include <linux/atomic.h>
+#include <linux/mutex.h>
+#include <linux/list.h>
+#include <linux/string.h>
+
+#include "obc_sample.h"
+#include "obc_delta.h"
+
+#define OBC_RING_ORDER 10	/* 1024 samples */
+#define OBC_RING_BATCH 64	/* samples copied out per read() */
+/* Worst case per sample in the stream */
+#define OBC_RING_SAMPLE_BYTES OBC_DELTA_MAX_BLOCK_SAMPLE_BYTES
+#define OBC_RING_BLOCK_US 10000
+
+static const char * const obc_ring_policy_names[OBC_RING_POLICIES] = {
+	[OBC_RING_DROP_OLDEST] = "drop-oldest",
+	[OBC_RING_DROP_NEWEST] = "drop-newest",
+	[OBC_RING_BLOCK] = "block",
+};
+
+struct obc_ring {
+	spinlock_t lock;
+	wait_queue_head_t wait;
+	wait_queue_head_t space;	/* producer waiting for a blocking reader */
+	struct list_head list;	/* open readers */
+	unsigned int held;	/* readers whose policy holds the producer back */
+	u8 policy;		/* given to readers at open */
+	unsigned int block_us;	/* longest producer wait per loss */
+	bool gap;		/* samples were discarded, flag the next stored one */
+	u64 dropped;
+	u64 block_timeouts;
+	u64 hw_overruns;
+	struct obc_ring_shm *shm;	/* vmalloc_user() area, shm page then slots */
+	struct obc_sample *buf;
+	unsigned int mask;
+	u64 head;		/* samples pushed since the ring was created */
+	atomic_t readers;
+	/* Optional correction run over each block as it is copied out */
+	void (*filter)(void *ctx, struct obc_sample *s, unsigned int n);
+	void *filter_ctx;
+};
+
+struct obc_ring_reader {
+	struct obc_ring *ring;
+	struct list_head node;
+	struct mutex lock;	/* serialises read() on one file */
+	u64 cursor;
+	u64 overruns;
+	u64 lost;
+	u64 pending_lost;	/* lost samples not yet reported in the stream */
+	u64 max_lag;
+	u8 policy;
+	int rate_vote;		/* governor rate index this file asked for, -1 for none */
+	struct obc_delta_enc enc;
+	struct obc_sample batch[OBC_RING_BATCH];
+	u8 out[OBC_DELTA_MAX_GAP_BYTES + OBC_RING_BATCH * OBC_RING_SAMPLE_BYTES];
+	size_t out_off;		/* encoded bytes of out already returned */
+	size_t out_len;		/* encoded bytes in out, the rest is due first */
+};
+
+static inline int obc_ring_init(struct obc_ring *ring, unsigned int order, u16 dev)
+{
+	ring->shm = vmalloc_user(PAGE_SIZE + (sizeof(*ring->buf) << order));
+	if(!ring->shm)
+		return -ENOMEM;
+	ring->shm->size = 1 << order;
+	ring->shm->record_size = sizeof(*ring->buf);
+	ring->shm->data_offset = PAGE_SIZE;
+	ring->shm->dev = dev;
+	ring->shm->version = OBC_RING_SHM_VERSION;
+	ring->buf = (void *)ring->shm + PAGE_SIZE;
+	spin_lock_init(&ring->lock);
+	init_waitqueue_head(&ring->wait);
+	init_waitqueue_head(&ring->space);
+	INIT_LIST_HEAD(&ring->list);
+	ring->held = 0;
+	ring->policy = OBC_RING_DROP_OLDEST;
+	ring->block_us = OBC_RING_BLOCK_US;
+	ring->gap = false;
+	ring->dropped = 0;
+	ring->block_timeouts = 0;
+	ring->hw_overruns = 0;
+	ring->mask = (1 << order) - 1;
+	ring->head = 0;
+	atomic_set(&ring->readers, 0);
+	ring->filter = NULL;
+	ring->filter_ctx = NULL;
+	return 0;
+}
+
+static inline void obc_ring_free(struct obc_ring *ring)
+{
+	vfree(ring->shm);
+	ring->shm = NULL;
+	ring->buf = NULL;
+}
+
+/*
+ * Strongest policy among the readers the next push would overrun,
+ * drop-oldest if it overruns none that hold the producer back. Called
+ * with the lock held.
+ */
+static inline int obc_ring_stall(struct obc_ring *ring)
+{
+	struct obc_ring_reader *r;
+	int policy = OBC_RING_DROP_OLDEST;
+	if(!ring->held)
+		return policy;
+	list_for_each_entry(r, &ring->list, node)
+		if(r->policy > policy && ring->head - r->cursor > ring->mask)
+			policy = r->policy;
+	return policy;
+}
+
+static inline bool obc_ring_unblocked(struct obc_ring *ring)
+{
+	unsigned long flags;
+	bool ok;
+	spin_lock_irqsave(&ring->lock, flags);
+	ok = obc_ring_stall(ring) != OBC_RING_BLOCK;
+	spin_unlock_irqrestore(&ring->lock, flags);
+	return ok;
+}
+
+/*
+ * Stores one sample for every reader. A blocking reader a full ring
+ * behind makes this wait up to block_us for it, once per loss: while
+ * samples are being discarded the next ones are discarded without a wait.
+ * May sleep if any reader uses the block policy.
+ */
+static inline void obc_ring_push(struct obc_ring *ring, const struct obc_sample *s)
+{
+	struct obc_sample *slot;
+	unsigned long flags;
+	int stall;
+	spin_lock_irqsave(&ring->lock, flags);
+	stall = obc_ring_stall(ring);
+	if(stall == OBC_RING_BLOCK && !ring->gap){
+		spin_unlock_irqrestore(&ring->lock, flags);
+		wait_event_timeout(ring->space, obc_ring_unblocked(ring),
+				usecs_to_jiffies(READ_ONCE(ring->block_us)));
+		spin_lock_irqsave(&ring->lock, flags);
+		stall = obc_ring_stall(ring);
+		if(stall == OBC_RING_BLOCK)
+			ring->block_timeouts++;
+	}
+	if(stall != OBC_RING_DROP_OLDEST){
+		ring->dropped++;
+		ring->gap = true;
+		spin_unlock_irqrestore(&ring->lock, flags);
+		return;
+	}
+	/* Mapped readers: head covering the old slot is visible before the slot changes */
+	smp_wmb();
+	slot = &ring->buf[ring->head & ring->mask];
+	*slot = *s;
+	if(ring->gap){
+		slot->flags |= OBC_SAMPLE_GAP;
+		ring->gap = false;
+	}
+	ring->head++;
+	smp_store_release(&ring->shm->head, (u32)ring->head);
+	spin_unlock_irqrestore(&ring->lock, flags);
+	wake_up_interruptible(&ring->wait);
+}
+
+/* The device lost samples in its own buffer, e.g. a FIFO that filled up */
+static inline void obc_ring_hw_overrun(struct obc_ring *ring)
+{
+	unsigned long flags;
+	spin_lock_irqsave(&ring->lock, flags);
+	ring->hw_overruns++;
+	spin_unlock_irqrestore(&ring->lock, flags);
+}
+
+/* Copies the most recent sample, -EAGAIN if nothing was captured yet */
+static inline int obc_ring_latest(struct obc_ring *ring, struct obc_sample *s)
+{
+	unsigned long flags;
+	int err = -EAGAIN;
+	spin_lock_irqsave(&ring->lock, flags);
+	if(ring->head){
+		*s = ring->buf[(ring->head - 1) & ring->mask];
+		err = 0;
+	}
+	spin_unlock_irqrestore(&ring->lock, flags);
+	return err;
+}
+
+/* Like obc_ring_latest, but waits up to timeout for the first capture */
+static inline int obc_ring_wait_latest(struct obc_ring *ring, struct obc_sample *s,
+		unsigned long timeout)
+{
+	long left;
+	left = wait_event_interruptible_timeout(ring->wait, READ_ONCE(ring->head), timeout);
+	if(left < 0)
+		return left;
+	return obc_ring_latest(ring, s);
+}
+
+static inline struct obc_ring_reader *obc_ring_reader_alloc(struct obc_ring *ring)
+{
+	struct obc_ring_reader *r;
+	unsigned long flags;
+	r = kzalloc(sizeof(*r), GFP_KERNEL);
+	if(!r)
+		return NULL;
+	r->ring = ring;
+	r->rate_vote = -1;
+	mutex_init(&r->lock);
+	obc_delta_enc_init(&r->enc, OBC_DELTA_DEFAULT_KEY_INTERVAL);
+	spin_lock_irqsave(&ring->lock, flags);
+	r->cursor = ring->head;
+	r->policy = ring->policy;
+	if(r->policy != OBC_RING_DROP_OLDEST)
+		ring->held++;
+	list_add_tail(&r->node, &ring->list);
+	spin_unlock_irqrestore(&ring->lock, flags);
+	atomic_inc(&ring->readers);
+	return r;
+}
+
+static inline void obc_ring_reader_free(struct obc_ring_reader *r)
+{
+	struct obc_ring *ring = r->ring;
+	unsigned long flags;
+	spin_lock_irqsave(&ring->lock, flags);
+	list_del(&r->node);
+	if(r->policy != OBC_RING_DROP_OLDEST)
+		ring->held--;
+	spin_unlock_irqrestore(&ring->lock, flags);
+	wake_up(&ring->space);
+	atomic_dec(&ring->readers);
+	kfree(r);
+}
+
+static inline int obc_ring_set_policy(struct obc_ring_reader *r, unsigned int policy)
+{
+	struct obc_ring *ring = r->ring;
+	unsigned long flags;
+	if(policy >= OBC_RING_POLICIES)
+		return -EINVAL;
+	spin_lock_irqsave(&ring->lock, flags);
+	if(r->policy != OBC_RING_DROP_OLDEST)
+		ring->held--;
+	r->policy = policy;
+	if(r->policy != OBC_RING_DROP_OLDEST)
+		ring->held++;
+	spin_unlock_irqrestore(&ring->lock, flags);
+	wake_up(&ring->space);
+	return 0;
+}
+
+static inline bool obc_ring_pending(struct obc_ring_reader *r)
+{
+	return READ_ONCE(r->ring->head) != r->cursor || READ_ONCE(r->out_off) != READ_ONCE(r->out_len);
+}
+
+/* Copies up to max samples from the reader's cursor, handling overrun */
+static inline unsigned int obc_ring_copy(struct obc_ring_reader *r,
+		struct obc_sample *out, unsigned int max)
+{
+	struct obc_ring *ring = r->ring;
+	unsigned long flags;
+	unsigned int n, i;
+	u64 lag;
+
+	spin_lock_irqsave(&ring->lock, flags);
+	lag = ring->head - r->cursor;
+	if(lag > r->max_lag)
+		r->max_lag = lag;
+	if(lag > ring->mask + 1){
+		u64 lost = lag - (ring->mask + 1);
+		r->cursor += lost;
+		r->lost += lost;
+		r->pending_lost += lost;
+		r->overruns++;
+		r->enc.seq_valid = 0;
+		lag = ring->mask + 1;
+	}
+	n = min_t(u64, lag, max);
+	for(i = 0; i < n; i++)
+		out[i] = ring->buf[(r->cursor + i) & ring->mask];
+	r->cursor += n;
+	spin_unlock_irqrestore(&ring->lock, flags);
+	if(n && r->policy == OBC_RING_BLOCK)
+		wake_up(&ring->space);
+	return n;
+}
+
+static inline void obc_ring_stat(struct obc_ring_reader *r, struct obc_ring_stat *st)
+{
+	unsigned long flags;
+	memset(st, 0, sizeof(*st));
+	spin_lock_irqsave(&r->ring->lock, flags);
+	st->head = r->ring->head;
+	st->cursor = r->cursor;
+	st->max_lag = r->max_lag;
+	st->dropped = r->ring->dropped;
+	st->block_timeouts = r->ring->block_timeouts;
+	st->hw_overruns = r->ring->hw_overruns;
+	st->policy = r->policy;
+	spin_unlock_irqrestore(&r->ring->lock, flags);
+	st->overruns = r->overruns;
+	st->lost = r->lost;
+	st->size = r->ring->mask + 1;
+	st->readers = atomic_read(&r->ring->readers);
+}
+
+/* Ring counters, then one line per open file: policy, pending samples, loss */
+static inline ssize_t obc_ring_show(struct obc_ring *ring, char *buf)
+{
+	struct obc_ring_reader *r;
+	unsigned long flags;
+	ssize_t len;
+	spin_lock_irqsave(&ring->lock, flags);
+	len = scnprintf(buf, PAGE_SIZE, "head %llu\nsize %u\ndropped %llu\nblock_timeouts %llu\n"
+			"hw_overruns %llu\n", ring->head, ring->mask + 1, ring->dropped,
+			ring->block_timeouts, ring->hw_overruns);
+	list_for_each_entry(r, &ring->list, node)
+		len += scnprintf(buf + len, PAGE_SIZE - len, "reader %s lag %llu max_lag %llu lost %llu\n",
+				obc_ring_policy_names[r->policy], ring->head - r->cursor,
+				r->max_lag, r->lost);
+	spin_unlock_irqrestore(&ring->lock, flags);
+	return len;
+}
+
+static inline ssize_t obc_ring_policy_show(struct obc_ring *ring, char *buf)
+{
+	return sprintf(buf, "%s %u\n", obc_ring_policy_names[ring->policy], ring->block_us);
+}
+
+/* Input: policy for newly opened files, optionally followed by block_us */
+static inline ssize_t obc_ring_policy_store(struct obc_ring *ring, const char *buf, size_t count)
+{
+	unsigned long flags;
+	unsigned int block_us, i;
+	char name[16];
+	int n = sscanf(buf, "%15s %u", name, &block_us);
+	if(n < 1)
+		return -EINVAL;
+	for(i = 0; i < OBC_RING_POLICIES && strcmp(name, obc_ring_policy_names[i]); i++)
+		;
+	if(i == OBC_RING_POLICIES)
+		return -EINVAL;
+	spin_lock_irqsave(&ring->lock, flags);
+	ring->policy = i;
+	if(n == 2)
+		ring->block_us = block_us;
+	spin_unlock_irqrestore(&ring->lock, flags);
+	return count;
+}
+
+/*
+ * read_iter() body shared by the sensor char devices, for read() and
+ * splice() alike: blocks until the reader has samples, then returns them
+ * as delta/varint chunks, preceded by a gap marker if the reader was
+ * overrun since the previous call. Samples that carry OBC_SAMPLE_GAP get
+ * a gap marker in front with the count missing from the sequence, 0 when
+ * the device could not tell. The chunks are encoded once into the
+ * reader's buffer and copied to the destination, a pipe's pages for
+ * splice().
+ *
+ * Reads of any size are served. A short copy, or a read with less room
+ * than a gap marker and one sample (61 bytes), returns what fits; the
+ * encoded rest is kept and returned by the next read before any new
+ * samples, so the stream never loses bytes it has taken from the ring.
+ */
+static inline ssize_t obc_ring_read_delta(struct obc_ring_reader *r, struct file *file,
+		struct iov_iter *to)
+{
+	size_t count = iov_iter_count(to), len = 0, copied;
+	unsigned int n, max;
+	ssize_t err;
+
+	if(!count)
+		return 0;
+	if(mutex_lock_interruptible(&r->lock))
+		return -ERESTARTSYS;
+	if(r->out_off != r->out_len){
+		copied = copy_to_iter(r->out + r->out_off, r->out_len - r->out_off, to);
+		r->out_off += copied;
+		if(r->out_off == r->out_len)
+			r->out_off = r->out_len = 0;
+		err = copied ? copied : -EFAULT;
+		goto out;
+	}
+	/* A read too short for a whole sample still takes one, its rest waits in out */
+	if(count < OBC_DELTA_MAX_GAP_BYTES + OBC_RING_SAMPLE_BYTES)
+		max = 1;
+	else
+		max = (min(count, sizeof(r->out)) - OBC_DELTA_MAX_GAP_BYTES) / OBC_RING_SAMPLE_BYTES;
+	if(max > OBC_RING_BATCH)
+		max = OBC_RING_BATCH;
+	for(;;){
+		n = obc_ring_copy(r, r->batch, max);
+		if(n || r->pending_lost)
+			break;
+		if(file->f_flags & O_NONBLOCK){
+			err = -EAGAIN;
+			goto out;
+		}
+		err = wait_event_interruptible(r->ring->wait, obc_ring_pending(r));
+		if(err)
+			goto out;
+	}
+	if(n && r->ring->filter)
+		r->ring->filter(r->ring->filter_ctx, r->batch, n);
+	if(r->pending_lost){
+		len = obc_delta_encode_gap(&r->enc, r->pending_lost, r->out);
+		r->pending_lost = 0;
+	}
+	len += obc_delta_encode_block(&r->enc, r->batch, n, r->out + len);
+	/* The cursor and the encoder have moved on, an unsent tail waits in out */
+	copied = copy_to_iter(r->out, len, to);
+	if(copied < len){
+		r->out_off = copied;
+		r->out_len = len;
+	}
+	err = copied ? copied : -EFAULT;
+out:
+	mutex_unlock(&r->lock);
+	return err;
+}
+
+/*
+ * llseek() for mapped readers: positions are sample numbers. SEEK_END is
+ * relative to the newest sample, SEEK_CUR returns the cursor.
+ */
+static inline loff_t obc_ring_llseek(struct obc_ring_reader *r, loff_t offset, int whence)
+{
+	unsigned long flags;
+	loff_t pos;
+	mutex_lock(&r->lock);
+	spin_lock_irqsave(&r->ring->lock, flags);
+	switch(whence){
+	case SEEK_SET:
+		pos = offset;
+		break;
+	case SEEK_CUR:
+		pos = r->cursor + offset;
+		break;
+	case SEEK_END:
+		pos = r->ring->head + offset;
+		break;
+	default:
+		pos = -EINVAL;
+	}
+	if(pos < 0 || pos > r->ring->head){
+		pos = -EINVAL;
+	}else{
+		r->cursor = pos;
+		r->enc.seq_valid = 0;
+		r->out_off = r->out_len = 0;
+	}
+	spin_unlock_irqrestore(&r->ring->lock, flags);
+	mutex_unlock(&r->lock);
+	/* Mapped readers release a blocked producer by seeking past what they used */
+	if(pos >= 0 && r->policy == OBC_RING_BLOCK)
+		wake_up(&r->ring->space);
+	return pos;
+}
+
+/* Maps the shm page and the slots read-only */
+static inline int obc_ring_mmap(struct obc_ring *ring, struct vm_area_struct *vma)
+{
+	if(vma->vm_flags & VM_WRITE)
+		return -EPERM;
+	vma->vm_flags &= ~VM_MAYWRITE;
+	return remap_vmalloc_range(vma, ring->shm, vma->vm_pgoff);
+}
+
+static inline unsigned int obc_ring_poll(struct obc_ring_reader *r, struct file *file, poll_table *wait)
+{
+	poll_wait(file, &r->ring->wait, wait);
+	return obc_ring_pending(r) ? POLLIN | POLLRDNORM : 0;
+}
+
+#endif
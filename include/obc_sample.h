@@ -0,0 +1,92 @@
+/* Sample record shared by the OBC sensor drivers and userspace tools */
+#ifndef OBC_SAMPLE_H
+#define OBC_SAMPLE_H
+
+#include <linux/types.h>
+
+enum {
+	OBC_DEV_NONE = 0,
+	OBC_DEV_ADXL345,
+	OBC_DEV_HMC5883L,
+	OBC_DEV_BMP280,
+	OBC_DEV_MAX
+};
+
+/* Samples were lost right before this one */
+#define OBC_SAMPLE_GAP (1 << 0)
+/* The bus read failed; values are the last good capture */
+#define OBC_SAMPLE_STALE (1 << 1)
+/* Values have the driver's calibration applied */
+#define OBC_SAMPLE_CALIBRATED (1 << 2)
+/*
+ * Range or gain register code the sample was captured with: the
+ * HMC5883L gain, the ADXL345 DATA_FORMAT range and FULL_RES bits
+ */
+#define OBC_SAMPLE_RANGE_SHIFT 8
+#define OBC_SAMPLE_RANGE_MASK (0xf << OBC_SAMPLE_RANGE_SHIFT)
+#define OBC_SAMPLE_RANGE(flags) (((flags) & OBC_SAMPLE_RANGE_MASK) >> OBC_SAMPLE_RANGE_SHIFT)
+
+/*
+ * One capture from one sensor, 32 bytes. For the BMP280 v[0] is the raw
+ * pressure and v[1] the raw temperature reading. Samples taken on the
+ * same tick of the common trigger (obc_trigger.h) share set; it is 0 for
+ * samples from a driver's own sampler.
+ */
+struct obc_sample {
+	__u64 t_ns;		/* CLOCK_MONOTONIC capture time */
+	__u32 seq;
+	__u16 dev;
+	__u16 flags;
+	__s32 v[3];
+	__u32 set;
+};
+
+/*
+ * First page of a driver's sample ring as seen through mmap(); the sample
+ * slots follow at data_offset. Sample n lives in slot n & (size - 1) and
+ * is complete once head is past n. A slot copied while head >= n + size
+ * may have been overwritten during the copy and must be discarded. head
+ * is 32 bits so 32-bit CPUs read it in one access; compare it modulo 2^32.
+ */
+struct obc_ring_shm {
+	__u32 head;		/* samples pushed since the ring was created, low bits */
+	__u32 size;		/* slots, a power of two */
+	__u32 record_size;
+	__u32 data_offset;
+	__u16 dev;
+	__u16 version;
+	__u32 reserved;
+};
+
+#define OBC_RING_SHM_VERSION 1
+
+/*
+ * What happens when a reader is a full ring behind. The ring is shared,
+ * so samples a reader makes the producer discard are lost to every
+ * reader; each then sees OBC_SAMPLE_GAP on the next stored sample. Ordered
+ * by how strongly the reader holds the producer back.
+ */
+enum {
+	OBC_RING_DROP_OLDEST = 0,	/* the reader skips to the oldest held sample */
+	OBC_RING_DROP_NEWEST,		/* new samples are discarded until the reader catches up */
+	OBC_RING_BLOCK,			/* the producer waits up to block_us, then drops the newest */
+	OBC_RING_POLICIES
+};
+
+/* Per file descriptor view of a driver's sample ring */
+struct obc_ring_stat {
+	__u64 head;		/* samples captured since probe */
+	__u64 cursor;		/* next sample this reader gets */
+	__u64 overruns;		/* times this reader fell a full ring behind */
+	__u64 lost;		/* samples this reader never saw */
+	__u32 size;
+	__u32 readers;
+	__u64 max_lag;		/* most samples this reader had pending */
+	__u64 dropped;		/* samples the producer discarded for held back readers */
+	__u64 block_timeouts;	/* producer waits that ended with a drop */
+	__u64 hw_overruns;	/* device buffer overruns reported by the driver */
+	__u32 policy;		/* OBC_RING_*, this reader's */
+	__u32 reserved;
+};
+
+#endif
@@ -0,0 +1,200 @@
+/*
+ * Placement and wakeup latency of a driver's capture thread.
+ *
+ * A driver's captures run on one thread, its trigger worker or its own
+ * sampler. The CPUs that thread may run on and its scheduling policy are
+ * kept here, applied whenever the thread is created and at once when
+ * changed from sysfs. The time from the timer or interrupt that was due
+ * to start a capture until the capture starts is kept as a histogram in
+ * power of two microsecond buckets, so a latency bound can be read off
+ * directly.
+ */
+#ifndef OBC_SCHED_H
+#define OBC_SCHED_H
+
+#include <linux/kernel.h>
+#include <linux/version.h>
+#include <linux/sched.h>
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 11, 0)
+#include <linux/sched/task.h>
+#endif
+#include <linux/cpumask.h>
+#include <linux/mutex.h>
+#include <linux/spinlock.h>
+#include <linux/string.h>
+#include <linux/log2.h>
+#include <linux/math64.h>
+
+/* Bucket 0 is below 1 us, bucket i below 2^i us, the last one everything above */
+#define OBC_SCHED_BUCKETS 16
+
+struct obc_sched {
+	struct mutex lock;	/* task and settings */
+	struct task_struct *task;	/* the capture thread, NULL while there is none */
+	struct cpumask cpus;
+	int policy;		/* SCHED_NORMAL, SCHED_FIFO or SCHED_RR */
+	int prio;		/* 1 to 99 for the real-time policies */
+	spinlock_t hist_lock;
+	u64 count;
+	u64 sum_ns;
+	u64 max_ns;
+	u32 hist[OBC_SCHED_BUCKETS];
+};
+
+static const struct {
+	const char *name;
+	int policy;
+} obc_sched_policies[] = {
+	{ "other", SCHED_NORMAL },
+	{ "fifo", SCHED_FIFO },
+	{ "rr", SCHED_RR },
+};
+
+static inline void obc_sched_init(struct obc_sched *s)
+{
+	memset(s, 0, sizeof(*s));
+	mutex_init(&s->lock);
+	spin_lock_init(&s->hist_lock);
+	cpumask_copy(&s->cpus, cpu_possible_mask);
+	s->policy = SCHED_NORMAL;
+}
+
+/* lock held */
+static inline int obc_sched_apply(struct obc_sched *s)
+{
+	struct sched_param p = { .sched_priority = s->policy == SCHED_NORMAL ? 0 : s->prio };
+	int err;
+	if(!s->task)
+		return 0;
+	err = set_cpus_allowed_ptr(s->task, &s->cpus);
+	if(!err)
+		err = sched_setscheduler_nocheck(s->task, s->policy, &p);
+	return err;
+}
+
+/* The capture thread has been created; it takes the stored settings */
+static inline void obc_sched_attach(struct obc_sched *s, struct task_struct *task)
+{
+	mutex_lock(&s->lock);
+	get_task_struct(task);
+	s->task = task;
+	if(obc_sched_apply(s))
+		printk(KERN_DEBUG "OBC: Cannot apply the settings of %s\n", task->comm);
+	mutex_unlock(&s->lock);
+}
+
+/* Before the capture thread is stopped */
+static inline void obc_sched_detach(struct obc_sched *s)
+{
+	mutex_lock(&s->lock);
+	if(s->task)
+		put_task_struct(s->task);
+	s->task = NULL;
+	mutex_unlock(&s->lock);
+}
+
+/* Records one wakeup, late_ns after the capture was due */
+static inline void obc_sched_latency(struct obc_sched *s, s64 late_ns)
+{
+	u64 us;
+	unsigned int b;
+	if(late_ns < 0)
+		late_ns = 0;
+	us = div_u64(late_ns, NSEC_PER_USEC);
+	b = us ? min_t(unsigned int, ilog2(us) + 1, OBC_SCHED_BUCKETS - 1) : 0;
+	spin_lock(&s->hist_lock);
+	s->hist[b]++;
+	s->count++;
+	s->sum_ns += late_ns;
+	s->max_ns = max_t(u64, s->max_ns, late_ns);
+	spin_unlock(&s->hist_lock);
+}
+
+/* Policy and priority, e.g. "fifo 50" */
+static inline ssize_t obc_sched_show(struct obc_sched *s, char *buf)
+{
+	const char *name = "?";
+	int i;
+	mutex_lock(&s->lock);
+	for(i = 0; i < ARRAY_SIZE(obc_sched_policies); i++)
+		if(obc_sched_policies[i].policy == s->policy)
+			name = obc_sched_policies[i].name;
+	i = sprintf(buf, "%s %d\n", name, s->policy == SCHED_NORMAL ? 0 : s->prio);
+	mutex_unlock(&s->lock);
+	return i;
+}
+
+/* "other", or "fifo"/"rr" and a priority from 1 to 99 */
+static inline ssize_t obc_sched_store(struct obc_sched *s, const char *buf, size_t count)
+{
+	char name[8];
+	int prio = 0, n, i, err;
+	n = sscanf(buf, "%7s %d", name, &prio);
+	if(n < 1)
+		return -EINVAL;
+	for(i = 0; i < ARRAY_SIZE(obc_sched_policies) && strcmp(name, obc_sched_policies[i].name); i++)
+		;
+	if(i == ARRAY_SIZE(obc_sched_policies))
+		return -EINVAL;
+	if(obc_sched_policies[i].policy != SCHED_NORMAL && (n < 2 || prio < 1 || prio > MAX_USER_RT_PRIO - 1))
+		return -EINVAL;
+	mutex_lock(&s->lock);
+	s->policy = obc_sched_policies[i].policy;
+	s->prio = prio;
+	err = obc_sched_apply(s);
+	mutex_unlock(&s->lock);
+	return err ? err : count;
+}
+
+static inline ssize_t obc_sched_cpus_show(struct obc_sched *s, char *buf)
+{
+	ssize_t len;
+	mutex_lock(&s->lock);
+	len = sprintf(buf, "%*pbl\n", cpumask_pr_args(&s->cpus));
+	mutex_unlock(&s->lock);
+	return len;
+}
+
+/* A CPU list such as "1" or "0-1" */
+static inline ssize_t obc_sched_cpus_store(struct obc_sched *s, const char *buf, size_t count)
+{
+	struct cpumask cpus;
+	int err = cpulist_parse(buf, &cpus);
+	if(err)
+		return err;
+	if(!cpumask_intersects(&cpus, cpu_online_mask))
+		return -EINVAL;
+	mutex_lock(&s->lock);
+	cpumask_copy(&s->cpus, &cpus);
+	err = obc_sched_apply(s);
+	mutex_unlock(&s->lock);
+	return err ? err : count;
+}
+
+/* Totals, then "lt <us> <count>" per bucket and "ge <us> <count>" for the open last one */
+static inline ssize_t obc_sched_hist_show(struct obc_sched *s, char *buf)
+{
+	ssize_t len;
+	unsigned int i;
+	spin_lock(&s->hist_lock);
+	len = sprintf(buf, "count %llu avg_us %llu max_us %llu\n", s->count,
+			s->count ? div64_u64(s->sum_ns, s->count * NSEC_PER_USEC) : 0,
+			div_u64(s->max_ns, NSEC_PER_USEC));
+	for(i = 0; i < OBC_SCHED_BUCKETS - 1; i++)
+		len += sprintf(buf + len, "lt %u %u\n", 1U << i, s->hist[i]);
+	len += sprintf(buf + len, "ge %u %u\n", 1U << (OBC_SCHED_BUCKETS - 2), s->hist[i]);
+	spin_unlock(&s->hist_lock);
+	return len;
+}
+
+/* Any write clears the histogram */
+static inline ssize_t obc_sched_hist_clear(struct obc_sched *s, size_t count)
+{
+	spin_lock(&s->hist_lock);
+	s->count = s->sum_ns = s->max_ns = 0;
+	memset(s->hist, 0, sizeof(s->hist));
+	spin_unlock(&s->hist_lock);
+	return count;
+}
+
+#endif
@@ -0,0 +1,74 @@
+/* On-flash layout of the telemetry recorder segment files */
+#ifndef OBC_SEGMENT_H
+#define OBC_SEGMENT_H
+
+#include <linux/types.h>
+#include "obc_sample.h"
+
+#define OBC_SEGMENT_MAGIC 0x5343424f /* "OBCS" */
+#define OBC_SEGMENT_VERSION 1
+#define OBC_SEGMENT_HEADER_SIZE 4096
+
+/*
+ * A segment is a preallocated file holding the header, a time index and
+ * fixed size records, in that order. Every index_stride-th record gets an
+ * index entry so that a time range can be located with a binary search
+ * over the index and a short forward scan over the records.
+ */
+struct obc_segment_header {
+	__u32 magic;
+	__u16 version;
+	__u16 record_size;
+	__u32 segment_no;
+	__u32 index_stride;
+	__u32 index_capacity;
+	__u32 record_capacity;
+	__u64 index_offset;
+	__u64 record_offset;
+	__u64 t_start_ns;
+	__u64 t_end_ns;
+	__u32 index_count;
+	__u32 record_count;
+	__u32 device_mask;
+	__u32 closed;		/* set once the segment was rotated cleanly */
+};
+
+struct obc_segment_index {
+	__u64 t_ns;
+	__u32 record;
+	__u32 reserved;
+};
+
+static inline const struct obc_segment_index *
+obc_segment_index(const struct obc_segment_header *hdr)
+{
+	return (const struct obc_segment_index *)((const char *)hdr + hdr->index_offset);
+}
+
+static inline const struct obc_sample *
+obc_segment_records(const struct obc_segment_header *hdr)
+{
+	return (const struct obc_sample *)((const char *)hdr + hdr->record_offset);
+}
+
+/* Returns the first record that may have a timestamp at or after t_ns */
+static inline __u32 obc_segment_seek(const struct obc_segment_header *hdr, __u64 t_ns)
+{
+	const struct obc_segment_index *idx = obc_segment_index(hdr);
+	const struct obc_sample *rec = obc_segment_records(hdr);
+	__u32 lo = 0, hi = hdr->index_count, r;
+
+	while (lo < hi) {
+		__u32 mid = lo + (hi - lo) / 2;
+		if (idx[mid].t_ns <= t_ns)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	r = lo ? idx[lo - 1].record : 0;
+	while (r < hdr->record_count && rec[r].t_ns < t_ns)
+		r++;
+	return r;
+}
+
+#endif
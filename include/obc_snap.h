@@ -0,0 +1,318 @@
+/*
+ * Pre-trigger snapshot buffer for event triggered high rate captures.
+ *
+ * While armed, every capture a driver takes is also stored in a fixed
+ * circular buffer of its own, at the full output rate and whether or not
+ * anybody reads the device. Nothing is delivered from it until a trigger
+ * fires: an activity threshold in the driver, an ioctl, a write to the
+ * "snapshot_state" attribute or the core's snapshot GPIO. The buffer then
+ * records the post-trigger part of the window and freezes, holding the
+ * samples around the trigger until it is armed again. The frozen window
+ * is read from the "snapshot" attribute as one blob, a struct
+ * obc_snap_header followed by the samples oldest first.
+ */
+#ifndef OBC_SNAP_H
+#define OBC_SNAP_H
+
+#include <linux/types.h>
+
+#define OBC_SNAP_MAGIC 0x4e43424f /* "OBCN" */
+#define OBC_SNAP_VERSION 1
+
+/* What fired the trigger */
+enum {
+	OBC_SNAP_USER = 0,	/* ioctl or sysfs */
+	OBC_SNAP_ACTIVITY,	/* the driver's activity threshold */
+	OBC_SNAP_GPIO,		/* the core's snapshot GPIO */
+	OBC_SNAP_REASONS
+};
+
+struct obc_snap_header {
+	__u32 magic;
+	__u16 version;
+	__u16 dev;		/* OBC_DEV_* */
+	__u32 record_size;	/* of the struct obc_sample records that follow */
+	__u32 count;		/* samples in the blob */
+	__u32 pre;		/* of them stored before the trigger */
+	__u16 reason;		/* OBC_SNAP_* */
+	__u16 reserved;
+	__u64 t_trigger_ns;	/* CLOCK_MONOTONIC */
+};
+
+#ifdef __KERNEL__
+
+#include <linux/kernel.h>
+#include <linux/device.h>
+#include <linux/spinlock.h>
+#include <linux/mutex.h>
+#include <linux/list.h>
+#include <linux/vmalloc.h>
+#include <linux/log2.h>
+#include <linux/math64.h>
+#include <linux/timekeeping.h>
+#include <linux/string.h>
+
+#include "obc_sample.h"
+
+enum {
+	OBC_SNAP_OFF = 0,
+	OBC_SNAP_ARMED,		/* recording, waiting for a trigger */
+	OBC_SNAP_TRIGGERED,	/* recording the post-trigger samples */
+	OBC_SNAP_FROZEN,	/* holding a window */
+	OBC_SNAP_STATES
+};
+
+static const char * const obc_snap_state_names[OBC_SNAP_STATES] = {
+	[OBC_SNAP_OFF] = "off",
+	[OBC_SNAP_ARMED] = "armed",
+	[OBC_SNAP_TRIGGERED] = "triggered",
+	[OBC_SNAP_FROZEN] = "frozen",
+};
+
+static const char * const obc_snap_reason_names[OBC_SNAP_REASONS] = {
+	[OBC_SNAP_USER] = "user",
+	[OBC_SNAP_ACTIVITY] = "activity",
+	[OBC_SNAP_GPIO] = "gpio",
+};
+
+struct obc_snap {
+	struct list_head node;	/* on the core's list, for the GPIO trigger */
+	struct device *dev;	/* for sysfs_notify() on "snapshot_state" */
+	spinlock_t lock;	/* triggers come from interrupts too */
+	struct mutex read_lock;	/* blob reads vs. re-arming */
+	struct obc_sample *buf;	/* NULL when disabled */
+	unsigned int mask;	/* slots - 1, a power of two */
+	unsigned int pre;	/* samples kept before the trigger */
+	unsigned int post;	/* and after it, pre + post within the slots */
+	u8 state;		/* OBC_SNAP_* */
+	u64 head;		/* samples stored since armed */
+	u64 trig_at;		/* head when the trigger fired */
+	u64 first;		/* oldest sample of the frozen window */
+	struct obc_snap_header hdr;	/* of the frozen window */
+	u64 triggers;
+	u64 ignored;		/* triggers while not armed */
+};
+
+/*
+ * Allocates room for kb kilobytes of samples, rounded down to a power of
+ * two slots; 0 leaves the buffer disabled. The window defaults to three
+ * quarters before the trigger. Starts armed.
+ */
+static inline int obc_snap_alloc(struct obc_snap *s, struct device *dev, u16 devid, unsigned int kb)
+{
+	unsigned long slots = ((unsigned long)kb << 10) / sizeof(struct obc_sample);
+	memset(s, 0, sizeof(*s));
+	INIT_LIST_HEAD(&s->node);
+	spin_lock_init(&s->lock);
+	mutex_init(&s->read_lock);
+	s->dev = dev;
+	s->hdr.dev = devid;
+	if(slots < 2)
+		return 0;
+	slots = rounddown_pow_of_two(slots);
+	s->buf = vmalloc(slots * sizeof(*s->buf));
+	if(!s->buf)
+		return -ENOMEM;
+	s->mask = slots - 1;
+	s->post = slots / 4;
+	s->pre = slots - s->post;
+	s->state = OBC_SNAP_ARMED;
+	return 0;
+}
+
+static inline void obc_snap_free(struct obc_snap *s)
+{
+	vfree(s->buf);
+	s->buf = NULL;
+	s->state = OBC_SNAP_OFF;
+}
+
+/* The driver keeps capturing while this is true, readers or not */
+static inline bool obc_snap_recording(struct obc_snap *s)
+{
+	u8 state = READ_ONCE(s->state);
+	return state == OBC_SNAP_ARMED || state == OBC_SNAP_TRIGGERED;
+}
+
+/* lock held */
+static inline void obc_snap_freeze(struct obc_snap *s)
+{
+	u64 pre = min_t(u64, s->trig_at, s->pre);
+	s->first = s->trig_at - pre;
+	s->hdr.magic = OBC_SNAP_MAGIC;
+	s->hdr.version = OBC_SNAP_VERSION;
+	s->hdr.record_size = sizeof(struct obc_sample);
+	s->hdr.count = s->head - s->first;
+	s->hdr.pre = pre;
+	s->state = OBC_SNAP_FROZEN;
+}
+
+/*
+ * Stores one capture. Returns true if it completed the window, the
+ * caller's cue to notify pollers with obc_snap_notify() outside its locks.
+ */
+static inline bool obc_snap_push(struct obc_snap *s, const struct obc_sample *smp)
+{
+	unsigned long flags;
+	bool done = false;
+	if(!obc_snap_recording(s))
+		return false;
+	spin_lock_irqsave(&s->lock, flags);
+	if(s->state == OBC_SNAP_ARMED ||
+			(s->state == OBC_SNAP_TRIGGERED && s->head - s->trig_at < s->post)){
+		s->buf[s->head & s->mask] = *smp;
+		s->head++;
+	}
+	if(s->state == OBC_SNAP_TRIGGERED && s->head - s->trig_at >= s->post){
+		obc_snap_freeze(s);
+		done = true;
+	}
+	spin_unlock_irqrestore(&s->lock, flags);
+	return done;
+}
+
+/*
+ * Fires the trigger, from any context. The window freezes once its
+ * post-trigger samples are stored; a trigger while not armed is counted
+ * and ignored.
+ */
+static inline void obc_snap_trigger(struct obc_snap *s, unsigned int reason)
+{
+	unsigned long flags;
+	spin_lock_irqsave(&s->lock, flags);
+	if(s->state == OBC_SNAP_ARMED){
+		s->state = OBC_SNAP_TRIGGERED;
+		s->trig_at = s->head;
+		s->hdr.t_trigger_ns = ktime_get_ns();
+		s->hdr.reason = reason;
+		s->triggers++;
+	}else{
+		s->ignored++;
+	}
+	spin_unlock_irqrestore(&s->lock, flags);
+}
+
+static inline void obc_snap_notify(struct obc_snap *s)
+{
+	if(s->dev)
+		sysfs_notify(&s->dev->kobj, NULL, "snapshot_state");
+}
+
+/* Drops the held window and records again; the caller wakes its sampler */
+static inline int obc_snap_arm(struct obc_snap *s)
+{
+	unsigned long flags;
+	if(!s->buf)
+		return -ENODEV;
+	mutex_lock(&s->read_lock);
+	spin_lock_irqsave(&s->lock, flags);
+	s->state = OBC_SNAP_ARMED;
+	s->head = 0;
+	spin_unlock_irqrestore(&s->lock, flags);
+	mutex_unlock(&s->read_lock);
+	return 0;
+}
+
+static inline void obc_snap_disarm(struct obc_snap *s)
+{
+	unsigned long flags;
+	mutex_lock(&s->read_lock);
+	spin_lock_irqsave(&s->lock, flags);
+	s->state = OBC_SNAP_OFF;
+	spin_unlock_irqrestore(&s->lock, flags);
+	mutex_unlock(&s->read_lock);
+}
+
+/* Samples kept before and after the trigger; refused while a window is recorded or held */
+static inline int obc_snap_set_window(struct obc_snap *s, unsigned int pre, unsigned int post)
+{
+	unsigned long flags;
+	int err = 0;
+	if(!s->buf)
+		return -ENODEV;
+	if((u64)pre + post > s->mask + 1)
+		return -EINVAL;
+	spin_lock_irqsave(&s->lock, flags);
+	if(s->state == OBC_SNAP_ARMED || s->state == OBC_SNAP_OFF){
+		s->pre = pre;
+		s->post = post;
+	}else{
+		err = -EBUSY;
+	}
+	spin_unlock_irqrestore(&s->lock, flags);
+	return err;
+}
+
+/* State, window in samples, capacity and trigger counts */
+static inline ssize_t obc_snap_show(struct obc_snap *s, char *buf)
+{
+	unsigned long flags;
+	ssize_t len;
+	spin_lock_irqsave(&s->lock, flags);
+	len = sprintf(buf, "%s pre %u post %u slots %u triggers %llu ignored %llu",
+			obc_snap_state_names[s->state], s->pre, s->post,
+			s->buf ? s->mask + 1 : 0, s->triggers, s->ignored);
+	if(s->state == OBC_SNAP_FROZEN)
+		len += sprintf(buf + len, " reason %s count %u",
+				obc_snap_reason_names[s->hdr.reason], s->hdr.count);
+	len += sprintf(buf + len, "\n");
+	spin_unlock_irqrestore(&s->lock, flags);
+	return len;
+}
+
+/* "arm", "trigger" or "off"; the caller wakes its sampler after arming */
+static inline ssize_t obc_snap_store(struct obc_snap *s, const char *buf, size_t count)
+{
+	int err = 0;
+	if(sysfs_streq(buf, "arm"))
+		err = obc_snap_arm(s);
+	else if(sysfs_streq(buf, "trigger"))
+		obc_snap_trigger(s, OBC_SNAP_USER);
+	else if(sysfs_streq(buf, "off"))
+		obc_snap_disarm(s);
+	else
+		err = -EINVAL;
+	return err ? err : count;
+}
+
+/*
+ * Binary read of the frozen window: the header, then the samples oldest
+ * first. Nothing is stored while frozen, so a read at any offset sees the
+ * same blob until the buffer is armed again.
+ */
+static inline ssize_t obc_snap_read_bin(struct obc_snap *s, char *buf, loff_t off, size_t count)
+{
+	size_t hlen = sizeof(s->hdr), rs = sizeof(struct obc_sample), len = 0, n;
+	u64 size, k;
+	u32 rem;
+	mutex_lock(&s->read_lock);
+	if(READ_ONCE(s->state) != OBC_SNAP_FROZEN){
+		mutex_unlock(&s->read_lock);
+		return -ENODATA;
+	}
+	size = hlen + (u64)s->hdr.count * rs;
+	if(off >= size){
+		mutex_unlock(&s->read_lock);
+		return 0;
+	}
+	count = min_t(u64, count, size - off);
+	if(off < hlen){
+		len = min_t(size_t, count, hlen - off);
+		memcpy(buf, (u8 *)&s->hdr + off, len);
+	}
+	while(len < count){
+		k = div_u64_rem(off + len - hlen, rs, &rem);
+		n = min_t(size_t, rs - rem, count - len);
+		memcpy(buf + len, (u8 *)&s->buf[(s->first + k) & s->mask] + rem, n);
+		len += n;
+	}
+	mutex_unlock(&s->read_lock);
+	return len;
+}
+
+void obc_snap_register(struct obc_snap *s);
+void obc_snap_unregister(struct obc_snap *s);
+
+#endif
+
+#endif
@@ -0,0 +1,303 @@
+/*
+ * Windowed per-channel statistics for housekeeping telemetry.
+ *
+ * Every capture a driver takes is added to the open window: min, max and
+ * shifted sums, each channel relative to its first value in the window,
+ * so that the integer sums cannot overflow for the samples a window holds.
+ * When a sample arrives past the window length the window is completed
+ * into mean and standard deviation in 1/256 counts and kept in a short
+ * history. Readers poll() the "stats" sysfs attribute, which is notified
+ * once per completed window, and read the history either as text or as
+ * struct obc_stats_window records from "stats_bin".
+ *
+ * Stale captures are left out and counted. A range change closes the
+ * window early, so each window has one scale.
+ */
+#ifndef OBC_STATS_H
+#define OBC_STATS_H
+
+#include <linux/types.h>
+
+/* Statistics of one channel over a window, counts as in struct obc_sample */
+struct obc_stats_chan {
+	__s32 min;
+	__s32 max;
+	__s32 mean_q8;		/* 1/256 counts */
+	__u32 stddev_q8;	/* sample standard deviation, 1/256 counts */
+};
+
+/*
+ * One completed window. flags has OBC_SAMPLE_GAP if samples were lost
+ * during the window, OBC_SAMPLE_STALE if stale captures were left out,
+ * OBC_STATS_CLIPPED if a value was too far from the window's first one to
+ * be summed exactly, and the range code in the OBC_SAMPLE_RANGE bits.
+ */
+struct obc_stats_window {
+	__u64 t_start_ns;	/* first sample */
+	__u64 t_end_ns;		/* last sample */
+	__u32 seq;		/* windows completed since the device was probed */
+	__u32 count;		/* samples in the statistics */
+	__u32 stale;		/* stale captures left out */
+	__u16 dev;
+	__u16 flags;
+	struct obc_stats_chan ch[3];
+};
+
+#define OBC_STATS_CLIPPED (1 << 7)
+
+#ifdef __KERNEL__
+
+#include <linux/kernel.h>
+#include <linux/device.h>
+#include <linux/spinlock.h>
+#include <linux/math64.h>
+#include <linux/string.h>
+
+#include "obc_sample.h"
+
+#define OBC_STATS_HISTORY 8
+/*
+ * Values more than this far from the window's first one are clipped. The
+ * drivers' channels are at most 20 bits wide, so this only catches bad
+ * data; with the window length capped below, no sum can overflow.
+ */
+#define OBC_STATS_MAX_DEV ((1 << 21) - 1)
+#define OBC_STATS_MAX_COUNT (1 << 20)
+
+struct obc_stats_acc {
+	s32 ref;
+	s32 min;
+	s32 max;
+	s64 sum;		/* of value - ref */
+	u64 sumsq;		/* of (value - ref)^2 */
+};
+
+struct obc_stats {
+	spinlock_t lock;
+	struct device *dev;	/* for sysfs_notify() on "stats" */
+	u16 devid;		/* OBC_DEV_* */
+	u8 channels;
+	u64 window_ns;		/* 0 while disabled */
+	/* Open window */
+	u64 t_start;
+	u64 t_last;
+	u32 count;
+	u32 stale;
+	u16 flags;
+	struct obc_stats_acc acc[3];
+	/* Completed windows, hist[seq % OBC_STATS_HISTORY] */
+	u32 seq;
+	struct obc_stats_window hist[OBC_STATS_HISTORY];
+};
+
+static inline void obc_stats_init(struct obc_stats *st, struct device *dev, u16 devid,
+		unsigned int channels)
+{
+	memset(st, 0, sizeof(*st));
+	spin_lock_init(&st->lock);
+	st->dev = dev;
+	st->devid = devid;
+	st->channels = channels;
+}
+
+static inline bool obc_stats_enabled(struct obc_stats *st)
+{
+	return READ_ONCE(st->window_ns);
+}
+
+/* Integer square root of a 64-bit value */
+static inline u32 obc_stats_sqrt(u64 x)
+{
+	u64 r = 0, bit = 1ULL << 62;
+	while(bit > x)
+		bit >>= 2;
+	while(bit){
+		if(x >= r + bit){
+			x -= r + bit;
+			r = (r >> 1) + bit;
+		}else{
+			r >>= 1;
+		}
+		bit >>= 2;
+	}
+	return r;
+}
+
+/*
+ * With q and r the quotient and remainder of sum / n, sum^2 / n is
+ * q^2 n + 2 q r + r^2 / n; every term stays within 64 bits.
+ */
+static inline void obc_stats_chan_done(const struct obc_stats_acc *a, u32 n,
+		struct obc_stats_chan *c)
+{
+	s64 q;
+	s32 r;
+	u64 m2, var;
+	u32 rem;
+	c->min = a->min;
+	c->max = a->max;
+	q = div_s64_rem(a->sum, n, &r);
+	c->mean_q8 = (s64)a->ref * 256 + div_s64(a->sum * 256, n);
+	m2 = a->sumsq - ((u64)(q * q) * n + 2 * q * r + div_u64((u64)((s64)r * r), n));
+	if(n < 2){
+		c->stddev_q8 = 0;
+		return;
+	}
+	/* Variance in 1/65536 counts^2, quotient and remainder scaled separately */
+	var = div_u64_rem(m2, n - 1, &rem);
+	var = (var << 16) + div_u64((u64)rem << 16, n - 1);
+	c->stddev_q8 = obc_stats_sqrt(var);
+}
+
+/* Completes the open window into the history. Called with the lock held */
+static inline void obc_stats_close(struct obc_stats *st)
+{
+	struct obc_stats_window *w = &st->hist[st->seq % OBC_STATS_HISTORY];
+	unsigned int i;
+	memset(w, 0, sizeof(*w));
+	w->t_start_ns = st->t_start;
+	w->t_end_ns = st->t_last;
+	w->seq = st->seq;
+	w->count = st->count;
+	w->stale = st->stale;
+	w->dev = st->devid;
+	w->flags = st->flags;
+	for(i = 0; i < st->channels && st->count; i++)
+		obc_stats_chan_done(&st->acc[i], st->count, &w->ch[i]);
+	st->seq++;
+	st->count = 0;
+	st->stale = 0;
+	st->flags = 0;
+}
+
+/*
+ * Adds one capture. Returns true if it completed a window, the caller's
+ * cue to notify sysfs pollers with obc_stats_notify() outside its locks.
+ */
+static inline bool obc_stats_add(struct obc_stats *st, const struct obc_sample *s)
+{
+	bool done = false;
+	unsigned int i;
+	s32 d;
+	if(!obc_stats_enabled(st))
+		return false;
+	spin_lock(&st->lock);
+	if(st->count || st->stale){
+		if(s->t_ns - st->t_start >= st->window_ns || st->count >= OBC_STATS_MAX_COUNT ||
+				(st->count && OBC_SAMPLE_RANGE(s->flags) != OBC_SAMPLE_RANGE(st->flags))){
+			obc_stats_close(st);
+			done = true;
+		}
+	}
+	if(!st->count && !st->stale)
+		st->t_start = s->t_ns;
+	st->t_last = s->t_ns;
+	st->flags |= s->flags & OBC_SAMPLE_GAP;
+	if(s->flags & OBC_SAMPLE_STALE){
+		st->stale++;
+		st->flags |= OBC_SAMPLE_STALE;
+		spin_unlock(&st->lock);
+		return done;
+	}
+	if(!st->count){
+		st->flags |= s->flags & OBC_SAMPLE_RANGE_MASK;
+		for(i = 0; i < st->channels; i++){
+			st->acc[i].ref = s->v[i];
+			st->acc[i].min = st->acc[i].max = s->v[i];
+			st->acc[i].sum = 0;
+			st->acc[i].sumsq = 0;
+		}
+	}
+	for(i = 0; i < st->channels; i++){
+		struct obc_stats_acc *a = &st->acc[i];
+		a->min = min(a->min, s->v[i]);
+		a->max = max(a->max, s->v[i]);
+		d = s->v[i] - a->ref;
+		if(d > OBC_STATS_MAX_DEV || d < -OBC_STATS_MAX_DEV){
+			d = clamp_t(s32, d, -OBC_STATS_MAX_DEV, OBC_STATS_MAX_DEV);
+			st->flags |= OBC_STATS_CLIPPED;
+		}
+		a->sum += d;
+		a->sumsq += (u64)((s64)d * d);
+	}
+	st->count++;
+	spin_unlock(&st->lock);
+	return done;
+}
+
+static inline void obc_stats_notify(struct obc_stats *st)
+{
+	if(st->dev)
+		sysfs_notify(&st->dev->kobj, NULL, "stats");
+}
+
+/* Window length in ms, 0 disables and drops the open window */
+static inline void obc_stats_set_window(struct obc_stats *st, unsigned int ms)
+{
+	spin_lock(&st->lock);
+	st->window_ns = (u64)ms * NSEC_PER_MSEC;
+	st->count = 0;
+	st->stale = 0;
+	st->flags = 0;
+	spin_unlock(&st->lock);
+}
+
+static inline ssize_t obc_stats_window_show(struct obc_stats *st, char *buf)
+{
+	return sprintf(buf, "%llu\n", div_u64(READ_ONCE(st->window_ns), NSEC_PER_MSEC));
+}
+
+/*
+ * The completed windows held, oldest first: a header line per window,
+ * then one line per channel with min, max, mean and standard deviation
+ * in counts.
+ */
+static inline ssize_t obc_stats_show(struct obc_stats *st, char *buf)
+{
+	const struct obc_stats_window *w;
+	ssize_t len = 0;
+	unsigned int i, k;
+	u32 first;
+	spin_lock(&st->lock);
+	first = st->seq > OBC_STATS_HISTORY ? st->seq - OBC_STATS_HISTORY : 0;
+	for(k = first; k != st->seq; k++){
+		w = &st->hist[k % OBC_STATS_HISTORY];
+		len += scnprintf(buf + len, PAGE_SIZE - len,
+				"window %u t_ns %llu %llu count %u stale %u flags 0x%x\n",
+				w->seq, w->t_start_ns, w->t_end_ns, w->count, w->stale, w->flags);
+		for(i = 0; i < st->channels; i++){
+			u32 mean = abs(w->ch[i].mean_q8);
+			len += scnprintf(buf + len, PAGE_SIZE - len, "%u %d %d %s%u.%02u %u.%02u\n", i,
+					w->ch[i].min, w->ch[i].max, w->ch[i].mean_q8 < 0 ? "-" : "",
+					mean >> 8, ((mean & 0xff) * 100) >> 8,
+					w->ch[i].stddev_q8 >> 8, ((w->ch[i].stddev_q8 & 0xff) * 100) >> 8);
+		}
+	}
+	spin_unlock(&st->lock);
+	return len;
+}
+
+/*
+ * Binary read of the held windows, oldest first, as whole
+ * struct obc_stats_window records; the file offset is ignored so each
+ * read returns the current history.
+ */
+static inline ssize_t obc_stats_read_bin(struct obc_stats *st, char *buf, loff_t off, size_t count)
+{
+	size_t len = 0;
+	u32 first, k;
+	if(off)
+		return 0;
+	spin_lock(&st->lock);
+	first = st->seq > OBC_STATS_HISTORY ? st->seq - OBC_STATS_HISTORY : 0;
+	for(k = first; k != st->seq && len + sizeof(st->hist[0]) <= count; k++){
+		memcpy(buf + len, &st->hist[k % OBC_STATS_HISTORY], sizeof(st->hist[0]));
+		len += sizeof(st->hist[0]);
+	}
+	spin_unlock(&st->lock);
+	return len;
+}
+
+#endif
+
+#endif
@@ -0,0 +1,89 @@
+/*
+ * Raw bus transaction trace, recorded by obc_core and replayed by the
+ * obc_trace tool.
+ *
+ * While tracing is enabled (/sys/devices/obc/trace_enable) every register
+ * access of the drivers is logged with its time, device, register, bytes
+ * and status. The records are read from /sys/devices/obc/trace; each read
+ * consumes whole records. Enabling the trace first logs one
+ * OBC_TRACE_LAYOUT record per probed sensor holding its struct obc_layout
+ * (obc_desc.h) and one OBC_TRACE_CALIB record per calibration block the
+ * drivers hold, so a trace carries what is needed to decode and correct
+ * its data reads on any host.
+ *
+ * A full buffer drops new records; the gap shows in seq.
+ */
+#ifndef OBC_TRACE_H
+#define OBC_TRACE_H
+
+#include <linux/types.h>
+
+/* The transfer wrote data to reg, otherwise read it */
+#define OBC_TRACE_WRITE (1 << 0)
+/* Not a transfer: data is the device's struct obc_layout */
+#define OBC_TRACE_LAYOUT (1 << 1)
+/*
+ * Not a transfer: data is a calibration block the driver applies, empty
+ * once it is dropped. reg tells the blocks of a device apart: the BMP280
+ * logs its trimming parameters at BMP280_CALIB_START (obc_baro.h), the
+ * HMC5883L the struct obc_magcal of each gain code.
+ */
+#define OBC_TRACE_CALIB (1 << 2)
+
+/* Followed by len data bytes, padded to OBC_TRACE_ALIGN */
+struct obc_trace_rec {
+	__u64 t_ns;		/* CLOCK_MONOTONIC, transfer completed */
+	__u32 seq;		/* records logged since tracing was enabled */
+	__s32 status;		/* 0 or a negative errno, no data then */
+	__u16 dev;		/* OBC_DEV_* */
+	__u16 len;
+	__u8 reg;
+	__u8 flags;
+	__u16 reserved;
+};
+
+#define OBC_TRACE_ALIGN 8
+#define OBC_TRACE_REC_SIZE(len) \
+	((sizeof(struct obc_trace_rec) + (len) + OBC_TRACE_ALIGN - 1) & ~(OBC_TRACE_ALIGN - 1))
+/* Largest transfer logged, an ADXL345 FIFO drain */
+#define OBC_TRACE_MAX_DATA 256
+/* Calibration blocks kept per device and the largest one */
+#define OBC_TRACE_CALIB_SLOTS 8
+#define OBC_TRACE_CALIB_MAX 48
+
+/* Header the obc_trace tool writes in front of a recorded trace */
+#define OBC_TRACE_FILE_MAGIC 0x5443424f /* "OBCT" */
+#define OBC_TRACE_FILE_VERSION 2	/* 1 had no OBC_TRACE_CALIB records */
+
+struct obc_trace_file_header {
+	__u32 magic;
+	__u16 version;
+	__u16 rec_size;		/* sizeof(struct obc_trace_rec) */
+};
+
+#ifdef __KERNEL__
+
+#include <linux/kernel.h>
+#include <linux/compiler.h>
+
+#include "obc_desc.h"
+
+extern bool obc_trace_on;
+
+void __obc_trace(u16 dev, u8 reg, u8 flags, const void *data, size_t len, int status);
+void obc_trace_layout(u16 dev, const struct obc_layout *l);
+void obc_trace_calib(u16 dev, u8 reg, const void *data, size_t len);
+
+/*
+ * Logs one transfer; status is the transfer's result, a positive one
+ * counts as success. Nothing but a flag test while tracing is off.
+ */
+static inline void obc_trace(u16 dev, u8 reg, u8 flags, const void *data, size_t len, int status)
+{
+	if(unlikely(READ_ONCE(obc_trace_on)))
+		__obc_trace(dev, reg, flags, data, len, status);
+}
+
+#endif
+
+#endif
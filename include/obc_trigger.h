@@ -0,0 +1,49 @@
+/*
+ * Common acquisition trigger, provided by the obc_core module.
+ *
+ * One time base (an hrtimer, or an external sync GPIO) starts the capture
+ * of every registered sensor at once. Each client has its own kthread
+ * worker, so the SPI and I2C transfers of one tick run in parallel instead
+ * of one after another. Every tick gets a capture set number; a client
+ * whose period is a multiple of the tick runs on every n-th tick only, so
+ * slow sensors stay aligned with the fast ones.
+ */
+#ifndef OBC_TRIGGER_H
+#define OBC_TRIGGER_H
+
+#include <linux/kernel.h>
+#include <linux/list.h>
+#include <linux/kthread.h>
+
+#include "obc_sched.h"
+
+struct obc_trigger_client {
+	const char *name;
+	/* Runs on the client's worker; set is the tick's capture set number */
+	void (*capture)(struct obc_trigger_client *c, u32 set, u64 t_ns);
+	/* Optional, called from the tick in interrupt context; false skips the capture */
+	bool (*wanted)(struct obc_trigger_client *c);
+	unsigned int period_us;	/* rounded to a multiple of the tick */
+	/* Optional, applied to the worker and fed its wakeup latency */
+	struct obc_sched *sched;
+
+	/* Owned by the trigger */
+	struct list_head node;
+	struct kthread_worker *worker;
+	struct kthread_work work;
+	unsigned long busy;	/* bit 0: a capture is queued or running */
+	u32 set;
+	u64 t_ns;
+	u64 due_ns;		/* timer expiry or interrupt time of the tick */
+	u64 fired;
+	u64 missed;		/* ticks dropped because the previous capture still ran */
+	u64 start_sum_ns;	/* tick to capture start */
+	u64 start_max_ns;
+	u64 run_max_ns;
+};
+
+int obc_trigger_register(struct obc_trigger_client *c);
+void obc_trigger_unregister(struct obc_trigger_client *c);
+unsigned int obc_trigger_period_us(void);
+
+#endif
@@ -0,0 +1,407 @@
+/*
+ * KUnit suites for the sample conversion kernels: the register layout
+ * decode of each sensor, the magnetometer calibration and the BMP280
+ * compensation. Everything tested is static inline in the headers, so
+ * this runs under UML or QEMU with no sensor attached:
+ *
+ *   ./tools/testing/kunit/kunit.py run --arch=um obc_conv obc_bench obc_bus
+ *
+ * obc_conv checks the results against the datasheet examples. obc_bench
+ * reports the time per sample of each kernel at several block sizes.
+ * obc_bus runs keyed reads through obc_core's bus scheduler on a dummy
+ * controller and checks that queued duplicates share one transfer.
+ */
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/timekeeping.h>
+#include <linux/math64.h>
+#include <linux/kthread.h>
+#include <linux/completion.h>
+#include <linux/delay.h>
+#include <linux/atomic.h>
+#include <kunit/test.h>
+
+#include "obc_sample.h"
+#include "obc_desc.h"
+#include "obc_magcal.h"
+#include "obc_bus.h"
+#include "../ADXL345/adxl345.h"
+/* Each driver names itself SENSOR_ID */
+#undef SENSOR_ID
+#include "../bmp280.h"
+#include "../HMC5883L/hmc5883l.h"
+
+/* Datasheet example: trimming parameters, ADC outputs and results */
+static const s16 bmp280_ref_calib[BMP280_CALIB_LEN / 2] = {
+	27504, 26435, -1000, (s16)36477, -10685, 3024, 2855, 140, -7, 15500, -14600, 6000
+};
+#define BMP280_REF_ADC_T 519888
+#define BMP280_REF_ADC_P 415148
+#define BMP280_REF_T_FINE 128422
+#define BMP280_REF_T 2508	/* 0.01 degC */
+#define BMP280_REF_P 100653	/* Pa */
+
+static void bmp280_ref_parse(struct bmp280_calib *c)
+{
+	u8 raw[BMP280_CALIB_LEN];
+	int i;
+	for(i = 0; i < BMP280_CALIB_LEN / 2; i++){
+		raw[2 * i] = (u16)bmp280_ref_calib[i] & 0xff;
+		raw[2 * i + 1] = (u16)bmp280_ref_calib[i] >> 8;
+	}
+	bmp280_calib_parse(c, raw);
+}
+
+static void obc_conv_adxl345(struct kunit *test)
+{
+	/* DATAX0 first: 256, -1 and the most negative count */
+	static const u8 raw[6] = { 0x00, 0x01, 0xff, 0xff, 0x00, 0x80 };
+	s32 v[AXIS];
+	obc_layout_decode(&adxl345_layout, raw, v);
+	KUNIT_EXPECT_EQ(test, v[0], 256);
+	KUNIT_EXPECT_EQ(test, v[1], -1);
+	KUNIT_EXPECT_EQ(test, v[2], -32768);
+}
+
+static void obc_conv_adxl345_scale(struct kunit *test)
+{
+	/* 3.9 mg/LSB with FULL_RES at any range, 31.2 mg/LSB at +-16 g without */
+	KUNIT_EXPECT_EQ(test, ADXL345_SCALE_UG(0), 3900);
+	KUNIT_EXPECT_EQ(test, ADXL345_SCALE_UG((1 << 3) | 3), 3900);
+	KUNIT_EXPECT_EQ(test, ADXL345_SCALE_UG(3), 31200);
+}
+
+static void obc_conv_hmc5883l(struct kunit *test)
+{
+	/* Data output range is 0xF800 to 0x07FF, register order X, Z, Y */
+	static const u8 raw[6] = { 0xf8, 0x00, 0x07, 0xff, 0x00, 0x01 };
+	s32 v[3];
+	obc_layout_decode(&hmc5883l_layout, raw, v);
+	KUNIT_EXPECT_EQ(test, v[0], -2048);
+	KUNIT_EXPECT_EQ(test, v[1], 2047);
+	KUNIT_EXPECT_EQ(test, v[2], 1);
+}
+
+static void obc_conv_bmp280_raw(struct kunit *test)
+{
+	/* The datasheet ADC outputs as they sit in PRESS_MSB to TEMP_XLSB */
+	static const u8 raw[6] = { 0x65, 0x5a, 0xc0, 0x7e, 0xed, 0x00 };
+	s32 v[2];
+	obc_layout_decode(&bmp280_layout, raw, v);
+	KUNIT_EXPECT_EQ(test, v[0], BMP280_REF_ADC_P);
+	KUNIT_EXPECT_EQ(test, v[1], BMP280_REF_ADC_T);
+}
+
+static void obc_conv_block(struct kunit *test)
+{
+	struct obc_sample s[ADXL345_FIFO_DEPTH];
+	u8 raw[ADXL345_FIFO_DEPTH * 6];
+	s32 v[AXIS];
+	int i, j;
+	for(i = 0; i < sizeof(raw); i++)
+		raw[i] = i * 37 + 11;
+	obc_layout_decode_block(&adxl345_layout, raw, s, ADXL345_FIFO_DEPTH);
+	for(i = 0; i < ADXL345_FIFO_DEPTH; i++){
+		obc_layout_decode(&adxl345_layout, raw + i * 6, v);
+		for(j = 0; j < AXIS; j++)
+			KUNIT_EXPECT_EQ(test, s[i].v[j], v[j]);
+	}
+}
+
+static void obc_conv_magcal(struct kunit *test)
+{
+	static const s32 scale[3] = { OBC_MAGCAL_ONE / 2, OBC_MAGCAL_ONE, 2 * OBC_MAGCAL_ONE };
+	struct obc_magcal c, f;
+	struct obc_sample s = { .v = { 100, -200, 300 } };
+	obc_magcal_identity(&c);
+	obc_magcal_apply(&c, &s, 1);
+	KUNIT_EXPECT_EQ(test, s.v[0], 100);
+	KUNIT_EXPECT_EQ(test, s.v[1], -200);
+	KUNIT_EXPECT_EQ(test, s.v[2], 300);
+	KUNIT_EXPECT_TRUE(test, s.flags & OBC_SAMPLE_CALIBRATED);
+	/* Hard-iron offset of 10.5, -20 and 0 counts */
+	c.offset[0] = 21 << (OBC_MAGCAL_OFFSET_SHIFT - 1);
+	c.offset[1] = -20 << OBC_MAGCAL_OFFSET_SHIFT;
+	obc_magcal_apply(&c, &s, 1);
+	KUNIT_EXPECT_EQ(test, s.v[0], 90);
+	KUNIT_EXPECT_EQ(test, s.v[1], -180);
+	KUNIT_EXPECT_EQ(test, s.v[2], 300);
+	obc_magcal_identity(&c);
+	obc_magcal_fold_scale(&f, &c, scale);
+	obc_magcal_apply(&f, &s, 1);
+	KUNIT_EXPECT_EQ(test, s.v[0], 45);
+	KUNIT_EXPECT_EQ(test, s.v[1], -180);
+	KUNIT_EXPECT_EQ(test, s.v[2], 600);
+}
+
+static void obc_conv_bmp280(struct kunit *test)
+{
+	struct bmp280_calib c;
+	s32 t, t_fine;
+	u32 p;
+	bmp280_ref_parse(&c);
+	KUNIT_EXPECT_EQ(test, c.t1, 27504);
+	KUNIT_EXPECT_EQ(test, c.p1, 36477);
+	KUNIT_EXPECT_EQ(test, c.p9, 6000);
+	t = bmp280_compensate_t(&c, BMP280_REF_ADC_T, &t_fine);
+	KUNIT_EXPECT_EQ(test, t_fine, BMP280_REF_T_FINE);
+	KUNIT_EXPECT_EQ(test, t, BMP280_REF_T);
+	p = bmp280_compensate_p(&c, BMP280_REF_ADC_P, t_fine);
+	KUNIT_EXPECT_EQ(test, p >> 8, BMP280_REF_P);
+	c.p1 = 0;
+	KUNIT_EXPECT_EQ(test, bmp280_compensate_p(&c, BMP280_REF_ADC_P, t_fine), 0);
+}
+
+static struct kunit_case obc_conv_cases[] = {
+	KUNIT_CASE(obc_conv_adxl345),
+	KUNIT_CASE(obc_conv_adxl345_scale),
+	KUNIT_CASE(obc_conv_hmc5883l),
+	KUNIT_CASE(obc_conv_bmp280_raw),
+	KUNIT_CASE(obc_conv_block),
+	KUNIT_CASE(obc_conv_magcal),
+	KUNIT_CASE(obc_conv_bmp280),
+	{}
+};
+
+static struct kunit_suite obc_conv_suite = {
+	.name = "obc_conv",
+	.test_cases = obc_conv_cases,
+};
+
+/* Each kernel converts this many samples per block size, in blocks of that size */
+#define OBC_BENCH_SAMPLES 65536
+#define OBC_BENCH_MAX_BLOCK 256
+
+static const unsigned int obc_bench_blocks[] = { 1, 16, 32, OBC_BENCH_MAX_BLOCK };
+
+struct obc_bench {
+	u8 *raw;
+	struct obc_sample *s;
+	struct obc_magcal cal;
+	struct bmp280_calib calib;
+};
+
+/* Keeps the results live so the loops are not optimized away */
+static s32 obc_bench_sink;
+
+static void obc_bench_adxl345(struct obc_bench *b, unsigned int n)
+{
+	obc_layout_decode_block(&adxl345_layout, b->raw, b->s, n);
+}
+
+static void obc_bench_hmc5883l(struct obc_bench *b, unsigned int n)
+{
+	obc_layout_decode_block(&hmc5883l_layout, b->raw, b->s, n);
+}
+
+static void obc_bench_bmp280_raw(struct obc_bench *b, unsigned int n)
+{
+	obc_layout_decode_block(&bmp280_layout, b->raw, b->s, n);
+}
+
+static void obc_bench_magcal(struct obc_bench *b, unsigned int n)
+{
+	obc_magcal_apply(&b->cal, b->s, n);
+}
+
+static void obc_bench_bmp280(struct obc_bench *b, unsigned int n)
+{
+	s32 t_fine;
+	unsigned int i;
+	for(i = 0; i < n; i++){
+		b->s[i].v[1] = bmp280_compensate_t(&b->calib, b->s[i].v[1], &t_fine);
+		b->s[i].v[0] = bmp280_compensate_p(&b->calib, b->s[i].v[0], t_fine);
+	}
+}
+
+static const struct {
+	const char *name;
+	void (*run)(struct obc_bench *b, unsigned int n);
+	bool refill;	/* the kernel works in place, restore the input each block */
+} obc_bench_kernels[] = {
+	{ "adxl345_decode", obc_bench_adxl345, false },
+	{ "hmc5883l_decode", obc_bench_hmc5883l, false },
+	{ "bmp280_decode", obc_bench_bmp280_raw, false },
+	{ "magcal_apply", obc_bench_magcal, true },
+	{ "bmp280_compensate", obc_bench_bmp280, true },
+};
+
+/* Decoded raw bytes, the input of the in-place kernels */
+static void obc_bench_refill(struct obc_bench *b, unsigned int n)
+{
+	obc_layout_decode_block(&bmp280_layout, b->raw, b->s, n);
+}
+
+static void obc_bench_run(struct kunit *test)
+{
+	struct obc_bench *b = test->priv;
+	unsigned int k, i, j, n;
+	u64 t0, ns, cns;
+	u32 rem;
+	for(k = 0; k < ARRAY_SIZE(obc_bench_kernels); k++){
+		for(i = 0; i < ARRAY_SIZE(obc_bench_blocks); i++){
+			n = obc_bench_blocks[i];
+			ns = 0;
+			for(j = 0; j < OBC_BENCH_SAMPLES / n; j++){
+				if(obc_bench_kernels[k].refill)
+					obc_bench_refill(b, n);
+				t0 = ktime_get_ns();
+				obc_bench_kernels[k].run(b, n);
+				ns += ktime_get_ns() - t0;
+				obc_bench_sink += b->s[n - 1].v[0];
+			}
+			cns = div_u64_rem(div_u64(ns * 100, OBC_BENCH_SAMPLES), 100, &rem);
+			kunit_info(test, "%s block %u: %llu.%02u ns/sample\n",
+					obc_bench_kernels[k].name, n, cns, rem);
+		}
+	}
+}
+
+static int obc_bench_init(struct kunit *test)
+{
+	struct obc_bench *b;
+	unsigned int i;
+	b = kunit_kzalloc(test, sizeof(*b), GFP_KERNEL);
+	if(!b)
+		return -ENOMEM;
+	b->raw = kunit_kzalloc(test, OBC_BENCH_MAX_BLOCK * 6, GFP_KERNEL);
+	b->s = kunit_kzalloc(test, OBC_BENCH_MAX_BLOCK * sizeof(*b->s), GFP_KERNEL);
+	if(!b->raw || !b->s)
+		return -ENOMEM;
+	/* Plausible readings: pressure and temperature around the datasheet example */
+	for(i = 0; i < OBC_BENCH_MAX_BLOCK * 6; i++)
+		b->raw[i] = (i % 3) ? i * 37 + 11 : 0x60 + (i & 0x7);
+	obc_magcal_identity(&b->cal);
+	b->cal.offset[0] = 5 << OBC_MAGCAL_OFFSET_SHIFT;
+	b->cal.matrix[0][1] = OBC_MAGCAL_ONE / 8;
+	bmp280_ref_parse(&b->calib);
+	test->priv = b;
+	return 0;
+}
+
+static struct kunit_case obc_bench_cases[] = {
+	KUNIT_CASE(obc_bench_run),
+	{}
+};
+
+static struct kunit_suite obc_bench_suite = {
+	.name = "obc_bench",
+	.init = obc_bench_init,
+	.test_cases = obc_bench_cases,
+};
+
+/* A transfer holding the bus, and two keyed reads queued behind it */
+struct obc_bus_test {
+	struct obc_bus_client holder;
+	struct completion holding;
+	struct completion release;
+	struct completion held;
+	atomic_t xfers;
+	struct obc_bus_test_read {
+		struct obc_bus_test *t;
+		struct obc_bus_client c;
+		u8 data[6];
+		int result;
+		struct completion done;
+	} read[2];
+};
+
+static const struct obc_bus_req obc_bus_test_hold_req = {
+	.class = OBC_BUS_HOUSEKEEPING,
+};
+
+static int obc_bus_test_hold(void *ctx)
+{
+	struct obc_bus_test *t = ctx;
+	complete(&t->holding);
+	wait_for_completion(&t->release);
+	return 0;
+}
+
+static int obc_bus_test_holder(void *arg)
+{
+	struct obc_bus_test *t = arg;
+	obc_bus_run(&t->holder, &obc_bus_test_hold_req, obc_bus_test_hold, t);
+	complete(&t->held);
+	return 0;
+}
+
+static int obc_bus_test_xfer(void *ctx)
+{
+	struct obc_bus_test_read *r = ctx;
+	atomic_inc(&r->t->xfers);
+	memset(r->data, 0x5a, sizeof(r->data));
+	return 0;
+}
+
+/* The key is the test, as a driver's is its device: both reads fetch the same data */
+static int obc_bus_test_reader(void *arg)
+{
+	struct obc_bus_test_read *r = arg;
+	struct obc_bus_req req;
+	obc_bus_capture_req(&r->c, &req, 0, r->t, r->data, sizeof(r->data));
+	r->result = obc_bus_run(&r->c, &req, obc_bus_test_xfer, r);
+	complete(&r->done);
+	return 0;
+}
+
+static void obc_bus_merge(struct kunit *test)
+{
+	struct obc_bus_test *t;
+	struct device *ctrl;
+	int i;
+	t = kunit_kzalloc(test, sizeof(*t), GFP_KERNEL);
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, t);
+	ctrl = root_device_register("obc_kunit_bus");
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, ctrl);
+	init_completion(&t->holding);
+	init_completion(&t->release);
+	init_completion(&t->held);
+	atomic_set(&t->xfers, 0);
+	KUNIT_ASSERT_EQ(test, obc_bus_attach(&t->holder, ctrl), 0);
+	for(i = 0; i < 2; i++){
+		t->read[i].t = t;
+		init_completion(&t->read[i].done);
+		t->read[i].c.capture_class = OBC_BUS_STREAM;
+		KUNIT_ASSERT_EQ(test, obc_bus_attach(&t->read[i].c, ctrl), 0);
+	}
+
+	kthread_run(obc_bus_test_holder, t, "obc_bus_hold");
+	wait_for_completion(&t->holding);
+	/* The second read finds the first still queued behind the holder */
+	for(i = 0; i < 2; i++){
+		kthread_run(obc_bus_test_reader, &t->read[i], "obc_bus_read%d", i);
+		msleep(20);
+	}
+	complete(&t->release);
+	wait_for_completion(&t->held);
+	for(i = 0; i < 2; i++)
+		wait_for_completion(&t->read[i].done);
+
+	KUNIT_EXPECT_EQ(test, atomic_read(&t->xfers), 1);
+	for(i = 0; i < 2; i++){
+		KUNIT_EXPECT_EQ(test, t->read[i].result, 0);
+		KUNIT_EXPECT_EQ(test, t->read[i].data[5], 0x5a);
+	}
+
+	obc_bus_detach(&t->holder);
+	for(i = 0; i < 2; i++)
+		obc_bus_detach(&t->read[i].c);
+	root_device_unregister(ctrl);
+}
+
+static struct kunit_case obc_bus_cases[] = {
+	KUNIT_CASE(obc_bus_merge),
+	{}
+};
+
+static struct kunit_suite obc_bus_suite = {
+	.name = "obc_bus",
+	.test_cases = obc_bus_cases,
+};
+
+kunit_test_suites(&obc_conv_suite, &obc_bench_suite, &obc_bus_suite);
+
+MODULE_LICENSE("GPL v2");
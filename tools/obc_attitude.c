@@ -0,0 +1,318 @@
+/*
+ * Attitude daemon: pairs every ADXL345 sample with the HMC5883L field at
+ * the same instant, runs the fixed-point TRIAD and complementary stages of
+ * obc_fusion.h at the accelerometer rate and publishes the estimate through
+ * shared memory (obc_attitude.h). Both sensors are read through
+ * libobcsensors, so on current drivers the samples come straight out of
+ * the mapped kernel rings and the loop makes no system call per sample
+ * besides the futex wake.
+ *
+ * The magnetometer runs slower than the accelerometer. An accelerometer
+ * sample that falls between two magnetometer samples uses the field
+ * interpolated to its capture time; one newer than the last magnetometer
+ * sample holds that field. If that is older than the skew limit only the
+ * tilt is updated, heading is taken from the previous estimate and the
+ * result is flagged OBC_ATTITUDE_MAG_STALE.
+ *
+ * Latency is measured from the accelerometer capture timestamp to the
+ * moment the estimate is visible in shared memory.
+ */
+#define _GNU_SOURCE
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <getopt.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "obc_sample.h"
+#include "obc_attitude.h"
+#include "obcsensors.h"
+#include "obc_fusion.h"
+
+#define NSEC_PER_SEC 1000000000ULL
+#define NSEC_PER_USEC 1000ULL
+#define BATCH 64
+
+struct mag_hist {
+	struct obcs_mag prev, last;
+	int have;
+};
+
+static const char *shm_name = OBC_ATTITUDE_SHM;
+static __u64 tau_us = 500000;
+static __u64 skew_ns = 50000000;
+static int rt_prio;
+static int verbose;
+static volatile sig_atomic_t stop;
+
+static struct obc_attitude_shm *shm;
+static __s64 q[4] = { OBC_FUSION_ONE, 0, 0, 0 };
+static __u64 last_t_ns;
+static int have_q;
+
+static __u64 now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (__u64)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+static void on_signal(int sig)
+{
+	(void)sig;
+	stop = 1;
+}
+
+static struct obc_attitude_shm *shm_create(const char *name)
+{
+	struct obc_attitude_shm *p;
+	int fd;
+
+	fd = shm_open(name, O_RDWR | O_CREAT, 0644);
+	if (fd < 0)
+		return NULL;
+	if (ftruncate(fd, sizeof(*p)) < 0) {
+		close(fd);
+		return NULL;
+	}
+	p = mmap(NULL, sizeof(*p), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (p == MAP_FAILED)
+		return NULL;
+	memset(p, 0, sizeof(*p));
+	p->version = OBC_ATTITUDE_VERSION;
+	__atomic_store_n(&p->magic, OBC_ATTITUDE_MAGIC, __ATOMIC_RELEASE);
+	return p;
+}
+
+static void publish(const struct obc_attitude *a)
+{
+	__u64 lat_ns, lat_us;
+	__u32 seq = shm->seq;
+	int b;
+
+	__atomic_store_n(&shm->seq, seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	shm->cur = *a;
+	shm->cur.t_publish_ns = now_ns();
+	__atomic_store_n(&shm->seq, seq + 2, __ATOMIC_RELEASE);
+	syscall(SYS_futex, &shm->seq, FUTEX_WAKE, 0x7fffffff, NULL, NULL, 0);
+
+	/* Statistics are outside the sequence lock, readers take them as approximate */
+	lat_ns = shm->cur.t_publish_ns - a->t_sample_ns;
+	lat_us = lat_ns / NSEC_PER_USEC;
+	for (b = 0; b < OBC_ATTITUDE_LAT_BUCKETS - 1 && lat_us >> (b + 1); b++)
+		;
+	shm->lat_hist[b]++;
+	shm->updates++;
+	shm->lat_sum_ns += lat_ns;
+	if (lat_ns > shm->lat_max_ns)
+		shm->lat_max_ns = lat_ns;
+}
+
+/* Field at time t: interpolated between the last two samples, else the last one */
+static int mag_at(const struct mag_hist *m, __u64 t, __s32 *v, __u32 *seq)
+{
+	const struct obcs_mag *a = &m->prev, *b = &m->last;
+	__s64 num, den;
+
+	if (!m->have)
+		return -1;
+	*seq = b->seq;
+	if (m->have > 1 && t >= a->t_ns && t < b->t_ns && a->gain == b->gain) {
+		den = b->t_ns - a->t_ns;
+		num = t - a->t_ns;
+		v[0] = a->x + (__s32)((b->x - a->x) * num / den);
+		v[1] = a->y + (__s32)((b->y - a->y) * num / den);
+		v[2] = a->z + (__s32)((b->z - a->z) * num / den);
+		return 0;
+	}
+	v[0] = b->x;
+	v[1] = b->y;
+	v[2] = b->z;
+	return t > b->t_ns + skew_ns ? 1 : 0;
+}
+
+static void mag_push(struct mag_hist *m, const struct obcs_mag *s)
+{
+	if (s->flags & OBC_SAMPLE_STALE)
+		return;
+	m->prev = m->last;
+	m->last = *s;
+	if (m->have < 2)
+		m->have++;
+}
+
+static void update(const struct obcs_accel *acc, const struct mag_hist *m)
+{
+	struct obc_attitude a;
+	__s32 accel[3] = { acc->x, acc->y, acc->z }, mag[3];
+	__s64 meas[4];
+	int old, i;
+
+	memset(&a, 0, sizeof(a));
+	a.t_sample_ns = acc->t_ns;
+	a.accel_seq = acc->seq;
+	if (acc->flags & OBC_SAMPLE_STALE) {
+		a.flags |= OBC_ATTITUDE_ACCEL_STALE;
+		goto out;
+	}
+	old = mag_at(m, acc->t_ns, mag, &a.mag_seq);
+	if (old < 0 || !obc_fusion_triad(accel, mag, meas))
+		return;
+	if (old) {
+		/* Only tilt is trusted: take north from the previous estimate */
+		a.flags |= OBC_ATTITUDE_MAG_STALE;
+		if (have_q) {
+			obc_fusion_north(q, mag);
+			obc_fusion_triad(accel, mag, meas);
+		}
+	}
+	if (!have_q || acc->flags & OBC_SAMPLE_GAP || acc->t_ns <= last_t_ns) {
+		for (i = 0; i < 4; i++)
+			q[i] = meas[i];
+		have_q = 1;
+	} else {
+		obc_fusion_blend(q, meas, obc_fusion_gain((acc->t_ns - last_t_ns) / NSEC_PER_USEC, tau_us));
+	}
+	last_t_ns = acc->t_ns;
+out:
+	for (i = 0; i < 4; i++)
+		a.q[i] = (__s32)q[i];
+	obc_fusion_euler(q, a.euler_mdeg);
+	publish(&a);
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [-s shm_name] [-t tau_ms] [-k mag_skew_ms] [-r rt_prio] [-v]\n"
+		"  -s  shared memory object (default %s)\n"
+		"  -t  complementary filter time constant (default 500 ms)\n"
+		"  -k  oldest magnetometer sample still used for yaw (default 50 ms)\n"
+		"  -r  run SCHED_FIFO at this priority and lock memory\n"
+		"  -v  print latency statistics every second\n",
+		prog, OBC_ATTITUDE_SHM);
+}
+
+int main(int argc, char **argv)
+{
+	struct obcs_dev *accel, *magn;
+	struct obcs_accel abuf[BATCH];
+	struct obcs_mag mbuf[BATCH];
+	struct mag_hist mh;
+	struct epoll_event ev[2];
+	__u64 next_report = 0;
+	int ep, opt, n, i, j;
+
+	while ((opt = getopt(argc, argv, "s:t:k:r:vh")) != -1) {
+		switch (opt) {
+		case 's':
+			shm_name = optarg;
+			break;
+		case 't':
+			tau_us = strtoull(optarg, NULL, 0) * 1000;
+			break;
+		case 'k':
+			skew_ns = strtoull(optarg, NULL, 0) * 1000000;
+			break;
+		case 'r':
+			rt_prio = atoi(optarg);
+			break;
+		case 'v':
+			verbose = 1;
+			break;
+		default:
+			usage(argv[0]);
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+
+	accel = obcs_open(OBCS_ADXL345, OBCS_PATH_AUTO);
+	if (!accel) {
+		perror("adxl345");
+		return 1;
+	}
+	magn = obcs_open(OBCS_HMC5883L, OBCS_PATH_AUTO);
+	if (!magn) {
+		perror("hmc5883l");
+		return 1;
+	}
+	shm = shm_create(shm_name);
+	if (!shm) {
+		perror(shm_name);
+		return 1;
+	}
+	if (rt_prio) {
+		struct sched_param sp = { .sched_priority = rt_prio };
+		if (sched_setscheduler(0, SCHED_FIFO, &sp) < 0)
+			perror("sched_setscheduler");
+		if (mlockall(MCL_CURRENT | MCL_FUTURE) < 0)
+			perror("mlockall");
+	}
+
+	ep = epoll_create1(EPOLL_CLOEXEC);
+	if (ep < 0) {
+		perror("epoll_create1");
+		return 1;
+	}
+	ev[0].events = EPOLLIN;
+	ev[0].data.ptr = accel;
+	ev[1].events = EPOLLIN;
+	ev[1].data.ptr = magn;
+	if (epoll_ctl(ep, EPOLL_CTL_ADD, obcs_fd(accel), &ev[0]) < 0 ||
+	    epoll_ctl(ep, EPOLL_CTL_ADD, obcs_fd(magn), &ev[1]) < 0) {
+		perror("epoll_ctl");
+		return 1;
+	}
+
+	signal(SIGINT, on_signal);
+	signal(SIGTERM, on_signal);
+	memset(&mh, 0, sizeof(mh));
+
+	fprintf(stderr, "obc_attitude: adxl345 via %s, hmc5883l via %s, publishing %s\n",
+		obcs_path_name(obcs_path(accel)), obcs_path_name(obcs_path(magn)), shm_name);
+
+	while (!stop) {
+		n = epoll_wait(ep, ev, 2, 1000);
+		if (n < 0 && errno != EINTR) {
+			perror("epoll_wait");
+			break;
+		}
+		/*
+		 * Drain the magnetometer first so accelerometer samples that
+		 * arrived in the same wakeup find the field bracketing them.
+		 */
+		while ((n = obcs_read_mag(magn, mbuf, BATCH)) > 0)
+			for (i = 0; i < n; i++)
+				mag_push(&mh, &mbuf[i]);
+		while ((n = obcs_read_accel(accel, abuf, BATCH)) > 0)
+			for (j = 0; j < n; j++)
+				update(&abuf[j], &mh);
+
+		if (verbose && now_ns() >= next_report) {
+			__u64 upd = shm->updates;
+			fprintf(stderr, "updates %llu latency avg %llu us max %llu us\n",
+				(unsigned long long)upd,
+				(unsigned long long)(upd ? shm->lat_sum_ns / upd / NSEC_PER_USEC : 0),
+				(unsigned long long)(shm->lat_max_ns / NSEC_PER_USEC));
+			next_report = now_ns() + NSEC_PER_SEC;
+		}
+	}
+
+	close(ep);
+	obcs_close(magn);
+	obcs_close(accel);
+	munmap(shm, sizeof(*shm));
+	return 0;
+}
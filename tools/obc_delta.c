@@ -0,0 +1,107 @@
+/* Decoder for the delta/varint sample stream described in obc_delta.h */
+#include <string.h>
+
+#include "obc_delta.h"
+
+void obc_delta_dec_init(struct obc_delta_dec *d, __u16 dev)
+{
+	memset(d, 0, sizeof(*d));
+	d->dev = dev;
+}
+
+static inline const __u8 *get_varint(const __u8 *p, const __u8 *end, __u64 *v)
+{
+	__u64 r = 0;
+	int shift = 0;
+
+	while (p < end && shift < 64) {
+		__u8 b = *p++;
+		r |= (__u64)(b & 0x7f) << shift;
+		if (!(b & 0x80)) {
+			*v = r;
+			return p;
+		}
+		shift += 7;
+	}
+	return NULL;
+}
+
+int obc_delta_decode(struct obc_delta_dec *d, const __u8 *in, size_t len,
+		size_t *used, struct obc_sample *out, unsigned int max)
+{
+	const __u8 *p = in, *end = in + len;
+	unsigned int n = 0;
+
+	while (p < end) {
+		const __u8 *q = p + 1;
+		unsigned int count = *p & OBC_DELTA_COUNT_MASK, i;
+		int key = *p & OBC_DELTA_KEY;
+		struct obc_delta_dec save = *d;
+		struct obc_sample *s = out + n;
+
+		if (*p == OBC_DELTA_GAP) {
+			__u64 lost;
+			if (!(q = get_varint(q, end, &lost)))
+				break;
+			d->lost += lost;
+			d->seq += lost;
+			d->flags |= OBC_SAMPLE_GAP;
+			p = q;
+			continue;
+		}
+		if (!count)
+			return -1;
+		if (count > max - n)
+			break;
+		for (i = 0; i < count; i++, s++) {
+			__u64 t, x, y, z, flags, seq, set;
+
+			if (!(q = get_varint(q, end, &t)) ||
+			    !(q = get_varint(q, end, &x)) ||
+			    !(q = get_varint(q, end, &y)) ||
+			    !(q = get_varint(q, end, &z)))
+				break;
+			if (key && i == 0) {
+				if (!(q = get_varint(q, end, &flags)) ||
+				    !(q = get_varint(q, end, &seq)) ||
+				    !(q = get_varint(q, end, &set)))
+					break;
+				d->last_t_us = t;
+				d->last[0] = obc_delta_unzigzag(x);
+				d->last[1] = obc_delta_unzigzag(y);
+				d->last[2] = obc_delta_unzigzag(z);
+				d->key_flags = flags & OBC_DELTA_KEY_FLAGS;
+				d->seq = seq;
+				d->set = set;
+				d->synced = 1;
+			} else {
+				if (!(q = get_varint(q, end, &set)))
+					break;
+				d->last_t_us += t;
+				d->last[0] += obc_delta_unzigzag(x);
+				d->last[1] += obc_delta_unzigzag(y);
+				d->last[2] += obc_delta_unzigzag(z);
+				d->set += obc_delta_unzigzag(set);
+			}
+			s->t_ns = d->last_t_us * 1000;
+			s->seq = d->seq++;
+			s->dev = d->dev;
+			s->flags = d->key_flags | d->flags;
+			d->flags = 0;
+			s->v[0] = d->last[0];
+			s->v[1] = d->last[1];
+			s->v[2] = d->last[2];
+			s->set = d->set;
+		}
+		if (i < count) {
+			/* Truncated chunk: leave it for the next call */
+			*d = save;
+			break;
+		}
+		if (d->synced)
+			n += count;
+		p = q;
+	}
+	*used = p - in;
+	return n;
+}
@@ -0,0 +1,166 @@
+/*
+ * Compression ratio and throughput of the delta/varint stream format on
+ * recorded segments. Throughput is given in MB/s of raw payload, counting
+ * a sample as its 6-byte xyz triplet plus an 8-byte timestamp.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "obc_delta.h"
+#include "obc_segment_map.h"
+
+#define RAW_SAMPLE_BYTES 14
+#define MIN_BENCH_NS 200000000ULL
+
+static const char *dev_name[OBC_DEV_MAX] = { "none", "adxl345", "hmc5883l", "bmp280" };
+
+static __u64 now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (__u64)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Random walk of a few LSB per step, for hosts without recordings */
+static size_t synth(struct obc_sample *s, size_t n, int dev)
+{
+	__s32 v[3] = { 100, -200, 900 };
+	size_t i;
+	int c;
+
+	for (i = 0; i < n; i++) {
+		memset(&s[i], 0, sizeof(s[i]));
+		s[i].t_ns = 1000000000ULL + i * 10000000ULL + rand() % 50000;
+		s[i].dev = dev;
+		for (c = 0; c < 3; c++) {
+			v[c] += rand() % 9 - 4;
+			s[i].v[c] = v[c];
+		}
+	}
+	return n;
+}
+
+static void bench(int dev, const struct obc_sample *s, size_t n, unsigned int key)
+{
+	/* Flag changes and keyframes can end chunks early */
+	size_t cap = n * (1 + OBC_DELTA_MAX_SAMPLE_BYTES);
+	__u8 *buf = malloc(cap);
+	struct obc_sample *out = malloc(n * sizeof(*out));
+	struct obc_delta_enc enc;
+	struct obc_delta_dec dec;
+	__u64 t0, enc_ns, dec_ns;
+	size_t len = 0, used, i;
+	unsigned int m, iters;
+	double raw = (double)n * RAW_SAMPLE_BYTES;
+
+	if (!buf || !out) {
+		fprintf(stderr, "out of memory\n");
+		exit(1);
+	}
+
+	iters = 0;
+	t0 = now_ns();
+	do {
+		obc_delta_enc_init(&enc, key);
+		m = n;
+		len = obc_delta_encode(&enc, s, &m, buf, cap);
+		iters++;
+	} while (now_ns() - t0 < MIN_BENCH_NS);
+	enc_ns = (now_ns() - t0) / iters;
+
+	iters = 0;
+	t0 = now_ns();
+	do {
+		obc_delta_dec_init(&dec, dev);
+		if (obc_delta_decode(&dec, buf, len, &used, out, n) != (int)n || used != len) {
+			fprintf(stderr, "%s: decode failed\n", dev_name[dev]);
+			exit(1);
+		}
+		iters++;
+	} while (now_ns() - t0 < MIN_BENCH_NS);
+	dec_ns = (now_ns() - t0) / iters;
+
+	for (i = 0; i < n; i++) {
+		if (out[i].t_ns / 1000 != s[i].t_ns / 1000 || out[i].v[0] != s[i].v[0] ||
+		    out[i].v[1] != s[i].v[1] || out[i].v[2] != s[i].v[2] || out[i].set != s[i].set ||
+		    (out[i].flags & OBC_DELTA_KEY_FLAGS) != (s[i].flags & OBC_DELTA_KEY_FLAGS)) {
+			fprintf(stderr, "%s: mismatch at sample %zu\n", dev_name[dev], i);
+			exit(1);
+		}
+	}
+
+	printf("%-9s %9zu samples %10.0f -> %9zu bytes  ratio %5.2f  %5.2f B/sample  enc %7.1f MB/s  dec %7.1f MB/s\n",
+		dev_name[dev], n, raw, len, raw / len, (double)len / n,
+		raw / enc_ns * 1e3, raw / dec_ns * 1e3);
+	free(buf);
+	free(out);
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [-k key_interval] [-n synthetic_samples] segment...\n", prog);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	struct obc_sample *per_dev[OBC_DEV_MAX] = { NULL };
+	size_t count[OBC_DEV_MAX] = { 0 }, cap[OBC_DEV_MAX] = { 0 };
+	unsigned int key = OBC_DELTA_DEFAULT_KEY_INTERVAL;
+	size_t synthetic = 0;
+	int opt, i, d;
+
+	while ((opt = getopt(argc, argv, "k:n:")) != -1) {
+		switch (opt) {
+		case 'k': key = strtoul(optarg, NULL, 0); break;
+		case 'n': synthetic = strtoul(optarg, NULL, 0); break;
+		default: usage(argv[0]);
+		}
+	}
+	if (optind >= argc && !synthetic)
+		usage(argv[0]);
+
+	for (i = optind; i < argc; i++) {
+		const struct obc_segment_header *hdr;
+		const struct obc_sample *rec;
+		size_t size;
+		__u32 r;
+
+		hdr = obc_segment_map(argv[i], &size);
+		if (!hdr)
+			continue;
+		rec = obc_segment_records(hdr);
+		for (r = 0; r < hdr->record_count; r++) {
+			d = rec[r].dev;
+			if (d <= OBC_DEV_NONE || d >= OBC_DEV_MAX)
+				continue;
+			if (count[d] == cap[d]) {
+				cap[d] = cap[d] ? 2 * cap[d] : 4096;
+				per_dev[d] = realloc(per_dev[d], cap[d] * sizeof(struct obc_sample));
+				if (!per_dev[d]) {
+					fprintf(stderr, "out of memory\n");
+					return 1;
+				}
+			}
+			per_dev[d][count[d]++] = rec[r];
+		}
+		munmap((void *)hdr, size);
+	}
+	if (synthetic && !count[OBC_DEV_HMC5883L]) {
+		per_dev[OBC_DEV_HMC5883L] = malloc(synthetic * sizeof(struct obc_sample));
+		if (!per_dev[OBC_DEV_HMC5883L])
+			return 1;
+		count[OBC_DEV_HMC5883L] = synth(per_dev[OBC_DEV_HMC5883L], synthetic, OBC_DEV_HMC5883L);
+	}
+
+	printf("key interval %u\n", key);
+	for (d = OBC_DEV_NONE + 1; d < OBC_DEV_MAX; d++) {
+		if (count[d])
+			bench(d, per_dev[d], count[d], key);
+		free(per_dev[d]);
+	}
+	return 0;
+}
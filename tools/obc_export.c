@@ -0,0 +1,90 @@
+/*
+ * Exports one device's samples from recorder segments as a delta/varint
+ * compressed stream (obc_delta.h) for downlink, optionally limited to a
+ * time range located through the segment index.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "obc_delta.h"
+#include "obc_segment_map.h"
+
+#define BATCH 256
+
+/* Flag changes end chunks early, so a batch may take several passes */
+static void put_batch(struct obc_delta_enc *enc, const struct obc_sample *s, unsigned int n,
+		__u8 *out, size_t size)
+{
+	unsigned int done, used;
+	size_t len;
+
+	for (done = 0; done < n; done += used) {
+		used = n - done;
+		len = obc_delta_encode(enc, s + done, &used, out, size);
+		fwrite(out, 1, len, stdout);
+	}
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s -d dev [-f from_ns] [-t to_ns] [-k key_interval] segment...\n", prog);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	static __u8 out[BATCH / OBC_DELTA_MAX_CHUNK_SAMPLES * OBC_DELTA_MAX_CHUNK_BYTES + OBC_DELTA_MAX_CHUNK_BYTES];
+	struct obc_sample batch[BATCH];
+	struct obc_delta_stream_header sh;
+	struct obc_delta_enc enc;
+	__u64 from = 0, to = ~0ULL;
+	unsigned int key = OBC_DELTA_DEFAULT_KEY_INTERVAL;
+	int dev = 0, opt, i;
+
+	while ((opt = getopt(argc, argv, "d:f:t:k:")) != -1) {
+		switch (opt) {
+		case 'd': dev = strtol(optarg, NULL, 0); break;
+		case 'f': from = strtoull(optarg, NULL, 0); break;
+		case 't': to = strtoull(optarg, NULL, 0); break;
+		case 'k': key = strtoul(optarg, NULL, 0); break;
+		default: usage(argv[0]);
+		}
+	}
+	if (dev <= OBC_DEV_NONE || dev >= OBC_DEV_MAX || optind >= argc || !key || key > 0xffff)
+		usage(argv[0]);
+
+	sh.magic = OBC_DELTA_STREAM_MAGIC;
+	sh.version = OBC_DELTA_STREAM_VERSION;
+	sh.dev = dev;
+	sh.key_interval = key;
+	fwrite(&sh, sizeof(sh), 1, stdout);
+	obc_delta_enc_init(&enc, key);
+
+	for (i = optind; i < argc; i++) {
+		const struct obc_segment_header *hdr;
+		const struct obc_sample *rec;
+		unsigned int n = 0;
+		size_t size;
+		__u32 r;
+
+		hdr = obc_segment_map(argv[i], &size);
+		if (!hdr)
+			continue;
+		if (hdr->record_count && hdr->t_end_ns >= from && hdr->t_start_ns <= to) {
+			rec = obc_segment_records(hdr);
+			for (r = obc_segment_seek(hdr, from); r < hdr->record_count && rec[r].t_ns <= to; r++) {
+				if (rec[r].dev != dev)
+					continue;
+				batch[n++] = rec[r];
+				if (n == BATCH) {
+					put_batch(&enc, batch, n, out, sizeof(out));
+					n = 0;
+				}
+			}
+			put_batch(&enc, batch, n, out, sizeof(out));
+		}
+		munmap((void *)hdr, size);
+	}
+	return fflush(stdout) ? 1 : 0;
+}
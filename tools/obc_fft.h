@@ -0,0 +1,155 @@
+/*
+ * Fixed-point complex FFT for the vibration analysis.
+ *
+ * Data is __s32, twiddles are Q30. The transform runs in place on split
+ * real and imaginary arrays: input in natural order, a bit-reversal pass,
+ * then radix-4 butterflies, with one radix-2 stage first when log2(n) is
+ * odd. Every stage scales its outputs down (by 4 or 2), so the result is
+ * the DFT divided by n and cannot overflow for inputs of magnitude below 2^28.
+ *
+ * The tables are built once with libm by obc_fft_init(); the transform
+ * itself uses no floating point.
+ */
+#ifndef OBC_FFT_H
+#define OBC_FFT_H
+
+#include <linux/types.h>
+#include <math.h>
+#include <stdlib.h>
+
+#define OBC_FFT_MIN_LOG2 4
+#define OBC_FFT_MAX_LOG2 12
+#define OBC_FFT_TW_SHIFT 30
+#define OBC_FFT_WIN_SHIFT 15
+
+struct obc_fft {
+	unsigned int log2n;
+	unsigned int n;
+	__s32 *tw_re, *tw_im;	/* W_n^k = cos(2 pi k / n) - i sin(2 pi k / n), k < 3n/4 */
+	__s32 *window;		/* Hann, Q15 */
+	__u16 *rev;		/* bit-reversed index */
+	double window_power;	/* sum of w^2 with w in [0, 1] */
+};
+
+static inline void obc_fft_free(struct obc_fft *f)
+{
+	free(f->tw_re);
+	free(f->tw_im);
+	free(f->window);
+	free(f->rev);
+	f->tw_re = f->tw_im = f->window = NULL;
+	f->rev = NULL;
+}
+
+static inline int obc_fft_init(struct obc_fft *f, unsigned int log2n)
+{
+	unsigned int k, b, r, n = 1U << log2n;
+	double w;
+
+	if (log2n < OBC_FFT_MIN_LOG2 || log2n > OBC_FFT_MAX_LOG2)
+		return -1;
+	f->log2n = log2n;
+	f->n = n;
+	f->tw_re = malloc(3 * n / 4 * sizeof(*f->tw_re));
+	f->tw_im = malloc(3 * n / 4 * sizeof(*f->tw_im));
+	f->window = malloc(n * sizeof(*f->window));
+	f->rev = malloc(n * sizeof(*f->rev));
+	if (!f->tw_re || !f->tw_im || !f->window || !f->rev) {
+		obc_fft_free(f);
+		return -1;
+	}
+	for (k = 0; k < 3 * n / 4; k++) {
+		f->tw_re[k] = (__s32)lround(cos(2 * M_PI * k / n) * (1 << OBC_FFT_TW_SHIFT));
+		f->tw_im[k] = (__s32)lround(-sin(2 * M_PI * k / n) * (1 << OBC_FFT_TW_SHIFT));
+	}
+	f->window_power = 0;
+	for (k = 0; k < n; k++) {
+		w = 0.5 - 0.5 * cos(2 * M_PI * k / n);
+		f->window[k] = (__s32)lround(w * (1 << OBC_FFT_WIN_SHIFT));
+		f->window_power += w * w;
+	}
+	for (k = 0; k < n; k++) {
+		for (r = 0, b = 0; b < log2n; b++)
+			r |= ((k >> b) & 1) << (log2n - 1 - b);
+		f->rev[k] = r;
+	}
+	return 0;
+}
+
+static inline __s32 obc_fft_mul_re(__s32 xr, __s32 xi, __s32 wr, __s32 wi)
+{
+	return (__s32)(((__s64)xr * wr - (__s64)xi * wi) >> OBC_FFT_TW_SHIFT);
+}
+
+static inline __s32 obc_fft_mul_im(__s32 xr, __s32 xi, __s32 wr, __s32 wi)
+{
+	return (__s32)(((__s64)xr * wi + (__s64)xi * wr) >> OBC_FFT_TW_SHIFT);
+}
+
+/* Rounded arithmetic shift */
+static inline __s32 obc_fft_scale(__s32 x, int shift)
+{
+	return (x + (1 << (shift - 1))) >> shift;
+}
+
+static inline void obc_fft_run(const struct obc_fft *f, __s32 *re, __s32 *im)
+{
+	unsigned int n = f->n, h, g, j, k, step;
+	__s32 t;
+
+	for (k = 0; k < n; k++) {
+		j = f->rev[k];
+		if (j > k) {
+			t = re[k]; re[k] = re[j]; re[j] = t;
+			t = im[k]; im[k] = im[j]; im[j] = t;
+		}
+	}
+
+	h = 1;
+	if (f->log2n & 1) {
+		for (k = 0; k < n; k += 2) {
+			__s32 ar = re[k], ai = im[k], br = re[k + 1], bi = im[k + 1];
+			re[k] = obc_fft_scale(ar + br, 1);
+			im[k] = obc_fft_scale(ai + bi, 1);
+			re[k + 1] = obc_fft_scale(ar - br, 1);
+			im[k + 1] = obc_fft_scale(ai - bi, 1);
+		}
+		h = 2;
+	}
+
+	/*
+	 * Two radix-2 stages fused: groups of 4h, legs h apart. With
+	 * w = W_4h^j the legs are weighted 1, w^2, w, w^3 in bit-reversed
+	 * order, and the second stage's -i twiddle is a swap.
+	 */
+	for (; 4 * h <= n; h *= 4) {
+		step = n / (4 * h);
+		for (g = 0; g < n; g += 4 * h) {
+			for (j = 0; j < h; j++) {
+				unsigned int a = g + j, b = a + h, c = b + h, d = c + h;
+				unsigned int k1 = j * step, k2 = 2 * k1, k3 = 3 * k1;
+				__s32 br = obc_fft_mul_re(re[b], im[b], f->tw_re[k2], f->tw_im[k2]);
+				__s32 bi = obc_fft_mul_im(re[b], im[b], f->tw_re[k2], f->tw_im[k2]);
+				__s32 cr = obc_fft_mul_re(re[c], im[c], f->tw_re[k1], f->tw_im[k1]);
+				__s32 ci = obc_fft_mul_im(re[c], im[c], f->tw_re[k1], f->tw_im[k1]);
+				__s32 dr = obc_fft_mul_re(re[d], im[d], f->tw_re[k3], f->tw_im[k3]);
+				__s32 di = obc_fft_mul_im(re[d], im[d], f->tw_re[k3], f->tw_im[k3]);
+				__s32 t0r = re[a] + br, t0i = im[a] + bi;
+				__s32 t1r = re[a] - br, t1i = im[a] - bi;
+				__s32 t2r = cr + dr, t2i = ci + di;
+				__s32 t3r = cr - dr, t3i = ci - di;
+
+				re[a] = obc_fft_scale(t0r + t2r, 2);
+				im[a] = obc_fft_scale(t0i + t2i, 2);
+				re[c] = obc_fft_scale(t0r - t2r, 2);
+				im[c] = obc_fft_scale(t0i - t2i, 2);
+				re[b] = obc_fft_scale(t1r + t3i, 2);
+				im[b] = obc_fft_scale(t1i - t3r, 2);
+				re[d] = obc_fft_scale(t1r - t3i, 2);
+				im[d] = obc_fft_scale(t1i + t3r, 2);
+			}
+		}
+	}
+}
+
+#endif
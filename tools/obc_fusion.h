@@ -0,0 +1,240 @@
+/*
+ * Fixed-point accelerometer/magnetometer attitude fusion.
+ *
+ * Vectors, direction cosines and quaternions are Q30 (OBC_FUSION_ONE is
+ * 1.0). obc_fusion_triad() builds the body to NED rotation from one
+ * accelerometer and one magnetometer reading; obc_fusion_blend() is the
+ * complementary stage, a normalised interpolation from the previous
+ * estimate towards the new measurement with a time-constant derived gain.
+ * Nothing here uses floating point or allocates.
+ */
+#ifndef OBC_FUSION_H
+#define OBC_FUSION_H
+
+#include <linux/types.h>
+
+#define OBC_FUSION_SHIFT 30
+#define OBC_FUSION_ONE (1LL << OBC_FUSION_SHIFT)
+
+static inline __u64 obc_fusion_isqrt(__u64 x)
+{
+	__u64 r = 0, bit = 1ULL << 62;
+
+	while (bit > x)
+		bit >>= 2;
+	while (bit) {
+		if (x >= r + bit) {
+			x -= r + bit;
+			r = (r >> 1) + bit;
+		} else {
+			r >>= 1;
+		}
+		bit >>= 2;
+	}
+	return r;
+}
+
+static inline __s64 obc_fusion_mul(__s64 a, __s64 b)
+{
+	return (a * b) >> OBC_FUSION_SHIFT;
+}
+
+/* Scales v to unit length in Q30, returns 0 for a zero vector */
+static inline int obc_fusion_normalize(__s64 *v, int n)
+{
+	__u64 sum = 0, len;
+	int i, shift = 0;
+
+	for (i = 0; i < n; i++)
+		sum += (__u64)(v[i] < 0 ? -v[i] : v[i]) * (__u64)(v[i] < 0 ? -v[i] : v[i]) >> shift;
+	/* Q30 inputs square to Q60; keep the sum and the shifted numerator in range */
+	while (sum >> 62) {
+		shift += 2;
+		sum >>= 2;
+	}
+	len = obc_fusion_isqrt(sum) << (shift / 2);
+	if (!len)
+		return 0;
+	for (i = 0; i < n; i++) {
+		/* v * 2^30 / len without overflowing for Q30 inputs */
+		__s64 hi = v[i] / (__s64)len, lo = v[i] % (__s64)len;
+		v[i] = (hi << OBC_FUSION_SHIFT) + (lo << OBC_FUSION_SHIFT) / (__s64)len;
+	}
+	return 1;
+}
+
+static inline void obc_fusion_cross(const __s64 *a, const __s64 *b, __s64 *out)
+{
+	out[0] = obc_fusion_mul(a[1], b[2]) - obc_fusion_mul(a[2], b[1]);
+	out[1] = obc_fusion_mul(a[2], b[0]) - obc_fusion_mul(a[0], b[2]);
+	out[2] = obc_fusion_mul(a[0], b[1]) - obc_fusion_mul(a[1], b[0]);
+}
+
+/* Shepperd's method, picking the best conditioned of the four forms */
+static inline void obc_fusion_dcm_to_quat(__s64 r[3][3], __s64 *q)
+{
+	__s64 tr = r[0][0] + r[1][1] + r[2][2], s;
+
+	if (tr > 0) {
+		s = 2 * (__s64)obc_fusion_isqrt((__u64)(OBC_FUSION_ONE + tr) << OBC_FUSION_SHIFT);
+		q[0] = s / 4;
+		q[1] = ((r[2][1] - r[1][2]) << OBC_FUSION_SHIFT) / s;
+		q[2] = ((r[0][2] - r[2][0]) << OBC_FUSION_SHIFT) / s;
+		q[3] = ((r[1][0] - r[0][1]) << OBC_FUSION_SHIFT) / s;
+	} else if (r[0][0] > r[1][1] && r[0][0] > r[2][2]) {
+		s = 2 * (__s64)obc_fusion_isqrt((__u64)(OBC_FUSION_ONE + r[0][0] - r[1][1] - r[2][2]) << OBC_FUSION_SHIFT);
+		q[0] = ((r[2][1] - r[1][2]) << OBC_FUSION_SHIFT) / s;
+		q[1] = s / 4;
+		q[2] = ((r[0][1] + r[1][0]) << OBC_FUSION_SHIFT) / s;
+		q[3] = ((r[0][2] + r[2][0]) << OBC_FUSION_SHIFT) / s;
+	} else if (r[1][1] > r[2][2]) {
+		s = 2 * (__s64)obc_fusion_isqrt((__u64)(OBC_FUSION_ONE + r[1][1] - r[0][0] - r[2][2]) << OBC_FUSION_SHIFT);
+		q[0] = ((r[0][2] - r[2][0]) << OBC_FUSION_SHIFT) / s;
+		q[1] = ((r[0][1] + r[1][0]) << OBC_FUSION_SHIFT) / s;
+		q[2] = s / 4;
+		q[3] = ((r[1][2] + r[2][1]) << OBC_FUSION_SHIFT) / s;
+	} else {
+		s = 2 * (__s64)obc_fusion_isqrt((__u64)(OBC_FUSION_ONE + r[2][2] - r[0][0] - r[1][1]) << OBC_FUSION_SHIFT);
+		q[0] = ((r[1][0] - r[0][1]) << OBC_FUSION_SHIFT) / s;
+		q[1] = ((r[0][2] + r[2][0]) << OBC_FUSION_SHIFT) / s;
+		q[2] = ((r[1][2] + r[2][1]) << OBC_FUSION_SHIFT) / s;
+		q[3] = s / 4;
+	}
+	if (q[0] < 0) {
+		q[0] = -q[0];
+		q[1] = -q[1];
+		q[2] = -q[2];
+		q[3] = -q[3];
+	}
+}
+
+/*
+ * TRIAD: the accelerometer measures the reaction to gravity (up), the
+ * magnetometer the field with its dip. Down and the horizontal east
+ * direction follow from them; north completes the frame. The rows of the
+ * rotation are the NED axes expressed in the body frame. Inputs are raw
+ * counts in the same body frame; returns 0 if they are degenerate.
+ */
+static inline int obc_fusion_triad(const __s32 *accel, const __s32 *mag, __s64 *q)
+{
+	__s64 d[3], m[3], e[3], n[3], r[3][3];
+	int i;
+
+	for (i = 0; i < 3; i++) {
+		d[i] = -(__s64)accel[i];
+		m[i] = mag[i];
+	}
+	if (!obc_fusion_normalize(d, 3) || !obc_fusion_normalize(m, 3))
+		return 0;
+	obc_fusion_cross(d, m, e);
+	if (!obc_fusion_normalize(e, 3))
+		return 0;
+	obc_fusion_cross(e, d, n);
+	for (i = 0; i < 3; i++) {
+		r[0][i] = n[i];
+		r[1][i] = e[i];
+		r[2][i] = d[i];
+	}
+	obc_fusion_dcm_to_quat(r, q);
+	return 1;
+}
+
+/* North axis of the estimate in the body frame, the first row of its rotation */
+static inline void obc_fusion_north(const __s64 *q, __s32 *n)
+{
+	n[0] = (__s32)(OBC_FUSION_ONE - 2 * (obc_fusion_mul(q[2], q[2]) + obc_fusion_mul(q[3], q[3])));
+	n[1] = (__s32)(2 * (obc_fusion_mul(q[1], q[2]) - obc_fusion_mul(q[0], q[3])));
+	n[2] = (__s32)(2 * (obc_fusion_mul(q[1], q[3]) + obc_fusion_mul(q[0], q[2])));
+}
+
+/* Gain of the complementary stage for one step of dt_us, Q16 */
+static inline __u32 obc_fusion_gain(__u64 dt_us, __u64 tau_us)
+{
+	return (__u32)((dt_us << 16) / (tau_us + dt_us));
+}
+
+/* q += gain * (meas - q) along the shorter arc, then renormalise */
+static inline void obc_fusion_blend(__s64 *q, const __s64 *meas, __u32 gain_q16)
+{
+	__s64 dot = 0, sign;
+	int i;
+
+	for (i = 0; i < 4; i++)
+		dot += obc_fusion_mul(q[i], meas[i]);
+	sign = dot < 0 ? -1 : 1;
+	for (i = 0; i < 4; i++)
+		q[i] += ((sign * meas[i] - q[i]) * (__s64)gain_q16) >> 16;
+	obc_fusion_normalize(q, 4);
+}
+
+/* atan(2^-i) in microdegrees for the CORDIC below */
+static const __s32 obc_fusion_atan_udeg[] = {
+	45000000, 26565051, 14036243, 7125016, 3576334, 1789911, 895174, 447614,
+	223811, 111906, 55953, 27976, 13988, 6994, 3497, 1749, 874, 437, 219, 109,
+	55, 27, 14, 7
+};
+
+/* atan2(y, x) in millidegrees, CORDIC in vectoring mode */
+static inline __s32 obc_fusion_atan2_mdeg(__s64 y, __s64 x)
+{
+	__s64 angle = 0, t;
+	unsigned int i;
+
+	if (!x && !y)
+		return 0;
+	/* Rotate into the right half plane first */
+	if (x < 0) {
+		angle = y >= 0 ? 180000000 : -180000000;
+		x = -x;
+		y = -y;
+	}
+	/* Scale to about 2^56: enough resolution, headroom for the 1.65 CORDIC gain */
+	while (x > (1LL << 57) || y > (1LL << 57) || y < -(1LL << 57)) {
+		x >>= 1;
+		y >>= 1;
+	}
+	while (x < (1LL << 56) && y < (1LL << 56) && y > -(1LL << 56)) {
+		x <<= 1;
+		y <<= 1;
+	}
+	for (i = 0; i < sizeof(obc_fusion_atan_udeg) / sizeof(obc_fusion_atan_udeg[0]); i++) {
+		if (y > 0) {
+			t = x + (y >> i);
+			y -= x >> i;
+			x = t;
+			angle += obc_fusion_atan_udeg[i];
+		} else {
+			t = x - (y >> i);
+			y += x >> i;
+			x = t;
+			angle -= obc_fusion_atan_udeg[i];
+		}
+	}
+	/* The half-plane flip above was by 180 degrees; wrap into (-180, 180] */
+	if (angle > 180000000)
+		angle -= 360000000;
+	else if (angle <= -180000000)
+		angle += 360000000;
+	return (__s32)(angle / 1000);
+}
+
+/* ZYX Euler angles of a Q30 quaternion: roll, pitch, yaw in millidegrees */
+static inline void obc_fusion_euler(const __s64 *q, __s32 *mdeg)
+{
+	__s64 w = q[0], x = q[1], y = q[2], z = q[3], sp;
+
+	mdeg[0] = obc_fusion_atan2_mdeg(2 * (obc_fusion_mul(w, x) + obc_fusion_mul(y, z)),
+			OBC_FUSION_ONE - 2 * (obc_fusion_mul(x, x) + obc_fusion_mul(y, y)));
+	sp = 2 * (obc_fusion_mul(w, y) - obc_fusion_mul(z, x));
+	if (sp > OBC_FUSION_ONE)
+		sp = OBC_FUSION_ONE;
+	else if (sp < -OBC_FUSION_ONE)
+		sp = -OBC_FUSION_ONE;
+	/* asin(s) = atan2(s, sqrt(1 - s^2)) */
+	mdeg[1] = obc_fusion_atan2_mdeg(sp,
+			(__s64)obc_fusion_isqrt((__u64)(OBC_FUSION_ONE - obc_fusion_mul(sp, sp)) << OBC_FUSION_SHIFT));
+	mdeg[2] = obc_fusion_atan2_mdeg(2 * (obc_fusion_mul(w, z) + obc_fusion_mul(x, y)),
+			OBC_FUSION_ONE - 2 * (obc_fusion_mul(y, y) + obc_fusion_mul(z, z)));
+}
+
+#endif
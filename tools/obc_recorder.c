@@ -0,0 +1,331 @@
+/*
+ * Telemetry recorder: samples the ADXL345, HMC5883L and BMP280 drivers at
+ * fixed rates and appends fixed size records to memory-mapped, preallocated
+ * segment files (see obc_segment.h). Nothing is allocated and nothing is
+ * formatted once a segment is open; the page cache is flushed with
+ * msync(MS_ASYNC) on a fixed period so the flash sees large sequential
+ * writes instead of one write per sample.
+ */
+#define _GNU_SOURCE
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <asm/types.h>
+
+#include "obc_sample.h"
+#include "obc_segment.h"
+#include "../ADXL345/adxl345.h"
+#include "../HMC5883L/hmc5883l_ioctl.h"
+
+#define NSEC_PER_SEC 1000000000ULL
+#define NSEC_PER_MSEC 1000000ULL
+
+struct source {
+	const char *path;
+	int fd;
+	__u16 dev;
+	__u32 seq;
+	__u64 period_ns;
+	__u64 next_ns;
+	int (*read)(struct source *src, struct obc_sample *s);
+};
+
+struct segment {
+	int fd;
+	size_t size;
+	struct obc_segment_header *hdr;
+	struct obc_segment_index *index;
+	struct obc_sample *rec;
+	__u64 synced;		/* records already passed to msync */
+	__u64 last_sync_ns;
+};
+
+static const char *out_dir = ".";
+static size_t segment_size = 4 << 20;
+static __u64 rotate_ns = 600 * NSEC_PER_SEC;
+static __u64 sync_ns = 1000 * NSEC_PER_MSEC;
+static __u32 index_stride = 64;
+static __u32 segment_no;
+static volatile sig_atomic_t stop;
+
+static __u64 now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (__u64)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+static int read_adxl345(struct source *src, struct obc_sample *s)
+{
+	__s16 axis[3];
+	if (ioctl(src->fd, ADXL345_READ, axis) < 0)
+		return -errno;
+	s->v[0] = axis[0];
+	s->v[1] = axis[1];
+	s->v[2] = axis[2];
+	return 0;
+}
+
+static int read_hmc5883l(struct source *src, struct obc_sample *s)
+{
+	__s16 axis[3];
+	if (ioctl(src->fd, HMC5883L_READ, axis) < 0)
+		return -errno;
+	s->v[0] = axis[0];
+	s->v[1] = axis[1];
+	s->v[2] = axis[2];
+	return 0;
+}
+
+/* The BMP280 'raw' attribute holds two decimal numbers: pressure temperature */
+static int read_bmp280(struct source *src, struct obc_sample *s)
+{
+	char buf[32], *p;
+	ssize_t n;
+	n = pread(src->fd, buf, sizeof(buf) - 1, 0);
+	if (n <= 0)
+		return n < 0 ? -errno : -EIO;
+	buf[n] = '\0';
+	s->v[0] = strtol(buf, &p, 10);
+	s->v[1] = strtol(p, NULL, 10);
+	s->v[2] = 0;
+	return 0;
+}
+
+static void segment_sync(struct segment *seg, int flags)
+{
+	long page = sysconf(_SC_PAGESIZE);
+	__u64 from, to;
+
+	from = seg->hdr->record_offset + seg->synced * sizeof(struct obc_sample);
+	to = seg->hdr->record_offset + (__u64)seg->hdr->record_count * sizeof(struct obc_sample);
+	from &= ~(__u64)(page - 1);
+	if (to > from)
+		msync((char *)seg->hdr + from, to - from, flags);
+	/* Header and index are small, always flush them with the records */
+	msync(seg->hdr, seg->hdr->record_offset, flags);
+	seg->synced = seg->hdr->record_count;
+}
+
+static void segment_close(struct segment *seg)
+{
+	__u64 used;
+	if (!seg->hdr)
+		return;
+	seg->hdr->closed = 1;
+	segment_sync(seg, MS_SYNC);
+	used = seg->hdr->record_offset + (__u64)seg->hdr->record_count * sizeof(struct obc_sample);
+	munmap(seg->hdr, seg->size);
+	/* Drop the unused tail so a partially filled segment does not waste flash */
+	if (ftruncate(seg->fd, used) < 0)
+		perror("ftruncate");
+	close(seg->fd);
+	seg->hdr = NULL;
+}
+
+static int segment_open(struct segment *seg, __u32 device_mask)
+{
+	char path[256];
+	__u64 cap, entries, rec_off;
+	long page = sysconf(_SC_PAGESIZE);
+	int err;
+
+	cap = (__u64)(segment_size - OBC_SEGMENT_HEADER_SIZE) * index_stride /
+		(index_stride * sizeof(struct obc_sample) + sizeof(struct obc_segment_index));
+	for (;;) {
+		entries = cap / index_stride + 1;
+		rec_off = OBC_SEGMENT_HEADER_SIZE + entries * sizeof(struct obc_segment_index);
+		rec_off = (rec_off + page - 1) & ~(__u64)(page - 1);
+		if (rec_off + cap * sizeof(struct obc_sample) <= segment_size)
+			break;
+		cap--;
+	}
+
+	snprintf(path, sizeof(path), "%s/obc-%010ld-%06u.seg", out_dir,
+			(long)time(NULL), segment_no);
+	seg->fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (seg->fd < 0) {
+		perror(path);
+		return -errno;
+	}
+	err = posix_fallocate(seg->fd, 0, segment_size);
+	if (err) {
+		fprintf(stderr, "%s: cannot preallocate: %s\n", path, strerror(err));
+		close(seg->fd);
+		return -err;
+	}
+	seg->hdr = mmap(NULL, segment_size, PROT_READ | PROT_WRITE, MAP_SHARED, seg->fd, 0);
+	if (seg->hdr == MAP_FAILED) {
+		perror("mmap");
+		seg->hdr = NULL;
+		close(seg->fd);
+		return -errno;
+	}
+	madvise(seg->hdr, segment_size, MADV_SEQUENTIAL);
+	seg->size = segment_size;
+
+	memset(seg->hdr, 0, sizeof(*seg->hdr));
+	seg->hdr->magic = OBC_SEGMENT_MAGIC;
+	seg->hdr->version = OBC_SEGMENT_VERSION;
+	seg->hdr->record_size = sizeof(struct obc_sample);
+	seg->hdr->segment_no = segment_no++;
+	seg->hdr->index_stride = index_stride;
+	seg->hdr->index_capacity = entries;
+	seg->hdr->record_capacity = cap;
+	seg->hdr->index_offset = OBC_SEGMENT_HEADER_SIZE;
+	seg->hdr->record_offset = rec_off;
+	seg->hdr->device_mask = device_mask;
+	seg->index = (struct obc_segment_index *)((char *)seg->hdr + seg->hdr->index_offset);
+	seg->rec = (struct obc_sample *)((char *)seg->hdr + rec_off);
+	seg->synced = 0;
+	seg->last_sync_ns = now_ns();
+	return 0;
+}
+
+/* Hot path: one record copy into the mapping and, every stride, one index entry */
+static void segment_append(struct segment *seg, const struct obc_sample *s)
+{
+	struct obc_segment_header *hdr = seg->hdr;
+	__u32 n = hdr->record_count;
+
+	if (n % hdr->index_stride == 0) {
+		seg->index[hdr->index_count].t_ns = s->t_ns;
+		seg->index[hdr->index_count].record = n;
+		hdr->index_count++;
+	}
+	seg->rec[n] = *s;
+	if (!n)
+		hdr->t_start_ns = s->t_ns;
+	hdr->t_end_ns = s->t_ns;
+	hdr->record_count = n + 1;
+}
+
+static int segment_full(const struct segment *seg, __u64 now)
+{
+	return seg->hdr->record_count >= seg->hdr->record_capacity ||
+		(seg->hdr->record_count && now - seg->hdr->t_start_ns >= rotate_ns);
+}
+
+static void on_signal(int sig)
+{
+	stop = 1;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [-o dir] [-s segment_bytes] [-r rotate_s] [-m msync_ms]\n"
+		"          [-i index_stride] [-a adxl345_hz] [-g hmc5883l_hz] [-b bmp280_hz]\n"
+		"          [-B bmp280_raw_attr]\n", prog);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	struct source src[] = {
+		{ "/dev/adxl345", -1, OBC_DEV_ADXL345, 0, NSEC_PER_SEC / 100, 0, read_adxl345 },
+		{ "/dev/hmc5883l-i2c", -1, OBC_DEV_HMC5883L, 0, NSEC_PER_SEC / 15, 0, read_hmc5883l },
+		{ "/sys/bus/spi/drivers/bmp280/spi1.0/raw", -1, OBC_DEV_BMP280, 0, NSEC_PER_SEC, 0, read_bmp280 },
+	};
+	const int nsrc = sizeof(src) / sizeof(src[0]);
+	struct segment seg = { .fd = -1 };
+	struct obc_sample s;
+	__u32 device_mask = 0;
+	unsigned long hz;
+	int opt, i;
+
+	while ((opt = getopt(argc, argv, "o:s:r:m:i:a:g:b:B:")) != -1) {
+		switch (opt) {
+		case 'o': out_dir = optarg; break;
+		case 's': segment_size = strtoul(optarg, NULL, 0); break;
+		case 'r': rotate_ns = strtoull(optarg, NULL, 0) * NSEC_PER_SEC; break;
+		case 'm': sync_ns = strtoull(optarg, NULL, 0) * NSEC_PER_MSEC; break;
+		case 'i': index_stride = strtoul(optarg, NULL, 0); break;
+		case 'a':
+		case 'g':
+		case 'b':
+			hz = strtoul(optarg, NULL, 0);
+			i = opt == 'a' ? 0 : opt == 'g' ? 1 : 2;
+			src[i].period_ns = hz ? NSEC_PER_SEC / hz : 0;
+			break;
+		case 'B': src[2].path = optarg; break;
+		default: usage(argv[0]);
+		}
+	}
+	if (!index_stride || segment_size < 2 * OBC_SEGMENT_HEADER_SIZE)
+		usage(argv[0]);
+
+	for (i = 0; i < nsrc; i++) {
+		if (!src[i].period_ns)
+			continue;
+		src[i].fd = open(src[i].path, src[i].dev == OBC_DEV_BMP280 ? O_RDONLY : O_RDWR);
+		if (src[i].fd < 0) {
+			fprintf(stderr, "%s: %s, not recorded\n", src[i].path, strerror(errno));
+			continue;
+		}
+		device_mask |= 1 << src[i].dev;
+	}
+	if (!device_mask) {
+		fprintf(stderr, "no sensor available\n");
+		return 1;
+	}
+
+	signal(SIGINT, on_signal);
+	signal(SIGTERM, on_signal);
+	if (segment_open(&seg, device_mask))
+		return 1;
+
+	for (i = 0; i < nsrc; i++)
+		src[i].next_ns = now_ns();
+
+	while (!stop) {
+		struct source *next = NULL;
+		struct timespec ts;
+		__u64 now;
+
+		for (i = 0; i < nsrc; i++)
+			if (src[i].fd >= 0 && (!next || src[i].next_ns < next->next_ns))
+				next = &src[i];
+		ts.tv_sec = next->next_ns / NSEC_PER_SEC;
+		ts.tv_nsec = next->next_ns % NSEC_PER_SEC;
+		if (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL))
+			continue;
+
+		memset(&s, 0, sizeof(s));
+		s.t_ns = now_ns();
+		s.dev = next->dev;
+		s.seq = next->seq++;
+		/* Absolute deadlines keep the rate exact; skip missed slots instead of bursting */
+		next->next_ns += next->period_ns;
+		if (next->next_ns < s.t_ns)
+			next->next_ns = s.t_ns + next->period_ns;
+		if (next->read(next, &s))
+			continue;
+
+		now = s.t_ns;
+		if (segment_full(&seg, now)) {
+			segment_close(&seg);
+			if (segment_open(&seg, device_mask))
+				return 1;
+		}
+		segment_append(&seg, &s);
+		if (now - seg.last_sync_ns >= sync_ns) {
+			segment_sync(&seg, MS_ASYNC);
+			seg.last_sync_ns = now;
+		}
+	}
+
+	segment_close(&seg);
+	for (i = 0; i < nsrc; i++)
+		if (src[i].fd >= 0)
+			close(src[i].fd);
+	return 0;
+}
@@ -0,0 +1,45 @@
+/* Read-only mapping of recorder segment files for the offline tools */
+#ifndef OBC_SEGMENT_MAP_H
+#define OBC_SEGMENT_MAP_H
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdio.h>
+
+#include "obc_segment.h"
+
+/* Returns the mapped header or NULL; *size receives the mapping length */
+static inline const struct obc_segment_header *obc_segment_map(const char *path, size_t *size)
+{
+	const struct obc_segment_header *hdr;
+	struct stat st;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0 || fstat(fd, &st) < 0) {
+		perror(path);
+		if (fd >= 0)
+			close(fd);
+		return NULL;
+	}
+	hdr = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (hdr == MAP_FAILED) {
+		perror(path);
+		return NULL;
+	}
+	if ((size_t)st.st_size < sizeof(*hdr) || hdr->magic != OBC_SEGMENT_MAGIC ||
+	    hdr->version != OBC_SEGMENT_VERSION ||
+	    hdr->record_size != sizeof(struct obc_sample) ||
+	    hdr->record_offset + (__u64)hdr->record_count * hdr->record_size > (__u64)st.st_size) {
+		fprintf(stderr, "%s: not a valid segment\n", path);
+		munmap((void *)hdr, st.st_size);
+		return NULL;
+	}
+	*size = st.st_size;
+	return hdr;
+}
+
+#endif
@@ -0,0 +1,475 @@
+/*
+ * Raw bus trace recorder and replay (see obc_trace.h).
+ *
+ *   obc_trace record FILE [-t seconds]
+ *   obc_trace replay FILE [-s speed] [-l loops] [-o samples]
+ *
+ * record enables tracing in obc_core and writes the records to FILE until
+ * interrupted or for the given time.
+ *
+ * replay feeds the data reads of a trace through the stages a sample
+ * takes in the drivers: decode with the layout logged in the trace, the
+ * correction with the calibration logged in it (the HMC5883L ring filter
+ * per gain, the BMP280 compensation to Pa and 0.01 degC) and the block
+ * encoding of the ring's compressed read path. Devices without
+ * calibration in the trace pass uncorrected, as in the driver; traces of
+ * format 1 carry none. Speed 1 keeps the recorded timing, larger
+ * values replay faster and 0 as fast as possible. The time per sample of
+ * each stage and a hash of the samples produced are printed, so two
+ * builds can be compared on the same input on any host; -o writes the
+ * samples of the first pass as struct obc_sample records.
+ */
+#define _GNU_SOURCE
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <asm/types.h>
+
+#include "obc_sample.h"
+#include "obc_trace.h"
+#include "obc_desc.h"
+#include "obc_magcal.h"
+#include "obc_baro.h"
+#include "obc_delta.h"
+#include "../ADXL345/adxl345.h"
+
+#define NSEC_PER_SEC 1000000000ULL
+#define TRACE_ENABLE "/sys/devices/obc/trace_enable"
+#define TRACE_DATA "/sys/devices/obc/trace"
+#define POLL_NS 20000000ULL
+
+/* From hmc5883l.h, which is kernel only */
+#define HMC5883L_CONFIG_REG_B 0x01
+#define HMC5883L_GAIN_OFFSET 5
+#define HMC5883L_GAIN_MASK 0x7
+#define HMC5883L_GAINS 8
+
+/* Most samples one record can hold, a full FIFO drain */
+#define MAX_BLOCK (OBC_TRACE_MAX_DATA / 2)
+
+static const char *dev_name[OBC_DEV_MAX] = { "none", "adxl345", "hmc5883l", "bmp280" };
+
+static volatile sig_atomic_t stop;
+
+struct replay_dev {
+	struct obc_layout layout;
+	int have_layout;
+	__u8 shadow[256];	/* last value written to each register */
+	__s32 last[3];		/* last good values, repeated by stale samples */
+	__u64 last_t_ns;
+	__u32 seq;
+	int gap;		/* records were lost before the next sample */
+	struct obc_delta_enc enc;
+	struct obc_magcal cal[HMC5883L_GAINS];	/* HMC5883L, per gain code */
+	__u8 cal_valid;				/* bit per gain */
+	struct bmp280_calib baro;		/* BMP280 */
+	int have_baro;
+	__u64 samples;
+	__u64 stale;
+	__u64 encoded;		/* bytes */
+};
+
+struct stage_time {
+	__u64 decode;
+	__u64 filter;
+	__u64 encode;
+};
+
+static __u64 now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (__u64)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+static void on_signal(int sig)
+{
+	stop = 1;
+}
+
+static int write_enable(const char *val)
+{
+	int fd = open(TRACE_ENABLE, O_WRONLY);
+	int ok;
+	if (fd < 0)
+		return -errno;
+	ok = write(fd, val, strlen(val)) == (ssize_t)strlen(val);
+	close(fd);
+	return ok ? 0 : -EIO;
+}
+
+/* Copies whatever the kernel holds into out; returns bytes or -errno */
+static ssize_t drain(int in, int out)
+{
+	static __u8 buf[64 * 1024];
+	ssize_t n, total = 0;
+	/* Every read consumes records, the offset is always 0 */
+	while ((n = pread(in, buf, sizeof(buf), 0)) > 0) {
+		if (write(out, buf, n) != n)
+			return -errno;
+		total += n;
+	}
+	return n < 0 ? -errno : total;
+}
+
+static int record(const char *path, double seconds)
+{
+	struct obc_trace_file_header hdr = {
+		.magic = OBC_TRACE_FILE_MAGIC,
+		.version = OBC_TRACE_FILE_VERSION,
+		.rec_size = sizeof(struct obc_trace_rec),
+	};
+	struct timespec poll = { 0, POLL_NS };
+	__u64 end = seconds > 0 ? now_ns() + (__u64)(seconds * NSEC_PER_SEC) : 0;
+	__u64 bytes = 0;
+	ssize_t n;
+	int in, out, err;
+
+	out = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (out < 0) {
+		perror(path);
+		return 1;
+	}
+	if (write(out, &hdr, sizeof(hdr)) != sizeof(hdr)) {
+		perror(path);
+		return 1;
+	}
+	in = open(TRACE_DATA, O_RDONLY);
+	if (in < 0 || (err = write_enable("1")) < 0) {
+		fprintf(stderr, "cannot enable the trace: %s\n", strerror(in < 0 ? errno : -err));
+		return 1;
+	}
+	signal(SIGINT, on_signal);
+	signal(SIGTERM, on_signal);
+	while (!stop && (!end || now_ns() < end)) {
+		n = drain(in, out);
+		if (n < 0)
+			break;
+		bytes += n;
+		nanosleep(&poll, NULL);
+	}
+	write_enable("0");
+	n = drain(in, out);
+	if (n > 0)
+		bytes += n;
+	close(in);
+	close(out);
+	printf("%llu bytes of trace in %s\n", (unsigned long long)bytes, path);
+	return n < 0;
+}
+
+static __u16 range_flags(int dev, const struct replay_dev *d)
+{
+	unsigned int code = 0;
+	if (dev == OBC_DEV_ADXL345)
+		code = d->shadow[DATA_FORMAT] & RANGE_CODE_MASK;
+	else if (dev == OBC_DEV_HMC5883L)
+		code = (d->shadow[HMC5883L_CONFIG_REG_B] >> HMC5883L_GAIN_OFFSET) & HMC5883L_GAIN_MASK;
+	return code << OBC_SAMPLE_RANGE_SHIFT;
+}
+
+static __u64 fnv1a(__u64 h, const void *p, size_t len)
+{
+	const __u8 *b = p;
+	while (len--)
+		h = (h ^ *b++) * 0x100000001b3ULL;
+	return h;
+}
+
+/*
+ * Turns one data read into samples the way the driver's capture does:
+ * the newest stamped with the transfer time, the others of a FIFO block
+ * spread evenly back to the previous capture. Returns the sample count.
+ */
+static unsigned int decode(struct replay_dev *d, const struct obc_trace_rec *r,
+		const __u8 *data, struct obc_sample *s)
+{
+	unsigned int n, i, k;
+	__u16 flags = range_flags(r->dev, d);
+	__u64 step;
+
+	if (r->status < 0) {
+		n = 1;
+		flags |= OBC_SAMPLE_STALE;
+		memcpy(s[0].v, d->last, sizeof(s[0].v));
+		d->stale++;
+	} else {
+		n = r->len / d->layout.len;
+		obc_layout_decode_block(&d->layout, data, s, n);
+		for (i = 0; i < n; i++)
+			for (k = d->layout.channels; k < 3; k++)
+				s[i].v[k] = 0;
+		if (n)
+			memcpy(d->last, s[n - 1].v, sizeof(d->last));
+	}
+	step = n > 1 && d->last_t_ns && r->t_ns > d->last_t_ns ? (r->t_ns - d->last_t_ns) / n : 0;
+	for (i = 0; i < n; i++) {
+		s[i].t_ns = r->t_ns - (n - 1 - i) * step;
+		s[i].seq = d->seq++;
+		s[i].dev = r->dev;
+		s[i].flags = flags;
+		s[i].set = 0;
+	}
+	if (n && d->gap) {
+		s[0].flags |= OBC_SAMPLE_GAP;
+		d->gap = 0;
+	}
+	d->last_t_ns = r->t_ns;
+	return n;
+}
+
+/*
+ * Takes a calibration block the driver logged, or the BMP280's own read
+ * of its trimming parameters when the trace started before its probe.
+ */
+static void take_calib(int dev, struct replay_dev *d, const struct obc_trace_rec *r,
+		const __u8 *data)
+{
+	if (dev == OBC_DEV_HMC5883L && r->reg < HMC5883L_GAINS) {
+		if (r->len >= sizeof(d->cal[0])) {
+			memcpy(&d->cal[r->reg], data, sizeof(d->cal[0]));
+			d->cal_valid |= 1 << r->reg;
+		} else {
+			d->cal_valid &= ~(1 << r->reg);
+		}
+	} else if (dev == OBC_DEV_BMP280 && r->reg == BMP280_CALIB_START &&
+			r->status >= 0 && r->len >= BMP280_CALIB_LEN) {
+		bmp280_calib_parse(&d->baro, data);
+		d->have_baro = 1;
+	}
+}
+
+/*
+ * The correction each driver applies before samples reach a reader: the
+ * HMC5883L ring filter in runs of one gain, uncalibrated gains untouched,
+ * and the BMP280 compensation of its compensated attribute.
+ */
+static void correct(int dev, const struct replay_dev *d, struct obc_sample *s, unsigned int n)
+{
+	unsigned int i, j, gain;
+	__s32 t_fine;
+
+	if (dev == OBC_DEV_HMC5883L) {
+		for (i = 0; i < n; i = j) {
+			gain = OBC_SAMPLE_RANGE(s[i].flags);
+			for (j = i + 1; j < n && OBC_SAMPLE_RANGE(s[j].flags) == gain; j++)
+				;
+			if (gain < HMC5883L_GAINS && (d->cal_valid & (1 << gain)))
+				obc_magcal_apply(&d->cal[gain], s + i, j - i);
+		}
+	} else if (dev == OBC_DEV_BMP280 && d->have_baro) {
+		for (i = 0; i < n; i++) {
+			s[i].v[1] = bmp280_compensate_t(&d->baro, s[i].v[1], &t_fine);
+			s[i].v[0] = (bmp280_compensate_p(&d->baro, s[i].v[0], t_fine) + 128) >> 8;
+			s[i].flags |= OBC_SAMPLE_CALIBRATED;
+		}
+	}
+}
+
+static int replay_pass(const __u8 *buf, size_t len, double speed, FILE *out, __u64 *hash,
+		struct replay_dev *devs, struct stage_time *st, __u64 *late)
+{
+	static struct obc_sample s[MAX_BLOCK];
+	static __u8 chunk[MAX_BLOCK * OBC_DELTA_MAX_BLOCK_SAMPLE_BYTES];
+	const struct obc_trace_rec *r;
+	__u64 t0 = 0, start = now_ns(), t, due;
+	__u32 next_seq = 0;
+	size_t off = 0, size;
+	unsigned int n, i;
+	struct replay_dev *d;
+
+	for (i = 0; i < OBC_DEV_MAX; i++) {
+		memset(&devs[i], 0, sizeof(devs[i]));
+		obc_delta_enc_init(&devs[i].enc, OBC_DELTA_DEFAULT_KEY_INTERVAL);
+	}
+	while (off + sizeof(*r) <= len && !stop) {
+		r = (const struct obc_trace_rec *)(buf + off);
+		size = OBC_TRACE_REC_SIZE(r->len);
+		if (off + size > len || r->len > OBC_TRACE_MAX_DATA)
+			break;
+		off += size;
+		if (r->dev >= OBC_DEV_MAX)
+			continue;
+		d = &devs[r->dev];
+		/* Records dropped by a full kernel buffer: every device may have lost samples */
+		if (r->seq != next_seq)
+			for (i = 0; i < OBC_DEV_MAX; i++)
+				devs[i].gap = 1;
+		next_seq = r->seq + 1;
+
+		if (r->flags & OBC_TRACE_LAYOUT) {
+			if (r->len >= sizeof(d->layout)) {
+				memcpy(&d->layout, r + 1, sizeof(d->layout));
+				d->have_layout = d->layout.len && d->layout.channels <= 3;
+			}
+			continue;
+		}
+		if (r->flags & OBC_TRACE_CALIB) {
+			take_calib(r->dev, d, r, (const __u8 *)(r + 1));
+			continue;
+		}
+		if (r->flags & OBC_TRACE_WRITE) {
+			for (i = 0; i < r->len && r->reg + i < sizeof(d->shadow); i++)
+				d->shadow[r->reg + i] = ((const __u8 *)(r + 1))[i];
+			continue;
+		}
+		if (r->reg == BMP280_CALIB_START)
+			take_calib(r->dev, d, r, (const __u8 *)(r + 1));
+		if (!d->have_layout || r->reg != d->layout.reg || r->len % d->layout.len)
+			continue;
+
+		if (speed > 0) {
+			if (!t0)
+				t0 = r->t_ns;
+			due = start + (__u64)((r->t_ns - t0) / speed);
+			if (now_ns() < due) {
+				struct timespec ts = { due / NSEC_PER_SEC, due % NSEC_PER_SEC };
+				clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+			} else if (now_ns() - due > 1000000) {
+				(*late)++;
+			}
+		}
+
+		t = now_ns();
+		n = decode(d, r, (const __u8 *)(r + 1), s);
+		st->decode += now_ns() - t;
+		if (!n)
+			continue;
+
+		t = now_ns();
+		correct(r->dev, d, s, n);
+		st->filter += now_ns() - t;
+
+		t = now_ns();
+		d->encoded += obc_delta_encode_block(&d->enc, s, n, chunk);
+		st->encode += now_ns() - t;
+
+		d->samples += n;
+		if (hash)
+			*hash = fnv1a(*hash, s, n * sizeof(s[0]));
+		if (out && fwrite(s, sizeof(s[0]), n, out) != n)
+			return -errno;
+	}
+	return 0;
+}
+
+static int replay(const char *path, double speed, unsigned int loops, const char *out_path)
+{
+	struct replay_dev devs[OBC_DEV_MAX];
+	struct stage_time st = { 0, 0, 0 };
+	const struct obc_trace_file_header *hdr;
+	__u64 hash = 0xcbf29ce484222325ULL, samples = 0, late = 0, t;
+	FILE *out = NULL;
+	struct stat sb;
+	__u8 *buf;
+	unsigned int pass, i;
+	int fd, err = 0;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0 || fstat(fd, &sb) < 0) {
+		perror(path);
+		return 1;
+	}
+	buf = malloc(sb.st_size + 1);
+	if (!buf || read(fd, buf, sb.st_size) != sb.st_size) {
+		perror(path);
+		return 1;
+	}
+	close(fd);
+	hdr = (const struct obc_trace_file_header *)buf;
+	if (sb.st_size < (off_t)sizeof(*hdr) || hdr->magic != OBC_TRACE_FILE_MAGIC ||
+			!hdr->version || hdr->version > OBC_TRACE_FILE_VERSION ||
+			hdr->rec_size != sizeof(struct obc_trace_rec)) {
+		fprintf(stderr, "%s: not a trace of this format\n", path);
+		return 1;
+	}
+	if (out_path && !(out = fopen(out_path, "wb"))) {
+		perror(out_path);
+		return 1;
+	}
+	signal(SIGINT, on_signal);
+
+	t = now_ns();
+	for (pass = 0; pass < loops && !stop && !err; pass++) {
+		err = replay_pass(buf + sizeof(*hdr), sb.st_size - sizeof(*hdr), speed,
+				pass ? NULL : out, pass ? NULL : &hash, devs, &st, &late);
+		for (i = 0; i < OBC_DEV_MAX; i++)
+			samples += devs[i].samples;
+	}
+	t = now_ns() - t;
+	if (out)
+		fclose(out);
+	if (err) {
+		fprintf(stderr, "writing %s: %s\n", out_path, strerror(-err));
+		return 1;
+	}
+
+	for (i = 1; i < OBC_DEV_MAX; i++)
+		if (devs[i].samples)
+			printf("%-9s %10llu samples %6llu stale %8llu bytes encoded\n", dev_name[i],
+					(unsigned long long)devs[i].samples,
+					(unsigned long long)devs[i].stale,
+					(unsigned long long)devs[i].encoded);
+	if (!samples) {
+		printf("no data reads in the trace\n");
+		return 0;
+	}
+	printf("ns/sample: decode %.1f filter %.1f encode %.1f\n",
+			(double)st.decode / samples, (double)st.filter / samples,
+			(double)st.encode / samples);
+	printf("%llu samples in %.3f s over %u pass(es)", (unsigned long long)samples,
+			(double)t / NSEC_PER_SEC, pass);
+	if (speed > 0)
+		printf(", %llu more than 1 ms late", (unsigned long long)late);
+	printf("\nhash %016llx\n", (unsigned long long)hash);
+	return 0;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s record FILE [-t seconds]\n"
+			"       %s replay FILE [-s speed] [-l loops] [-o samples]\n", prog, prog);
+	exit(2);
+}
+
+int main(int argc, char **argv)
+{
+	double seconds = 0, speed = 1;
+	unsigned int loops = 1;
+	const char *out = NULL;
+	int opt;
+
+	if (argc < 3)
+		usage(argv[0]);
+	optind = 3;
+	while ((opt = getopt(argc, argv, "t:s:l:o:")) != -1) {
+		switch (opt) {
+		case 't':
+			seconds = atof(optarg);
+			break;
+		case 's':
+			speed = atof(optarg);
+			break;
+		case 'l':
+			loops = atoi(optarg);
+			break;
+		case 'o':
+			out = optarg;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (!strcmp(argv[1], "record"))
+		return record(argv[2], seconds);
+	if (!strcmp(argv[1], "replay"))
+		return replay(argv[2], speed, loops ? loops : 1, out);
+	usage(argv[0]);
+	return 2;
+}
@@ -0,0 +1,350 @@
+/*
+ * Vibration spectrum analysis over the ADXL345 stream.
+ *
+ * Samples are cut into consecutive windows of n samples per axis. Each
+ * window has its mean removed, is Hann weighted and goes through the
+ * fixed-point FFT of obc_fft.h; x and y share one complex transform and
+ * are separated afterwards, so three axes cost two FFTs. Power per bin is
+ * summed over the windows of one report period. Every period one line per
+ * axis is printed with the measured sample rate, the RMS acceleration,
+ * the strongest spectral peaks and the averaged one-sided PSD reduced to
+ * a few linear bands, which is small enough to downlink instead of the
+ * raw stream.
+ *
+ * A window is restarted on a gap, a stale sample or a range change, so
+ * every window is contiguous and has one scale.
+ *
+ * -B runs the FFT benchmark instead: CPU time per transform for each size
+ * and the share of one core the analysis needs at the given sample rate.
+ */
+#define _GNU_SOURCE
+#include <unistd.h>
+#include <errno.h>
+#include <getopt.h>
+#include <math.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "obc_sample.h"
+#include "obcsensors.h"
+#include "obc_fft.h"
+
+#define NSEC_PER_SEC 1000000000ULL
+#define BATCH 64
+#define AXES 3
+/*
+ * Counts, 13 bits at most, are moved up before the window so the FFT
+ * keeps fractional bits; x + iy stays well below the FFT's 2^28 limit.
+ */
+#define IN_SHIFT 12
+/* Bin power is accumulated this much smaller to leave room for many windows */
+#define PSD_SHIFT 16
+#define MAX_PEAKS 8
+#define MAX_BANDS 64
+
+static unsigned int log2n = 10;
+static unsigned int rate_hz = 3200;
+static unsigned int report_s = 10;
+static unsigned int nbands = 16;
+static unsigned int npeaks = 3;
+static volatile sig_atomic_t stop;
+
+static struct obc_fft fft;
+static __s16 win[AXES][1 << OBC_FFT_MAX_LOG2];
+static __s32 re[2][1 << OBC_FFT_MAX_LOG2], im[2][1 << OBC_FFT_MAX_LOG2];
+static unsigned int fill;
+static __u64 win_t0;
+static __u32 win_scale;
+
+/* Report period accumulators */
+static __u64 psd[AXES][(1 << (OBC_FFT_MAX_LOG2 - 1)) + 1];
+static double sumsq[AXES];
+static unsigned int windows;
+static __u64 window_ns;
+static __u32 scale_ug;
+
+static __u64 now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (__u64)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+static __u64 cpu_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+	return (__u64)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+static void on_signal(int sig)
+{
+	(void)sig;
+	stop = 1;
+}
+
+/* Mean removed, windowed and scaled into the FFT input */
+static void load(__s32 *dst, const __s16 *src, unsigned int axis)
+{
+	__s64 sum = 0;
+	__s32 mean, v;
+	unsigned int k;
+
+	for (k = 0; k < fft.n; k++)
+		sum += src[k];
+	mean = (__s32)(sum / (__s64)fft.n);
+	for (k = 0; k < fft.n; k++) {
+		v = src[k] - mean;
+		sumsq[axis] += (double)v * v;
+		dst[k] = (__s32)(((__s64)(v << IN_SHIFT) * fft.window[k]) >> OBC_FFT_WIN_SHIFT);
+	}
+}
+
+/*
+ * Power of a real signal packed as the real part (sign 1) or imaginary
+ * part (sign -1) of Z: X[k] = (Z[k] + conj Z[n-k]) / 2 and
+ * Y[k] = (Z[k] - conj Z[n-k]) / 2i.
+ */
+static void accumulate(__u64 *acc, const __s32 *zr, const __s32 *zi, int sign)
+{
+	unsigned int k, m, n = fft.n;
+	__s64 r, i;
+
+	for (k = 0; k <= n / 2; k++) {
+		m = (n - k) & (n - 1);
+		r = (__s64)zr[k] + sign * (__s64)zr[m];
+		i = (__s64)zi[k] - sign * (__s64)zi[m];
+		acc[k] += (__u64)(r * r + i * i) >> (PSD_SHIFT + 2);
+	}
+}
+
+static void analyse(void)
+{
+	unsigned int k;
+
+	load(re[0], win[0], 0);
+	load(im[0], win[1], 1);
+	load(re[1], win[2], 2);
+	for (k = 0; k < fft.n; k++)
+		im[1][k] = 0;
+	obc_fft_run(&fft, re[0], im[0]);
+	obc_fft_run(&fft, re[1], im[1]);
+	accumulate(psd[0], re[0], im[0], 1);
+	accumulate(psd[1], re[0], im[0], -1);
+	accumulate(psd[2], re[1], im[1], 1);
+	windows++;
+}
+
+static void reset_report(void)
+{
+	memset(psd, 0, sizeof(psd));
+	memset(sumsq, 0, sizeof(sumsq));
+	windows = 0;
+	window_ns = 0;
+}
+
+/*
+ * One line per axis: rate, RMS in mg, peaks as frequency:PSD and the
+ * mean PSD of each band, PSD in g^2/Hz.
+ */
+static void report(__u64 t_ns)
+{
+	static const char axis_name[AXES] = { 'x', 'y', 'z' };
+	unsigned int half = fft.n / 2, per_band, a, k, b, p;
+	unsigned int peak[MAX_PEAKS];
+	double fs, g, to_psd, band;
+	unsigned int bins;
+
+	if (!windows)
+		return;
+	fs = (double)windows * (fft.n - 1) * NSEC_PER_SEC / window_ns;
+	g = scale_ug * 1e-6;
+	/* Undo the /n of the FFT and the input shift, one-sided PSD */
+	to_psd = 2.0 * fft.n * fft.n * ldexp(1.0, PSD_SHIFT - 2 * IN_SHIFT) * g * g /
+		(windows * fs * fft.window_power);
+	per_band = (half + nbands - 1) / nbands;
+
+	for (a = 0; a < AXES; a++) {
+		printf("vib %llu %c fs=%.1f win=%u n=%u rms_mg=%.3f peaks=",
+		       (unsigned long long)(t_ns / 1000000), axis_name[a], fs, fft.n, windows,
+		       sqrt(sumsq[a] / ((double)windows * fft.n)) * g * 1000);
+		/* Local maxima, strongest first; DC and Nyquist left out */
+		for (p = 0; p < npeaks; p++) {
+			peak[p] = 0;
+			for (k = 2; k < half; k++) {
+				if (psd[a][k] < psd[a][k - 1] || psd[a][k] < psd[a][k + 1])
+					continue;
+				for (b = 0; b < p && peak[b] != k; b++)
+					;
+				if (b == p && (!peak[p] || psd[a][k] > psd[a][peak[p]]))
+					peak[p] = k;
+			}
+			if (!peak[p])
+				break;
+			printf("%s%.1f:%.3e", p ? "," : "", peak[p] * fs / fft.n, psd[a][peak[p]] * to_psd);
+		}
+		printf(" psd=");
+		for (b = 0; b * per_band < half; b++) {
+			band = 0;
+			bins = 0;
+			for (k = b * per_band + 1; k <= (b + 1) * per_band && k < half; k++, bins++)
+				band += psd[a][k];
+			printf("%s%.3e", b ? "," : "", bins ? band * to_psd / bins : 0);
+		}
+		printf("\n");
+	}
+	fflush(stdout);
+}
+
+static void push(const struct obcs_accel *s)
+{
+	if (s->flags & (OBC_SAMPLE_GAP | OBC_SAMPLE_STALE) || (fill && s->scale_ug != win_scale))
+		fill = 0;
+	if (s->flags & OBC_SAMPLE_STALE)
+		return;
+	if (!fill) {
+		win_t0 = s->t_ns;
+		win_scale = s->scale_ug;
+	}
+	win[0][fill] = s->x;
+	win[1][fill] = s->y;
+	win[2][fill] = s->z;
+	if (++fill < fft.n)
+		return;
+	fill = 0;
+	/* A report covers one scale; a range change starts a new one */
+	if (windows && win_scale != scale_ug)
+		reset_report();
+	scale_ug = win_scale;
+	window_ns += s->t_ns - win_t0;
+	analyse();
+}
+
+/* CPU time per FFT size, and the load at rate_hz for three axes in two transforms */
+static int bench(void)
+{
+	unsigned int l, k, iters;
+	__u64 t0, t;
+
+	printf("%6s %10s %8s\n", "n", "us/fft", "cpu%");
+	for (l = OBC_FFT_MIN_LOG2 + 2; l <= OBC_FFT_MAX_LOG2; l++) {
+		if (obc_fft_init(&fft, l) < 0)
+			return 1;
+		srand(l);
+		for (k = 0; k < fft.n; k++) {
+			re[0][k] = (rand() % 8192 - 4096) << IN_SHIFT;
+			im[0][k] = (rand() % 8192 - 4096) << IN_SHIFT;
+		}
+		iters = 0;
+		t0 = cpu_ns();
+		do {
+			obc_fft_run(&fft, re[0], im[0]);
+			iters++;
+			t = cpu_ns() - t0;
+		} while (t < NSEC_PER_SEC / 4);
+		printf("%6u %10.2f %8.3f\n", fft.n, t / 1000.0 / iters,
+		       100.0 * 2 * rate_hz / fft.n * t / iters / NSEC_PER_SEC);
+		obc_fft_free(&fft);
+	}
+	return 0;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [-n fft_size] [-r rate_hz] [-c report_s] [-b bands] [-p peaks] [-B]\n"
+		"  -n  samples per window, power of two from %u to %u (default 1024)\n"
+		"  -r  accelerometer rate asked for (default 3200 Hz)\n"
+		"  -c  report period (default 10 s)\n"
+		"  -b  PSD bands per report (default 16)\n"
+		"  -p  peaks per report (default 3)\n"
+		"  -B  benchmark the FFT sizes and exit\n",
+		prog, 1 << OBC_FFT_MIN_LOG2, 1 << OBC_FFT_MAX_LOG2);
+}
+
+int main(int argc, char **argv)
+{
+	struct obcs_accel buf[BATCH];
+	struct obcs_dev *accel;
+	__u64 next_report;
+	unsigned int n_opt = 1024;
+	int opt, bench_only = 0, n, i, err;
+
+	while ((opt = getopt(argc, argv, "n:r:c:b:p:Bh")) != -1) {
+		switch (opt) {
+		case 'n':
+			n_opt = strtoul(optarg, NULL, 0);
+			break;
+		case 'r':
+			rate_hz = strtoul(optarg, NULL, 0);
+			break;
+		case 'c':
+			report_s = strtoul(optarg, NULL, 0);
+			break;
+		case 'b':
+			nbands = strtoul(optarg, NULL, 0);
+			break;
+		case 'p':
+			npeaks = strtoul(optarg, NULL, 0);
+			break;
+		case 'B':
+			bench_only = 1;
+			break;
+		default:
+			usage(argv[0]);
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+	for (log2n = 0; (1U << log2n) < n_opt; log2n++)
+		;
+	if ((1U << log2n) != n_opt || !rate_hz || !report_s ||
+	    !nbands || nbands > MAX_BANDS || npeaks > MAX_PEAKS) {
+		usage(argv[0]);
+		return 1;
+	}
+	if (bench_only)
+		return bench();
+	if (obc_fft_init(&fft, log2n) < 0) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	accel = obcs_open(OBCS_ADXL345, OBCS_PATH_AUTO);
+	if (!accel) {
+		perror("adxl345");
+		return 1;
+	}
+	err = obcs_set_rate(accel, rate_hz);
+	if (err < 0)
+		fprintf(stderr, "obc_vibe: cannot ask for %u Hz: %s\n", rate_hz, strerror(-err));
+
+	signal(SIGINT, on_signal);
+	signal(SIGTERM, on_signal);
+	fprintf(stderr, "obc_vibe: adxl345 via %s, %u point windows, report every %u s\n",
+		obcs_path_name(obcs_path(accel)), fft.n, report_s);
+
+	reset_report();
+	next_report = now_ns() + report_s * NSEC_PER_SEC;
+	while (!stop) {
+		err = obcs_wait(accel, 1000);
+		if (err < 0 && err != -EINTR) {
+			fprintf(stderr, "obc_vibe: %s\n", strerror(-err));
+			break;
+		}
+		while ((n = obcs_read_accel(accel, buf, BATCH)) > 0)
+			for (i = 0; i < n; i++)
+				push(&buf[i]);
+		if (now_ns() >= next_report) {
+			report(now_ns());
+			reset_report();
+			next_report += report_s * NSEC_PER_SEC;
+		}
+	}
+
+	obcs_close(accel);
+	obc_fft_free(&fft);
+	return 0;
+}
@@ -0,0 +1,671 @@
+/* libobcsensors, see obcsensors.h */
+#define _GNU_SOURCE
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/timerfd.h>
+#include <fcntl.h>
+#include <glob.h>
+#include <poll.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "obcsensors.h"
+#include "obc_delta.h"
+#include "obc_magcal.h"
+#include "../ADXL345/adxl345.h"
+#include "../HMC5883L/hmc5883l_ioctl.h"
+
+#define NSEC_PER_SEC 1000000000ULL
+#define HMC5883L_GAINS 8
+
+struct sensor_info {
+	const char *dev;		/* char device, NULL if none */
+	const char *sysfs;		/* glob for the sysfs attribute */
+	unsigned long read_sample;	/* ioctl returning struct obc_sample */
+	unsigned long read;		/* older ioctl returning three u16 */
+	unsigned long set_rate;		/* rate request to the driver's governor */
+	unsigned long set_policy;	/* overrun policy of the file */
+	unsigned int hz;		/* default rate of the timer paths */
+};
+
+static const struct sensor_info sensors[] = {
+	[OBCS_ADXL345] = { "/dev/adxl345", NULL,
+		ADXL345_READ_SAMPLE, ADXL345_READ, ADXL345_SET_RATE, ADXL345_SET_RING_POLICY, 100 },
+	[OBCS_HMC5883L] = { "/dev/hmc5883l-i2c", "/sys/bus/i2c/drivers/hmc5883l-i2c/*/hmc5883l_int_x",
+		HMC5883L_READ_SAMPLE, HMC5883L_READ, HMC5883L_SET_RATE, HMC5883L_SET_RING_POLICY, 15 },
+	[OBCS_BMP280] = { NULL, "/sys/bus/spi/drivers/bmp280/*/raw",
+		0, 0, 0, 0, 1 },
+};
+
+struct obcs_dev {
+	enum obcs_sensor sensor;
+	enum obcs_path path;
+	int fd;			/* char device, or first sysfs attribute */
+	int sysfs_fd[2];	/* HMC5883L y and z attributes */
+	int timer_fd;		/* pacing of the ioctl and sysfs paths */
+	int use_read;		/* driver predates *_READ_SAMPLE */
+	__u32 seq;
+	__u64 lost;
+	int gap;		/* flag the next sample */
+
+	/* OBCS_PATH_MMAP */
+	void *map;
+	size_t map_len;
+	const struct obc_ring_shm *shm;
+	const struct obc_sample *slots;
+	__u32 mask;
+	__u32 cursor;		/* next sample, same 32-bit numbering as shm->head */
+	__u32 kcursor;		/* the file's cursor in the kernel, low bits */
+	int held;		/* the file's policy holds the producer back */
+	struct obc_magcal cal[HMC5883L_GAINS];
+	unsigned int cal_valid;
+
+	/* OBCS_PATH_STREAM */
+	struct obc_delta_dec dec;
+	size_t in_len;
+	__u8 in[4096];
+};
+
+const char *obcs_path_name(enum obcs_path path)
+{
+	static const char *names[] = { "auto", "mmap", "stream", "ioctl", "sysfs" };
+	return path <= OBCS_PATH_SYSFS ? names[path] : "?";
+}
+
+static int sensor_valid(enum obcs_sensor sensor)
+{
+	return sensor >= OBCS_ADXL345 && sensor <= OBCS_BMP280;
+}
+
+static off_t seek_end(struct obcs_dev *d)
+{
+	off_t pos = lseek(d->fd, 0, SEEK_END);
+
+	if (pos >= 0)
+		d->kcursor = pos;
+	return pos;
+}
+
+/*
+ * Moves the file's cursor up to ours. Only needed when the policy holds
+ * the producer back, which waits for the file's cursor and not ours.
+ */
+static int mmap_release(struct obcs_dev *d)
+{
+	off_t pos;
+
+	if (!d->held)
+		return 0;
+	pos = lseek(d->fd, (__s32)(d->cursor - d->kcursor), SEEK_CUR);
+	if (pos < 0)
+		return -errno;
+	d->kcursor = pos;
+	return 0;
+}
+
+static int open_mmap(struct obcs_dev *d)
+{
+	const struct sensor_info *info = &sensors[d->sensor];
+	struct obc_ring_shm shm;
+	long page = sysconf(_SC_PAGESIZE);
+	void *p;
+
+	if (!info->dev)
+		return -ENODEV;
+	d->fd = open(info->dev, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+	if (d->fd < 0)
+		return -errno;
+	/* The first page says how large the whole mapping is */
+	p = mmap(NULL, page, PROT_READ, MAP_SHARED, d->fd, 0);
+	if (p == MAP_FAILED)
+		return -errno;
+	shm = *(const struct obc_ring_shm *)p;
+	munmap(p, page);
+	if (shm.version != OBC_RING_SHM_VERSION || shm.record_size != sizeof(struct obc_sample) ||
+			!shm.size || (shm.size & (shm.size - 1)))
+		return -EPROTO;
+	d->map_len = shm.data_offset + (size_t)shm.size * shm.record_size;
+	d->map = mmap(NULL, d->map_len, PROT_READ, MAP_SHARED, d->fd, 0);
+	if (d->map == MAP_FAILED) {
+		d->map = NULL;
+		return -errno;
+	}
+	d->shm = d->map;
+	d->slots = (const struct obc_sample *)((const char *)d->map + shm.data_offset);
+	d->mask = shm.size - 1;
+	d->cursor = __atomic_load_n(&d->shm->head, __ATOMIC_ACQUIRE);
+	if (seek_end(d) < 0)
+		return -errno;
+	if (d->sensor == OBCS_HMC5883L)
+		obcs_reload_calibration(d);
+	return 0;
+}
+
+static int open_stream(struct obcs_dev *d)
+{
+	const struct sensor_info *info = &sensors[d->sensor];
+	ssize_t r;
+
+	if (!info->dev)
+		return -ENODEV;
+	d->fd = open(info->dev, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+	if (d->fd < 0)
+		return -errno;
+	obc_delta_dec_init(&d->dec, d->sensor);
+	/* Drivers without a stream fail read() with -EINVAL; keep whatever a stream returns */
+	r = read(d->fd, d->in, sizeof(d->in));
+	if (r < 0 && errno != EAGAIN)
+		return -errno;
+	d->in_len = r > 0 ? r : 0;
+	return 0;
+}
+
+static int open_timer(struct obcs_dev *d)
+{
+	d->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (d->timer_fd < 0)
+		return -errno;
+	return obcs_set_rate(d, sensors[d->sensor].hz);
+}
+
+static int open_ioctl(struct obcs_dev *d)
+{
+	const struct sensor_info *info = &sensors[d->sensor];
+	struct obc_sample s;
+	__u16 axis[3];
+
+	if (!info->dev)
+		return -ENODEV;
+	d->fd = open(info->dev, O_RDWR | O_CLOEXEC);
+	if (d->fd < 0)
+		return -errno;
+	if (ioctl(d->fd, info->read_sample, &s) < 0) {
+		if (errno != ENOTTY && errno != EINVAL)
+			return -errno;
+		if (ioctl(d->fd, info->read, axis) < 0 && errno != ENODATA)
+			return -errno;
+		d->use_read = 1;
+	}
+	return open_timer(d);
+}
+
+/* HMC5883L: int_x triggers a bus read, int_y and int_z return the same capture */
+static int open_sysfs(struct obcs_dev *d)
+{
+	const struct sensor_info *info = &sensors[d->sensor];
+	char path[512], *attr;
+	glob_t g;
+	int i;
+
+	if (!info->sysfs)
+		return -ENODEV;
+	if (glob(info->sysfs, 0, NULL, &g) || !g.gl_pathc) {
+		globfree(&g);
+		return -ENODEV;
+	}
+	snprintf(path, sizeof(path), "%s", g.gl_pathv[0]);
+	globfree(&g);
+	d->fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (d->fd < 0)
+		return -errno;
+	if (d->sensor == OBCS_HMC5883L) {
+		attr = path + strlen(path) - 1;
+		for (i = 0; i < 2; i++) {
+			*attr = i ? 'z' : 'y';
+			d->sysfs_fd[i] = open(path, O_RDONLY | O_CLOEXEC);
+			if (d->sysfs_fd[i] < 0)
+				return -errno;
+		}
+	}
+	return open_timer(d);
+}
+
+static void release(struct obcs_dev *d)
+{
+	if (d->map)
+		munmap(d->map, d->map_len);
+	if (d->fd >= 0)
+		close(d->fd);
+	if (d->sysfs_fd[0] >= 0)
+		close(d->sysfs_fd[0]);
+	if (d->sysfs_fd[1] >= 0)
+		close(d->sysfs_fd[1]);
+	if (d->timer_fd >= 0)
+		close(d->timer_fd);
+	d->map = NULL;
+	d->fd = d->sysfs_fd[0] = d->sysfs_fd[1] = d->timer_fd = -1;
+}
+
+struct obcs_dev *obcs_open(enum obcs_sensor sensor, enum obcs_path path)
+{
+	static int (*const opens[])(struct obcs_dev *) = {
+		[OBCS_PATH_MMAP] = open_mmap,
+		[OBCS_PATH_STREAM] = open_stream,
+		[OBCS_PATH_IOCTL] = open_ioctl,
+		[OBCS_PATH_SYSFS] = open_sysfs,
+	};
+	struct obcs_dev *d;
+	enum obcs_path p;
+	int err = -ENODEV;
+
+	if (!sensor_valid(sensor) || path > OBCS_PATH_SYSFS) {
+		errno = EINVAL;
+		return NULL;
+	}
+	d = calloc(1, sizeof(*d));
+	if (!d)
+		return NULL;
+	d->sensor = sensor;
+	d->fd = d->sysfs_fd[0] = d->sysfs_fd[1] = d->timer_fd = -1;
+	for (p = path ? path : OBCS_PATH_MMAP; p <= OBCS_PATH_SYSFS; p++) {
+		err = opens[p](d);
+		if (!err) {
+			d->path = p;
+			return d;
+		}
+		release(d);
+		if (path)
+			break;
+	}
+	free(d);
+	errno = -err;
+	return NULL;
+}
+
+void obcs_close(struct obcs_dev *d)
+{
+	if (!d)
+		return;
+	release(d);
+	free(d);
+}
+
+enum obcs_path obcs_path(const struct obcs_dev *d)
+{
+	return d->path;
+}
+
+int obcs_fd(const struct obcs_dev *d)
+{
+	return d->timer_fd >= 0 ? d->timer_fd : d->fd;
+}
+
+int obcs_set_rate(struct obcs_dev *d, unsigned int hz)
+{
+	const struct sensor_info *si = &sensors[d->sensor];
+	struct itimerspec its;
+	__u64 period;
+	__u32 mhz = hz * 1000;
+
+	if (!hz)
+		return -EINVAL;
+	/* Drivers with a governor run at least this fast while the handle is open */
+	if (d->path != OBCS_PATH_SYSFS && si->set_rate &&
+	    ioctl(d->fd, si->set_rate, &mhz) < 0 && errno != ENOTTY)
+		return -errno;
+	if (d->timer_fd < 0)
+		return d->path == OBCS_PATH_SYSFS || !si->set_rate ? -EOPNOTSUPP : 0;
+	period = NSEC_PER_SEC / hz;
+	its.it_interval.tv_sec = period / NSEC_PER_SEC;
+	its.it_interval.tv_nsec = period % NSEC_PER_SEC;
+	its.it_value = its.it_interval;
+	if (timerfd_settime(d->timer_fd, 0, &its, NULL) < 0)
+		return -errno;
+	return 0;
+}
+
+int obcs_set_policy(struct obcs_dev *d, unsigned int policy)
+{
+	const struct sensor_info *si = &sensors[d->sensor];
+	__u32 p = policy;
+
+	if ((d->path != OBCS_PATH_MMAP && d->path != OBCS_PATH_STREAM) || !si->set_policy)
+		return -EOPNOTSUPP;
+	if (ioctl(d->fd, si->set_policy, &p) < 0)
+		return -errno;
+	d->held = policy != OBC_RING_DROP_OLDEST;
+	if (d->path == OBCS_PATH_MMAP && mmap_release(d) < 0)
+		return -errno;
+	return 0;
+}
+
+int obcs_reload_calibration(struct obcs_dev *d)
+{
+	struct obc_magcal_set set;
+	unsigned int g;
+
+	if (d->sensor != OBCS_HMC5883L || !d->map)
+		return -EOPNOTSUPP;
+	d->cal_valid = 0;
+	for (g = 0; g < HMC5883L_GAINS; g++) {
+		memset(&set, 0, sizeof(set));
+		set.gain = g;
+		if (ioctl(d->fd, HMC5883L_GET_CAL, &set) < 0)
+			return -errno;
+		d->cal[g] = set.cal;
+		if (set.valid)
+			d->cal_valid |= 1 << g;
+	}
+	return 0;
+}
+
+/* Same correction the driver applies on its read() path */
+static void calibrate(struct obcs_dev *d, struct obc_sample *s, unsigned int n)
+{
+	unsigned int i, j, gain;
+
+	for (i = 0; i < n; i = j) {
+		gain = OBC_SAMPLE_RANGE(s[i].flags);
+		for (j = i + 1; j < n && OBC_SAMPLE_RANGE(s[j].flags) == gain; j++)
+			;
+		if (gain < HMC5883L_GAINS && (d->cal_valid & (1 << gain)))
+			obc_magcal_apply(&d->cal[gain], s + i, j - i);
+	}
+}
+
+/* Skips samples the producer has lapped, returns the samples available */
+static __u32 mmap_available(struct obcs_dev *d)
+{
+	__u32 head = __atomic_load_n(&d->shm->head, __ATOMIC_ACQUIRE);
+	__u32 lag = head - d->cursor;
+
+	if (lag > d->mask + 1) {
+		d->lost += lag - (d->mask + 1);
+		d->cursor = head - (d->mask + 1);
+		d->gap = 1;
+		lag = d->mask + 1;
+	}
+	return lag;
+}
+
+/* Number of samples from cursor that may have been overwritten while copied */
+static __u32 mmap_torn(struct obcs_dev *d, __u32 n)
+{
+	__u32 head, i;
+
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	head = __atomic_load_n(&d->shm->head, __ATOMIC_RELAXED);
+	for (i = 0; i < n && head - (d->cursor + i) > d->mask; i++)
+		;
+	return i;
+}
+
+static int read_mmap(struct obcs_dev *d, struct obc_sample *out, unsigned int max)
+{
+	__u32 n, i, torn;
+
+	for (;;) {
+		n = mmap_available(d);
+		if (n)
+			break;
+		/*
+		 * Drained: move the kernel cursor up to ours so poll() waits for
+		 * the next sample. The kernel head can only be at or past ours,
+		 * so if the shared head has not moved after the seek they match.
+		 */
+		if (seek_end(d) < 0)
+			return -errno;
+		if (__atomic_load_n(&d->shm->head, __ATOMIC_ACQUIRE) == d->cursor)
+			return 0;
+	}
+	if (n > max)
+		n = max;
+	for (i = 0; i < n; i++)
+		out[i] = d->slots[(d->cursor + i) & d->mask];
+	torn = mmap_torn(d, n);
+	if (torn) {
+		memmove(out, out + torn, (n - torn) * sizeof(*out));
+		d->lost += torn;
+		d->gap = 1;
+	}
+	d->cursor += n;
+	n -= torn;
+	if (mmap_release(d) < 0)
+		return -errno;
+	if (d->sensor == OBCS_HMC5883L && d->cal_valid)
+		calibrate(d, out, n);
+	return n;
+}
+
+static int read_stream(struct obcs_dev *d, struct obc_sample *out, unsigned int max)
+{
+	size_t used;
+	ssize_t r;
+	int n;
+
+	for (;;) {
+		n = obc_delta_decode(&d->dec, d->in, d->in_len, &used, out, max);
+		if (n < 0)
+			return -EPROTO;
+		memmove(d->in, d->in + used, d->in_len - used);
+		d->in_len -= used;
+		if (n)
+			break;
+		r = read(d->fd, d->in + d->in_len, sizeof(d->in) - d->in_len);
+		if (r < 0)
+			return errno == EAGAIN ? 0 : -errno;
+		if (!r)
+			return 0;
+		d->in_len += r;
+	}
+	d->lost = d->dec.lost;
+	return n;
+}
+
+/* Consumes timer expirations, returns 1 if a sample is due */
+static int timer_due(struct obcs_dev *d)
+{
+	__u64 expirations;
+
+	if (read(d->timer_fd, &expirations, sizeof(expirations)) < 0)
+		return errno == EAGAIN ? 0 : -errno;
+	return 1;
+}
+
+static int read_ioctl(struct obcs_dev *d, struct obc_sample *out)
+{
+	const struct sensor_info *info = &sensors[d->sensor];
+	__u16 axis[3];
+	int i;
+
+	memset(out, 0, sizeof(*out));
+	if (!d->use_read) {
+		if (ioctl(d->fd, info->read_sample, out) < 0)
+			return -errno;
+		return 1;
+	}
+	if (ioctl(d->fd, info->read, axis) < 0)
+		return errno == ENODATA ? 0 : -errno;
+	for (i = 0; i < 3; i++)
+		out->v[i] = (__s16)axis[i];
+	return 1;
+}
+
+static int read_attr(int fd, __s32 *v, int count)
+{
+	char buf[64], *p = buf;
+	ssize_t n;
+	int i;
+
+	n = pread(fd, buf, sizeof(buf) - 1, 0);
+	if (n <= 0)
+		return n < 0 ? -errno : -EIO;
+	buf[n] = '\0';
+	for (i = 0; i < count; i++)
+		v[i] = strtol(p, &p, 10);
+	return 0;
+}
+
+static int read_sysfs(struct obcs_dev *d, struct obc_sample *out)
+{
+	int err;
+
+	memset(out, 0, sizeof(*out));
+	if (d->sensor == OBCS_BMP280)
+		return read_attr(d->fd, out->v, 2) ? -EIO : 1;
+	err = read_attr(d->fd, &out->v[0], 1);
+	if (!err)
+		err = read_attr(d->sysfs_fd[0], &out->v[1], 1);
+	if (!err)
+		err = read_attr(d->sysfs_fd[1], &out->v[2], 1);
+	return err ? err : 1;
+}
+
+static __u64 now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (__u64)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+int obcs_read(struct obcs_dev *d, struct obc_sample *out, unsigned int max)
+{
+	int n;
+
+	if (!max)
+		return 0;
+	switch (d->path) {
+	case OBCS_PATH_MMAP:
+		n = read_mmap(d, out, max);
+		break;
+	case OBCS_PATH_STREAM:
+		return read_stream(d, out, max);
+	default:
+		n = timer_due(d);
+		if (n <= 0)
+			return n;
+		n = d->path == OBCS_PATH_IOCTL ? read_ioctl(d, out) : read_sysfs(d, out);
+		if (n <= 0)
+			return n;
+		/* The older interfaces carry no capture metadata */
+		if (!out->t_ns) {
+			out->t_ns = now_ns();
+			out->dev = d->sensor;
+			out->seq = d->seq++;
+		}
+		break;
+	}
+	if (n > 0 && d->gap) {
+		out[0].flags |= OBC_SAMPLE_GAP;
+		d->gap = 0;
+	}
+	return n;
+}
+
+#define OBCS_BATCH 64
+
+int obcs_read_accel(struct obcs_dev *d, struct obcs_accel *out, unsigned int max)
+{
+	struct obc_sample s[OBCS_BATCH];
+	int n, i;
+
+	if (d->sensor != OBCS_ADXL345)
+		return -EINVAL;
+	n = obcs_read(d, s, max < OBCS_BATCH ? max : OBCS_BATCH);
+	for (i = 0; i < n; i++) {
+		out[i].t_ns = s[i].t_ns;
+		out[i].seq = s[i].seq;
+		out[i].flags = s[i].flags;
+		out[i].x = s[i].v[0];
+		out[i].y = s[i].v[1];
+		out[i].z = s[i].v[2];
+		out[i].scale_ug = ADXL345_SCALE_UG(OBC_SAMPLE_RANGE(s[i].flags));
+	}
+	return n;
+}
+
+/* The HMC5883L data registers are ordered X, Z, Y */
+int obcs_read_mag(struct obcs_dev *d, struct obcs_mag *out, unsigned int max)
+{
+	struct obc_sample s[OBCS_BATCH];
+	int n, i;
+
+	if (d->sensor != OBCS_HMC5883L)
+		return -EINVAL;
+	n = obcs_read(d, s, max < OBCS_BATCH ? max : OBCS_BATCH);
+	for (i = 0; i < n; i++) {
+		out[i].t_ns = s[i].t_ns;
+		out[i].seq = s[i].seq;
+		out[i].flags = s[i].flags;
+		out[i].gain = OBC_SAMPLE_RANGE(s[i].flags);
+		out[i].x = s[i].v[0];
+		out[i].y = s[i].v[2];
+		out[i].z = s[i].v[1];
+	}
+	return n;
+}
+
+int obcs_read_baro(struct obcs_dev *d, struct obcs_baro *out, unsigned int max)
+{
+	struct obc_sample s[OBCS_BATCH];
+	int n, i;
+
+	if (d->sensor != OBCS_BMP280)
+		return -EINVAL;
+	n = obcs_read(d, s, max < OBCS_BATCH ? max : OBCS_BATCH);
+	for (i = 0; i < n; i++) {
+		out[i].t_ns = s[i].t_ns;
+		out[i].seq = s[i].seq;
+		out[i].flags = s[i].flags;
+		out[i].adc_p = s[i].v[0];
+		out[i].adc_t = s[i].v[1];
+	}
+	return n;
+}
+
+int obcs_wait(struct obcs_dev *d, int timeout_ms)
+{
+	struct pollfd pfd = { .fd = obcs_fd(d), .events = POLLIN };
+	int r;
+
+	r = poll(&pfd, 1, timeout_ms);
+	if (r < 0)
+		return -errno;
+	return r;
+}
+
+__u64 obcs_lost(const struct obcs_dev *d)
+{
+	return d->lost;
+}
+
+int obcs_peek(struct obcs_dev *d, const struct obc_sample **first, unsigned int *n)
+{
+	__u32 avail, to_end;
+
+	if (d->path != OBCS_PATH_MMAP)
+		return -EOPNOTSUPP;
+	avail = mmap_available(d);
+	if (!avail) {
+		if (seek_end(d) < 0)
+			return -errno;
+		avail = mmap_available(d);
+	}
+	/* Only the part up to the end of the ring is contiguous */
+	to_end = d->mask + 1 - (d->cursor & d->mask);
+	*first = &d->slots[d->cursor & d->mask];
+	*n = avail < to_end ? avail : to_end;
+	return 0;
+}
+
+int obcs_consume(struct obcs_dev *d, unsigned int n)
+{
+	__u32 torn;
+
+	if (d->path != OBCS_PATH_MMAP)
+		return -EOPNOTSUPP;
+	torn = mmap_torn(d, n);
+	d->cursor += n;
+	if (mmap_release(d) < 0)
+		return -errno;
+	if (torn) {
+		d->lost += torn;
+		d->gap = 1;
+		return -ESTALE;
+	}
+	return 0;
+}
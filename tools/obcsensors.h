@@ -0,0 +1,127 @@
+/*
+ * libobcsensors: userspace access to the ADXL345, HMC5883L and BMP280
+ * drivers.
+ *
+ * obcs_open() picks the fastest interface the running drivers offer:
+ *
+ *   OBCS_PATH_MMAP    the driver's sample ring mapped read-only, no copy
+ *                     through the kernel and no system call per batch
+ *   OBCS_PATH_STREAM  read() of the delta/varint stream (obc_delta.h)
+ *   OBCS_PATH_IOCTL   one *_READ_SAMPLE (or *_READ) ioctl per sample,
+ *                     paced by a timer
+ *   OBCS_PATH_SYSFS   the sysfs attributes of the older drivers, paced by
+ *                     a timer
+ *
+ * Every handle has one file descriptor that can be added to poll/epoll;
+ * it becomes readable when obcs_read() has something to return. Reads
+ * never block: drain with obcs_read() until it returns 0, then wait on
+ * the descriptor again.
+ */
+#ifndef OBCSENSORS_H
+#define OBCSENSORS_H
+
+#include <linux/types.h>
+
+#include "obc_sample.h"
+
+enum obcs_sensor {
+	OBCS_ADXL345 = OBC_DEV_ADXL345,
+	OBCS_HMC5883L = OBC_DEV_HMC5883L,
+	OBCS_BMP280 = OBC_DEV_BMP280,
+};
+
+enum obcs_path {
+	OBCS_PATH_AUTO = 0,	/* fastest available, in the order below */
+	OBCS_PATH_MMAP,
+	OBCS_PATH_STREAM,
+	OBCS_PATH_IOCTL,
+	OBCS_PATH_SYSFS,
+};
+
+/*
+ * Acceleration in raw counts and the micro-g per count of the range it
+ * was captured with. The ioctl and sysfs paths carry no range, their
+ * scale is that of +-2 g at 10 bits.
+ */
+struct obcs_accel {
+	__u64 t_ns;
+	__u32 seq;
+	__u16 flags;		/* OBC_SAMPLE_* */
+	__s16 x, y, z;
+	__u32 scale_ug;
+};
+
+/* Magnetic field in raw counts at the gain it was captured with */
+struct obcs_mag {
+	__u64 t_ns;
+	__u32 seq;
+	__u16 flags;
+	__u16 gain;
+	__s32 x, y, z;
+};
+
+/* Uncompensated pressure and temperature ADC outputs */
+struct obcs_baro {
+	__u64 t_ns;
+	__u32 seq;
+	__u16 flags;
+	__s32 adc_p, adc_t;
+};
+
+struct obcs_dev;
+
+/* Returns NULL with errno set if the sensor has none of the requested paths */
+struct obcs_dev *obcs_open(enum obcs_sensor sensor, enum obcs_path path);
+void obcs_close(struct obcs_dev *d);
+
+enum obcs_path obcs_path(const struct obcs_dev *d);
+const char *obcs_path_name(enum obcs_path path);
+
+/* Descriptor for poll/epoll, readable when obcs_read() has data */
+int obcs_fd(const struct obcs_dev *d);
+
+/*
+ * Sampling rate of the timer driven paths. On the char device paths it is
+ * also passed to the driver's rate governor as the rate this handle needs.
+ */
+int obcs_set_rate(struct obcs_dev *d, unsigned int hz);
+
+/*
+ * Overrun policy of the handle's file, OBC_RING_* from obc_sample.h; the
+ * char device paths only. With drop-newest or block, samples the driver
+ * discards for a slow reader are lost to every reader of that sensor.
+ */
+int obcs_set_policy(struct obcs_dev *d, unsigned int policy);
+
+/*
+ * Copies up to max samples into out. Returns the number copied, 0 when
+ * nothing is pending or a negative errno. The first sample after lost
+ * ones carries OBC_SAMPLE_GAP.
+ */
+int obcs_read(struct obcs_dev *d, struct obc_sample *out, unsigned int max);
+int obcs_read_accel(struct obcs_dev *d, struct obcs_accel *out, unsigned int max);
+int obcs_read_mag(struct obcs_dev *d, struct obcs_mag *out, unsigned int max);
+int obcs_read_baro(struct obcs_dev *d, struct obcs_baro *out, unsigned int max);
+
+/* Waits for data, timeout_ms < 0 waits forever. Returns 1, 0 on timeout or -errno */
+int obcs_wait(struct obcs_dev *d, int timeout_ms);
+
+/*
+ * Samples this handle never saw because it fell a full ring behind; on the
+ * stream path also those the driver discarded or reported lost
+ */
+__u64 obcs_lost(const struct obcs_dev *d);
+
+/*
+ * Zero-copy access on OBCS_PATH_MMAP: *first points at up to *n samples
+ * in the kernel ring, in place and uncalibrated. After using them call
+ * obcs_consume(); it returns -ESTALE if the producer overwrote any of them
+ * meanwhile, in which case the results must be discarded.
+ */
+int obcs_peek(struct obcs_dev *d, const struct obc_sample **first, unsigned int *n);
+int obcs_consume(struct obcs_dev *d, unsigned int n);
+
+/* Fetches the HMC5883L calibration again after it was changed */
+int obcs_reload_calibration(struct obcs_dev *d);
+
+#endif